@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2023 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Arena (region) allocator.
+ *
+ * The memory is allocated by bumping the pointer in the current chunk;
+ * a new chunk is added when it runs out of space.  The objects are not
+ * freed individually: all memory is released at once on arena_reset()
+ * or arena_destroy().
+ *
+ * The reset coalesces the chunks into a single chunk of the total size,
+ * therefore an arena which is reset and reused for similar workloads
+ * reaches a steady state where it performs no system allocations.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define	ARENA_ALIGN		(alignof(max_align_t))
+#define	ARENA_DEF_SIZE		(4096)
+
+typedef struct chunk {
+	struct chunk *		next;
+	size_t			size;
+	size_t			used;
+	alignas(ARENA_ALIGN) unsigned char data[];
+} chunk_t;
+
+struct arena {
+	chunk_t *		chunks;
+	size_t			total;
+	size_t			chunk_size;
+};
+
+static chunk_t *
+chunk_create(size_t size)
+{
+	chunk_t *c;
+
+	if ((c = malloc(offsetof(chunk_t, data[size]))) == NULL) {
+		return NULL;
+	}
+	c->next = NULL;
+	c->size = size;
+	c->used = 0;
+	return c;
+}
+
+/*
+ * arena_create: create a new arena with the given chunk size.
+ *
+ * => Zero means the default size.
+ */
+arena_t *
+arena_create(size_t chunk_size)
+{
+	arena_t *arena;
+
+	if ((arena = calloc(1, sizeof(arena_t))) == NULL) {
+		return NULL;
+	}
+	arena->chunk_size = chunk_size ? chunk_size : ARENA_DEF_SIZE;
+	if ((arena->chunks = chunk_create(arena->chunk_size)) == NULL) {
+		free(arena);
+		return NULL;
+	}
+	arena->total = arena->chunk_size;
+	return arena;
+}
+
+static void
+arena_free_chunks(arena_t *arena)
+{
+	chunk_t *c = arena->chunks;
+
+	while (c) {
+		chunk_t *next = c->next;
+		free(c);
+		c = next;
+	}
+	arena->chunks = NULL;
+}
+
+void
+arena_destroy(arena_t *arena)
+{
+	arena_free_chunks(arena);
+	free(arena);
+}
+
+/*
+ * arena_size: get the total size of the arena chunks.
+ */
+size_t
+arena_size(const arena_t *arena)
+{
+	return arena->total;
+}
+
+/*
+ * arena_reset: release all objects allocated from the arena.
+ *
+ * => If the arena has grown, then the chunks are replaced by a single
+ *    chunk of the total size (the allocation failure is not fatal: the
+ *    arena is then left with the first chunk).
+ */
+void
+arena_reset(arena_t *arena)
+{
+	chunk_t *c = arena->chunks;
+
+	if (c && c->next) {
+		arena_free_chunks(arena);
+		if ((c = chunk_create(arena->total)) == NULL) {
+			c = chunk_create(arena->chunk_size);
+		}
+		arena->chunks = c;
+		arena->total = c ? c->size : 0;
+	}
+	if (c) {
+		c->used = 0;
+	}
+}
+
+/*
+ * arena_alloc: allocate the memory of the given length from the arena.
+ */
+void *
+arena_alloc(arena_t *arena, size_t len)
+{
+	chunk_t *c = arena->chunks;
+	void *ptr;
+
+	len = roundup2(len, ARENA_ALIGN);
+	if (__predict_false(c == NULL || c->size - c->used < len)) {
+		/*
+		 * Add a new chunk (possibly larger than the default).
+		 */
+		const size_t size = MAX(arena->chunk_size, len);
+
+		if ((c = chunk_create(size)) == NULL) {
+			return NULL;
+		}
+		c->next = arena->chunks;
+		arena->chunks = c;
+		arena->total += size;
+	}
+	ptr = &c->data[c->used];
+	c->used += len;
+	return ptr;
+}
+
+void *
+arena_zalloc(arena_t *arena, size_t len)
+{
+	void *ptr;
+
+	if ((ptr = arena_alloc(arena, len)) != NULL) {
+		memset(ptr, 0, len);
+	}
+	return ptr;
+}
+
+/*
+ * arena_strndup: create a NIL terminated copy of the given string.
+ */
+char *
+arena_strndup(arena_t *arena, const char *s, size_t len)
+{
+	char *str;
+
+	if ((str = arena_alloc(arena, len + 1)) != NULL) {
+		memcpy(str, s, len);
+		str[len] = '\0';
+	}
+	return str;
+}
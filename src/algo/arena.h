@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2023 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+typedef struct arena arena_t;
+
+arena_t *	arena_create(size_t);
+void		arena_reset(arena_t *);
+void		arena_destroy(arena_t *);
+size_t		arena_size(const arena_t *);
+
+void *		arena_alloc(arena_t *, size_t);
+void *		arena_zalloc(arena_t *, size_t);
+char *		arena_strndup(arena_t *, const char *, size_t);
+
+#endif
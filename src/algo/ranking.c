@@ -38,8 +38,32 @@
  *	Information Retrieval", Cambridge University Press
  */
 
+/*
+ * get_counters: get the document count and the document frequency of
+ * the term.  If the global statistics are given (distributed search),
+ * then use them instead of the local index counters.
+ *
+ * => The local counters are taken from the read view pinned by the
+ *    search, so they are consistent with the term bitmaps.
+ * => Returns -1 if the global statistics do not have the term: the
+ *    local counters must not be mixed with the global ones.
+ */
+static inline int
+get_counters(const nxs_index_t *idx, const nxs_stats_t *stats,
+    const idxterm_t *term, uint64_t *doc_count, uint64_t *doc_freq)
+{
+	if (stats) {
+		*doc_count = nxs_stats_get_doc_count(stats);
+		return nxs_stats_get_doc_freq(stats, term, doc_freq);
+	}
+	*doc_count = idx->view.doc_count;
+	*doc_freq = idxterm_get_doc_freq(idx, term);
+	return 0;
+}
+
 float
-tf_idf(const nxs_index_t *idx, const idxterm_t *term, const idxdoc_t *doc)
+tf_idf(const nxs_index_t *idx, const nxs_stats_t *stats,
+    const idxterm_t *term, const idxdoc_t *doc)
 {
 	/*
 	 * TF-IDF intuition:
@@ -70,12 +94,14 @@ tf_idf(const nxs_index_t *idx, const idxterm_t *term, const idxdoc_t *doc)
 	 */
 
 	int term_freq;
-	unsigned long doc_freq, doc_count;
+	uint64_t doc_freq, doc_count;
 	float tf, idf;
 
 	term_freq = idxdoc_get_termcount(idx, doc, term->id);
-	doc_count = idx_get_doc_count(idx);
-	doc_freq = roaring64_bitmap_get_cardinality(term->doc_bitmap);
+	if (__predict_false(get_counters(idx, stats, term,
+	    &doc_count, &doc_freq) == -1)) {
+		return -1;
+	}
 	ASSERT(doc_freq > 0);
 
 	/*
@@ -90,14 +116,15 @@ tf_idf(const nxs_index_t *idx, const idxterm_t *term, const idxdoc_t *doc)
 	tf = log(term_freq + 1);
 	idf = log((float)doc_count / doc_freq) + 1;
 
-	app_dbgx("term_freq %d, doc_freq %u, tf %f, idf %f, score %f",
+	app_dbgx("term_freq %d, doc_freq %"PRIu64", tf %f, idf %f, score %f",
 	    term_freq, doc_freq, tf, idf, tf * idf);
 
 	return tf * idf;
 }
 
 float
-bm25(const nxs_index_t *idx, const idxterm_t *term, const idxdoc_t *doc)
+bm25(const nxs_index_t *idx, const nxs_stats_t *stats,
+    const idxterm_t *term, const idxdoc_t *doc)
 {
 	/*
 	 * BM25 can be seen as an evolution of TF-IDF.
@@ -142,12 +169,14 @@ bm25(const nxs_index_t *idx, const idxterm_t *term, const idxdoc_t *doc)
 	static const double b = 0.75f;
 
 	int term_freq;
-	unsigned long doc_freq, doc_count;
+	uint64_t doc_freq, doc_count, token_count;
 	double tf, dl, adl, tf_bm25, idf_bm25;
 
 	term_freq = idxdoc_get_termcount(idx, doc, term->id);
-	doc_count = idx_get_doc_count(idx);
-	doc_freq = roaring64_bitmap_get_cardinality(term->doc_bitmap);
+	if (__predict_false(get_counters(idx, stats, term,
+	    &doc_count, &doc_freq) == -1)) {
+		return -1;
+	}
 	ASSERT(doc_freq > 0);
 
 	/*
@@ -160,7 +189,9 @@ bm25(const nxs_index_t *idx, const idxterm_t *term, const idxdoc_t *doc)
 	/*
 	 * Get the average document length, but also verify it.
 	 */
-	adl = idx_get_token_count(idx) / doc_count;
+	token_count = stats ?
+	    nxs_stats_get_token_count(stats) : idx->view.token_count;
+	adl = token_count / doc_count;
 	if (__predict_false(adl < 1)) {
 		return -1;
 	}
@@ -191,6 +222,20 @@ get_ranking_func_id(const char *name)
 	return INVALID_ALGO;
 }
 
+const char *
+get_ranking_func_name(ranking_algo_t algo)
+{
+	switch (algo) {
+	case TF_IDF:
+		return "TF-IDF";
+	case BM25:
+		return "BM25";
+	default:
+		break;
+	}
+	return NULL;
+}
+
 ranking_func_t
 get_ranking_func(ranking_algo_t algo)
 {
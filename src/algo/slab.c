@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2024 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Slab allocator for the long-lived small objects, such as the bitmap
+ * containers, which otherwise fragment the general purpose allocator
+ * over the add/remove churn.
+ *
+ * - The objects are grouped by the size classes; each class has the
+ * slabs (~64 KB) which hold the objects of that size only.  Therefore,
+ * the freed objects are always reusable by the same class.
+ *
+ * - Each object has a small header (just before the returned pointer)
+ * which refers to its slab.  A slab which becomes empty is returned to
+ * the system, except one spare slab per class (to avoid the thrashing
+ * on the boundary).
+ *
+ * - The objects larger than the largest class are allocated using
+ * malloc(3), but still have the header.
+ *
+ * The allocator is global (it serves the process-wide memory hooks) and
+ * thread-safe: each class is protected by its own lock.
+ */
+
+#include <sys/queue.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "slab.h"
+#include "utils.h"
+
+#define	SLAB_SIZE		(64UL * 1024)	// 64 KB
+#define	SLAB_MIN_OBJS		(8)
+
+#define	SLAB_ALIGN		(16)
+#define	SLAB_LARGE		UINT16_MAX
+
+/*
+ * The size classes (including the header).  The largest class fits
+ * the 8 KB bitmap container with the 64-byte alignment.
+ */
+static const unsigned slab_class_sizes[] = {
+	32, 48, 64, 96, 128, 192, 256, 384, 512, 768,
+	1024, 1536, 2048, 3072, 4096, 6144, 8320,
+};
+
+#define	SLAB_NCLASSES		__arraycount(slab_class_sizes)
+
+typedef struct {
+	struct slab *		slab;	// NULL for the large objects
+	uint32_t		size;	// requested size
+	uint16_t		cls;	// size class index (or SLAB_LARGE)
+	uint16_t		offset;	// header offset from the object start
+} slab_hdr_t;
+
+static_assert(sizeof(slab_hdr_t) == SLAB_ALIGN, "slab_hdr_t size");
+
+typedef struct slab {
+	TAILQ_ENTRY(slab)	entry;
+	struct slab_class *	cls;
+	void *			free_list;
+	unsigned		next;	// first never used object
+	unsigned		nfree;
+	char			objs[] __aligned(SLAB_ALIGN);
+} slab_t;
+
+typedef struct slab_class {
+	pthread_mutex_t		lock;
+	size_t			size;
+	unsigned		nobjs;
+
+	/* Slabs with the free objects; the empty spare is at the tail. */
+	TAILQ_HEAD(, slab)	partial;
+	slab_t *		spare;
+
+	/* Statistics: the slabs, the objects and requested bytes. */
+	unsigned		nslabs;
+	size_t			nalloc;
+	size_t			used;
+} slab_class_t;
+
+static slab_class_t		slab_classes[SLAB_NCLASSES];
+static pthread_once_t		slab_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t		large_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t			large_used;
+static size_t			large_reserved;
+
+static void
+slab_sysinit(void)
+{
+	for (unsigned i = 0; i < SLAB_NCLASSES; i++) {
+		slab_class_t *cls = &slab_classes[i];
+
+		pthread_mutex_init(&cls->lock, NULL);
+		cls->size = slab_class_sizes[i];
+		cls->nobjs = MAX(SLAB_SIZE / cls->size, SLAB_MIN_OBJS);
+		TAILQ_INIT(&cls->partial);
+	}
+}
+
+static inline size_t
+slab_len(const slab_class_t *cls)
+{
+	return offsetof(slab_t, objs) + cls->nobjs * cls->size;
+}
+
+/*
+ * slab_get_class: get the class index for the object of the given size
+ * (including the header and the alignment padding) or SLAB_LARGE.
+ */
+static unsigned
+slab_get_class(size_t len)
+{
+	for (unsigned i = 0; i < SLAB_NCLASSES; i++) {
+		if (len <= slab_class_sizes[i]) {
+			return i;
+		}
+	}
+	return SLAB_LARGE;
+}
+
+static void *
+slab_obj_get(slab_class_t *cls, slab_t **slabp)
+{
+	slab_t *slab;
+	void *obj;
+
+	if ((slab = TAILQ_FIRST(&cls->partial)) == NULL) {
+		if ((slab = malloc(slab_len(cls))) == NULL) {
+			return NULL;
+		}
+		slab->cls = cls;
+		slab->free_list = NULL;
+		slab->next = 0;
+		slab->nfree = cls->nobjs;
+		TAILQ_INSERT_HEAD(&cls->partial, slab, entry);
+		cls->nslabs++;
+	}
+	if (slab == cls->spare) {
+		cls->spare = NULL;
+	}
+
+	/* Reuse the freed object or take the next unused one. */
+	if ((obj = slab->free_list) != NULL) {
+		slab->free_list = *(void **)obj;
+	} else {
+		ASSERT(slab->next < cls->nobjs);
+		obj = &slab->objs[slab->next++ * cls->size];
+	}
+	if (--slab->nfree == 0) {
+		TAILQ_REMOVE(&cls->partial, slab, entry);
+	}
+	cls->nalloc++;
+	*slabp = slab;
+	return obj;
+}
+
+static void
+slab_obj_put(slab_class_t *cls, slab_t *slab, void *obj)
+{
+	*(void **)obj = slab->free_list;
+	slab->free_list = obj;
+	cls->nalloc--;
+
+	if (slab->nfree++ == 0) {
+		/* Was full: has a free object now. */
+		TAILQ_INSERT_HEAD(&cls->partial, slab, entry);
+	}
+	if (slab->nfree < cls->nobjs) {
+		return;
+	}
+
+	/*
+	 * The slab is empty: keep it as the spare, unless there is one;
+	 * otherwise, release the memory.
+	 */
+	TAILQ_REMOVE(&cls->partial, slab, entry);
+	if (cls->spare == NULL) {
+		TAILQ_INSERT_TAIL(&cls->partial, slab, entry);
+		cls->spare = slab;
+		return;
+	}
+	cls->nslabs--;
+	free(slab);
+}
+
+/*
+ * large_span: the memory span of the large object (from the start of
+ * the allocation to the end of the object).
+ */
+static inline size_t
+large_span(const slab_hdr_t *hdr)
+{
+	return hdr->offset + sizeof(slab_hdr_t) +
+	    roundup2(hdr->size, SLAB_ALIGN);
+}
+
+static void *
+slab_alloc_large(size_t size, size_t align, size_t len)
+{
+	slab_hdr_t *hdr;
+	uintptr_t addr;
+	void *obj;
+
+	if ((obj = malloc(len)) == NULL) {
+		return NULL;
+	}
+	addr = roundup2((uintptr_t)obj + sizeof(slab_hdr_t), align);
+	hdr = (slab_hdr_t *)addr - 1;
+	hdr->slab = NULL;
+	hdr->size = size;
+	hdr->cls = SLAB_LARGE;
+	hdr->offset = (uintptr_t)hdr - (uintptr_t)obj;
+
+	pthread_mutex_lock(&large_lock);
+	large_used += size;
+	large_reserved += large_span(hdr);
+	pthread_mutex_unlock(&large_lock);
+	return (void *)addr;
+}
+
+/*
+ * slab_aligned_alloc: allocate the object of the given size with the
+ * given alignment (a power of two).
+ */
+void *
+slab_aligned_alloc(size_t align, size_t size)
+{
+	slab_class_t *cls;
+	slab_hdr_t *hdr;
+	uintptr_t addr;
+	unsigned c;
+	slab_t *slab;
+	size_t len;
+	void *obj;
+
+	if (__predict_false(size > UINT32_MAX || align > UINT16_MAX)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_once(&slab_once, slab_sysinit);
+
+	align = MAX(align, SLAB_ALIGN);
+	len = roundup2(size, SLAB_ALIGN) + align;
+	if ((c = slab_get_class(len)) == SLAB_LARGE) {
+		return slab_alloc_large(size, align, len);
+	}
+	cls = &slab_classes[c];
+
+	pthread_mutex_lock(&cls->lock);
+	if ((obj = slab_obj_get(cls, &slab)) != NULL) {
+		cls->used += size;
+	}
+	pthread_mutex_unlock(&cls->lock);
+	if (obj == NULL) {
+		return NULL;
+	}
+
+	addr = roundup2((uintptr_t)obj + sizeof(slab_hdr_t), align);
+	hdr = (slab_hdr_t *)addr - 1;
+	hdr->slab = slab;
+	hdr->size = size;
+	hdr->cls = c;
+	hdr->offset = (uintptr_t)hdr - (uintptr_t)obj;
+	return (void *)addr;
+}
+
+void *
+slab_alloc(size_t size)
+{
+	return slab_aligned_alloc(SLAB_ALIGN, size);
+}
+
+void *
+slab_calloc(size_t n, size_t size)
+{
+	void *ptr;
+
+	if (size && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ((ptr = slab_alloc(n * size)) != NULL) {
+		memset(ptr, 0, n * size);
+	}
+	return ptr;
+}
+
+void
+slab_free(void *ptr)
+{
+	slab_hdr_t *hdr;
+	void *obj;
+
+	if (ptr == NULL) {
+		return;
+	}
+	hdr = (slab_hdr_t *)ptr - 1;
+	obj = (char *)hdr - hdr->offset;
+
+	if (hdr->cls == SLAB_LARGE) {
+		pthread_mutex_lock(&large_lock);
+		large_used -= hdr->size;
+		large_reserved -= large_span(hdr);
+		pthread_mutex_unlock(&large_lock);
+		free(obj);
+	} else {
+		slab_class_t *cls = hdr->slab->cls;
+
+		pthread_mutex_lock(&cls->lock);
+		cls->used -= hdr->size;
+		slab_obj_put(cls, hdr->slab, obj);
+		pthread_mutex_unlock(&cls->lock);
+	}
+}
+
+/*
+ * slab_realloc: resize the object; it stays in place if the new size
+ * still fits its size class.
+ */
+void *
+slab_realloc(void *ptr, size_t size)
+{
+	slab_hdr_t *hdr;
+	void *nptr;
+
+	if (ptr == NULL) {
+		return slab_alloc(size);
+	}
+	hdr = (slab_hdr_t *)ptr - 1;
+	if (hdr->cls != SLAB_LARGE && hdr->offset == 0 &&
+	    roundup2(size, SLAB_ALIGN) + SLAB_ALIGN <=
+	    slab_class_sizes[hdr->cls]) {
+		slab_class_t *cls = hdr->slab->cls;
+
+		pthread_mutex_lock(&cls->lock);
+		cls->used = cls->used - hdr->size + size;
+		pthread_mutex_unlock(&cls->lock);
+		hdr->size = size;
+		return ptr;
+	}
+	if ((nptr = slab_alloc(size)) == NULL) {
+		return NULL;
+	}
+	memcpy(nptr, ptr, MIN(hdr->size, size));
+	slab_free(ptr);
+	return nptr;
+}
+
+/*
+ * slab_get_stats: get the memory usage statistics.
+ *
+ * => The fragmentation is the difference between the reserved and
+ *    the used memory: the free objects in the slabs, the size class
+ *    rounding and the headers.
+ */
+void
+slab_get_stats(slab_stats_t *st)
+{
+	memset(st, 0, sizeof(slab_stats_t));
+	pthread_once(&slab_once, slab_sysinit);
+
+	for (unsigned i = 0; i < SLAB_NCLASSES; i++) {
+		slab_class_t *cls = &slab_classes[i];
+		size_t nfree;
+
+		pthread_mutex_lock(&cls->lock);
+		nfree = (size_t)cls->nslabs * cls->nobjs - cls->nalloc;
+		st->used += cls->used;
+		st->reserved += cls->nslabs * slab_len(cls);
+		st->free += nfree * cls->size;
+		st->slabs += cls->nslabs;
+		pthread_mutex_unlock(&cls->lock);
+	}
+
+	pthread_mutex_lock(&large_lock);
+	st->used += large_used;
+	st->reserved += large_reserved;
+	st->large = large_reserved;
+	pthread_mutex_unlock(&large_lock);
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2024 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+
+typedef struct {
+	size_t		used;		// bytes requested by the callers
+	size_t		reserved;	// bytes held (slabs and large objects)
+	size_t		free;		// bytes of the free objects in the slabs
+	size_t		large;		// bytes of the large objects
+	unsigned	slabs;		// number of the slabs
+} slab_stats_t;
+
+void *		slab_alloc(size_t);
+void *		slab_calloc(size_t, size_t);
+void *		slab_realloc(void *, size_t);
+void *		slab_aligned_alloc(size_t, size_t);
+void		slab_free(void *);
+
+void		slab_get_stats(slab_stats_t *);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2024 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Top-k selection of the (score, ID) pairs.
+ *
+ * The entries are in a flat array: introselect (quickselect with the
+ * median-of-three pivot, falling back to heapsort if the recursion gets
+ * too deep) moves the k best entries to the front, then only they are
+ * sorted (introsort).  This is O(n + k log k) on average, compared to
+ * O(n log k) of the capped heap, and the comparison is inlined.
+ *
+ * The order is by the score (descending), then by the ID (ascending),
+ * therefore it is deterministic: the equal scores are ordered by ID.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "topk.h"
+#include "utils.h"
+
+/* Ranges up to this size are sorted using the insertion sort. */
+#define	TOPK_SMALL		(16)
+
+/* Sample size for the pruning and the minimum array size to use it. */
+#define	TOPK_SAMPLE		(512)
+#define	TOPK_PRUNE_MIN		(16 * TOPK_SAMPLE)
+
+/*
+ * topk_before: whether the entry a comes before the entry b.
+ */
+static inline bool
+topk_before(const topk_entry_t *a, const topk_entry_t *b)
+{
+	return a->key > b->key || (a->key == b->key && a->id < b->id);
+}
+
+static inline void
+topk_swap(topk_entry_t *a, topk_entry_t *b)
+{
+	const topk_entry_t tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+static void
+topk_insertion_sort(topk_entry_t *a, size_t n)
+{
+	for (size_t i = 1; i < n; i++) {
+		const topk_entry_t e = a[i];
+		size_t j = i;
+
+		while (j > 0 && topk_before(&e, &a[j - 1])) {
+			a[j] = a[j - 1];
+			j--;
+		}
+		a[j] = e;
+	}
+}
+
+static void
+topk_siftdown(topk_entry_t *a, size_t i, size_t n)
+{
+	for (;;) {
+		size_t c = 2 * i + 1;
+
+		if (c >= n) {
+			break;
+		}
+		if (c + 1 < n && topk_before(&a[c], &a[c + 1])) {
+			c++;
+		}
+		if (!topk_before(&a[i], &a[c])) {
+			break;
+		}
+		topk_swap(&a[i], &a[c]);
+		i = c;
+	}
+}
+
+static void
+topk_heapsort(topk_entry_t *a, size_t n)
+{
+	for (size_t i = n / 2; i-- > 0;) {
+		topk_siftdown(a, i, n);
+	}
+	for (size_t i = n; i-- > 1;) {
+		topk_swap(&a[0], &a[i]);
+		topk_siftdown(a, 0, i);
+	}
+}
+
+/*
+ * topk_partition: partition the range around the median of three.
+ *
+ * => Returns the final position of the pivot: the entries before it
+ *    come before the pivot and the entries after it come after.
+ */
+static size_t
+topk_partition(topk_entry_t *a, size_t n)
+{
+	topk_entry_t *x = &a[0], *y = &a[n / 2], *z = &a[n - 1];
+	topk_entry_t pivot;
+	size_t i = 0, j = n;
+
+	/* Order the three entries, then move the median to the front. */
+	if (topk_before(y, x)) {
+		topk_swap(x, y);
+	}
+	if (topk_before(z, y)) {
+		topk_swap(y, z);
+		if (topk_before(y, x)) {
+			topk_swap(x, y);
+		}
+	}
+	topk_swap(x, y);
+	pivot = a[0];
+
+	for (;;) {
+		do {
+			i++;
+		} while (i < n && topk_before(&a[i], &pivot));
+		do {
+			j--;
+		} while (topk_before(&pivot, &a[j]));
+		if (i >= j) {
+			break;
+		}
+		topk_swap(&a[i], &a[j]);
+	}
+	topk_swap(&a[0], &a[j]);
+	return j;
+}
+
+static void
+topk_introsort(topk_entry_t *a, size_t n, unsigned depth)
+{
+	while (n > TOPK_SMALL) {
+		size_t p;
+
+		if (depth-- == 0) {
+			topk_heapsort(a, n);
+			return;
+		}
+		p = topk_partition(a, n);
+
+		/* Recurse into the smaller part; loop on the larger. */
+		if (p < n - p - 1) {
+			topk_introsort(a, p, depth);
+			a += p + 1;
+			n -= p + 1;
+		} else {
+			topk_introsort(a + p + 1, n - p - 1, depth);
+			n = p;
+		}
+	}
+	topk_insertion_sort(a, n);
+}
+
+/*
+ * topk_introselect: move the k first entries (in any order) to the
+ * front of the array.
+ */
+static void
+topk_introselect(topk_entry_t *a, size_t n, size_t k, unsigned depth)
+{
+	while (n > TOPK_SMALL) {
+		size_t p;
+
+		if (depth-- == 0) {
+			topk_heapsort(a, n);
+			return;
+		}
+		p = topk_partition(a, n);
+		if (p == k || p + 1 == k) {
+			return;
+		}
+		if (k < p) {
+			n = p;
+		} else {
+			a += p + 1;
+			n -= p + 1;
+			k -= p + 1;
+		}
+	}
+	topk_insertion_sort(a, n);
+}
+
+static unsigned
+topk_depth(size_t n)
+{
+	unsigned depth = 0;
+
+	while (n >>= 1) {
+		depth++;
+	}
+	return depth * 2;
+}
+
+/*
+ * topk_prune: move the entries which may be in the top k to the front
+ * of the array and return their count.
+ *
+ * => Estimates the threshold entry from a sample, with some margin,
+ *    then moves the entries up to it to the front in a single pass.
+ *    If there are fewer than k such entries (a bad sample), then the
+ *    whole array is returned.
+ */
+static size_t
+topk_prune(topk_entry_t *a, size_t n, size_t k)
+{
+	topk_entry_t sample[TOPK_SAMPLE], threshold;
+	size_t r, c = 0;
+
+	/*
+	 * Evenly spaced sample; the expected rank of the k-th entry in
+	 * the sample plus the margin (a few standard deviations).
+	 */
+	for (unsigned i = 0; i < TOPK_SAMPLE; i++) {
+		sample[i] = a[(size_t)i * n / TOPK_SAMPLE];
+	}
+	r = (k * TOPK_SAMPLE) / n;
+	r += 8 + 2 * (unsigned)sqrt(r);
+	if (r >= TOPK_SAMPLE) {
+		return n;
+	}
+	topk_introselect(sample, TOPK_SAMPLE, r + 1, topk_depth(TOPK_SAMPLE));
+	threshold = sample[0];
+	for (unsigned i = 1; i <= r; i++) {
+		if (topk_before(&threshold, &sample[i])) {
+			threshold = sample[i];
+		}
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (!topk_before(&threshold, &a[i])) {
+			topk_swap(&a[c++], &a[i]);
+		}
+	}
+	return c >= k ? c : n;
+}
+
+/*
+ * topk_select: move the k best entries to the front of the array, in
+ * the order of the score (descending), then the ID (ascending).
+ *
+ * => Returns the number of the selected entries, i.e. MIN(n, k).
+ */
+size_t
+topk_select(topk_entry_t *a, size_t n, size_t k)
+{
+	if (k < n) {
+		if (n >= TOPK_PRUNE_MIN && k < n / 4) {
+			n = topk_prune(a, n, k);
+		}
+		topk_introselect(a, n, k, topk_depth(n));
+		n = k;
+	}
+	topk_introsort(a, n, topk_depth(n));
+	return n;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2024 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+#ifndef _TOPK_H_
+#define _TOPK_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+typedef struct {
+	uint64_t	id;
+	float		score;
+	uint32_t	key;	// the score as an ordered integer
+} topk_entry_t;
+
+/*
+ * topk_entry_set: set the entry; the score is converted into the key
+ * which has the same order, but can be compared as an integer (the
+ * order is total, e.g. the negative zero is the same as zero).
+ */
+static inline void
+topk_entry_set(topk_entry_t *e, uint64_t id, float score)
+{
+	uint32_t u = 0;
+
+	if (score != 0) {
+		memcpy(&u, &score, sizeof(uint32_t));
+	}
+	e->id = id;
+	e->score = score;
+	e->key = (u & 0x80000000U) ? ~u : (u | 0x80000000U);
+}
+
+size_t		topk_select(topk_entry_t *, size_t, size_t);
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2022 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Index handle cache.
+ *
+ * Opening an index is relatively expensive: the terms and dtmap indexes
+ * are replayed to build the in-memory structures (including the BK-tree).
+ * The applications serving many (small) indexes would normally keep
+ * their own cache of the handles.  Instead, the library provides:
+ *
+ * - nxs_index_acquire() which returns the already open index handle,
+ * if any, acquiring a reference; otherwise, the index is opened.
+ *
+ * - nxs_index_release() which drops the reference.  The last reference
+ * does not close the index; instead, the handle is put on the idle list
+ * (in the LRU order) and may be re-acquired at almost no cost, since
+ * the index is only synced with the on-disk data on access.
+ *
+ * The idle handles are closed when they exceed the idle timeout or when
+ * the estimated memory usage of all open indexes exceeds the budget.
+ * See nxs_index_cache_config().  The handles in use are never evicted.
+ * The GC also optimizes the modified term bitmaps of the idle handles,
+ * in batches, so it is not done on the add/remove path.
+ *
+ * If the index is destroyed while its handle is in use, the handle is
+ * removed from the cache (it cannot be acquired anymore) and marked as
+ * doomed: the last release closes it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define __NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "index.h"
+#include "utils.h"
+
+/* Approximate overhead of the hash map entry and the allocator. */
+#define	CACHE_ENTRY_OVERHEAD	(64)
+
+static time_t
+cache_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/*
+ * idx_get_memusage: get the estimated memory usage of the index.
+ *
+ * => Includes the mapped index files and the in-memory structures; the
+ *    term bitmaps are approximated by the document-term data.
+ * => The shared dictionary is divided among the indexes using it.
+ */
+size_t
+idx_get_memusage(const nxs_index_t *idx)
+{
+	const idxdict_t *dict = idx->dict;
+	size_t len = 0;
+
+	len += dict->terms_memmap.mapped_len;
+	len += dict->term_count * (sizeof(idxterm_t) + CACHE_ENTRY_OVERHEAD);
+	len += dict->terms_consumed;
+	len /= dict->refcnt;
+
+	len += idx->dt_memmap.mapped_len;
+	len += idx->dt_count * (sizeof(idxdoc_t) + CACHE_ENTRY_OVERHEAD);
+	len += idx->dt_consumed / 2;
+	return len;
+}
+
+/*
+ * nxs_index_cache_config: set the memory budget (in bytes) and the idle
+ * timeout (in seconds) for the idle index handles.
+ *
+ * => Zero means no limit.
+ */
+__dso_public void
+nxs_index_cache_config(nxs_t *nxs, size_t max_mem, unsigned idle_timeout)
+{
+	nxs->cache_max_mem = max_mem;
+	nxs->cache_idle_timeout = idle_timeout;
+	nxs_index_cache_gc(nxs);
+}
+
+static void
+cache_evict(nxs_t *nxs, nxs_index_t *idx)
+{
+	ASSERT(idx->refcnt == 0);
+	app_dbgx("evicting index `%s'", idx->name);
+	nxs_index_close(idx);
+	(void)nxs;
+}
+
+/*
+ * nxs_index_cache_gc: close the idle index handles which exceeded the
+ * idle timeout or the memory budget; optimize the modified term bitmaps
+ * of the remaining idle handles.
+ *
+ * => Returns the number of closed index handles.
+ */
+__dso_public unsigned
+nxs_index_cache_gc(nxs_t *nxs)
+{
+	const time_t now = cache_now();
+	unsigned count = 0;
+	nxs_index_t *idx;
+
+	/*
+	 * Idle timeout: the list is in the LRU order.
+	 */
+	while (nxs->cache_idle_timeout &&
+	    (idx = TAILQ_FIRST(&nxs->idle_list)) != NULL) {
+		if (now - idx->idle_since < (time_t)nxs->cache_idle_timeout) {
+			break;
+		}
+		cache_evict(nxs, idx);
+		count++;
+	}
+
+	/*
+	 * Memory budget: evict the least recently used handles.
+	 */
+	if (nxs->cache_max_mem && !TAILQ_EMPTY(&nxs->idle_list)) {
+		size_t total = 0;
+
+		TAILQ_FOREACH(idx, &nxs->index_list, entry) {
+			total += idx_get_memusage(idx);
+		}
+		while (total > nxs->cache_max_mem &&
+		    (idx = TAILQ_FIRST(&nxs->idle_list)) != NULL) {
+			total -= idx_get_memusage(idx);
+			cache_evict(nxs, idx);
+			count++;
+		}
+	}
+
+	/*
+	 * Optimize a batch of the modified term bitmaps, once enough of
+	 * them accumulate.
+	 */
+	TAILQ_FOREACH(idx, &nxs->idle_list, idle_entry) {
+		if (idx->post_dirty_count >= IDX_OPTIMIZE_BATCH) {
+			(void)idxpost_optimize(idx, false);
+		}
+	}
+	return count;
+}
+
+/*
+ * nxs_index_acquire: get the index handle, opening the index if needed.
+ *
+ * => The handle must be released with nxs_index_release().
+ */
+__dso_public nxs_index_t *
+nxs_index_acquire(nxs_t *nxs, const char *name)
+{
+	nxs_index_t *idx;
+
+	nxs_clear_error(nxs);
+
+	if (str_isalnumdu(name) == -1) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "invalid characters in index name", NULL);
+		return NULL;
+	}
+	if ((idx = rhashmap_get(nxs->indexes, name, strlen(name))) != NULL) {
+		if (idx->refcnt++ == 0) {
+			TAILQ_REMOVE(&nxs->idle_list, idx, idle_entry);
+		}
+		return idx;
+	}
+
+	/*
+	 * Make some room before opening a new index.
+	 */
+	nxs_index_cache_gc(nxs);
+	return nxs_index_open(nxs, name);
+}
+
+/*
+ * nxs_index_release: release the index handle.
+ *
+ * => The last reference puts the handle on the idle list or, if the
+ *    index was destroyed, closes it.
+ */
+__dso_public void
+nxs_index_release(nxs_index_t *idx)
+{
+	nxs_t *nxs = idx->nxs;
+
+	ASSERT(idx->refcnt > 0);
+	if (--idx->refcnt > 0) {
+		return;
+	}
+	if (idx->doomed) {
+		nxs_index_close(idx);
+		return;
+	}
+	idx->idle_since = cache_now();
+	TAILQ_INSERT_TAIL(&nxs->idle_list, idx, idle_entry);
+	nxs_index_cache_gc(nxs);
+}
+
+/*
+ * nxs_index_cache_drop: remove the handle of the index from the cache.
+ *
+ * => The idle handle is closed; the handle in use is marked as doomed
+ *    and is closed by the last release.
+ */
+void
+nxs_index_cache_drop(nxs_t *nxs, const char *name)
+{
+	nxs_index_t *idx;
+
+	idx = rhashmap_get(nxs->indexes, name, strlen(name));
+	if (idx == NULL) {
+		return;
+	}
+	if (idx->refcnt == 0) {
+		cache_evict(nxs, idx);
+		return;
+	}
+	rhashmap_del(nxs->indexes, idx->name, strlen(idx->name));
+	idx->doomed = true;
+}
+
+/*
+ * nxs_index_cache_sync: sync the open index handles (including the idle
+ * ones) with the changes published by the other handles or processes,
+ * so that the searches find them up to date.
+ *
+ * => Intended to be called periodically, e.g. from a timer of the event
+ *    loop.  The instance is not thread-safe, therefore the calls must be
+ *    serialized with the other operations (as with nxs_index_cache_gc()).
+ * => Returns the number of the updated handles.  The failures are
+ *    declared, but do not prevent the other handles from being synced.
+ */
+__dso_public unsigned
+nxs_index_cache_sync(nxs_t *nxs)
+{
+	unsigned count = 0;
+	nxs_index_t *idx;
+
+	nxs_clear_error(nxs);
+	TAILQ_FOREACH(idx, &nxs->index_list, entry) {
+		if (idx_sync(idx) == 1) {
+			count++;
+		}
+	}
+	return count;
+}
@@ -13,8 +13,20 @@
  * and create pipelines which be invoked by the tokenizer.
  *
  * See description of filter_ops_t in the filters.h headers.
+ *
+ * Token cache
+ *
+ *	Each pipeline has a bounded cache of its final output (or the
+ *	discard verdict) keyed by the raw token value.  The words repeat
+ *	within a document and across the documents, therefore most of the
+ *	tokens skip the filters.  The filters of a pipeline are fixed on
+ *	its creation and they are expected to be deterministic, therefore
+ *	the entries never become stale: the cache is invalidated only by
+ *	destroying the pipeline (e.g. re-opening the index).  The least
+ *	recently used entries are evicted when the cache is full.
  */
 
+#include <sys/queue.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -43,7 +55,28 @@ typedef struct {
 	const filter_ops_t *	ops;
 } filter_t;
 
+/*
+ * Token cache entry: the raw value (the key), followed by the filtered
+ * value, if not discarded.  Both are NUL-terminated.
+ */
+typedef struct fcache_ent {
+	TAILQ_ENTRY(fcache_ent)	entry;
+	uint16_t		key_len;
+	uint16_t		value_len;
+	bool			discard;
+	char			data[];
+} fcache_ent_t;
+
+#define	FILTER_CACHE_DEF	(8192)
+#define	FILTER_CACHE_KEYMAX	(STRBUF_DEF_SIZE)
+
 struct filter_pipeline {
+	/* Token cache (NULL if disabled) and its LRU list. */
+	rhashmap_t *		cache_map;
+	TAILQ_HEAD(, fcache_ent) cache_list;
+	unsigned		cache_count;
+	unsigned		cache_max;
+
 	unsigned		count;
 	filter_t		filters[];
 };
@@ -121,10 +154,14 @@ nxs_filter_register(nxs_t *nxs, const char *name,
 
 /*
  * filter_pipeline_create: construct a new pipeline of filters.
+ *
+ * => The "token_cache" parameter sets the number of the cached tokens
+ *    (zero disables the cache).
  */
 filter_pipeline_t *
 filter_pipeline_create(nxs_t *nxs, nxs_params_t *params)
 {
+	uint64_t cache_max = FILTER_CACHE_DEF;
 	const char **filters;
 	filter_pipeline_t *fp;
 	size_t count = 0, len;
@@ -145,6 +182,7 @@ filter_pipeline_create(nxs_t *nxs, nxs_params_t *params)
 		return NULL;
 	}
 	fp->count = count;
+	TAILQ_INIT(&fp->cache_list);
 
 	for (unsigned i = 0; i < count; i++) {
 		const char *name = filters[i];
@@ -169,6 +207,19 @@ filter_pipeline_create(nxs_t *nxs, nxs_params_t *params)
 			goto err;
 		}
 	}
+
+	/*
+	 * Create the token cache, unless disabled or there are no filters.
+	 */
+	(void)nxs_params_get_uint(params, "token_cache", &cache_max);
+	if (count && cache_max) {
+		fp->cache_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+		if (fp->cache_map == NULL) {
+			nxs_decl_errx(nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+			goto err;
+		}
+		fp->cache_max = MIN(cache_max, UINT_MAX);
+	}
 	free(filters);
 	return fp;
 err:
@@ -177,9 +228,26 @@ err:
 	return NULL;
 }
 
+static void
+fcache_evict(filter_pipeline_t *fp, fcache_ent_t *ent)
+{
+	rhashmap_del(fp->cache_map, ent->data, ent->key_len);
+	TAILQ_REMOVE(&fp->cache_list, ent, entry);
+	fp->cache_count--;
+	free(ent);
+}
+
 void
 filter_pipeline_destroy(filter_pipeline_t *fp)
 {
+	fcache_ent_t *ent;
+
+	while ((ent = TAILQ_FIRST(&fp->cache_list)) != NULL) {
+		fcache_evict(fp, ent);
+	}
+	if (fp->cache_map) {
+		rhashmap_destroy(fp->cache_map);
+	}
 	for (unsigned i = 0; i < fp->count; i++) {
 		filter_t *filt = &fp->filters[i];
 
@@ -191,13 +259,10 @@ filter_pipeline_destroy(filter_pipeline_t *fp)
 }
 
 /*
- * filter_pipeline_run: apply the filters.
- *
- * Mutates the given string buffer.  Filters may return a new string
- * buffer (output), if the former is too small.
+ * filter_pipeline_exec: apply the filters.
  */
-filter_action_t
-filter_pipeline_run(filter_pipeline_t *fp, strbuf_t *buf)
+static filter_action_t
+filter_pipeline_exec(filter_pipeline_t *fp, strbuf_t *buf)
 {
 	for (unsigned i = 0; i < fp->count; i++) {
 		filter_t *filt = &fp->filters[i];
@@ -217,3 +282,86 @@ filter_pipeline_run(filter_pipeline_t *fp, strbuf_t *buf)
 	}
 	return FILT_MUTATION;
 }
+
+/*
+ * fcache_put: cache the result of the pipeline for the given key.
+ */
+static void
+fcache_put(filter_pipeline_t *fp, const char *key, size_t key_len,
+    filter_action_t action, const strbuf_t *buf)
+{
+	const bool discard = action == FILT_DISCARD;
+	const size_t value_len = discard ? 0 : buf->length;
+	fcache_ent_t *ent;
+
+	if (value_len > UINT16_MAX) {
+		return;
+	}
+	ent = malloc(offsetof(fcache_ent_t, data[key_len + value_len + 2]));
+	if (ent == NULL) {
+		return;
+	}
+	ent->key_len = key_len;
+	ent->value_len = value_len;
+	ent->discard = discard;
+	memcpy(ent->data, key, key_len);
+	ent->data[key_len] = '\0';
+	memcpy(&ent->data[key_len + 1], buf->value, value_len);
+	ent->data[key_len + 1 + value_len] = '\0';
+
+	if (fp->cache_count >= fp->cache_max) {
+		fcache_evict(fp, TAILQ_FIRST(&fp->cache_list));
+	}
+	if (rhashmap_put(fp->cache_map, ent->data, key_len, ent) != ent) {
+		free(ent);
+		return;
+	}
+	TAILQ_INSERT_TAIL(&fp->cache_list, ent, entry);
+	fp->cache_count++;
+}
+
+/*
+ * filter_pipeline_run: apply the filters or get the cached result.
+ *
+ * Mutates the given string buffer.  Filters may return a new string
+ * buffer (output), if the former is too small.
+ */
+filter_action_t
+filter_pipeline_run(filter_pipeline_t *fp, strbuf_t *buf)
+{
+	const size_t key_len = buf->length;
+	char key[FILTER_CACHE_KEYMAX];
+	filter_action_t action;
+	fcache_ent_t *ent;
+
+	if (fp->cache_map == NULL || key_len > FILTER_CACHE_KEYMAX) {
+		return filter_pipeline_exec(fp, buf);
+	}
+	ent = rhashmap_get(fp->cache_map, buf->value, key_len);
+	if (ent) {
+		/* Cache hit: move to the tail (most recently used). */
+		TAILQ_REMOVE(&fp->cache_list, ent, entry);
+		TAILQ_INSERT_TAIL(&fp->cache_list, ent, entry);
+		if (ent->discard) {
+			return FILT_DISCARD;
+		}
+		if (strbuf_prealloc(buf, ent->value_len + 1) == -1) {
+			return filter_pipeline_exec(fp, buf);
+		}
+		memcpy(buf->value, &ent->data[ent->key_len + 1],
+		    ent->value_len + 1);
+		buf->length = ent->value_len;
+		return FILT_MUTATION;
+	}
+
+	/*
+	 * Cache miss: run the filters and cache the result (unless
+	 * an error).  Save the key, since the buffer gets mutated.
+	 */
+	memcpy(key, buf->value, key_len);
+	action = filter_pipeline_exec(fp, buf);
+	if (action != FILT_ERROR) {
+		fcache_put(fp, key, key_len, action, buf);
+	}
+	return action;
+}
@@ -10,6 +10,7 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 #include <inttypes.h>
 
 #include <lua.h>
@@ -22,6 +23,7 @@
 #define	NXS_PARAMS_METATABLE	"nxs-params-obj"
 #define	NXS_IDX_METATABLE	"nxs-index-obj"
 #define	NXS_RESP_METATABLE	"nxs-resp-obj"
+#define	NXS_QUERY_METATABLE	"nxs-query-obj"
 
 static nxs_t *	nxs = NULL;
 
@@ -121,6 +123,81 @@ lua_nxs_params_fromjson(lua_State *L)
 	return 1;
 }
 
+/*
+ * Typed setters for the search parameters; return the params object.
+ */
+
+static int
+lua_nxs_params_set_limit(lua_State *L)
+{
+	nxs_params_t *params = lua_nxs_params_getctx(L, 1);
+	lua_Integer limit = luaL_checkinteger(L, 2);
+
+	/* Note: validated on use (as the JSON values). */
+	nxs_params_set_limit(params, limit > 0 ? (uint64_t)limit : 0);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+lua_nxs_params_set_algo(lua_State *L)
+{
+	nxs_params_t *params = lua_nxs_params_getctx(L, 1);
+	const char *algo = luaL_checkstring(L, 2);
+
+	nxs_params_set_algo(params, algo);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+lua_nxs_params_set_fuzzymatch(lua_State *L)
+{
+	nxs_params_t *params = lua_nxs_params_getctx(L, 1);
+
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+	nxs_params_set_fuzzymatch(params, lua_toboolean(L, 2));
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+lua_nxs_params_set_timeout(lua_State *L)
+{
+	nxs_params_t *params = lua_nxs_params_getctx(L, 1);
+	lua_Integer timeout = luaL_checkinteger(L, 2);
+
+	luaL_argcheck(L, timeout >= 0 && timeout <= UINT_MAX, 2,
+	    "non-negative `integer' expected");
+	nxs_params_set_timeout(params, timeout);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+lua_nxs_params_set_stable(lua_State *L)
+{
+	nxs_params_t *params = lua_nxs_params_getctx(L, 1);
+
+	luaL_checktype(L, 2, LUA_TBOOLEAN);
+	nxs_params_set_stable(params, lua_toboolean(L, 2));
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+lua_nxs_params_set_id_range(lua_State *L)
+{
+	nxs_params_t *params = lua_nxs_params_getctx(L, 1);
+	nxs_doc_id_t id_min, id_max;
+
+	id_min = lua_isnoneornil(L, 2) ? 0 : luaL_checkinteger(L, 2);
+	id_max = lua_isnoneornil(L, 3) ? UINT64_MAX : luaL_checkinteger(L, 3);
+	nxs_params_set_id_range(params, id_min, id_max);
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
 static int
 lua_nxs_params_gc(lua_State *L)
 {
@@ -156,7 +233,7 @@ static int
 lua_nxs_index_gc(lua_State *L)
 {
 	nxs_index_t *idx = lua_nxs_index_getctx(L);
-	nxs_index_close(idx);
+	nxs_index_release(idx);
 	return 0;
 }
 
@@ -170,13 +247,13 @@ lua_nxs_index_open(lua_State *L)
 	name = lua_tostring(L, 1);
 	luaL_argcheck(L, name, 1, "non-empty `string' expected");
 
-	if ((idx = nxs_index_open(nxs, name)) == NULL) {
+	if ((idx = nxs_index_acquire(nxs, name)) == NULL) {
 		lua_pushnil(L);
 		lua_nxs_push_error(L);
 		return 2;
 	}
 	if ((ret = lua_nxs_index_newctx(L, idx)) == -1) {
-		nxs_index_close(idx);
+		nxs_index_release(idx);
 		return luaL_error(L, "OOM");
 	}
 	lua_pushnil(L);
@@ -227,6 +304,32 @@ lua_nxs_index_destroy(lua_State *L)
 	return 1;
 }
 
+static int
+lua_nxs_index_cache_config(lua_State *L)
+{
+	size_t max_mem;
+	unsigned idle_timeout;
+
+	max_mem = luaL_optinteger(L, 1, 0);
+	idle_timeout = luaL_optinteger(L, 2, 0);
+	nxs_index_cache_config(nxs, max_mem, idle_timeout);
+	return 0;
+}
+
+static int
+lua_nxs_index_cache_gc(lua_State *L)
+{
+	lua_pushinteger(L, nxs_index_cache_gc(nxs));
+	return 1;
+}
+
+static int
+lua_nxs_index_cache_sync(lua_State *L)
+{
+	lua_pushinteger(L, nxs_index_cache_sync(nxs));
+	return 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 static int
@@ -274,6 +377,158 @@ lua_nxs_index_remove(lua_State *L)
 	return 1;
 }
 
+static int
+lua_nxs_index_sync(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	int ret;
+
+	if ((ret = nxs_index_sync(idx)) == -1) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	lua_pushboolean(L, ret);
+	return 1;
+}
+
+static int
+lua_nxs_index_set_synonyms(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	const char *text;
+	size_t len;
+
+	text = lua_tolstring(L, 2, &len);
+	luaL_argcheck(L, text, 2, "`string' expected");
+
+	if (nxs_index_set_synonyms(idx, text, len) == -1) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int
+lua_nxs_index_repl_pos(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	uint64_t terms_pos, dtmap_pos;
+
+	nxs_index_repl_pos(idx, &terms_pos, &dtmap_pos);
+	lua_pushinteger(L, terms_pos);
+	lua_pushinteger(L, dtmap_pos);
+	return 2;
+}
+
+static int
+lua_nxs_index_repl_export(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	uint64_t terms_pos, dtmap_pos;
+	size_t maxlen, len;
+	void *buf;
+
+	terms_pos = luaL_checkinteger(L, 2);
+	dtmap_pos = luaL_checkinteger(L, 3);
+	maxlen = luaL_optinteger(L, 4, 0);
+
+	buf = nxs_index_repl_export(idx, terms_pos, dtmap_pos, maxlen, &len);
+	if (buf == NULL) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	lua_pushlstring(L, buf, len);
+	free(buf);
+	lua_pushnil(L);
+	return 2;
+}
+
+static int
+lua_nxs_index_repl_apply(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	const char *data;
+	size_t len;
+
+	data = lua_tolstring(L, 2, &len);
+	luaL_argcheck(L, data && len, 2, "non-empty `string' expected");
+
+	if (nxs_index_repl_apply(idx, data, len) == -1) {
+		lua_pushboolean(L, false);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static int
+lua_nxs_index_snapshot(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	const char *snapname;
+
+	snapname = lua_tostring(L, 2);
+	luaL_argcheck(L, snapname, 2, "non-empty `string' expected");
+
+	if (nxs_index_snapshot(idx, snapname) == -1) {
+		lua_pushboolean(L, false);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+static int
+lua_nxs_index_clone(lua_State *L)
+{
+	const char *snapname, *name;
+	nxs_index_t *idx;
+
+	snapname = lua_tostring(L, 1);
+	luaL_argcheck(L, snapname, 1, "non-empty `string' expected");
+	name = lua_tostring(L, 2);
+	luaL_argcheck(L, name, 2, "non-empty `string' expected");
+
+	if ((idx = nxs_index_clone(nxs, snapname, name)) == NULL) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	if (lua_nxs_index_newctx(L, idx) == -1) {
+		nxs_index_close(idx);
+		return luaL_error(L, "OOM");
+	}
+	lua_pushnil(L);
+	return 2;
+}
+
+static int
+lua_nxs_snapshot_destroy(lua_State *L)
+{
+	const char *snapname;
+
+	snapname = lua_tostring(L, 1);
+	luaL_argcheck(L, snapname, 1, "non-empty `string' expected");
+
+	if (nxs_snapshot_destroy(nxs, snapname) == -1) {
+		lua_pushboolean(L, false);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	lua_pushboolean(L, true);
+	return 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 static int
@@ -328,6 +583,14 @@ lua_nxs_resp_tojson(lua_State *L)
 	return 1;
 }
 
+static int
+lua_nxs_resp_generation(lua_State *L)
+{
+	nxs_resp_t *resp = lua_nxs_resp_getctx(L, 1);
+	lua_pushinteger(L, nxs_resp_generation(resp));
+	return 1;
+}
+
 static int
 lua_nxs_resp_gc(lua_State *L)
 {
@@ -342,6 +605,7 @@ static int
 lua_nxs_index_search(lua_State *L)
 {
 	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	nxs_stats_t *stats = NULL;
 	nxs_params_t *params;
 	nxs_resp_t *resp;
 	const char *text;
@@ -352,7 +616,30 @@ lua_nxs_index_search(lua_State *L)
 	luaL_argcheck(L, text && len, 2, "non-empty `string' expected");
 	params = lua_isnoneornil(L, 3) ? NULL : lua_nxs_params_getctx(L, 3);
 
-	resp = nxs_index_search(idx, params, text, len);
+	if (!lua_isnoneornil(L, 4)) {
+		const char *json;
+		size_t json_len;
+
+		/*
+		 * Global statistics (as JSON) for the distributed search.
+		 */
+		json = lua_tolstring(L, 4, &json_len);
+		luaL_argcheck(L, json && json_len, 4,
+		    "non-empty `string' expected");
+
+		if ((stats = nxs_stats_fromjson(nxs, json, json_len)) == NULL) {
+			lua_pushnil(L);
+			lua_nxs_push_error(L);
+			return 2;
+		}
+	}
+
+	if (stats) {
+		resp = nxs_index_search_global(idx, params, stats, text, len);
+		nxs_stats_release(stats);
+	} else {
+		resp = nxs_index_search(idx, params, text, len);
+	}
 	if (resp == NULL) {
 		lua_pushnil(L);
 		lua_nxs_push_error(L);
@@ -367,6 +654,114 @@ lua_nxs_index_search(lua_State *L)
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/*
+ * Prepared query object.  It holds a reference to the index object,
+ * so the index is not released while the query is in use.
+ */
+typedef struct {
+	nxs_query_t *	query;
+	int		idx_ref;
+} lua_nxs_query_t;
+
+static lua_nxs_query_t *
+lua_nxs_query_getctx(lua_State *L)
+{
+	return luaL_checkudata(L, 1, NXS_QUERY_METATABLE);
+}
+
+static int
+lua_nxs_index_prepare(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	nxs_params_t *params;
+	lua_nxs_query_t *lq;
+	nxs_query_t *query;
+	const char *text;
+	size_t len;
+
+	text = lua_tolstring(L, 2, &len);
+	luaL_argcheck(L, text && len, 2, "non-empty `string' expected");
+	params = lua_isnoneornil(L, 3) ? NULL : lua_nxs_params_getctx(L, 3);
+
+	if ((query = nxs_query_prepare(idx, params, text, len)) == NULL) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	if ((lq = lua_newuserdata(L, sizeof(lua_nxs_query_t))) == NULL) {
+		nxs_query_release(query);
+		return luaL_error(L, "OOM");
+	}
+	lq->query = query;
+	lua_pushvalue(L, 1);
+	lq->idx_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	luaL_getmetatable(L, NXS_QUERY_METATABLE);
+	lua_setmetatable(L, -2);
+	lua_pushnil(L);
+	return 2;
+}
+
+static int
+lua_nxs_query_exec(lua_State *L)
+{
+	lua_nxs_query_t *lq = lua_nxs_query_getctx(L);
+	nxs_resp_t *resp;
+
+	if ((resp = nxs_query_exec(lq->query)) == NULL) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	if (lua_nxs_resp_acquire(L, resp) == -1) {
+		return luaL_error(L, "OOM");
+	}
+	lua_pushnil(L);
+	return 2;
+}
+
+static int
+lua_nxs_query_gc(lua_State *L)
+{
+	lua_nxs_query_t *lq = lua_nxs_query_getctx(L);
+
+	nxs_query_release(lq->query);
+	luaL_unref(L, LUA_REGISTRYINDEX, lq->idx_ref);
+	return 0;
+}
+
+static int
+lua_nxs_index_stats(lua_State *L)
+{
+	nxs_index_t *idx = lua_nxs_index_getctx(L);
+	nxs_params_t *params;
+	nxs_stats_t *stats;
+	const char *text;
+	char *json;
+	size_t len;
+
+	text = lua_tolstring(L, 2, &len);
+	luaL_argcheck(L, text && len, 2, "non-empty `string' expected");
+	params = lua_isnoneornil(L, 3) ? NULL : lua_nxs_params_getctx(L, 3);
+
+	if ((stats = nxs_index_getstats(idx, params, text, len)) == NULL) {
+		lua_pushnil(L);
+		lua_nxs_push_error(L);
+		return 2;
+	}
+	json = nxs_stats_tojson(stats, &len);
+	nxs_stats_release(stats);
+	if (json == NULL) {
+		return luaL_error(L, "OOM");
+	}
+	lua_pushlstring(L, json, len);
+	free(json);
+	lua_pushnil(L);
+	return 2;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 static void
 lua_nxs_setup_constants(lua_State *L)
 {
@@ -415,12 +810,23 @@ luaopen_nxsearch(lua_State *L)
 		{ "open",	lua_nxs_index_open	},
 		{ "create",	lua_nxs_index_create	},
 		{ "destroy",	lua_nxs_index_destroy	},
+		{ "clone",	lua_nxs_index_clone	},
+		{ "destroy_snapshot", lua_nxs_snapshot_destroy },
+		{ "cache_config", lua_nxs_index_cache_config },
+		{ "cache_gc",	lua_nxs_index_cache_gc	},
+		{ "cache_sync",	lua_nxs_index_cache_sync },
 		{ "newparams",	lua_nxs_params_create	},
 		{ "load_lua",	lua_nxs_load_lua	},
 		{ NULL,		NULL			},
 	};
 	static const struct luaL_Reg nxs_param_methods[] = {
 		{ "fromjson",	lua_nxs_params_fromjson	},
+		{ "set_limit",	lua_nxs_params_set_limit },
+		{ "set_algo",	lua_nxs_params_set_algo	},
+		{ "set_fuzzymatch", lua_nxs_params_set_fuzzymatch },
+		{ "set_timeout", lua_nxs_params_set_timeout },
+		{ "set_stable", lua_nxs_params_set_stable },
+		{ "set_id_range", lua_nxs_params_set_id_range },
 		{ "__gc",	lua_nxs_params_gc	},
 		{ NULL,		NULL			},
 	};
@@ -428,19 +834,34 @@ luaopen_nxsearch(lua_State *L)
 		{ "add",	lua_nxs_index_add	},
 		{ "remove",	lua_nxs_index_remove	},
 		{ "search",	lua_nxs_index_search	},
+		{ "prepare",	lua_nxs_index_prepare	},
+		{ "stats",	lua_nxs_index_stats	},
+		{ "sync",	lua_nxs_index_sync	},
+		{ "set_synonyms", lua_nxs_index_set_synonyms },
+		{ "repl_pos",	lua_nxs_index_repl_pos	},
+		{ "repl_export", lua_nxs_index_repl_export },
+		{ "repl_apply",	lua_nxs_index_repl_apply },
+		{ "snapshot",	lua_nxs_index_snapshot	},
 		{ "__gc",	lua_nxs_index_gc	},
 		{ NULL,		NULL			},
 	};
 	static const struct luaL_Reg nxs_resp_methods[] = {
 		{ "repr",	lua_nxs_resp_repr	},
 		{ "tojson",	lua_nxs_resp_tojson	},
+		{ "generation",	lua_nxs_resp_generation	},
 		{ "__gc",	lua_nxs_resp_gc		},
 		{ NULL,		NULL			},
 	};
+	static const struct luaL_Reg nxs_query_methods[] = {
+		{ "exec",	lua_nxs_query_exec	},
+		{ "__gc",	lua_nxs_query_gc	},
+		{ NULL,		NULL			},
+	};
 
 	lua_push_class(L, NXS_PARAMS_METATABLE, nxs_param_methods);
 	lua_push_class(L, NXS_IDX_METATABLE, nxs_index_methods);
 	lua_push_class(L, NXS_RESP_METATABLE, nxs_resp_methods);
+	lua_push_class(L, NXS_QUERY_METATABLE, nxs_query_methods);
 
 	if (!nxs) {
 		static int lua_regkey_dtor;
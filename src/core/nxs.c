@@ -77,17 +77,73 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include <roaring/memory.h>
+
 #define __NXSLIB_PRIVATE
 #include "nxs_impl.h"
 #include "filters.h"
 #include "rhashmap.h"
 #include "storage.h"
 #include "index.h"
+#include "slab.h"
 
 static const char *default_filters[] = {
 	"normalizer", "stopwords", "stemmer"
 };
 
+static const char *ngram_filters[] = {
+	"normalizer"
+};
+
+/*
+ * The bitmap containers are allocated from the slabs (see slab.c).  The
+ * memory hooks are process-wide, therefore they are set when the library
+ * is loaded, before any bitmap could be allocated.  Not used with ASan,
+ * so it can track the individual objects.
+ */
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define	NXS_ASAN	1
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define	NXS_ASAN	1
+#endif
+
+#if !defined(NXS_ASAN)
+static void __attribute__((constructor))
+nxs_roaring_sysinit(void)
+{
+	const roaring_memory_t hooks = {
+		.malloc		= slab_alloc,
+		.realloc	= slab_realloc,
+		.calloc		= slab_calloc,
+		.free		= slab_free,
+		.aligned_malloc	= slab_aligned_alloc,
+		.aligned_free	= slab_free,
+	};
+	roaring_init_memory_hook(hooks);
+}
+#endif
+
+/*
+ * nxs_get_memstats: get the memory statistics of the bitmap allocator.
+ *
+ * => The statistics are process-wide (for all instances).
+ */
+__dso_public void
+nxs_get_memstats(nxs_memstats_t *ms)
+{
+	slab_stats_t st;
+
+	slab_get_stats(&st);
+	ms->used = st.used;
+	ms->reserved = st.reserved;
+	ms->free = st.free;
+	ms->large = st.large;
+	ms->slabs = st.slabs;
+}
+
 __dso_public nxs_t *
 nxs_open(const char *basedir)
 {
@@ -103,6 +159,7 @@ nxs_open(const char *basedir)
 		return NULL;
 	}
 	TAILQ_INIT(&nxs->index_list);
+	TAILQ_INIT(&nxs->idle_list);
 
 	/*
 	 * Get the base directory and save the sanitized path.
@@ -127,6 +184,10 @@ nxs_open(const char *basedir)
 	if (nxs->indexes == NULL) {
 		goto err;
 	}
+	nxs->dicts = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	if (nxs->dicts == NULL) {
+		goto err;
+	}
 	return nxs;
 err:
 	nxs_close(nxs);
@@ -145,6 +206,9 @@ nxs_close(nxs_t *nxs)
 	if (nxs->indexes) {
 		rhashmap_destroy(nxs->indexes);
 	}
+	if (nxs->dicts) {
+		rhashmap_destroy(nxs->dicts);
+	}
 	filters_sysfini(nxs);
 	free(nxs->basedir);
 	free(nxs->errmsg);
@@ -222,6 +286,7 @@ nxs_index_create(nxs_t *nxs, const char *name, nxs_params_t *params)
 	nxs_params_t *def_params = NULL;
 	const char **filters = NULL;
 	nxs_index_t *idx = NULL;
+	uint64_t ngram = 0;
 	size_t filter_count;
 	char *path;
 
@@ -261,9 +326,17 @@ nxs_index_create(nxs_t *nxs, const char *name, nxs_params_t *params)
 		params = def_params;
 	}
 	filters = nxs_params_get_strlist(params, "filters", &filter_count);
-	if (filters == NULL && nxs_params_set_strlist(params, "filters",
-	    default_filters, __arraycount(default_filters)) == -1) {
-		goto out;
+	if (filters == NULL) {
+		/* Stemming and stop words do not apply to the n-grams. */
+		const bool ngrams = nxs_params_get_uint(params,
+		    "ngram", &ngram) == 0 && ngram;
+
+		if (nxs_params_set_strlist(params, "filters",
+		    ngrams ? ngram_filters : default_filters,
+		    ngrams ? __arraycount(ngram_filters) :
+		    __arraycount(default_filters)) == -1) {
+			goto out;
+		}
 	}
 	if (nxs_params_get_str(params, "algo") == NULL &&
 	    nxs_params_set_str(params, "algo", NXS_DEFAULT_RANKING_ALGO) == -1) {
@@ -302,7 +375,9 @@ out:
 __dso_public int
 nxs_index_destroy(nxs_t *nxs, const char *name)
 {
-	const char *idx_files[] = { "params.db", "nxsterms", "nxsdtmap", "" };
+	const char *idx_files[] = {
+		"params.db", "nxsterms", "nxsdtmap", "nxssyn", ""
+	};
 	const unsigned n = __arraycount(idx_files);
 	int ec = 0, ret = -1;
 	char *paths[n];
@@ -313,6 +388,9 @@ nxs_index_destroy(nxs_t *nxs, const char *name)
 		return -1;
 	}
 
+	/* Close the idle handle or doom the one in use, if cached. */
+	nxs_index_cache_drop(nxs, name);
+
 	/* Initialize all paths. */
 	for (unsigned i = 0; i < n; i++) {
 		ec += asprintf(&paths[i], "%s/data/%s/%s",
@@ -324,9 +402,10 @@ nxs_index_destroy(nxs_t *nxs, const char *name)
 
 	/*
 	 * Remove all index files, but skip the last entry.
+	 * Note: there is no terms index if the dictionary is shared.
 	 */
 	for (unsigned i = 0; i < n - 1 /* last entry is directory */; i++) {
-		if (unlink(paths[i]) == -1) {
+		if (unlink(paths[i]) == -1 && errno != ENOENT) {
 			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
 			    "could not remove `%s'", paths[i]);
 			goto out;
@@ -371,12 +450,41 @@ index_get_params(nxs_t *nxs, const char *name)
 	return params;
 }
 
+/*
+ * get_map_flags: get the memory mapping policies from the parameters.
+ */
+static unsigned
+get_map_flags(nxs_params_t *params)
+{
+	static const struct {
+		const char *	name;
+		unsigned	flag;
+	} map_opts[] = {
+		{ "mmap_hugepages",	IDXMAP_HUGEPAGE	},
+		{ "mmap_populate",	IDXMAP_POPULATE	},
+		{ "mmap_lock",		IDXMAP_LOCK	},
+		{ "mmap_prefetch",	IDXMAP_PREFETCH	},
+	};
+	unsigned flags = 0;
+
+	for (unsigned i = 0; i < __arraycount(map_opts); i++) {
+		bool val;
+
+		if (nxs_params_get_bool(params, map_opts[i].name, &val) == 0 &&
+		    val) {
+			flags |= map_opts[i].flag;
+		}
+	}
+	return flags;
+}
+
 __dso_public nxs_index_t *
 nxs_index_open(nxs_t *nxs, const char *name)
 {
 	const size_t name_len = strlen(name);
-	const char *algo_name;
+	const char *algo_name, *dict_name;
 	nxs_params_t *params;
+	uint64_t ngram = 0;
 	nxs_index_t *idx;
 	char *path;
 	int ret;
@@ -415,6 +523,16 @@ nxs_index_open(nxs_t *nxs, const char *name)
 		goto err;
 	}
 	idx->algo = get_ranking_func_id(algo_name);
+	idx->lang = nxs_params_get_str(params, "lang");
+
+	if (nxs_params_get_uint(params, "ngram", &ngram) == 0 && ngram &&
+	    (ngram < NGRAM_MIN || ngram > NGRAM_MAX)) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "invalid n-gram size (%u to %u)", NGRAM_MIN, NGRAM_MAX);
+		goto err;
+	}
+	idx->ngram = ngram;
+	idx->map_flags = get_map_flags(params);
 
 	/*
 	 * Create the filter pipeline.
@@ -425,14 +543,24 @@ nxs_index_open(nxs_t *nxs, const char *name)
 	}
 
 	/*
-	 * Open the terms index.
+	 * Open the terms index: either the shared dictionary or
+	 * the index's own.
 	 */
-	if (asprintf(&path, "%s/data/%s/%s",
-	    nxs->basedir, name, "nxsterms") == -1) {
-		goto err;
+	if ((dict_name = nxs_params_get_str(params, "dictionary")) != NULL) {
+		if (str_isalnumdu(dict_name) == -1) {
+			nxs_decl_errx(nxs, NXS_ERR_INVALID,
+			    "invalid characters in dictionary name", NULL);
+			goto err;
+		}
+		ret = idx_terms_open_shared(idx, dict_name);
+	} else {
+		if (asprintf(&path, "%s/data/%s/%s",
+		    nxs->basedir, name, "nxsterms") == -1) {
+			goto err;
+		}
+		ret = idx_terms_open(idx, path);
+		free(path);
 	}
-	ret = idx_terms_open(idx, path);
-	free(path);
 	if (ret == -1) {
 		goto err;
 	}
@@ -449,7 +577,15 @@ nxs_index_open(nxs_t *nxs, const char *name)
 	if (ret == -1) {
 		goto err;
 	}
+
+	/*
+	 * Load the synonym dictionary, if any.
+	 */
+	if (idxsyn_open(idx, name) == -1) {
+		goto err;
+	}
 	idx->name = strdup(name);
+	idx->refcnt = 1;
 	rhashmap_put(nxs->indexes, name, name_len, idx);
 	TAILQ_INSERT_TAIL(&nxs->index_list, idx, entry);
 	return idx;
@@ -472,8 +608,19 @@ nxs_index_close(nxs_index_t *idx)
 	nxs_t *nxs = idx->nxs;
 
 	if (idx->name) {
+		if (idx->refcnt > 1) {
+			/* Acquired elsewhere too: just drop the reference. */
+			idx->refcnt--;
+			return;
+		}
+		if (idx->refcnt == 0 && !idx->doomed) {
+			TAILQ_REMOVE(&nxs->idle_list, idx, idle_entry);
+		}
+		if (!idx->doomed) {
+			rhashmap_del(nxs->indexes,
+			    idx->name, strlen(idx->name));
+		}
 		TAILQ_REMOVE(&nxs->index_list, idx, entry);
-		rhashmap_del(nxs->indexes, idx->name, strlen(idx->name));
 		free(idx->name);
 	}
 	if (idx->fp) {
@@ -482,6 +629,12 @@ nxs_index_close(nxs_index_t *idx)
 	if (idx->params) {
 		nxs_params_release(idx->params);
 	}
+	for (unsigned i = 0; i < IDX_QUERY_ARENAS; i++) {
+		if (idx->query_arenas[i]) {
+			arena_destroy(idx->query_arenas[i]);
+		}
+	}
+	idxsyn_close(idx);
 	idx_dtmap_close(idx);
 	idx_terms_close(idx);
 	free(idx);
@@ -513,7 +666,10 @@ nxs_index_add(nxs_index_t *idx, nxs_params_t *params __unused,
 	/*
 	 * Tokenize and resolve tokens to terms.
 	 */
-	if ((tokens = tokenize(idx->fp, idx->params, text, len)) == NULL) {
+	tokens = idx->ngram ?
+	    tokenize_ngrams(idx->fp, idx->ngram, text, len) :
+	    tokenize(idx->fp, idx->lang, text, len);
+	if (tokens == NULL) {
 		nxs_decl_errx(idx->nxs, NXS_ERR_FATAL,
 		    "tokenizer failed", NULL);
 		return -1;
@@ -560,3 +716,39 @@ nxs_index_remove(nxs_index_t *idx, nxs_doc_id_t doc_id)
 	}
 	return 0;
 }
+
+/*
+ * nxs_index_sync: bring the index handle up to date with the changes
+ * made by the other handles or processes.
+ *
+ * => The searches sync the handle themselves, but the catch-up after
+ *    a burst of the updates may be moved out of the request path by
+ *    calling this periodically (see also nxs_index_cache_sync()).
+ * => Returns 1 if the handle was updated, 0 if it was already up to
+ *    date or -1 on failure.
+ */
+__dso_public int
+nxs_index_sync(nxs_index_t *idx)
+{
+	nxs_clear_error(idx->nxs);
+	return idx_sync(idx);
+}
+
+/*
+ * nxs_index_optimize: optimize all in-memory term bitmaps of the index.
+ *
+ * => The modified bitmaps of the idle handles are also optimized in
+ *    batches by nxs_index_cache_gc(); this is a full pass, e.g. for the
+ *    periodic maintenance.
+ */
+__dso_public int
+nxs_index_optimize(nxs_index_t *idx)
+{
+	nxs_clear_error(idx->nxs);
+
+	if (idx_sync(idx) == -1) {
+		return -1;
+	}
+	(void)idxpost_optimize(idx, true);
+	return 0;
+}
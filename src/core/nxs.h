@@ -9,6 +9,7 @@
 #define _NXSLIB_H_
 
 #include <sys/cdefs.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <stdbool.h>
 
@@ -28,6 +29,21 @@ void		nxs_close(nxs_t *);
 
 int		nxs_luafilter_load(nxs_t *, const char *, const char *);
 
+/*
+ * Memory statistics of the bitmap allocator (process-wide).
+ * The fragmentation is (reserved - used) / reserved.
+ */
+
+typedef struct {
+	size_t		used;		// bytes requested by the bitmaps
+	size_t		reserved;	// bytes held by the allocator
+	size_t		free;		// bytes of the free objects in the slabs
+	size_t		large;		// bytes of the objects above the slabs
+	unsigned	slabs;		// number of the slabs
+} nxs_memstats_t;
+
+void		nxs_get_memstats(nxs_memstats_t *);
+
 /*
  * Errors.
  */
@@ -63,6 +79,14 @@ int		nxs_params_set_str(nxs_params_t *, const char *, const char *);
 int		nxs_params_set_uint(nxs_params_t *, const char *, uint64_t);
 int		nxs_params_set_bool(nxs_params_t *, const char *, bool);
 
+void		nxs_params_set_limit(nxs_params_t *, uint64_t);
+void		nxs_params_set_algo(nxs_params_t *, const char *);
+void		nxs_params_set_fuzzymatch(nxs_params_t *, bool);
+void		nxs_params_set_timeout(nxs_params_t *, unsigned);
+void		nxs_params_set_stable(nxs_params_t *, bool);
+void		nxs_params_set_id_range(nxs_params_t *,
+		    nxs_doc_id_t, nxs_doc_id_t);
+
 char *		nxs_params_tojson(const nxs_params_t *, size_t *);
 void		nxs_params_release(nxs_params_t *);
 
@@ -79,9 +103,35 @@ nxs_params_t *	nxs_index_get_params(nxs_index_t *);
 
 nxs_index_t *	nxs_index_open(nxs_t *, const char *);
 void		nxs_index_close(nxs_index_t *);
+
+nxs_index_t *	nxs_index_acquire(nxs_t *, const char *);
+void		nxs_index_release(nxs_index_t *);
+void		nxs_index_cache_config(nxs_t *, size_t, unsigned);
+unsigned	nxs_index_cache_gc(nxs_t *);
+unsigned	nxs_index_cache_sync(nxs_t *);
+int		nxs_index_sync(nxs_index_t *);
 int		nxs_index_add(nxs_index_t *, nxs_params_t *, nxs_doc_id_t,
 		    const char *, size_t);
 int		nxs_index_remove(nxs_index_t *, nxs_doc_id_t);
+int		nxs_index_set_synonyms(nxs_index_t *, const char *, size_t);
+int		nxs_index_optimize(nxs_index_t *);
+
+/*
+ * Replication API.
+ */
+
+void		nxs_index_repl_pos(nxs_index_t *, uint64_t *, uint64_t *);
+void *		nxs_index_repl_export(nxs_index_t *, uint64_t, uint64_t,
+		    size_t, size_t *);
+int		nxs_index_repl_apply(nxs_index_t *, const void *, size_t);
+
+/*
+ * Snapshot API.
+ */
+
+int		nxs_index_snapshot(nxs_index_t *, const char *);
+nxs_index_t *	nxs_index_clone(nxs_t *, const char *, const char *);
+int		nxs_snapshot_destroy(nxs_t *, const char *);
 
 /*
  * Query and response API.
@@ -96,10 +146,41 @@ nxs_resp_t *	nxs_index_search(nxs_index_t *, nxs_params_t *,
 void		nxs_resp_iter_reset(nxs_resp_t *);
 bool		nxs_resp_iter_result(nxs_resp_t *, nxs_doc_id_t *, float *);
 unsigned	nxs_resp_resultcount(const nxs_resp_t *);
+uint64_t	nxs_resp_generation(const nxs_resp_t *);
 
 char *		nxs_resp_tojson(nxs_resp_t *, size_t *);
 void		nxs_resp_release(nxs_resp_t *);
 
+/*
+ * Prepared query API.
+ */
+
+struct nxs_query;
+typedef struct nxs_query nxs_query_t;
+
+nxs_query_t *	nxs_query_prepare(nxs_index_t *, nxs_params_t *,
+		    const char *, size_t);
+nxs_resp_t *	nxs_query_exec(nxs_query_t *);
+void		nxs_query_release(nxs_query_t *);
+
+/*
+ * Distributed search API (two-phase: statistics, then scoring).
+ */
+
+struct nxs_stats;
+typedef struct nxs_stats nxs_stats_t;
+
+nxs_stats_t *	nxs_index_getstats(nxs_index_t *, nxs_params_t *,
+		    const char *, size_t);
+nxs_resp_t *	nxs_index_search_global(nxs_index_t *, nxs_params_t *,
+		    const nxs_stats_t *, const char *, size_t);
+
+nxs_stats_t *	nxs_stats_create(void);
+nxs_stats_t *	nxs_stats_fromjson(nxs_t *, const char *, size_t);
+int		nxs_stats_merge(nxs_stats_t *, const nxs_stats_t *);
+char *		nxs_stats_tojson(const nxs_stats_t *, size_t *);
+void		nxs_stats_release(nxs_stats_t *);
+
 __END_DECLS
 
 #endif
@@ -30,6 +30,14 @@ struct nxs {
 	rhashmap_t *		indexes;
 	TAILQ_HEAD(, nxs_index)	index_list;
 
+	/* Shared term dictionaries (name => idxdict_t). */
+	rhashmap_t *		dicts;
+
+	/* Idle index handles (in the LRU order) and the cache limits. */
+	TAILQ_HEAD(, nxs_index)	idle_list;
+	size_t			cache_max_mem;
+	unsigned		cache_idle_timeout;
+
 	/* Filter list. */
 	TAILQ_HEAD(, filter_entry) filter_list;
 	unsigned		filters_count;
@@ -45,34 +53,75 @@ int	nxs_filter_register(nxs_t *, const char *, const filter_ops_t *, void *);
 void	nxs_clear_error(nxs_t *);
 void	nxs_error_checkpoint(nxs_t *);
 
+void	nxs_index_cache_drop(nxs_t *, const char *);
+
 /*
  * Ranking algorithms.
  */
 
-typedef float (*ranking_func_t)(const nxs_index_t *,
+typedef float (*ranking_func_t)(const nxs_index_t *, const nxs_stats_t *,
     const idxterm_t *, const idxdoc_t *);
 
-float	tf_idf(const nxs_index_t *, const idxterm_t *, const idxdoc_t *);
-float	bm25(const nxs_index_t *, const idxterm_t *, const idxdoc_t *);
+float	tf_idf(const nxs_index_t *, const nxs_stats_t *,
+	    const idxterm_t *, const idxdoc_t *);
+float	bm25(const nxs_index_t *, const nxs_stats_t *,
+	    const idxterm_t *, const idxdoc_t *);
 
 ranking_algo_t	get_ranking_func_id(const char *);
+const char *	get_ranking_func_name(ranking_algo_t);
 ranking_func_t	get_ranking_func(ranking_algo_t);
 
 /*
  * Internal params and response API.
  */
 
+/*
+ * Compiled search parameters: the typed values, set either directly
+ * or compiled from the key-value pairs.  The flags indicate which of
+ * the values are set (the rest should take the defaults).
+ */
+typedef struct {
+	unsigned		set;
+	uint64_t		limit;
+	ranking_algo_t		algo;
+	bool			fuzzymatch;
+	unsigned		timeout;
+	bool			stable;
+	nxs_doc_id_t		id_min;
+	nxs_doc_id_t		id_max;
+} nxs_sparams_t;
+
+#define	NXS_SPARAM_LIMIT	(0x01)
+#define	NXS_SPARAM_ALGO		(0x02)
+#define	NXS_SPARAM_FUZZYMATCH	(0x04)
+#define	NXS_SPARAM_TIMEOUT	(0x08)
+#define	NXS_SPARAM_STABLE	(0x10)
+#define	NXS_SPARAM_IDRANGE	(0x20)
+
 int		nxs_params_serialize(nxs_t *, const nxs_params_t *, const char *);
 nxs_params_t *	nxs_params_unserialize(nxs_t *, const char *);
+const nxs_sparams_t *nxs_params_get_search(nxs_t *, nxs_params_t *);
 const char **	nxs_params_get_strlist(nxs_params_t *, const char *, size_t *);
 const char *	nxs_params_get_str(nxs_params_t *, const char *);
 int		nxs_params_get_uint(nxs_params_t *, const char *, uint64_t *);
 int		nxs_params_get_bool(nxs_params_t *, const char *, bool *);
 
-nxs_resp_t *	nxs_resp_create(size_t);
+nxs_resp_t *	nxs_resp_create(size_t, arena_t *);
 int		nxs_resp_addresult(nxs_resp_t *, const idxdoc_t *, float);
 void		nxs_resp_adderror(nxs_resp_t *, nxs_err_t, const char *);
-void		nxs_resp_build(nxs_resp_t *);
+int		nxs_resp_build(nxs_resp_t *);
+void		nxs_resp_set_generation(nxs_resp_t *, uint64_t);
+
+/*
+ * Internal statistics API (global counters for the distributed search).
+ */
+
+void		nxs_stats_add_counts(nxs_stats_t *, uint64_t, uint64_t);
+int		nxs_stats_add_term(nxs_stats_t *, const char *, size_t, uint64_t);
+uint64_t	nxs_stats_get_doc_count(const nxs_stats_t *);
+uint64_t	nxs_stats_get_token_count(const nxs_stats_t *);
+int		nxs_stats_get_doc_freq(const nxs_stats_t *,
+		    const idxterm_t *, uint64_t *);
 
 /*
  * Error messaging.
@@ -6,6 +6,8 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-qual"
@@ -16,7 +18,20 @@
 #include "nxs_impl.h"
 #include "utils.h"
 
+/*
+ * The parameters are the key-value pairs, stored as a JSON document,
+ * which is also the interchange format.  The search parameters are
+ * also kept in the typed form:
+ *
+ * - The values set using the typed setters (they take precedence).
+ * - The compiled values: merged with the key-value pairs and validated
+ *   once, then cached until any of the parameters change.
+ */
 struct nxs_params {
+	nxs_sparams_t		sp;
+	nxs_sparams_t		compiled;
+	bool			compiled_valid;
+
 	yyjson_mut_doc *	doc;
 	yyjson_mut_val *	root;
 };
@@ -43,6 +58,7 @@ nxs_params_set_strlist(nxs_params_t *params, const char *key,
 	yyjson_mut_val *arr;
 
 	arr = yyjson_mut_arr_with_strcpy(params->doc, vals, count);
+	params->compiled_valid = false;
 	if (!yyjson_mut_obj_add(params->root, ckey, arr)) {
 		return -1;
 	}
@@ -55,6 +71,7 @@ nxs_params_set_str(nxs_params_t *params, const char *key, const char *val)
 	yyjson_mut_val *ckey = yyjson_mut_strcpy(params->doc, key);
 	yyjson_mut_val *cval = yyjson_mut_strcpy(params->doc, val);
 
+	params->compiled_valid = false;
 	if (!yyjson_mut_obj_add(params->root, ckey, cval)) {
 		return -1;
 	}
@@ -67,6 +84,7 @@ nxs_params_set_uint(nxs_params_t *params, const char *key, uint64_t val)
 	yyjson_mut_val *ckey = yyjson_mut_strcpy(params->doc, key);
 	yyjson_mut_val *cval = yyjson_mut_uint(params->doc, val);
 
+	params->compiled_valid = false;
 	if (!yyjson_mut_obj_add(params->root, ckey, cval)) {
 		return -1;
 	}
@@ -79,12 +97,69 @@ nxs_params_set_bool(nxs_params_t *params, const char *key, bool val)
 	yyjson_mut_val *ckey = yyjson_mut_strcpy(params->doc, key);
 	yyjson_mut_val *cval = yyjson_mut_bool(params->doc, val);
 
+	params->compiled_valid = false;
 	if (!yyjson_mut_obj_add(params->root, ckey, cval)) {
 		return -1;
 	}
 	return 0;
 }
 
+/*
+ * Typed setters for the search parameters.
+ *
+ * => The values are validated when the parameters are used.
+ */
+
+__dso_public void
+nxs_params_set_limit(nxs_params_t *params, uint64_t limit)
+{
+	params->sp.limit = limit;
+	params->sp.set |= NXS_SPARAM_LIMIT;
+	params->compiled_valid = false;
+}
+
+__dso_public void
+nxs_params_set_algo(nxs_params_t *params, const char *algo)
+{
+	params->sp.algo = get_ranking_func_id(algo);
+	params->sp.set |= NXS_SPARAM_ALGO;
+	params->compiled_valid = false;
+}
+
+__dso_public void
+nxs_params_set_fuzzymatch(nxs_params_t *params, bool fuzzymatch)
+{
+	params->sp.fuzzymatch = fuzzymatch;
+	params->sp.set |= NXS_SPARAM_FUZZYMATCH;
+	params->compiled_valid = false;
+}
+
+__dso_public void
+nxs_params_set_timeout(nxs_params_t *params, unsigned timeout)
+{
+	params->sp.timeout = timeout;
+	params->sp.set |= NXS_SPARAM_TIMEOUT;
+	params->compiled_valid = false;
+}
+
+__dso_public void
+nxs_params_set_stable(nxs_params_t *params, bool stable)
+{
+	params->sp.stable = stable;
+	params->sp.set |= NXS_SPARAM_STABLE;
+	params->compiled_valid = false;
+}
+
+__dso_public void
+nxs_params_set_id_range(nxs_params_t *params,
+    nxs_doc_id_t id_min, nxs_doc_id_t id_max)
+{
+	params->sp.id_min = id_min;
+	params->sp.id_max = id_max;
+	params->sp.set |= NXS_SPARAM_IDRANGE;
+	params->compiled_valid = false;
+}
+
 __dso_public void
 nxs_params_release(nxs_params_t *params)
 {
@@ -154,6 +229,138 @@ nxs_params_get_bool(nxs_params_t *params, const char *key, bool *val)
 	return 0;
 }
 
+/*
+ * nxs_params_get_search: get the compiled search parameters.
+ *
+ * => Returns NULL (with the error declared) if any value is invalid.
+ */
+const nxs_sparams_t *
+nxs_params_get_search(nxs_t *nxs, nxs_params_t *params)
+{
+	const nxs_sparams_t *tsp = &params->sp;
+	nxs_sparams_t *sp = &params->compiled;
+	const char *algo;
+	uint64_t val;
+
+	if (params->compiled_valid) {
+		return sp;
+	}
+	memset(sp, 0, sizeof(nxs_sparams_t));
+
+	/*
+	 * Compile the key-value pairs.
+	 */
+	if (nxs_params_get_uint(params, "limit", &sp->limit) == 0) {
+		sp->set |= NXS_SPARAM_LIMIT;
+	}
+	if ((algo = nxs_params_get_str(params, "algo")) != NULL) {
+		sp->algo = get_ranking_func_id(algo);
+		sp->set |= NXS_SPARAM_ALGO;
+	}
+	if (nxs_params_get_bool(params, "fuzzymatch", &sp->fuzzymatch) == 0) {
+		sp->set |= NXS_SPARAM_FUZZYMATCH;
+	}
+	if (nxs_params_get_uint(params, "timeout", &val) == 0) {
+		sp->timeout = MIN(val, UINT_MAX);
+		sp->set |= NXS_SPARAM_TIMEOUT;
+	}
+	if (nxs_params_get_bool(params, "stable", &sp->stable) == 0) {
+		sp->set |= NXS_SPARAM_STABLE;
+	}
+	sp->id_max = UINT64_MAX;
+	if (nxs_params_get_uint(params, "id_min", &sp->id_min) == 0) {
+		sp->set |= NXS_SPARAM_IDRANGE;
+	}
+	if (nxs_params_get_uint(params, "id_max", &sp->id_max) == 0) {
+		sp->set |= NXS_SPARAM_IDRANGE;
+	}
+
+	/*
+	 * Override with the typed values.
+	 */
+	if (tsp->set & NXS_SPARAM_LIMIT) {
+		sp->limit = tsp->limit;
+	}
+	if (tsp->set & NXS_SPARAM_ALGO) {
+		sp->algo = tsp->algo;
+	}
+	if (tsp->set & NXS_SPARAM_FUZZYMATCH) {
+		sp->fuzzymatch = tsp->fuzzymatch;
+	}
+	if (tsp->set & NXS_SPARAM_TIMEOUT) {
+		sp->timeout = tsp->timeout;
+	}
+	if (tsp->set & NXS_SPARAM_STABLE) {
+		sp->stable = tsp->stable;
+	}
+	if (tsp->set & NXS_SPARAM_IDRANGE) {
+		sp->id_min = tsp->id_min;
+		sp->id_max = tsp->id_max;
+	}
+	sp->set |= tsp->set;
+
+	/*
+	 * Validate.
+	 */
+	if ((sp->set & NXS_SPARAM_LIMIT) &&
+	    (sp->limit == 0 || sp->limit > UINT_MAX)) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID, "invalid limit", NULL);
+		return NULL;
+	}
+	if ((sp->set & NXS_SPARAM_ALGO) && sp->algo == INVALID_ALGO) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID, "invalid algorithm", NULL);
+		return NULL;
+	}
+	if ((sp->set & NXS_SPARAM_IDRANGE) && sp->id_min > sp->id_max) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "invalid document ID range", NULL);
+		return NULL;
+	}
+	params->compiled_valid = true;
+	return sp;
+}
+
+/*
+ * params_sync_typed: put the values set using the typed setters into
+ * the JSON document, so they are included in the interchange form.
+ */
+static void
+params_sync_typed(const nxs_params_t *params)
+{
+	const nxs_sparams_t *sp = &params->sp;
+	yyjson_mut_doc *doc = params->doc;
+	yyjson_mut_val *root = params->root;
+	const char *algo;
+
+	if (sp->set & NXS_SPARAM_LIMIT) {
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "limit"),
+		    yyjson_mut_uint(doc, sp->limit));
+	}
+	if ((sp->set & NXS_SPARAM_ALGO) &&
+	    (algo = get_ranking_func_name(sp->algo)) != NULL) {
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "algo"),
+		    yyjson_mut_str(doc, algo));
+	}
+	if (sp->set & NXS_SPARAM_FUZZYMATCH) {
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "fuzzymatch"),
+		    yyjson_mut_bool(doc, sp->fuzzymatch));
+	}
+	if (sp->set & NXS_SPARAM_TIMEOUT) {
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "timeout"),
+		    yyjson_mut_uint(doc, sp->timeout));
+	}
+	if (sp->set & NXS_SPARAM_STABLE) {
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "stable"),
+		    yyjson_mut_bool(doc, sp->stable));
+	}
+	if (sp->set & NXS_SPARAM_IDRANGE) {
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "id_min"),
+		    yyjson_mut_uint(doc, sp->id_min));
+		yyjson_mut_obj_put(root, yyjson_mut_str(doc, "id_max"),
+		    yyjson_mut_uint(doc, sp->id_max));
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////
 
 int
@@ -161,6 +368,7 @@ nxs_params_serialize(nxs_t *nxs, const nxs_params_t *params, const char *path)
 {
 	yyjson_write_err err;
 
+	params_sync_typed(params);
 	if (!yyjson_mut_write_file(path, params->doc,
 	    YYJSON_WRITE_PRETTY, NULL, &err)) {
 		nxs_decl_errx(nxs, NXS_ERR_SYSTEM,
@@ -214,5 +422,6 @@ nxs_params_fromjson(nxs_t *nxs, const char *json, size_t len)
 __dso_public char *
 nxs_params_tojson(const nxs_params_t *params, size_t *len)
 {
+	params_sync_typed(params);
 	return yyjson_mut_write(params->doc, YYJSON_WRITE_PRETTY, len);
 }
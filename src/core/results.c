@@ -15,7 +15,8 @@
 #define __NXSLIB_PRIVATE
 #include "nxs_impl.h"
 #include "rhashmap.h"
-#include "heap.h"
+#include "topk.h"
+#include "arena.h"
 #include "utils.h"
 
 typedef struct {
@@ -26,14 +27,21 @@ typedef struct {
 
 struct nxs_resp {
 	rhashmap_t *		doc_map;
-	heap_t *		heap;
+	size_t			limit;
 	size_t			count;
 
 	result_entry_t *	results;
 
+	/* Scratch arena for the entries (released on build). */
+	arena_t *		scratch;
+	bool			own_scratch;
+
 	char *			errmsg;
 	int			errno;
 
+	/* Generation of the index read view. */
+	uint64_t		generation;
+
 	yyjson_mut_doc *	doc;
 	yyjson_mut_val *	root;
 
@@ -41,10 +49,15 @@ struct nxs_resp {
 	yyjson_mut_arr_iter	results_iter;
 };
 
-static int	result_entry_cmp(const void *, const void *);
-
+/*
+ * nxs_resp_create: create the response object.
+ *
+ * => The result entries are allocated from the given scratch arena,
+ *    which must not be reset until the response is built; if NULL,
+ *    then the response creates its own arena.
+ */
 nxs_resp_t *
-nxs_resp_create(size_t limit)
+nxs_resp_create(size_t limit, arena_t *scratch)
 {
 	nxs_resp_t *resp;
 	yyjson_mut_val *results_key;
@@ -52,20 +65,24 @@ nxs_resp_create(size_t limit)
 	if ((resp = calloc(1, sizeof(nxs_resp_t))) == NULL) {
 		return NULL;
 	}
+	if (scratch == NULL) {
+		if ((scratch = arena_create(0)) == NULL) {
+			free(resp);
+			return NULL;
+		}
+		resp->own_scratch = true;
+	}
+	resp->scratch = scratch;
 
 	/*
-	 * Create the document map and the heap.
+	 * Create the document map.
 	 */
 	resp->doc_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
 	if (resp->doc_map == NULL) {
 		nxs_resp_release(resp);
 		return NULL;
 	}
-	resp->heap = heap_create(limit, result_entry_cmp);
-	if (resp->heap == NULL) {
-		nxs_resp_release(resp);
-		return NULL;
-	}
+	resp->limit = limit;
 
 	/*
 	 * Create a new JSON document.
@@ -90,22 +107,15 @@ nxs_resp_create(size_t limit)
 __dso_public void
 nxs_resp_release(nxs_resp_t *resp)
 {
-	result_entry_t *entry = resp->results;
-
 	if (resp->doc) {
 		yyjson_mut_doc_free(resp->doc);
 	}
-	while (entry) {
-		result_entry_t *next = entry->next;
-		free(entry);
-		entry = next;
+	if (resp->own_scratch && resp->scratch) {
+		arena_destroy(resp->scratch);
 	}
 	if (resp->doc_map) {
 		rhashmap_destroy(resp->doc_map);
 	}
-	if (resp->heap) {
-		heap_destroy(resp->heap);
-	}
 	free(resp->errmsg);
 	free(resp);
 }
@@ -136,7 +146,8 @@ nxs_resp_addresult(nxs_resp_t *resp, const idxdoc_t *doc, float score)
 		return 0;
 	}
 
-	if ((entry = calloc(1, sizeof(result_entry_t))) == NULL) {
+	entry = arena_alloc(resp->scratch, sizeof(result_entry_t));
+	if (entry == NULL) {
 		return -1;
 	}
 	rhashmap_put(resp->doc_map, &doc->id, sizeof(nxs_doc_id_t), entry);
@@ -150,65 +161,56 @@ nxs_resp_addresult(nxs_resp_t *resp, const idxdoc_t *doc, float score)
 }
 
 static inline void
-add_json_result_entry(nxs_resp_t *resp, result_entry_t *entry)
+add_json_result_entry(nxs_resp_t *resp, const topk_entry_t *entry)
 {
 	yyjson_mut_val *resobj = yyjson_mut_obj(resp->doc);
 
-	yyjson_mut_obj_add_uint(resp->doc, resobj, "doc_id", entry->doc_id);
+	yyjson_mut_obj_add_uint(resp->doc, resobj, "doc_id", entry->id);
 	yyjson_mut_obj_add_real(resp->doc, resobj, "score", entry->score);
 	yyjson_mut_arr_append(resp->results_arr, resobj);
 }
 
-/*
- * result_entry_cmp: comparator for the result entries.
- */
-static int
-result_entry_cmp(const void *p1, const void *p2)
-{
-	const result_entry_t *e1 = p1;
-	const result_entry_t *e2 = p2;
-
-	if (e1->score < e2->score)
-		return -1;
-	if (e1->score > e2->score)
-		return 1;
-	return 0;
-}
-
 /*
  * nxs_resp_build: finish up the response object (build any structures,
  * initialize the iterators, etc).
+ *
+ * => The results are ordered by the score, then by the document ID.
+ * => Returns 0 on success and -1 on failure (no memory).
  */
-void
+int
 nxs_resp_build(nxs_resp_t *resp)
 {
-	result_entry_t **top_results, *entry;
+	topk_entry_t *entries = NULL;
+	result_entry_t *entry;
+	size_t n = 0;
 
 	/*
-	 * Sort the entries with a cap and build the JSON entries.
+	 * Select the top entries and build the JSON entries.
 	 */
-	entry = resp->results;
-	while (entry) {
-		result_entry_t *next = entry->next;
-		heap_add(resp->heap, entry);
-		entry = next;
+	if (resp->count) {
+		entries = arena_alloc(resp->scratch,
+		    resp->count * sizeof(topk_entry_t));
+		if (entries == NULL) {
+			return -1;
+		}
 	}
-	top_results = heap_sort(resp->heap, &resp->count);
+	for (entry = resp->results; entry; entry = entry->next) {
+		topk_entry_set(&entries[n++], entry->doc_id, entry->score);
+	}
+	ASSERT(n == resp->count);
+
+	resp->count = topk_select(entries, n, resp->limit);
 	for (size_t i = 0; i < resp->count; i++) {
-		add_json_result_entry(resp, top_results[i]);
+		add_json_result_entry(resp, &entries[i]);
 	}
-	heap_destroy(resp->heap);
-	resp->heap = NULL;
 
 	/*
 	 * Destroy the entries.
 	 */
-	entry = resp->results;
-	while (entry) {
-		result_entry_t *next = entry->next;
-		free(entry);
-		entry = next;
+	if (resp->own_scratch) {
+		arena_destroy(resp->scratch);
 	}
+	resp->scratch = NULL;
 
 	rhashmap_destroy(resp->doc_map);
 	resp->doc_map = NULL;
@@ -217,6 +219,7 @@ nxs_resp_build(nxs_resp_t *resp)
 	/* Set the count and initialize the iterator. */
 	yyjson_mut_obj_add_uint(resp->doc, resp->root, "count", resp->count);
 	yyjson_mut_arr_iter_init(resp->results_arr, &resp->results_iter);
+	return 0;
 }
 
 __dso_public void
@@ -244,3 +247,22 @@ nxs_resp_resultcount(const nxs_resp_t *resp)
 {
 	return resp->count;
 }
+
+void
+nxs_resp_set_generation(nxs_resp_t *resp, uint64_t generation)
+{
+	resp->generation = generation;
+}
+
+/*
+ * nxs_resp_generation: get the generation of the index state at which
+ * the search was performed.
+ *
+ * => The responses of the same query at the same generation are equal,
+ *    therefore it may be used to key or validate the cached responses.
+ */
+__dso_public uint64_t
+nxs_resp_generation(const nxs_resp_t *resp)
+{
+	return resp->generation;
+}
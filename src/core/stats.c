@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2022 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Index statistics for the distributed search.
+ *
+ * When the document collection is split across multiple indexes (shards),
+ * the scores produced by each shard are not comparable, because ranking
+ * algorithms depend on the collection-wide counters: the total document
+ * count, the total token count and the document frequency of each term.
+ * Therefore, searching is performed in two phases:
+ *
+ * - The coordinator obtains the statistics for the query terms from each
+ * shard (see nxs_index_getstats()) and merges (sums) them.
+ *
+ * - The merged statistics are then passed to every shard together with
+ * the query (see nxs_index_search_global()), so the ranking algorithm
+ * uses the global counters instead of the local ones.  The per-shard
+ * results can then be merged by the score.
+ *
+ * The statistics are exchanged as JSON:
+ *
+ *	{
+ *		"doc_count": N,
+ *		"token_count": T,
+ *		"terms": { "term_1": doc_freq_1, ... }
+ *	}
+ */
+
+#include <sys/queue.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-qual"
+#include <yyjson.h>
+#pragma GCC diagnostic pop
+
+#define __NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "rhashmap.h"
+#include "index.h"
+#include "utils.h"
+
+typedef struct stats_term {
+	uint64_t		doc_freq;
+	TAILQ_ENTRY(stats_term)	entry;
+	size_t			value_len;
+	char			value[];
+} stats_term_t;
+
+struct nxs_stats {
+	uint64_t		doc_count;
+	uint64_t		token_count;
+
+	/* Term value => document frequency map and the list. */
+	rhashmap_t *		term_map;
+	TAILQ_HEAD(, stats_term) term_list;
+};
+
+__dso_public nxs_stats_t *
+nxs_stats_create(void)
+{
+	nxs_stats_t *stats;
+
+	if ((stats = calloc(1, sizeof(nxs_stats_t))) == NULL) {
+		return NULL;
+	}
+	TAILQ_INIT(&stats->term_list);
+
+	stats->term_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	if (stats->term_map == NULL) {
+		free(stats);
+		return NULL;
+	}
+	return stats;
+}
+
+__dso_public void
+nxs_stats_release(nxs_stats_t *stats)
+{
+	stats_term_t *st;
+
+	while ((st = TAILQ_FIRST(&stats->term_list)) != NULL) {
+		TAILQ_REMOVE(&stats->term_list, st, entry);
+		free(st);
+	}
+	rhashmap_destroy(stats->term_map);
+	free(stats);
+}
+
+void
+nxs_stats_add_counts(nxs_stats_t *stats, uint64_t doc_count,
+    uint64_t token_count)
+{
+	stats->doc_count += doc_count;
+	stats->token_count += token_count;
+}
+
+/*
+ * nxs_stats_add_term: add the document frequency for the given term
+ * or add to the existing one if the term is already present.
+ */
+int
+nxs_stats_add_term(nxs_stats_t *stats, const char *value, size_t len,
+    uint64_t doc_freq)
+{
+	stats_term_t *st;
+
+	if ((st = rhashmap_get(stats->term_map, value, len)) != NULL) {
+		st->doc_freq += doc_freq;
+		return 0;
+	}
+	if ((st = malloc(offsetof(stats_term_t, value[len + 1]))) == NULL) {
+		return -1;
+	}
+	memcpy(st->value, value, len);
+	st->value[len] = '\0';
+	st->value_len = len;
+	st->doc_freq = doc_freq;
+
+	if (rhashmap_put(stats->term_map, st->value, len, st) != st) {
+		free(st);
+		return -1;
+	}
+	TAILQ_INSERT_TAIL(&stats->term_list, st, entry);
+	return 0;
+}
+
+uint64_t
+nxs_stats_get_doc_count(const nxs_stats_t *stats)
+{
+	return stats->doc_count;
+}
+
+uint64_t
+nxs_stats_get_token_count(const nxs_stats_t *stats)
+{
+	return stats->token_count;
+}
+
+/*
+ * nxs_stats_get_doc_freq: get the global document frequency of the term.
+ *
+ * => Returns -1 if the statistics do not have the term.
+ */
+int
+nxs_stats_get_doc_freq(const nxs_stats_t *stats, const idxterm_t *term,
+    uint64_t *doc_freq)
+{
+	const stats_term_t *st;
+
+	st = rhashmap_get(stats->term_map, term->value, term->value_len);
+	if (st == NULL || st->doc_freq == 0) {
+		return -1;
+	}
+	*doc_freq = st->doc_freq;
+	return 0;
+}
+
+/*
+ * nxs_stats_merge: add the counters of the source statistics into
+ * the destination statistics.
+ */
+__dso_public int
+nxs_stats_merge(nxs_stats_t *dst, const nxs_stats_t *src)
+{
+	const stats_term_t *st;
+
+	nxs_stats_add_counts(dst, src->doc_count, src->token_count);
+
+	TAILQ_FOREACH(st, &src->term_list, entry) {
+		if (nxs_stats_add_term(dst, st->value,
+		    st->value_len, st->doc_freq) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+__dso_public nxs_stats_t *
+nxs_stats_fromjson(nxs_t *nxs, const char *json, size_t len)
+{
+	yyjson_val *root, *terms, *key, *val;
+	nxs_stats_t *stats = NULL;
+	yyjson_read_err err;
+	yyjson_doc *doc;
+	size_t idx, max;
+
+	doc = yyjson_read_opts((char *)(uintptr_t)json, len, 0, NULL, &err);
+	if (!doc) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "stats parsing failed: %s at %u", err.msg, err.pos);
+		return NULL;
+	}
+	root = yyjson_doc_get_root(doc);
+	if (!yyjson_is_obj(root)) {
+		goto err;
+	}
+	if ((stats = nxs_stats_create()) == NULL) {
+		nxs_decl_errx(nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		goto out;
+	}
+
+	val = yyjson_obj_get(root, "doc_count");
+	if (val && !yyjson_is_uint(val)) {
+		goto err;
+	}
+	stats->doc_count = yyjson_get_uint(val);
+
+	val = yyjson_obj_get(root, "token_count");
+	if (val && !yyjson_is_uint(val)) {
+		goto err;
+	}
+	stats->token_count = yyjson_get_uint(val);
+
+	if ((terms = yyjson_obj_get(root, "terms")) == NULL) {
+		goto out;
+	}
+	if (!yyjson_is_obj(terms)) {
+		goto err;
+	}
+	yyjson_obj_foreach(terms, idx, max, key, val) {
+		if (!yyjson_is_uint(val)) {
+			goto err;
+		}
+		if (nxs_stats_add_term(stats, yyjson_get_str(key),
+		    yyjson_get_len(key), yyjson_get_uint(val)) == -1) {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "nxs_stats_add_term failed", NULL);
+			nxs_stats_release(stats);
+			stats = NULL;
+			goto out;
+		}
+	}
+out:
+	yyjson_doc_free(doc);
+	return stats;
+err:
+	nxs_decl_errx(nxs, NXS_ERR_INVALID, "invalid stats", NULL);
+	if (stats) {
+		nxs_stats_release(stats);
+		stats = NULL;
+	}
+	goto out;
+}
+
+/*
+ * nxs_stats_tojson: return the statistics as a JSON string.
+ *
+ * => The string must be released with free(3) by the caller.
+ * => Returns NULL on failure.
+ */
+__dso_public char *
+nxs_stats_tojson(const nxs_stats_t *stats, size_t *len)
+{
+	yyjson_mut_val *root, *terms;
+	const stats_term_t *st;
+	yyjson_mut_doc *doc;
+	char *json;
+
+	if ((doc = yyjson_mut_doc_new(NULL)) == NULL) {
+		return NULL;
+	}
+	root = yyjson_mut_obj(doc);
+	yyjson_mut_doc_set_root(doc, root);
+
+	yyjson_mut_obj_add_uint(doc, root, "doc_count", stats->doc_count);
+	yyjson_mut_obj_add_uint(doc, root, "token_count", stats->token_count);
+
+	terms = yyjson_mut_obj(doc);
+	TAILQ_FOREACH(st, &stats->term_list, entry) {
+		yyjson_mut_val *key, *val;
+
+		key = yyjson_mut_strncpy(doc, st->value, st->value_len);
+		val = yyjson_mut_uint(doc, st->doc_freq);
+		yyjson_mut_obj_add(terms, key, val);
+	}
+	yyjson_mut_obj_add_val(doc, root, "terms", terms);
+
+	json = yyjson_mut_write(doc, 0, len);
+	yyjson_mut_doc_free(doc);
+	return json;
+}
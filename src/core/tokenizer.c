@@ -17,6 +17,8 @@
 #include <string.h>
 #include <unicode/ustring.h>
 #include <unicode/ubrk.h>
+#include <unicode/uchar.h>
+#include <unicode/utf8.h>
 #include <unicode/utypes.h>
 
 #define __NXSLIB_PRIVATE
@@ -44,17 +46,28 @@ token_create(const char *value, size_t len)
 		return NULL;
 	}
 	token->idxterm = NULL;
+	token->fuzzy = NULL;
 	token->count = 0;
+	token->weight = 0;
 	return token;
 }
 
 void
 token_destroy(token_t *token)
 {
+	if (token->fuzzy) {
+		idxfuzzy_release(token->fuzzy);
+	}
 	strbuf_release(&token->buffer);
 	free(token);
 }
 
+/*
+ * Token sets with up to this many tokens use a linear scan instead of
+ * the hash map (the small sets, e.g. queries, are the common case).
+ */
+#define	TOKENSET_LINEAR_MAX	(16)
+
 tokenset_t *
 tokenset_create(void)
 {
@@ -65,10 +78,65 @@ tokenset_create(void)
 	}
 	TAILQ_INIT(&tset->list);
 	TAILQ_INIT(&tset->staging);
-	tset->map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
 	return tset;
 }
 
+/*
+ * tokenset_create_arena: create a token set with the tokens allocated
+ * from the given arena.
+ *
+ * => The set must be destroyed before the arena is reset.
+ */
+tokenset_t *
+tokenset_create_arena(arena_t *arena)
+{
+	tokenset_t *tset;
+
+	if ((tset = arena_zalloc(arena, sizeof(tokenset_t))) == NULL) {
+		return NULL;
+	}
+	TAILQ_INIT(&tset->list);
+	TAILQ_INIT(&tset->staging);
+	tset->arena = arena;
+	return tset;
+}
+
+static token_t *
+tokenset_token_create(tokenset_t *tset, const char *value, size_t len)
+{
+	token_t *token;
+
+	if (tset->arena == NULL) {
+		return token_create(value, len);
+	}
+	if ((token = arena_alloc(tset->arena, sizeof(token_t))) == NULL) {
+		return NULL;
+	}
+	strbuf_init(&token->buffer);
+
+	if (strbuf_acquire(&token->buffer, value, len) == -1) {
+		return NULL;
+	}
+	token->idxterm = NULL;
+	token->fuzzy = NULL;
+	token->count = 0;
+	token->weight = 0;
+	return token;
+}
+
+static void
+tokenset_token_destroy(tokenset_t *tset, token_t *token)
+{
+	if (tset->arena == NULL) {
+		token_destroy(token);
+		return;
+	}
+	if (token->fuzzy) {
+		idxfuzzy_release(token->fuzzy);
+	}
+	strbuf_release(&token->buffer);
+}
+
 void
 tokenset_destroy(tokenset_t *tset)
 {
@@ -77,11 +145,62 @@ tokenset_destroy(tokenset_t *tset)
 	TAILQ_CONCAT(&tset->list, &tset->staging, entry);
 	while ((token = TAILQ_FIRST(&tset->list)) != NULL) {
 		TAILQ_REMOVE(&tset->list, token, entry);
-		token_destroy(token);
+		tokenset_token_destroy(tset, token);
 	}
 	ASSERT(TAILQ_EMPTY(&tset->staging));
-	rhashmap_destroy(tset->map);
-	free(tset);
+	if (tset->map) {
+		rhashmap_destroy(tset->map);
+	}
+	if (tset->arena == NULL) {
+		free(tset);
+	}
+}
+
+static token_t *
+tokenset_lookup(tokenset_t *tset, const char *value, size_t len)
+{
+	token_t *token;
+
+	if (tset->map) {
+		return rhashmap_get(tset->map, value, len);
+	}
+	TAILQ_FOREACH(token, &tset->list, entry) {
+		const strbuf_t *str = &token->buffer;
+
+		if (str->length == len && memcmp(str->value, value, len) == 0)
+			return token;
+	}
+	TAILQ_FOREACH(token, &tset->staging, entry) {
+		const strbuf_t *str = &token->buffer;
+
+		if (str->length == len && memcmp(str->value, value, len) == 0)
+			return token;
+	}
+	return NULL;
+}
+
+/*
+ * tokenset_create_map: switch the set from the linear scan to the map.
+ *
+ * => On failure, the set keeps using the linear scan.
+ */
+static void
+tokenset_create_map(tokenset_t *tset)
+{
+	token_t *token;
+
+	tset->map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	if (tset->map == NULL) {
+		return;
+	}
+	TAILQ_FOREACH(token, &tset->list, entry) {
+		const strbuf_t *str = &token->buffer;
+		rhashmap_put(tset->map, str->value, str->length, token);
+	}
+	TAILQ_FOREACH(token, &tset->staging, entry) {
+		const strbuf_t *str = &token->buffer;
+		rhashmap_put(tset->map, str->value, str->length, token);
+	}
 }
 
 /*
@@ -97,22 +216,28 @@ tokenset_add(tokenset_t *tset, token_t *token)
 	const strbuf_t *str = &token->buffer;
 	token_t *current_token;
 
-	current_token = rhashmap_get(tset->map, str->value, str->length);
+	current_token = tokenset_lookup(tset, str->value, str->length);
 	if (current_token) {
 		/* Already in the set: increment the counter. */
 		current_token->count++;
-		token_destroy(token);
+		tokenset_token_destroy(tset, token);
 		tset->seen++;
 		return current_token;
 	}
 
 	token->count = 1;
 	TAILQ_INSERT_TAIL(&tset->list, token, entry);
-	rhashmap_put(tset->map, str->value, str->length, token);
+	if (tset->map) {
+		rhashmap_put(tset->map, str->value, str->length, token);
+	}
 
 	tset->data_len += str->length;
 	tset->count++;
 	tset->seen++;
+
+	if (tset->map == NULL && tset->count > TOKENSET_LINEAR_MAX) {
+		tokenset_create_map(tset);
+	}
 	return token;
 }
 
@@ -121,14 +246,16 @@ tokenset_remove(tokenset_t *tset, token_t *token)
 {
 	const strbuf_t *str = &token->buffer;
 
-	rhashmap_del(tset->map, str->value, str->length);
+	if (tset->map) {
+		rhashmap_del(tset->map, str->value, str->length);
+	}
 	TAILQ_REMOVE(&tset->list, token, entry);
 
 	tset->data_len -= str->length;
 	tset->seen -= token->count;
 	tset->count--;
 
-	token_destroy(token);
+	tokenset_token_destroy(tset, token);
 }
 
 /*
@@ -148,7 +275,8 @@ tokenset_moveback(tokenset_t *tset, token_t *token)
  * If found, then associate it with the token.
  *
  * => If the TOKENSET_FUZZYMATCH flag is set and no term is found for
- *    the given token, then attempt to fuzzy search for a matching term.
+ *    the given token, then attempt to expand it to the closest terms
+ *    (the best one is also associated as the term).
  *
  * => If the TOKENSET_STAGE flag is set and no term is found, then move
  *    the given token to a separate staging list.
@@ -176,7 +304,11 @@ tokenset_resolve(tokenset_t *tset, nxs_index_t *idx, unsigned flags)
 
 		term = idxterm_lookup(idx, value, len);
 		if (!term && fuzzymatch) {
-			term = idxterm_fuzzysearch(idx, value, len);
+			ASSERT(token->fuzzy == NULL);
+			token->fuzzy = idxfuzzy_get(idx, value, len);
+			if (token->fuzzy) {
+				term = token->fuzzy->terms[0].term;
+			}
 		}
 		if (!term) {
 			if (stage) {
@@ -198,6 +330,39 @@ tokenset_resolve(tokenset_t *tset, nxs_index_t *idx, unsigned flags)
 	}
 }
 
+/*
+ * tokenset_add_value: add the value, which is already processed by the
+ * filter pipeline (e.g. a query expansion), to the set.
+ */
+token_t *
+tokenset_add_value(tokenset_t *tset, const char *value, size_t len)
+{
+	token_t *token;
+
+	if ((token = tokenset_token_create(tset, value, len)) == NULL) {
+		return NULL;
+	}
+	return tokenset_add(tset, token);
+}
+
+/*
+ * tokenset_unresolve: drop the association of the tokens with the terms
+ * and release the fuzzy expansions, if any.
+ */
+void
+tokenset_unresolve(tokenset_t *tset)
+{
+	token_t *token;
+
+	TAILQ_FOREACH(token, &tset->list, entry) {
+		if (token->fuzzy) {
+			idxfuzzy_release(token->fuzzy);
+			token->fuzzy = NULL;
+		}
+		token->idxterm = NULL;
+	}
+}
+
 /*
  * tokenize_value: create a token for the given value, run the filters
  * and add it to the token list (unless it's already there).
@@ -209,14 +374,14 @@ tokenize_value(filter_pipeline_t *fp, tokenset_t *tokens,
 	filter_action_t action;
 	token_t *token;
 
-	token = token_create(val, len);
+	token = tokenset_token_create(tokens, val, len);
 	if (__predict_false(token == NULL)) {
 		return -1;
 	}
 	action = filter_pipeline_run(fp, &token->buffer);
 	if (__predict_false(action != FILT_MUTATION)) {
 		ASSERT(action == FILT_DISCARD || action == FILT_ERROR);
-		token_destroy(token);
+		tokenset_token_destroy(tokens, token);
 		if (action == FILT_ERROR) {
 			return -1;
 		}
@@ -232,7 +397,7 @@ tokenize_value(filter_pipeline_t *fp, tokenset_t *tokens,
  * See: https://unicode.org/reports/tr29/
  */
 tokenset_t *
-tokenize(filter_pipeline_t *fp, nxs_params_t *params,
+tokenize(filter_pipeline_t *fp, const char *lang,
     const char *text, size_t text_len)
 {
 	UBreakIterator *it_token = NULL;
@@ -262,8 +427,7 @@ tokenize(filter_pipeline_t *fp, nxs_params_t *params,
 	 * https://unicode-org.github.io/icu/userguide/boundaryanalysis/break-rules.html
 	 * https://github.com/unicode-org/icu/blob/main/icu4c/source/data/brkitr/rules/word.txt
 	 */
-	it_token = ubrk_open(UBRK_WORD, nxs_params_get_str(params, "lang"),
-	    utext, -1, &ec);
+	it_token = ubrk_open(UBRK_WORD, lang, utext, -1, &ec);
 	if (__predict_false(U_FAILURE(ec))) {
 		const char *errmsg __unused = u_errorName(ec);
 		app_dbgx("ubrk_open() failed: %s", errmsg);
@@ -300,3 +464,124 @@ err:
 	free(utext);
 	return tokens;
 }
+
+/*
+ * N-gram tokenization.
+ *
+ * The text is split into the runs of characters separated by the white
+ * space (there is no word segmentation, so it works for the CJK text and
+ * for the identifiers with punctuation); each run is processed by the
+ * filter pipeline and then split into the overlapping character n-grams.
+ * The runs shorter than n characters are produced as a whole.
+ */
+
+static inline size_t
+utf8_next(const char *s, size_t len, size_t i)
+{
+	i++;
+	while (i < len && (s[i] & 0xc0) == 0x80) {
+		i++;
+	}
+	return i;
+}
+
+static int
+ngram_run(filter_pipeline_t *fp, tokenset_t *tokens, unsigned n,
+    const char *run, size_t len, ngram_func_t func, void *arg)
+{
+	filter_action_t action;
+	size_t start = 0, end = 0;
+	unsigned nchars = 0;
+	int ret = -1;
+	strbuf_t buf;
+
+	strbuf_init(&buf);
+	if (strbuf_acquire(&buf, run, len) == -1) {
+		return -1;
+	}
+	action = filter_pipeline_run(fp, &buf);
+	if (action != FILT_MUTATION || buf.length == 0) {
+		strbuf_release(&buf);
+		return action == FILT_ERROR ? -1 : 0;
+	}
+
+	/* The first n-gram. */
+	while (end < buf.length && nchars < n) {
+		end = utf8_next(buf.value, buf.length, end);
+		nchars++;
+	}
+	for (;;) {
+		token_t *token;
+
+		token = tokenset_add_value(tokens,
+		    &buf.value[start], end - start);
+		if (token == NULL || (func && func(arg, token) == -1)) {
+			goto out;
+		}
+		if (end == buf.length) {
+			break;
+		}
+		start = utf8_next(buf.value, buf.length, start);
+		end = utf8_next(buf.value, buf.length, end);
+	}
+	ret = 0;
+out:
+	strbuf_release(&buf);
+	return ret;
+}
+
+/*
+ * tokenize_ngrams_value: produce the n-grams of the value and add them
+ * to the token set.
+ *
+ * => If the function is given, then it is called for each n-gram in
+ *    the order of their occurrence (including the repetitions).
+ */
+int
+tokenize_ngrams_value(filter_pipeline_t *fp, tokenset_t *tokens,
+    unsigned n, const char *val, size_t len, ngram_func_t func, void *arg)
+{
+	int32_t i = 0, run = 0;
+
+	ASSERT(n > 0);
+
+	while (i < (int32_t)len) {
+		const int32_t prev = i;
+		UChar32 c;
+
+		U8_NEXT(val, i, (int32_t)len, c);
+		if (c < 0 || !u_isUWhiteSpace(c)) {
+			continue;
+		}
+		if (prev > run && ngram_run(fp, tokens, n,
+		    &val[run], prev - run, func, arg) == -1) {
+			return -1;
+		}
+		run = i;
+	}
+	if ((int32_t)len > run && ngram_run(fp, tokens, n,
+	    &val[run], len - run, func, arg) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * tokenize_ngrams: tokenize the text into the character n-grams.
+ */
+tokenset_t *
+tokenize_ngrams(filter_pipeline_t *fp, unsigned n,
+    const char *text, size_t text_len)
+{
+	tokenset_t *tokens;
+
+	if ((tokens = tokenset_create()) == NULL) {
+		return NULL;
+	}
+	if (tokenize_ngrams_value(fp, tokens, n,
+	    text, text_len, NULL, NULL) == -1) {
+		tokenset_destroy(tokens);
+		return NULL;
+	}
+	return tokens;
+}
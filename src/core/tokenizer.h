@@ -14,6 +14,7 @@
 
 #include "nxs.h"
 #include "strbuf.h"
+#include "arena.h"
 #include "rhashmap.h"
 #include "filters.h"
 
@@ -23,23 +24,31 @@
 
 typedef struct token {
 	/*
-	 * Token: list entry, counter of how many times the token
-	 * was seen and the string buffer storing the value of
-	 * after the filter pipeline processing.
+	 * Token: list entry, the resolved term (or its fuzzy expansion),
+	 * counter of how many times the token was seen, the scoring weight
+	 * (the query boost) and the string buffer storing the value of after
+	 * the filter pipeline processing.
 	 */
 	TAILQ_ENTRY(token)	entry;
 	struct idxterm *	idxterm;
+	struct idxfuzzy *	fuzzy;
 	unsigned		count;
+	float			weight;
 	strbuf_t		buffer;
 } token_t;
 
 typedef struct {
 	/*
 	 * Token list and a map for counting the unique tokens.
+	 * The map is created only when the set grows beyond the
+	 * TOKENSET_LINEAR_MAX tokens; small sets are scanned.
 	 */
 	TAILQ_HEAD(, token)	list;
 	rhashmap_t *		map;
 
+	/* Arena to allocate the tokens from (optional). */
+	arena_t *		arena;
+
 	/* Staging list for tokens which are not in the index. */
 	TAILQ_HEAD(, token)	staging;
 
@@ -58,14 +67,27 @@ token_t *	token_create(const char *, size_t);
 void		token_destroy(token_t *);
 
 tokenset_t *	tokenset_create(void);
+tokenset_t *	tokenset_create_arena(arena_t *);
 token_t *	tokenset_add(tokenset_t *, token_t *);
+token_t *	tokenset_add_value(tokenset_t *, const char *, size_t);
 void		tokenset_moveback(tokenset_t *, token_t *);
 void		tokenset_resolve(tokenset_t *, nxs_index_t *, unsigned);
+void		tokenset_unresolve(tokenset_t *);
 void		tokenset_destroy(tokenset_t *);
 
 int		tokenize_value(filter_pipeline_t *, tokenset_t *,
 		    const char *, size_t, token_t **);
-tokenset_t *	tokenize(filter_pipeline_t *, nxs_params_t *,
+tokenset_t *	tokenize(filter_pipeline_t *, const char *,
+		    const char *, size_t);
+
+#define	NGRAM_MIN		(2)
+#define	NGRAM_MAX		(3)
+
+typedef int (*ngram_func_t)(void *, token_t *);
+
+int		tokenize_ngrams_value(filter_pipeline_t *, tokenset_t *,
+		    unsigned, const char *, size_t, ngram_func_t, void *);
+tokenset_t *	tokenize_ngrams(filter_pipeline_t *, unsigned,
 		    const char *, size_t);
 
 #endif
@@ -103,6 +103,7 @@ idx_dtmap_open(nxs_index_t *idx, const char *path)
 	 *
 	 * => Returns the descriptor with the lock held.
 	 */
+	idx->dt_memmap.flags = idx->map_flags;
 	if ((fd = idx_db_open(&idx->dt_memmap, path, &created)) == -1) {
 		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
 		    "could not open dtmap index", NULL);
@@ -132,6 +133,9 @@ idx_dtmap_open(nxs_index_t *idx, const char *path)
 	if (idx->dt_map == NULL) {
 		goto err;
 	}
+	if (idxpost_sysinit(idx) == -1 || idxfuzzy_sysinit(idx) == -1) {
+		goto err;
+	}
 	TAILQ_INIT(&idx->dt_list);
 	idx->dt_consumed = 0;
 	f_lock_exit(fd);
@@ -158,6 +162,8 @@ idx_dtmap_close(nxs_index_t *idx)
 	if (idx->dt_map) {
 		rhashmap_destroy(idx->dt_map);
 	}
+	idxfuzzy_sysfini(idx);
+	idxpost_sysfini(idx);
 	idx_db_release(idxmap);
 }
 
@@ -226,7 +232,7 @@ dtmap_build_block(nxs_index_t *idx, nxs_doc_id_t doc_id, tokenset_t *tokens)
 		mmrw_store32(&mm, idxterm->id);
 		mmrw_store32(&mm, token->count);
 
-		if (idxterm_add_doc(idxterm, doc_id) == -1) {
+		if (idxterm_add_doc(idx, idxterm, doc_id) == -1) {
 			/* Revert the increments. */
 			dtmap_decr_totals(idx, tokens, token);
 			nxs_decl_err(idx->nxs, NXS_ERR_FATAL,
@@ -313,7 +319,7 @@ again:
 	 * Add the document to the in-memory map.
 	 */
 	offset = sizeof(idxdt_hdr_t) + data_len;
-	if ((doc = idxdoc_create(idx, doc_id, offset)) == NULL) {
+	if ((doc = idxdoc_create(idx, doc_id, offset, tokens->seen)) == NULL) {
 		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
 		    "idxdoc_create failed", NULL);
 		goto err;
@@ -411,7 +417,7 @@ dtmap_build_tdmap(nxs_index_t *idx, const nxs_doc_id_t doc_id,
 			}
 			goto err;
 		}
-		if (idxterm_add_doc(term, doc_id) == -1) {
+		if (idxterm_add_doc(idx, term, doc_id) == -1) {
 			nxs_decl_err(idx->nxs, NXS_ERR_FATAL,
 			    "idxterm_add_doc failed", NULL);
 			goto err;
@@ -432,7 +438,7 @@ err:
 		}
 		term = idxterm_lookup_by_id(idx, term_id);
 		ASSERT(term != NULL);
-		idxterm_del_doc(term, doc_id);
+		idxterm_del_doc(idx, term, doc_id);
 	}
 	return -1;
 }
@@ -519,7 +525,8 @@ idx_dtmap_sync(nxs_index_t *idx, unsigned flags)
 		 * Create the document and build the reverse
 		 * term-document index.
 		 */
-		if ((doc = idxdoc_create(idx, doc_id, offset)) == NULL) {
+		doc = idxdoc_create(idx, doc_id, offset, doc_total_len);
+		if (doc == NULL) {
 			nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
 			    "idxdoc_create failed", NULL);
 			goto out;
@@ -543,16 +550,71 @@ out:
 	return ret;
 }
 
+/*
+ * dtmap_remove_doc: clear the document ID of its record block, remove the
+ * document from the term bitmaps, decrement the term counters and destroy
+ * the in-memory document entry.
+ *
+ * => Must be called with the dtmap lock held.
+ * => Returns the document length (in tokens) or -1 on failure.
+ */
+static int64_t
+dtmap_remove_doc(nxs_index_t *idx, idxdoc_t *doc)
+{
+	idxmap_t *idxmap = &idx->dt_memmap;
+	uint64_t *doc_id_ptr;
+	uint32_t seen;
+	unsigned n;
+	mmrw_t mm;
+
+	/*
+	 * Find the document in the index.
+	 */
+	doc_id_ptr = MAP_GET_OFF(idxmap->baseptr, doc->offset);
+	mmrw_init(&mm, doc_id_ptr,
+	    (sizeof(idxdt_hdr_t) + idx->dt_consumed) - doc->offset);
+
+	/*
+	 * Set the document ID to zero.  This indicates to the fresh
+	 * consumers that this document entry is no longer valid.
+	 */
+	atomic_store_release(doc_id_ptr, 0);
+
+	/*
+	 * Iterate the document terms and decrement the term counters.
+	 */
+	if (mmrw_advance(&mm, 8) == -1 ||
+	    mmrw_fetch32(&mm, &seen) == -1 ||
+	    mmrw_fetch32(&mm, &n) == -1) {
+		return -1;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		nxs_term_id_t term_id;
+		idxterm_t *term;
+		uint32_t count;
+
+		if (mmrw_fetch32(&mm, &term_id) == -1 ||
+		    mmrw_fetch32(&mm, &count) == -1) {
+			return -1;
+		}
+		if ((term = idxterm_lookup_by_id(idx, term_id)) == NULL) {
+			return -1;
+		}
+		idxterm_del_doc(idx, term, doc->id);
+		idxterm_decr_total(idx, term, count);
+	}
+	idxdoc_destroy(idx, doc);
+	return seen;
+}
+
 int
 idx_dtmap_remove(nxs_index_t *idx, nxs_doc_id_t doc_id)
 {
 	idxmap_t *idxmap = &idx->dt_memmap;
 	size_t append_len, data_len, target_len;
-	uint64_t *doc_id_ptr;
 	idxdt_hdr_t *hdr;
 	idxdoc_t *doc;
-	uint32_t seen;
-	unsigned n;
+	int64_t seen;
 	int ret = -1;
 	mmrw_t mm;
 
@@ -590,54 +652,21 @@ idx_dtmap_remove(nxs_index_t *idx, nxs_doc_id_t doc_id)
 	}
 
 	/*
-	 * Find the document in the index.
-	 */
-	doc_id_ptr = MAP_GET_OFF(idxmap->baseptr, doc->offset);
-	mmrw_init(&mm, doc_id_ptr,
-	    (sizeof(idxdt_hdr_t) + idx->dt_consumed) - doc->offset);
-
-	/*
-	 * Set the document ID to zero.  This indicates to the fresh
-	 * consumers that this document entry is no longer valid.
-	 */
-	atomic_store_release(doc_id_ptr, 0);
-
-	/*
-	 * Iterate the document terms and decrement the term counters.
+	 * Clear the document record and remove the in-memory entry.
 	 */
-	if (mmrw_advance(&mm, 8) == -1 ||
-	    mmrw_fetch32(&mm, &seen) == -1 ||
-	    mmrw_fetch32(&mm, &n) == -1) {
-		return -1;
-	}
-	for (unsigned i = 0; i < n; i++) {
-		nxs_term_id_t term_id;
-		idxterm_t *term;
-		uint32_t count;
-
-		if (mmrw_fetch32(&mm, &term_id) == -1 ||
-		    mmrw_fetch32(&mm, &count) == -1) {
-			goto out;
-		}
-		if ((term = idxterm_lookup_by_id(idx, term_id)) == NULL) {
-			goto out;
-		}
-		idxterm_del_doc(term, doc->id);
-		idxterm_decr_total(idx, term, count);
+	if ((seen = dtmap_remove_doc(idx, doc)) == -1) {
+		goto out;
 	}
 
 	/*
 	 * Append the index with a special entry: document ID with document
 	 * length and term count being set to zero.  This indicates to the
 	 * active consumers that the document has been removed.
-	 *
-	 * Finally, remove the in-memory document entry.
 	 */
 	mmrw_init(&mm, IDXDT_DATA_PTR(hdr, data_len), append_len);
 	if (mmrw_store64(&mm, doc_id) == -1 || mmrw_store64(&mm, 0) == -1) {
 		goto out;
 	}
-	idxdoc_destroy(idx, doc);
 
 	/* Decrement the counters. */
 	atomic_store_relaxed(&hdr->doc_count,
@@ -654,15 +683,167 @@ out:
 	return ret;
 }
 
+/*
+ * dtmap_verify_blocks: verify the replicated document-term blocks.
+ */
+static int
+dtmap_verify_blocks(nxs_index_t *idx, const void *data, size_t len)
+{
+	mmrw_t mm;
+
+	mmrw_init(&mm, (void *)(uintptr_t)data, len);
+	while (mm.remaining) {
+		nxs_doc_id_t doc_id;
+		uint32_t n, doc_total_len;
+
+		if (mmrw_fetch64(&mm, &doc_id) == -1 ||
+		    mmrw_fetch32(&mm, &doc_total_len) == -1 ||
+		    mmrw_fetch32(&mm, &n) == -1) {
+			goto err;
+		}
+		if (doc_total_len == 0 && n != 0) {
+			goto err;
+		}
+		for (unsigned i = 0; i < n; i++) {
+			nxs_term_id_t term_id;
+			uint32_t count;
+
+			if (mmrw_fetch32(&mm, &term_id) == -1 ||
+			    mmrw_fetch32(&mm, &count) == -1) {
+				goto err;
+			}
+			if (doc_id && !idxterm_lookup_by_id(idx, term_id)) {
+				goto err;
+			}
+		}
+	}
+	return 0;
+err:
+	nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+	    "corrupted replication dtmap data", NULL);
+	return -1;
+}
+
+/*
+ * idx_dtmap_apply: append the replicated document-term blocks at the given
+ * position, apply the document deletions and update the counters.
+ *
+ * => Must be called with the dtmap lock held and the index synced.
+ * => The terms referenced by the blocks must already be present.
+ */
+int
+idx_dtmap_apply(nxs_index_t *idx, size_t pos, const void *data, size_t len)
+{
+	idxmap_t *idxmap = &idx->dt_memmap;
+	size_t data_len, target_len;
+	uint64_t token_count;
+	uint32_t doc_count;
+	idxdt_hdr_t *hdr;
+	void *dataptr;
+	mmrw_t mm;
+
+	ASSERT(f_lock_owned(idxmap->fd));
+
+	hdr = idxmap->baseptr;
+	data_len = be64toh(atomic_load_acquire(&hdr->data_len));
+	if (data_len != pos || idx->dt_consumed != data_len) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "dtmap replication position mismatch (%zu vs %zu)",
+		    pos, data_len);
+		return -1;
+	}
+	if (len == 0) {
+		return 0;
+	}
+	if (dtmap_verify_blocks(idx, data, len) == -1) {
+		return -1;
+	}
+
+	target_len = sizeof(idxdt_hdr_t) + data_len + len;
+	if ((hdr = idx_db_map(idxmap, target_len, true)) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
+		    "dtmap mapping failed", NULL);
+		return -1;
+	}
+	dataptr = IDXDT_DATA_PTR(hdr, data_len);
+	memcpy(dataptr, data, len);
+
+	/*
+	 * Apply the blocks: account the new documents and process the
+	 * deletion marks (the leader clears the removed document blocks
+	 * in-place, therefore this must be replayed here).
+	 */
+	token_count = IDXDT_TOKEN_COUNT(hdr);
+	doc_count = IDXDT_DOC_COUNT(hdr);
+
+	mmrw_init(&mm, dataptr, len);
+	while (mm.remaining) {
+		nxs_doc_id_t doc_id;
+		uint32_t n, doc_total_len;
+
+		mmrw_fetch64(&mm, &doc_id);
+		mmrw_fetch32(&mm, &doc_total_len);
+		mmrw_fetch32(&mm, &n);
+
+		if (doc_id && doc_total_len == 0) {
+			idxdoc_t *doc = idxdoc_lookup(idx, doc_id);
+			int64_t seen;
+
+			if (doc == NULL) {
+				/* Removed before it was replicated. */
+				continue;
+			}
+			if ((seen = dtmap_remove_doc(idx, doc)) == -1) {
+				nxs_decl_errx(idx->nxs, NXS_ERR_FATAL,
+				    "corrupted dtmap index", NULL);
+				return -1;
+			}
+			token_count -= seen;
+			doc_count--;
+			continue;
+		}
+		for (unsigned i = 0; i < n; i++) {
+			nxs_term_id_t term_id;
+			uint32_t count;
+
+			mmrw_fetch32(&mm, &term_id);
+			mmrw_fetch32(&mm, &count);
+			if (doc_id) {
+				const idxterm_t *term;
+
+				term = idxterm_lookup_by_id(idx, term_id);
+				idxterm_incr_total(idx, term, count);
+			}
+		}
+		if (doc_id) {
+			token_count += doc_total_len;
+			doc_count++;
+		}
+	}
+
+	/*
+	 * Update the counters and publish the new data length.
+	 */
+	atomic_store_relaxed(&hdr->token_count, htobe64(token_count));
+	atomic_store_relaxed(&hdr->doc_count, htobe32(doc_count));
+	atomic_store_release(&hdr->data_len, htobe64(data_len + len));
+
+	if (idxmap->sync) {
+		msync(hdr, target_len, MS_ASYNC);
+	}
+	return idx_dtmap_sync(idx, 0);
+}
+
 /*
  * idx_get_token_count: get the total token count in the index.
+ *
+ * => The counters reflect the consumed state (i.e. the last sync) and,
+ *    therefore, they are consistent with the in-memory structures.
  */
 uint64_t
 idx_get_token_count(const nxs_index_t *idx)
 {
-	const idxmap_t *idxmap = &idx->dt_memmap;
-	const idxdt_hdr_t *hdr = idxmap->baseptr;
-	return IDXDT_TOKEN_COUNT(hdr);
+	return idx->dt_tokens;
 }
 
 /*
@@ -671,7 +852,70 @@ idx_get_token_count(const nxs_index_t *idx)
 uint32_t
 idx_get_doc_count(const nxs_index_t *idx)
 {
-	const idxmap_t *idxmap = &idx->dt_memmap;
-	const idxdt_hdr_t *hdr = idxmap->baseptr;
-	return IDXDT_DOC_COUNT(hdr);
+	return idx->dt_count;
+}
+
+/*
+ * idx_get_generation: get the generation number of the index state.
+ *
+ * => The index data is append-only, therefore the sum of the consumed
+ *    lengths is monotonic and changes on any update (including removals).
+ */
+uint64_t
+idx_get_generation(const nxs_index_t *idx)
+{
+	return (uint64_t)idx->dict->terms_consumed + idx->dt_consumed;
+}
+
+/*
+ * idx_view_pin: pin the read view of the index at its current (synced)
+ * state; the search takes all its statistics from the view.
+ *
+ * => The generation may be used to key the results, e.g. by a cache.
+ */
+const idxview_t *
+idx_view_pin(nxs_index_t *idx)
+{
+	idxview_t *view = &idx->view;
+
+	view->generation = idx_get_generation(idx);
+	view->doc_count = idx->dt_count;
+	view->token_count = idx->dt_tokens;
+	return view;
+}
+
+/*
+ * idx_get_published_generation: get the generation of the index state
+ * published in the shared headers, i.e. including the changes of the
+ * other handles or processes not yet consumed by this handle.
+ */
+uint64_t
+idx_get_published_generation(const nxs_index_t *idx)
+{
+	const idxterms_hdr_t *terms_hdr = idx->dict->terms_memmap.baseptr;
+	const idxdt_hdr_t *dt_hdr = idx->dt_memmap.baseptr;
+
+	return (uint64_t)be32toh(atomic_load_acquire(&terms_hdr->data_len)) +
+	    be64toh(atomic_load_acquire(&dt_hdr->data_len));
+}
+
+/*
+ * idx_sync: sync the term index and then the dtmap index, unless there
+ * are no changes published since the last sync (a cheap check of the
+ * shared headers, without touching the data).
+ *
+ * => Returns 1 if the handle was updated, 0 if it was up to date
+ *    or -1 on failure.
+ */
+int
+idx_sync(nxs_index_t *idx)
+{
+	if (idx_get_published_generation(idx) == idx_get_generation(idx)) {
+		return 0;
+	}
+	if (idx_terms_sync(idx) == -1 ||
+	    idx_dtmap_sync(idx, DTMAP_PARTIAL_SYNC) == -1) {
+		return -1;
+	}
+	return 1;
 }
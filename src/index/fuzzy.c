@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2023 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Fuzzy expansion of the query tokens.
+ *
+ * A token which does not match any term is expanded to a bounded set
+ * of the closest terms within the edit distance tolerance.  The terms
+ * form a weighted disjunction: the document matches if it contains any
+ * of them and each term contributes its score discounted by the edit
+ * distance (see idxterm_fuzzysearch()).
+ *
+ * The expansion, including the union of the document bitmaps, is cached
+ * per index, therefore a repeated misspelling costs little more than a
+ * single term lookup.  The entries are reference counted (the tokens
+ * hold the references) and are recomputed when the index generation
+ * changes, i.e. when there are new terms or documents.
+ */
+
+#include <sys/queue.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#define	__NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "rhashmap.h"
+#include "index.h"
+#include "utils.h"
+
+int
+idxfuzzy_sysinit(nxs_index_t *idx)
+{
+	TAILQ_INIT(&idx->fuzzy_list);
+	idx->fuzzy_count = 0;
+	idx->fuzzy_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	return idx->fuzzy_map ? 0 : -1;
+}
+
+static void
+fuzzy_evict(nxs_index_t *idx, idxfuzzy_t *fz)
+{
+	rhashmap_del(idx->fuzzy_map, fz->value, fz->value_len);
+	TAILQ_REMOVE(&idx->fuzzy_list, fz, entry);
+	idx->fuzzy_count--;
+	idxfuzzy_release(fz);
+}
+
+void
+idxfuzzy_sysfini(nxs_index_t *idx)
+{
+	idxfuzzy_t *fz;
+
+	if (idx->fuzzy_map == NULL) {
+		return;
+	}
+	while ((fz = TAILQ_FIRST(&idx->fuzzy_list)) != NULL) {
+		fuzzy_evict(idx, fz);
+	}
+	rhashmap_destroy(idx->fuzzy_map);
+	idx->fuzzy_map = NULL;
+}
+
+/*
+ * fuzzy_create: perform the fuzzy search and compute the expansion.
+ *
+ * => The union of the documents is built only for multiple terms.
+ */
+static idxfuzzy_t *
+fuzzy_create(nxs_index_t *idx, const char *value, size_t len)
+{
+	idxfuzzy_t *fz;
+	int count;
+
+	if ((fz = calloc(1, offsetof(idxfuzzy_t, value[len + 1]))) == NULL) {
+		return NULL;
+	}
+	memcpy(fz->value, value, len);
+	fz->value[len] = '\0';
+	fz->value_len = len;
+	fz->generation = idx_get_generation(idx);
+	fz->refcnt = 1;
+
+	if ((count = idxterm_fuzzysearch(idx, value, len, fz->terms)) == -1) {
+		goto err;
+	}
+	fz->count = count;
+
+	if (count > 1) {
+		const roaring64_bitmap_t *bm;
+
+		if ((fz->doc_bitmap = roaring64_bitmap_create()) == NULL) {
+			goto err;
+		}
+		for (int i = 0; i < count; i++) {
+			if ((bm = idxterm_get_docs(idx, fz->terms[i].term))) {
+				roaring64_bitmap_or_inplace(fz->doc_bitmap, bm);
+			}
+		}
+	}
+	return fz;
+err:
+	free(fz);
+	return NULL;
+}
+
+/*
+ * idxfuzzy_get: get the fuzzy expansion of the given value.
+ *
+ * => Returns the referenced expansion, which must be released with
+ *    idxfuzzy_release(), or NULL if there are no candidate terms.
+ * => The negative results are cached too.
+ */
+idxfuzzy_t *
+idxfuzzy_get(nxs_index_t *idx, const char *value, size_t len)
+{
+	idxfuzzy_t *fz;
+
+	if (len > UINT16_MAX) {
+		return NULL;
+	}
+	fz = rhashmap_get(idx->fuzzy_map, value, len);
+	if (fz && fz->generation != idx_get_generation(idx)) {
+		fuzzy_evict(idx, fz);
+		fz = NULL;
+	}
+	if (fz) {
+		/* Cache hit: move to the tail (most recently used). */
+		TAILQ_REMOVE(&idx->fuzzy_list, fz, entry);
+		TAILQ_INSERT_TAIL(&idx->fuzzy_list, fz, entry);
+		goto out;
+	}
+
+	if ((fz = fuzzy_create(idx, value, len)) == NULL) {
+		return NULL;
+	}
+	if (idx->fuzzy_count >= FUZZY_CACHE_MAX) {
+		fuzzy_evict(idx, TAILQ_FIRST(&idx->fuzzy_list));
+	}
+	if (rhashmap_put(idx->fuzzy_map, fz->value, fz->value_len, fz) != fz) {
+		idxfuzzy_release(fz);
+		return NULL;
+	}
+	TAILQ_INSERT_TAIL(&idx->fuzzy_list, fz, entry);
+	idx->fuzzy_count++;
+out:
+	if (fz->count == 0) {
+		return NULL;
+	}
+	fz->refcnt++;
+	return fz;
+}
+
+void
+idxfuzzy_release(idxfuzzy_t *fz)
+{
+	ASSERT(fz->refcnt > 0);
+	if (--fz->refcnt > 0) {
+		return;
+	}
+	if (fz->doc_bitmap) {
+		roaring64_bitmap_free(fz->doc_bitmap);
+	}
+	free(fz);
+}
+
+/*
+ * idxfuzzy_get_docs: get the documents matching any of the terms.
+ */
+roaring64_bitmap_t *
+idxfuzzy_get_docs(const nxs_index_t *idx, const idxfuzzy_t *fz)
+{
+	ASSERT(fz->count > 0);
+	if (fz->doc_bitmap) {
+		return fz->doc_bitmap;
+	}
+	return idxterm_get_docs(idx, fz->terms[0].term);
+}
@@ -27,7 +27,8 @@
 #include "utils.h"
 
 idxdoc_t *
-idxdoc_create(nxs_index_t *idx, nxs_doc_id_t id, uint64_t offset)
+idxdoc_create(nxs_index_t *idx, nxs_doc_id_t id, uint64_t offset,
+    uint32_t len)
 {
 	idxdoc_t *doc;
 
@@ -37,6 +38,7 @@ idxdoc_create(nxs_index_t *idx, nxs_doc_id_t id, uint64_t offset)
 	}
 	doc->id = id;
 	doc->offset = offset;
+	doc->len = len;
 
 	if (rhashmap_put(idx->dt_map, &doc->id,
 	    sizeof(nxs_doc_id_t), doc) != doc) {
@@ -45,6 +47,7 @@ idxdoc_create(nxs_index_t *idx, nxs_doc_id_t id, uint64_t offset)
 		return NULL;
 	}
 	TAILQ_INSERT_TAIL(&idx->dt_list, doc, entry);
+	idx->dt_tokens += len;
 	idx->dt_count++;
 
 	app_dbgx("doc ID %"PRIu64" at %"PRIu64" => %p", id, offset, doc);
@@ -56,6 +59,7 @@ idxdoc_destroy(nxs_index_t *idx, idxdoc_t *doc)
 {
 	rhashmap_del(idx->dt_map, &doc->id, sizeof(nxs_doc_id_t));
 	TAILQ_REMOVE(&idx->dt_list, doc, entry);
+	idx->dt_tokens -= doc->len;
 	idx->dt_count--;
 	app_dbgx("doc ID %"PRIu64" (%p), total %lu",
 	    doc->id, doc, idx->dt_count);
@@ -76,21 +80,9 @@ idxdoc_lookup(nxs_index_t *idx, nxs_doc_id_t doc_id)
  * idxdoc_get_doclen: get the document length in tokens.
  */
 int
-idxdoc_get_doclen(const nxs_index_t *idx, const idxdoc_t *doc)
+idxdoc_get_doclen(const nxs_index_t *idx __unused, const idxdoc_t *doc)
 {
-	const idxmap_t *idxmap = &idx->dt_memmap;
-	const idxdt_hdr_t *hdr = idxmap->baseptr;
-	unsigned n;
-	mmrw_t mm;
-
-	mmrw_init(&mm, MAP_GET_OFF(hdr, doc->offset),
-	    (sizeof(idxdt_hdr_t) + idx->dt_consumed) - doc->offset);
-
-	if (mmrw_advance(&mm, 8) == -1 ||
-	    mmrw_fetch32(&mm, &n) == -1) {
-		return -1;
-	}
-	return (int)n;
+	return (int)doc->len;
 }
 
 /*
@@ -31,6 +31,10 @@
  * - Synchronization of the data readers and writers (e.g. data appending)
  * is implemented on top of this by the index structure module (currently,
  * we have "terms" and "tdmap").
+ *
+ * Mapping policies (see IDXMAP_* flags) are applied to the whole mapping
+ * on each (re)map.  They are intended for the read-mostly indexes: the
+ * growing file is remapped, so the pre-faulting and locking is repeated.
  */
 
 #include <sys/types.h>
@@ -111,6 +115,30 @@ err:
 	return -1;
 }
 
+/*
+ * idx_db_advise: apply the memory mapping policies to the new mapping.
+ *
+ * => The policies are hints: the failures (e.g. RLIMIT_MEMLOCK or the
+ *    lack of the huge page support for the file system) are ignored.
+ */
+static void
+idx_db_advise(const idxmap_t *idxmap, void *addr, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+	if ((idxmap->flags & IDXMAP_HUGEPAGE) != 0 &&
+	    madvise(addr, len, MADV_HUGEPAGE) == -1) {
+		app_dbg("madvise(MADV_HUGEPAGE) failed", NULL);
+	}
+#endif
+	if ((idxmap->flags & IDXMAP_PREFETCH) != 0 &&
+	    madvise(addr, len, MADV_WILLNEED) == -1) {
+		app_dbg("madvise(MADV_WILLNEED) failed", NULL);
+	}
+	if ((idxmap->flags & IDXMAP_LOCK) != 0 && mlock(addr, len) == -1) {
+		app_dbg("mlock() failed", NULL);
+	}
+}
+
 /*
  * idx_db_map: map or remap the index based on the new target length.
  *
@@ -121,6 +149,7 @@ idx_db_map(idxmap_t *idxmap, size_t target_len, bool extend)
 {
 	const size_t file_len = roundup2(target_len, IDX_SIZE_STEP);
 	void *addr, *current_baseptr = idxmap->baseptr;
+	int flags = MAP_SHARED | MAP_FILE;
 	struct stat st;
 
 	ASSERT(!extend || f_lock_owned(idxmap->fd));
@@ -158,12 +187,18 @@ idx_db_map(idxmap_t *idxmap, size_t target_len, bool extend)
 		}
 	}
 
+#ifdef MAP_POPULATE
+	if (idxmap->flags & IDXMAP_POPULATE) {
+		flags |= MAP_POPULATE;
+	}
+#endif
 	app_dbgx("fd %u length %zu", idxmap->fd, file_len);
 	addr = mmap(NULL, file_len, PROT_READ | PROT_WRITE,
-	    MAP_SHARED | MAP_FILE, idxmap->fd, 0);
+	    flags, idxmap->fd, 0);
 	if (addr == MAP_FAILED) {
 		return NULL;
 	}
+	idx_db_advise(idxmap, addr, file_len);
 
 	/* Remove the current mapping, if present. */
 	if (current_baseptr) {
@@ -15,6 +15,9 @@
  *
  * - Tracks the documents where the term occurs, i.e. provides the
  * following mapping: term_id => [doc IDs ...].
+ *
+ * The terms belong to the dictionary (idxdict_t) which may be shared by
+ * multiple indexes, while the term-document mapping is per index.
  */
 
 #include <sys/queue.h>
@@ -26,6 +29,7 @@
 #include <stdatomic.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <unistd.h>
 
 #define	__NXSLIB_PRIVATE
@@ -38,54 +42,54 @@
 static int	idxterm_levdist(void *, const void *, const void *);
 
 int
-idxterm_sysinit(nxs_index_t *idx)
+idxterm_sysinit(idxdict_t *dict)
 {
-	TAILQ_INIT(&idx->term_list);
+	TAILQ_INIT(&dict->term_list);
 
-	idx->term_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
-	if (idx->term_map == NULL) {
+	dict->term_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	if (dict->term_map == NULL) {
 		goto err;
 	}
 
-	idx->td_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
-	if (idx->td_map == NULL) {
+	dict->td_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	if (dict->td_map == NULL) {
 		goto err;
 	}
 
-	idx->term_levctx = levdist_create();
-	if (idx->term_levctx == NULL) {
+	dict->term_levctx = levdist_create();
+	if (dict->term_levctx == NULL) {
 		goto err;
 	}
 
-	idx->term_bkt = bktree_create(idxterm_levdist, idx);
-	if (idx->term_bkt == NULL) {
+	dict->term_bkt = bktree_create(idxterm_levdist, dict);
+	if (dict->term_bkt == NULL) {
 		goto err;
 	}
 	return 0;
 err:
-	idxterm_sysfini(idx);
+	idxterm_sysfini(dict);
 	return -1;
 }
 
 void
-idxterm_sysfini(nxs_index_t *idx)
+idxterm_sysfini(idxdict_t *dict)
 {
 	idxterm_t *term;
 
-	while ((term = TAILQ_FIRST(&idx->term_list)) != NULL) {
-		idxterm_destroy(idx, term);
+	while ((term = TAILQ_FIRST(&dict->term_list)) != NULL) {
+		idxterm_destroy(dict, term);
 	}
-	if (idx->term_map) {
-		rhashmap_destroy(idx->term_map);
+	if (dict->term_map) {
+		rhashmap_destroy(dict->term_map);
 	}
-	if (idx->td_map) {
-		rhashmap_destroy(idx->td_map);
+	if (dict->td_map) {
+		rhashmap_destroy(dict->td_map);
 	}
-	if (idx->term_bkt) {
-		bktree_destroy(idx->term_bkt);
+	if (dict->term_bkt) {
+		bktree_destroy(dict->term_bkt);
 	}
-	if (idx->term_levctx) {
-		levdist_destroy(idx->term_levctx);
+	if (dict->term_levctx) {
+		levdist_destroy(dict->term_levctx);
 	}
 }
 
@@ -94,9 +98,9 @@ idxterm_levdist(void *ctx, const void *a, const void *b)
 {
 	const idxterm_t *term_a = a;
 	const idxterm_t *term_b = b;
-	nxs_index_t *idx = ctx;
+	idxdict_t *dict = ctx;
 
-	return levdist(idx->term_levctx, term_a->value, term_a->value_len,
+	return levdist(dict->term_levctx, term_a->value, term_a->value_len,
 	    term_b->value, term_b->value_len);
 }
 
@@ -114,7 +118,6 @@ idxterm_create(const char *token, const size_t len, const size_t offset)
 		return NULL;
 	}
 	term->id = 0;
-	term->doc_bitmap = roaring64_bitmap_create();
 	term->offset = offset;
 
 	memcpy(term->value, token, len);
@@ -127,7 +130,7 @@ idxterm_create(const char *token, const size_t len, const size_t offset)
 }
 
 void
-idxterm_destroy(nxs_index_t *idx, idxterm_t *term)
+idxterm_destroy(idxdict_t *dict, idxterm_t *term)
 {
 	if (term->id) {
 		/*
@@ -138,12 +141,11 @@ idxterm_destroy(nxs_index_t *idx, idxterm_t *term)
 		 * Nevertheless, the API should not leave the stray pointers
 		 * in the tree.
 		 */
-		rhashmap_del(idx->td_map, &term->id, sizeof(nxs_term_id_t));
-		rhashmap_del(idx->term_map, term->value, term->value_len);
-		TAILQ_REMOVE(&idx->term_list, term, entry);
-		idx->term_count--;
+		rhashmap_del(dict->td_map, &term->id, sizeof(nxs_term_id_t));
+		rhashmap_del(dict->term_map, term->value, term->value_len);
+		TAILQ_REMOVE(&dict->term_list, term, entry);
+		dict->term_count--;
 	}
-	roaring64_bitmap_free(term->doc_bitmap);
 	free(term);
 }
 
@@ -157,31 +159,32 @@ idxterm_destroy(nxs_index_t *idx, idxterm_t *term)
 idxterm_t *
 idxterm_insert(nxs_index_t *idx, idxterm_t *term, nxs_term_id_t term_id)
 {
+	idxdict_t *dict = idx->dict;
 	const size_t len = term->value_len;
 	idxterm_t *result_term;
 
 	/*
 	 * Map the term/token value to the object.
 	 */
-	result_term = rhashmap_put(idx->term_map, term->value, len, term);
+	result_term = rhashmap_put(dict->term_map, term->value, len, term);
 	if (result_term != term) {
 		/* Error: the index contains a duplicate. */
 		app_dbgx("duplicate term [%s] in the map", term->value);
 		return result_term;
 	}
-	if (bktree_insert(idx->term_bkt, term) == -1) {
+	if (bktree_insert(dict->term_bkt, term) == -1) {
 		app_dbgx("bktree_insert on term [%s] failed", term->value);
-		rhashmap_del(idx->term_map, term->value, len);
+		rhashmap_del(dict->term_map, term->value, len);
 		return NULL;
 	}
-	TAILQ_INSERT_TAIL(&idx->term_list, term, entry);
-	idx->term_count++;
+	TAILQ_INSERT_TAIL(&dict->term_list, term, entry);
+	dict->term_count++;
 
 	/*
 	 * Assign the term ID and map the ID to the term object.
 	 */
 	term->id = term_id;
-	rhashmap_put(idx->td_map, &term->id, sizeof(nxs_term_id_t), term);
+	rhashmap_put(dict->td_map, &term->id, sizeof(nxs_term_id_t), term);
 	app_dbgx("term %p [%s] => %u", term, term->value, term->id);
 	return term;
 }
@@ -192,7 +195,7 @@ idxterm_insert(nxs_index_t *idx, idxterm_t *term, nxs_term_id_t term_id)
 idxterm_t *
 idxterm_lookup(nxs_index_t *idx, const char *value, size_t len)
 {
-	return rhashmap_get(idx->term_map, value, len);
+	return rhashmap_get(idx->dict->term_map, value, len);
 }
 
 /*
@@ -201,24 +204,33 @@ idxterm_lookup(nxs_index_t *idx, const char *value, size_t len)
 idxterm_t *
 idxterm_lookup_by_id(nxs_index_t *idx, nxs_term_id_t term_id)
 {
-	return rhashmap_get(idx->td_map, &term_id, sizeof(nxs_term_id_t));
+	return rhashmap_get(idx->dict->td_map, &term_id, sizeof(nxs_term_id_t));
 }
 
 /*
- * idxterm_fuzzysearch: perform a fuzzy match search.
+ * idxterm_fuzzysearch: perform a fuzzy match search and select up to
+ * FUZZY_MAX_TERMS closest terms within the edit distance tolerance.
+ *
+ * => The terms are ordered by the edit distance and then by popularity
+ *    (total occurrences); the weight is discounted by the distance.
+ * => Returns the number of selected terms or -1 on failure.
  */
-idxterm_t *
-idxterm_fuzzysearch(nxs_index_t *idx, const char *value, size_t len)
+int
+idxterm_fuzzysearch(nxs_index_t *idx, const char *value, size_t len,
+    idxfuzzy_term_t *terms)
 {
-	idxterm_t *search_token, *term = NULL, *iterm;
+	idxdict_t *dict = idx->dict;
+	unsigned dist[FUZZY_MAX_TERMS];
+	uint64_t total[FUZZY_MAX_TERMS];
+	idxterm_t *search_token, *iterm;
 	deque_t *results = NULL;
-	uint64_t term_total = 0;
 	unsigned total_len;
+	int count = -1;
 
 	/* XXX: inefficient (alloc + copy) */
 	total_len = offsetof(idxterm_t, value[(unsigned)len + 1]);
 	if ((search_token = malloc(total_len)) == NULL) {
-		return NULL;
+		return -1;
 	}
 	memcpy(search_token->value, value, len);
 	search_token->value[len] = '\0';
@@ -227,31 +239,62 @@ idxterm_fuzzysearch(nxs_index_t *idx, const char *value, size_t len)
 	if ((results = deque_create(0, 0)) == NULL) {
 		goto out;
 	}
-	if (bktree_search(idx->term_bkt, LEVDIST_TOLERANCE,
+	if (bktree_search(dict->term_bkt, LEVDIST_TOLERANCE,
 	    search_token, results) == -1) {
 		goto out;
 	}
 
 	/*
-	 * Select the most popular term.
+	 * Keep the best candidates (insertion into the short sorted
+	 * array).  Note: with a shared dictionary, the term might not
+	 * occur in this index at all.
 	 */
+	count = 0;
 	while ((iterm = deque_pop_back(results)) != NULL) {
-		if (idxterm_get_total(idx, iterm) > term_total) {
-			term = iterm;
+		unsigned d, i;
+		uint64_t tc;
+
+		if (dict->name && !idxterm_get_docs(idx, iterm)) {
+			continue;
+		}
+		d = levdist(dict->term_levctx, value, len,
+		    iterm->value, iterm->value_len);
+		tc = idxterm_get_total(idx, iterm);
+
+		for (i = count; i > 0; i--) {
+			if (dist[i - 1] < d ||
+			    (dist[i - 1] == d && total[i - 1] >= tc)) {
+				break;
+			}
+			if (i < FUZZY_MAX_TERMS) {
+				terms[i] = terms[i - 1];
+				dist[i] = dist[i - 1];
+				total[i] = total[i - 1];
+			}
+		}
+		if (i == FUZZY_MAX_TERMS) {
+			continue;
 		}
+		terms[i].term = iterm;
+		dist[i] = d;
+		total[i] = tc;
+		count += (count < FUZZY_MAX_TERMS);
+	}
+	for (int i = 0; i < count; i++) {
+		terms[i].weight = 1.0f / (1 + dist[i]);
 	}
 out:
 	if (results) {
 		deque_destroy(results);
 	}
 	free(search_token);
-	return term;
+	return count;
 }
 
 uint64_t
 idxterm_get_total(nxs_index_t *idx, const idxterm_t *term)
 {
-	const idxmap_t *idxmap = &idx->terms_memmap;
+	const idxmap_t *idxmap = &idx->dict->terms_memmap;
 	const idxterms_hdr_t *hdr = idxmap->baseptr;
 	uint64_t *tc = MAP_GET_OFF(hdr, term->offset);
 
@@ -267,7 +310,7 @@ idxterm_get_total(nxs_index_t *idx, const idxterm_t *term)
 void
 idxterm_incr_total(nxs_index_t *idx, const idxterm_t *term, unsigned count)
 {
-	const idxmap_t *idxmap = &idx->terms_memmap;
+	const idxmap_t *idxmap = &idx->dict->terms_memmap;
 	const idxterms_hdr_t *hdr = idxmap->baseptr;
 	uint64_t *tc = MAP_GET_OFF(hdr, term->offset);
 	uint64_t old_tc, new_tc;
@@ -285,7 +328,7 @@ idxterm_incr_total(nxs_index_t *idx, const idxterm_t *term, unsigned count)
 void
 idxterm_decr_total(nxs_index_t *idx, const idxterm_t *term, unsigned count)
 {
-	const idxmap_t *idxmap = &idx->terms_memmap;
+	const idxmap_t *idxmap = &idx->dict->terms_memmap;
 	const idxterms_hdr_t *hdr = idxmap->baseptr;
 	uint64_t *tc = MAP_GET_OFF(hdr, term->offset);
 	uint64_t old_tc, new_tc;
@@ -312,17 +355,149 @@ idxterm_decr_total(nxs_index_t *idx, const idxterm_t *term, unsigned count)
 	app_dbgx("term %u count -%u ", term->id, count);
 }
 
+/*
+ * idxpost_{sysinit,sysfini}: setup and destroy the term-document mapping.
+ */
+
+int
+idxpost_sysinit(nxs_index_t *idx)
+{
+	TAILQ_INIT(&idx->post_list);
+	TAILQ_INIT(&idx->post_dirty);
+	idx->post_dirty_count = 0;
+	idx->post_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	return idx->post_map ? 0 : -1;
+}
+
+void
+idxpost_sysfini(nxs_index_t *idx)
+{
+	idxpost_t *post;
+
+	while ((post = TAILQ_FIRST(&idx->post_list)) != NULL) {
+		TAILQ_REMOVE(&idx->post_list, post, entry);
+		roaring64_bitmap_free(post->doc_bitmap);
+		free(post);
+	}
+	if (idx->post_map) {
+		rhashmap_destroy(idx->post_map);
+		idx->post_map = NULL;
+	}
+}
+
+/*
+ * idxpost_optimize: optimize the term bitmaps, i.e. convert the containers
+ * to the run-length encoding where it is smaller and release the unused
+ * capacity (which accumulates over the add/remove churn).
+ *
+ * => Processes either all bitmaps or a batch of the modified ones.
+ * => Returns the number of bytes released.
+ */
+size_t
+idxpost_optimize(nxs_index_t *idx, bool all)
+{
+	unsigned count = all ? UINT_MAX : IDX_OPTIMIZE_BATCH;
+	size_t saved = 0;
+	idxpost_t *post;
+
+	if (all) {
+		TAILQ_FOREACH(post, &idx->post_list, entry) {
+			roaring64_bitmap_run_optimize(post->doc_bitmap);
+			saved += roaring64_bitmap_shrink_to_fit(
+			    post->doc_bitmap);
+		}
+	}
+	while (count-- && (post = TAILQ_FIRST(&idx->post_dirty)) != NULL) {
+		TAILQ_REMOVE(&idx->post_dirty, post, dirty_entry);
+		idx->post_dirty_count--;
+		post->dirty = false;
+
+		if (!all) {
+			roaring64_bitmap_run_optimize(post->doc_bitmap);
+			saved += roaring64_bitmap_shrink_to_fit(
+			    post->doc_bitmap);
+		}
+	}
+	return saved;
+}
+
+/*
+ * idxpost_set_dirty: mark the term bitmap as modified.
+ *
+ * => The optimization is not performed here, on the add/remove path:
+ *    the batches are run by the handle cache GC (see cache.c).
+ */
+static void
+idxpost_set_dirty(nxs_index_t *idx, idxpost_t *post)
+{
+	if (!post->dirty) {
+		TAILQ_INSERT_TAIL(&idx->post_dirty, post, dirty_entry);
+		idx->post_dirty_count++;
+		post->dirty = true;
+	}
+}
+
+/*
+ * idxterm_get_docs: get the bitmap of the documents in which the term
+ * occurs in the given index.
+ *
+ * => Returns NULL if the term never occurred in the index.
+ */
+roaring64_bitmap_t *
+idxterm_get_docs(const nxs_index_t *idx, const idxterm_t *term)
+{
+	const idxpost_t *post;
+
+	post = rhashmap_get(idx->post_map, &term->id, sizeof(nxs_term_id_t));
+	return post ? post->doc_bitmap : NULL;
+}
+
+/*
+ * idxterm_get_doc_freq: get the number of documents in the index
+ * in which the term occurs.
+ */
+uint64_t
+idxterm_get_doc_freq(const nxs_index_t *idx, const idxterm_t *term)
+{
+	const roaring64_bitmap_t *bm = idxterm_get_docs(idx, term);
+	return bm ? roaring64_bitmap_get_cardinality(bm) : 0;
+}
+
 int
-idxterm_add_doc(idxterm_t *term, nxs_doc_id_t doc_id)
+idxterm_add_doc(nxs_index_t *idx, const idxterm_t *term, nxs_doc_id_t doc_id)
 {
-	roaring64_bitmap_add(term->doc_bitmap, doc_id);
+	idxpost_t *post;
+
+	post = rhashmap_get(idx->post_map, &term->id, sizeof(nxs_term_id_t));
+	if (post == NULL) {
+		if ((post = malloc(sizeof(idxpost_t))) == NULL) {
+			return -1;
+		}
+		if ((post->doc_bitmap = roaring64_bitmap_create()) == NULL) {
+			free(post);
+			return -1;
+		}
+		post->term_id = term->id;
+		post->dirty = false;
+		rhashmap_put(idx->post_map, &post->term_id,
+		    sizeof(nxs_term_id_t), post);
+		TAILQ_INSERT_TAIL(&idx->post_list, post, entry);
+	}
+	roaring64_bitmap_add(post->doc_bitmap, doc_id);
+	idxpost_set_dirty(idx, post);
 	app_dbgx("term %u => doc %"PRIu64, term->id, doc_id);
 	return 0;
 }
 
 void
-idxterm_del_doc(idxterm_t *term, nxs_doc_id_t doc_id)
+idxterm_del_doc(nxs_index_t *idx, const idxterm_t *term, nxs_doc_id_t doc_id)
 {
-	roaring64_bitmap_remove(term->doc_bitmap, doc_id);
+	idxpost_t *post;
+
+	post = rhashmap_get(idx->post_map, &term->id, sizeof(nxs_term_id_t));
+	if (post) {
+		roaring64_bitmap_remove(post->doc_bitmap, doc_id);
+		idxpost_set_dirty(idx, post);
+	}
 	app_dbgx("unlinking doc %"PRIu64" from term %u", doc_id, term->id);
 }
@@ -9,6 +9,7 @@
 #define	_NXS_INDEX_H_
 
 #include <sys/queue.h>
+#include <sys/types.h>
 #include <inttypes.h>
 #include <stdbool.h>
 
@@ -25,6 +26,23 @@
 
 #define	LEVDIST_TOLERANCE	(2)
 
+/* Fuzzy match: terms per expansion and the cached expansions. */
+#define	FUZZY_MAX_TERMS		(4)
+#define	FUZZY_CACHE_MAX		(256)
+
+/* Cached unions of the synonym groups. */
+#define	SYN_CACHE_MAX		(128)
+
+/* Modified term bitmaps to accumulate before the optimization pass. */
+#define	IDX_OPTIMIZE_BATCH	(1024)
+
+/*
+ * Arenas kept for reuse: the query and the scoring scratch.  The arenas
+ * grown larger than the limit (e.g. by a broad query) are not kept.
+ */
+#define	IDX_QUERY_ARENAS	(2)
+#define	IDX_QUERY_ARENA_MAX	(1024 * 1024)
+
 typedef uint32_t nxs_term_id_t;
 
 typedef enum {
@@ -43,40 +61,124 @@ typedef struct idxterm {
 	nxs_term_id_t		id;
 	uint32_t		offset;
 	TAILQ_ENTRY(idxterm)	entry;
+	uint16_t		value_len;
+	char			value[];
+} idxterm_t;
 
-	/* Bitmap of the documents in which this term occurs. */
+/*
+ * idxpost_t is the per-index bitmap of the documents in which the term
+ * occurs.  It is separate from the term, since the term dictionary may
+ * be shared by multiple indexes.
+ */
+typedef struct idxpost {
+	nxs_term_id_t		term_id;
+	bool			dirty;
+	roaring64_bitmap_t *	doc_bitmap;
+	TAILQ_ENTRY(idxpost)	entry;
+	TAILQ_ENTRY(idxpost)	dirty_entry;
+} idxpost_t;
+
+/*
+ * idxfuzzy_t is the fuzzy expansion of a value which does not match
+ * any term: the closest terms, weighted by the edit distance, and the
+ * union of their documents.  It is cached per index and is valid only
+ * for the index generation it was computed at.
+ */
+typedef struct {
+	idxterm_t *		term;
+	float			weight;
+} idxfuzzy_term_t;
+
+typedef struct idxfuzzy {
+	unsigned		refcnt;
+	uint64_t		generation;
 	roaring64_bitmap_t *	doc_bitmap;
+	TAILQ_ENTRY(idxfuzzy)	entry;
+	unsigned		count;
+	idxfuzzy_term_t		terms[FUZZY_MAX_TERMS];
 	uint16_t		value_len;
 	char			value[];
-} idxterm_t;
+} idxfuzzy_t;
+
+/*
+ * idxsyn_cent_t is the cached union of the documents of the synonym
+ * group (or the bitmap of the query filter), valid for the index
+ * generation it was computed at.  The key is the group key or the hash
+ * of the filter; the latter also keeps the canonical form of the filter
+ * (the key data), which must match on lookup.
+ */
+typedef struct idxsyn_cent {
+	uint64_t		key;
+	uint64_t		generation;
+	roaring64_bitmap_t *	doc_bitmap;
+	TAILQ_ENTRY(idxsyn_cent) entry;
+	size_t			data_len;
+	unsigned char		data[];
+} idxsyn_cent_t;
 
 typedef struct idxdoc {
 	nxs_doc_id_t		id;
 	uint64_t		offset;
 	TAILQ_ENTRY(idxdoc)	entry;
+	uint32_t		len;	// document length in tokens
 } idxdoc_t;
 
+/*
+ * idxview_t is the read view of the index pinned by the search: the
+ * generation (of the consumed terms and dtmap data) and the counters
+ * consistent with it, i.e. with the in-memory structures.  The shared
+ * header counters may be ahead, as other processes keep appending.
+ */
+typedef struct {
+	uint64_t		generation;
+	uint64_t		doc_count;
+	uint64_t		token_count;
+} idxview_t;
+
+/*
+ * Memory mapping policies (the index parameters; see idx_db_map()).
+ */
+#define	IDXMAP_HUGEPAGE		(0x01)	// transparent huge page hint
+#define	IDXMAP_POPULATE		(0x02)	// pre-fault the pages
+#define	IDXMAP_LOCK		(0x04)	// lock the pages in memory
+#define	IDXMAP_PREFETCH		(0x08)	// asynchronous read-ahead
+
 typedef struct idxmap {
 	int			fd;
 	void *			baseptr;
 	size_t			mapped_len;
 	bool			sync;
+	unsigned		flags;
 } idxmap_t;
 
-struct nxs_index {
-	/*
-	 * Terms list.
-	 */
+/*
+ * idxdict_t is the term dictionary: the terms index and the in-memory
+ * term structures.  It is either private to the index or shared by the
+ * group of indexes (see the "dictionary" parameter).
+ */
+typedef struct idxdict {
 	idxmap_t		terms_memmap;
 	size_t			terms_consumed;
 	nxs_term_id_t		terms_last_id;
 
 	rhashmap_t *		term_map;
+	rhashmap_t *		td_map;
 	bktree_t *		term_bkt;
 	TAILQ_HEAD(, idxterm)	term_list;
 	size_t			term_count;
 	levdist_t *		term_levctx;
 
+	/* Shared dictionary name (NULL if private) and reference count. */
+	char *			name;
+	unsigned		refcnt;
+} idxdict_t;
+
+struct nxs_index {
+	/*
+	 * Terms list (dictionary).
+	 */
+	idxdict_t *		dict;
+
 	/*
 	 * Document-term index.
 	 */
@@ -85,19 +187,64 @@ struct nxs_index {
 	rhashmap_t *		dt_map;
 	TAILQ_HEAD(, idxdoc)	dt_list;
 	size_t			dt_count;
+	uint64_t		dt_tokens;
+
+	/* Read view of the current search. */
+	idxview_t		view;
 
 	/*
 	 * Term-document map (the reverse index).
 	 */
-	rhashmap_t *		td_map;
+	rhashmap_t *		post_map;
+	TAILQ_HEAD(, idxpost)	post_list;
+
+	/* Term bitmaps modified since their last optimization. */
+	TAILQ_HEAD(, idxpost)	post_dirty;
+	unsigned		post_dirty_count;
+
 	filter_pipeline_t *	fp;
 	ranking_algo_t		algo;
+	const char *		lang;
+
+	/* N-gram size in the n-gram tokenizer mode (zero for words). */
+	unsigned		ngram;
+
+	/* Memory mapping policies of the index files (IDXMAP_*). */
+	unsigned		map_flags;
+
+	/* Cache of the fuzzy expansions (in the LRU order). */
+	rhashmap_t *		fuzzy_map;
+	TAILQ_HEAD(, idxfuzzy)	fuzzy_list;
+	unsigned		fuzzy_count;
+
+	/*
+	 * Synonym dictionary (optional): the mapping, its version
+	 * (incremented on each load) and the cache of group unions.
+	 */
+	const void *		syn_baseptr;
+	size_t			syn_mapped_len;
+	unsigned		syn_version;
+	rhashmap_t *		syn_cache_map;
+	TAILQ_HEAD(, idxsyn_cent) syn_cache_list;
+	unsigned		syn_cache_count;
+
+	/* Arenas of the finished queries, kept for reuse. */
+	arena_t *		query_arenas[IDX_QUERY_ARENAS];
 
 	/* Instance back-pointer, params, index name, list entry. */
 	nxs_t *			nxs;
 	nxs_params_t *		params;
 	char *			name;
 	TAILQ_ENTRY(nxs_index)	entry;
+
+	/*
+	 * Handle cache: reference count, the idle list entry and whether
+	 * the index was destroyed while in use (the last release closes it).
+	 */
+	unsigned		refcnt;
+	time_t			idle_since;
+	TAILQ_ENTRY(nxs_index)	idle_entry;
+	bool			doomed;
 };
 
 /*
@@ -110,26 +257,65 @@ void		idx_db_release(idxmap_t *);
 /*
  * Term (in-memory) interface.
  */
-int		idxterm_sysinit(nxs_index_t *);
-void		idxterm_sysfini(nxs_index_t *);
+int		idxterm_sysinit(idxdict_t *);
+void		idxterm_sysfini(idxdict_t *);
 
 idxterm_t *	idxterm_create(const char *, const size_t, const size_t);
-void		idxterm_destroy(nxs_index_t *, idxterm_t *);
+void		idxterm_destroy(idxdict_t *, idxterm_t *);
 
 idxterm_t *	idxterm_insert(nxs_index_t *, idxterm_t *, nxs_term_id_t);
 idxterm_t *	idxterm_lookup(nxs_index_t *, const char *, size_t);
 idxterm_t *	idxterm_lookup_by_id(nxs_index_t *, nxs_term_id_t);
-idxterm_t *	idxterm_fuzzysearch(nxs_index_t *, const char *, size_t);
-int		idxterm_add_doc(idxterm_t *, nxs_doc_id_t);
-void		idxterm_del_doc(idxterm_t *, nxs_doc_id_t);
+int		idxterm_fuzzysearch(nxs_index_t *, const char *, size_t,
+		    idxfuzzy_term_t *);
 void		idxterm_incr_total(nxs_index_t *, const idxterm_t *, unsigned);
 void		idxterm_decr_total(nxs_index_t *, const idxterm_t *, unsigned);
 uint64_t	idxterm_get_total(nxs_index_t *, const idxterm_t *);
 
+/*
+ * Term-document (in-memory) interface.
+ */
+int		idxpost_sysinit(nxs_index_t *);
+void		idxpost_sysfini(nxs_index_t *);
+
+int		idxterm_add_doc(nxs_index_t *, const idxterm_t *, nxs_doc_id_t);
+void		idxterm_del_doc(nxs_index_t *, const idxterm_t *, nxs_doc_id_t);
+roaring64_bitmap_t *idxterm_get_docs(const nxs_index_t *, const idxterm_t *);
+uint64_t	idxterm_get_doc_freq(const nxs_index_t *, const idxterm_t *);
+size_t		idxpost_optimize(nxs_index_t *, bool);
+
+/*
+ * Fuzzy expansion interface.
+ */
+int		idxfuzzy_sysinit(nxs_index_t *);
+void		idxfuzzy_sysfini(nxs_index_t *);
+
+idxfuzzy_t *	idxfuzzy_get(nxs_index_t *, const char *, size_t);
+void		idxfuzzy_release(idxfuzzy_t *);
+roaring64_bitmap_t *idxfuzzy_get_docs(const nxs_index_t *,
+		    const idxfuzzy_t *);
+
+/*
+ * Synonym dictionary interface.
+ */
+int		idxsyn_open(nxs_index_t *, const char *);
+void		idxsyn_close(nxs_index_t *);
+uint32_t	idxsyn_lookup(const nxs_index_t *, const char *, size_t);
+unsigned	idxsyn_group_count(const nxs_index_t *, uint32_t);
+const char *	idxsyn_group_term(const nxs_index_t *, uint32_t, unsigned,
+		    size_t *);
+uint64_t	idxsyn_group_key(const nxs_index_t *, uint32_t);
+
+roaring64_bitmap_t *idxsyn_cache_get(nxs_index_t *, uint64_t,
+		    const void *, size_t);
+int		idxsyn_cache_put(nxs_index_t *, uint64_t,
+		    const void *, size_t, roaring64_bitmap_t *);
+void		idxsyn_cache_gc(nxs_index_t *);
+
 /*
  * Document (in-memory) interface.
  */
-idxdoc_t *	idxdoc_create(nxs_index_t *, nxs_doc_id_t, uint64_t);
+idxdoc_t *	idxdoc_create(nxs_index_t *, nxs_doc_id_t, uint64_t, uint32_t);
 void		idxdoc_destroy(nxs_index_t *, idxdoc_t *);
 idxdoc_t *	idxdoc_lookup(nxs_index_t *, nxs_doc_id_t);
 
@@ -141,8 +327,10 @@ int		idxdoc_get_termcount(const nxs_index_t *,
  * Terms index interface.
  */
 int		idx_terms_open(nxs_index_t *, const char *);
+int		idx_terms_open_shared(nxs_index_t *, const char *);
 int		idx_terms_add(nxs_index_t *, tokenset_t *);
 int		idx_terms_sync(nxs_index_t *);
+int		idx_terms_apply(nxs_index_t *, size_t, const void *, size_t);
 void		idx_terms_close(nxs_index_t *);
 
 /*
@@ -155,9 +343,15 @@ int		idx_dtmap_open(nxs_index_t *, const char *);
 int		idx_dtmap_add(nxs_index_t *, nxs_doc_id_t, tokenset_t *);
 int		idx_dtmap_remove(nxs_index_t *, nxs_doc_id_t);
 int		idx_dtmap_sync(nxs_index_t *, unsigned);
+int		idx_dtmap_apply(nxs_index_t *, size_t, const void *, size_t);
 void		idx_dtmap_close(nxs_index_t *);
 
 uint64_t	idx_get_token_count(const nxs_index_t *);
 uint32_t	idx_get_doc_count(const nxs_index_t *);
+size_t		idx_get_memusage(const nxs_index_t *);
+uint64_t	idx_get_generation(const nxs_index_t *);
+uint64_t	idx_get_published_generation(const nxs_index_t *);
+int		idx_sync(nxs_index_t *);
+const idxview_t *idx_view_pin(nxs_index_t *);
 
 #endif
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2022 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Index replication.
+ *
+ * The terms and dtmap indexes are append-only with the data length
+ * being atomically published, therefore the index is essentially a log.
+ * The data length of each index serves as a position (watermark):
+ *
+ * - The follower obtains its positions using nxs_index_repl_pos() and
+ * requests the changes past them from the leader.
+ *
+ * - The leader produces a change set using nxs_index_repl_export(),
+ * which contains the raw terms and dtmap blocks past the given positions.
+ *
+ * - The follower appends them using nxs_index_repl_apply() and runs
+ * the normal sync.  The in-place updates of the leader (the term total
+ * counts and the deletion of documents) are replayed by the follower.
+ *
+ * The change set carries only complete blocks.  The dtmap data length
+ * is fetched before the terms data length, therefore all terms referenced
+ * by the exported documents are always included.
+ *
+ * See the storage.h header for the change set layout.
+ */
+
+#include <sys/file.h>
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+
+#define	__NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "storage.h"
+#include "index.h"
+#include "mmrw.h"
+#include "utils.h"
+
+/*
+ * nxs_index_repl_pos: get the current replication positions of the index.
+ */
+__dso_public void
+nxs_index_repl_pos(nxs_index_t *idx, uint64_t *terms_pos, uint64_t *dtmap_pos)
+{
+	const idxterms_hdr_t *thdr = idx->dict->terms_memmap.baseptr;
+	const idxdt_hdr_t *dhdr = idx->dt_memmap.baseptr;
+
+	*dtmap_pos = be64toh(atomic_load_acquire(&dhdr->data_len));
+	*terms_pos = be32toh(atomic_load_acquire(&thdr->data_len));
+}
+
+/*
+ * repl_dtmap_extent: determine the length of the complete dtmap blocks
+ * from the given position, up to the given length limit.
+ *
+ * => Always includes at least one block, if there is any.
+ */
+static ssize_t
+repl_dtmap_extent(nxs_index_t *idx, size_t pos, size_t data_len,
+    size_t maxlen)
+{
+	const idxdt_hdr_t *hdr = idx->dt_memmap.baseptr;
+	size_t len = 0;
+
+	while (pos + len < data_len) {
+		const uint32_t *np = IDXDT_DATA_PTR(hdr, pos + len + 8 + 4);
+		size_t blk_len;
+
+		if (pos + len + 8 + 4 + 4 > data_len) {
+			return -1;
+		}
+		blk_len = IDXDT_META_LEN(be32toh(*np));
+		if (pos + len + blk_len > data_len) {
+			return -1;
+		}
+		if (maxlen && len && len + blk_len > maxlen) {
+			break;
+		}
+		len += blk_len;
+	}
+	return len;
+}
+
+/*
+ * repl_dtmap_copy: copy the dtmap blocks.
+ *
+ * => The document ID may be concurrently cleared, therefore it must
+ *    be read atomically.
+ */
+static void
+repl_dtmap_copy(nxs_index_t *idx, size_t pos, size_t len, void *buf)
+{
+	const idxdt_hdr_t *hdr = idx->dt_memmap.baseptr;
+	size_t off = 0;
+
+	while (off < len) {
+		uint64_t *doc_id_ptr = IDXDT_DATA_PTR(hdr, pos + off);
+		const uint32_t *np = MAP_GET_OFF(doc_id_ptr, 8 + 4);
+		const size_t blk_len = IDXDT_META_LEN(be32toh(*np));
+		uint64_t *bufp = MAP_GET_OFF(buf, off);
+
+		*bufp = atomic_load_acquire(doc_id_ptr);
+		memcpy(bufp + 1, doc_id_ptr + 1, blk_len - 8);
+		off += blk_len;
+	}
+}
+
+/*
+ * nxs_index_repl_export: produce the change set past the given positions.
+ *
+ * => The maxlen limits the length of the dtmap data (zero for no limit).
+ * => Returns the change set which must be released with free(3).
+ */
+__dso_public void *
+nxs_index_repl_export(nxs_index_t *idx, uint64_t terms_pos,
+    uint64_t dtmap_pos, size_t maxlen, size_t *lenp)
+{
+	size_t terms_len, dtmap_len, total_len;
+	uint64_t terms_data_len, dtmap_data_len;
+	const idxterms_hdr_t *thdr;
+	ssize_t extent_len;
+	idxrepl_hdr_t *rhdr;
+	void *buf;
+
+	nxs_clear_error(idx->nxs);
+
+	if (idx->dict->name) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID, "replication is not "
+		    "supported for indexes with a shared dictionary", NULL);
+		return NULL;
+	}
+
+	/*
+	 * Fetch the dtmap data length first and then the terms.
+	 */
+	nxs_index_repl_pos(idx, &terms_data_len, &dtmap_data_len);
+	if (terms_pos > terms_data_len || dtmap_pos > dtmap_data_len) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "replication position is past the index data", NULL);
+		return NULL;
+	}
+	if (idx_db_map(&idx->dict->terms_memmap,
+	    sizeof(idxterms_hdr_t) + terms_data_len, false) == NULL ||
+	    idx_db_map(&idx->dt_memmap,
+	    sizeof(idxdt_hdr_t) + dtmap_data_len, false) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
+		    "index mapping failed", NULL);
+		return NULL;
+	}
+
+	extent_len = repl_dtmap_extent(idx, dtmap_pos, dtmap_data_len, maxlen);
+	if (extent_len == -1) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "invalid dtmap replication position", NULL);
+		return NULL;
+	}
+	terms_len = terms_data_len - terms_pos;
+	dtmap_len = extent_len;
+
+	total_len = sizeof(idxrepl_hdr_t) + terms_len + dtmap_len;
+	if ((buf = malloc(total_len)) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		return NULL;
+	}
+
+	rhdr = buf;
+	memset(rhdr, 0, sizeof(idxrepl_hdr_t));
+	memcpy(rhdr->mark, NXS_R_MARK, sizeof(rhdr->mark));
+	rhdr->ver = NXS_ABI_VER;
+	rhdr->terms_pos = htobe32(terms_pos);
+	rhdr->terms_len = htobe32(terms_len);
+	rhdr->dtmap_pos = htobe64(dtmap_pos);
+	rhdr->dtmap_len = htobe64(dtmap_len);
+
+	thdr = idx->dict->terms_memmap.baseptr;
+	memcpy(MAP_GET_OFF(buf, sizeof(idxrepl_hdr_t)),
+	    MAP_GET_OFF(thdr, sizeof(idxterms_hdr_t) + terms_pos), terms_len);
+	repl_dtmap_copy(idx, dtmap_pos, dtmap_len,
+	    MAP_GET_OFF(buf, sizeof(idxrepl_hdr_t) + terms_len));
+
+	app_dbgx("exported %zu terms and %zu dtmap bytes",
+	    terms_len, dtmap_len);
+	*lenp = total_len;
+	return buf;
+}
+
+/*
+ * nxs_index_repl_apply: apply the change set produced by the leader.
+ *
+ * => The follower index must not be modified otherwise.
+ */
+__dso_public int
+nxs_index_repl_apply(nxs_index_t *idx, const void *buf, size_t len)
+{
+	idxmap_t *idxmap = &idx->dt_memmap;
+	const idxrepl_hdr_t *rhdr = buf;
+	size_t terms_pos, terms_len, dtmap_pos, dtmap_len;
+	const void *terms_data, *dtmap_data;
+	int ret = -1;
+
+	nxs_clear_error(idx->nxs);
+
+	if (idx->dict->name) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID, "replication is not "
+		    "supported for indexes with a shared dictionary", NULL);
+		return -1;
+	}
+	if (len < sizeof(idxrepl_hdr_t) ||
+	    memcmp(rhdr->mark, NXS_R_MARK, sizeof(rhdr->mark)) != 0) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "invalid replication data", NULL);
+		return -1;
+	}
+	if (rhdr->ver != NXS_ABI_VER) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "incompatible replication data version", NULL);
+		return -1;
+	}
+	terms_pos = be32toh(rhdr->terms_pos);
+	terms_len = be32toh(rhdr->terms_len);
+	dtmap_pos = be64toh(rhdr->dtmap_pos);
+	dtmap_len = be64toh(rhdr->dtmap_len);
+
+	if (len - sizeof(idxrepl_hdr_t) < terms_len ||
+	    len - sizeof(idxrepl_hdr_t) - terms_len != dtmap_len) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "truncated replication data", NULL);
+		return -1;
+	}
+	terms_data = MAP_GET_OFF(buf, sizeof(idxrepl_hdr_t));
+	dtmap_data = MAP_GET_OFF(terms_data, terms_len);
+
+	/*
+	 * Lock the dtmap and sync both indexes (the terms must be
+	 * synced with the dtmap lock held).
+	 */
+	if (f_lock_enter(idxmap->fd, LOCK_EX) == -1) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM, "locking failed", NULL);
+		return -1;
+	}
+	if (idx_terms_sync(idx) == -1 || idx_dtmap_sync(idx, 0) == -1) {
+		goto out;
+	}
+
+	/*
+	 * Append the terms first, since the documents reference them.
+	 */
+	if (idx_terms_apply(idx, terms_pos, terms_data, terms_len) == -1) {
+		goto out;
+	}
+	if (idx_dtmap_apply(idx, dtmap_pos, dtmap_data, dtmap_len) == -1) {
+		goto out;
+	}
+	app_dbgx("applied %zu terms and %zu dtmap bytes",
+	    terms_len, dtmap_len);
+	ret = 0;
+out:
+	f_lock_exit(idxmap->fd);
+	if (ret) {
+		nxs_error_checkpoint(idx->nxs);
+	}
+	return ret;
+}
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2022 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Index snapshots and cloning.
+ *
+ * The snapshot is taken without blocking the writers: the data lengths
+ * (watermarks) of the dtmap and terms indexes are fetched (in this order,
+ * therefore all referenced terms are included) and the files are copied
+ * only up to them.  The copy uses reflink where supported.
+ *
+ * However, the leader performs some in-place updates: the term totals,
+ * the dtmap counters and the clearing of removed document IDs.  Hence,
+ * the snapshot is fixed up after copying:
+ *
+ * - The data lengths are set to the watermarks.
+ *
+ * - The document IDs are re-fetched atomically from the source index
+ * (a concurrent removal may be copied partially otherwise).
+ *
+ * - The dtmap counters and the term totals are re-computed from the
+ * document blocks, therefore the snapshot is self-consistent.
+ *
+ * Snapshots are stored in the "snapshots" directory under the base
+ * directory.  A new index can be created from the snapshot (cloned)
+ * almost instantly using the reflink, where supported.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define	__NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "storage.h"
+#include "index.h"
+#include "mmrw.h"
+#include "utils.h"
+
+static const char *snapshot_files[] = { "params.db", "nxsterms", "nxsdtmap" };
+
+static char *
+get_snapshot_path(nxs_t *nxs, const char *snapname, const char *file)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/snapshots/%s%s%s", nxs->basedir,
+	    snapname, file ? "/" : "", file ? file : "") == -1) {
+		return NULL;
+	}
+	return path;
+}
+
+/*
+ * snapshot_remove: remove the snapshot files (if any) and the directory.
+ */
+static int
+snapshot_remove(nxs_t *nxs, const char *snapname)
+{
+	char *path;
+	int ret;
+
+	for (unsigned i = 0; i < __arraycount(snapshot_files); i++) {
+		if ((path = get_snapshot_path(nxs,
+		    snapname, snapshot_files[i])) == NULL) {
+			return -1;
+		}
+		ret = unlink(path);
+		free(path);
+		if (ret == -1 && errno != ENOENT) {
+			return -1;
+		}
+	}
+	if ((path = get_snapshot_path(nxs, snapname, NULL)) == NULL) {
+		return -1;
+	}
+	ret = rmdir(path);
+	free(path);
+	return ret;
+}
+
+/*
+ * snapshot_copy: copy the index file up to the given length and map it.
+ */
+static int
+snapshot_copy(nxs_t *nxs, const char *snapname, const char *file,
+    const idxmap_t *src, size_t len, idxmap_t *dst)
+{
+	char *path;
+
+	if ((path = get_snapshot_path(nxs, snapname, file)) == NULL) {
+		return -1;
+	}
+	dst->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	free(path);
+	if (dst->fd == -1) {
+		return -1;
+	}
+	if (fs_copy_range(dst->fd, src->fd, len) == -1 ||
+	    ftruncate(dst->fd, roundup2(len, IDX_SIZE_STEP)) == -1) {
+		return -1;
+	}
+	if (idx_db_map(dst, len, false) == NULL) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * snapshot_terms_fixup: set the data length, reset the term totals and
+ * build the term ID to offset map.
+ */
+static uint32_t *
+snapshot_terms_fixup(nxs_t *nxs, idxmap_t *idxmap, size_t data_len,
+    size_t *countp)
+{
+	idxterms_hdr_t *hdr = idxmap->baseptr;
+	uint32_t *offsets = NULL;
+	size_t count = 0, max = 0;
+	mmrw_t mm;
+
+	atomic_store_release(&hdr->data_len, htobe32(data_len));
+
+	mmrw_init(&mm, IDXTERMS_DATA_PTR(hdr, 0), data_len);
+	while (mm.remaining) {
+		uint16_t len;
+
+		if (mmrw_fetch16(&mm, &len) == -1 || len == 0 ||
+		    mmrw_advance(&mm, len + 1 + IDXTERMS_PAD_LEN(len)) == -1) {
+			goto err;
+		}
+		if (count == max) {
+			uint32_t *noffsets;
+
+			max = max ? max * 2 : 1024;
+			noffsets = realloc(offsets, max * sizeof(uint32_t));
+			if (noffsets == NULL) {
+				goto err;
+			}
+			offsets = noffsets;
+		}
+		offsets[count++] = (uintptr_t)mm.curptr - (uintptr_t)hdr;
+
+		if (mmrw_store64(&mm, 0) == -1) {
+			goto err;
+		}
+	}
+	*countp = count;
+	return offsets;
+err:
+	nxs_decl_errx(nxs, NXS_ERR_FATAL, "corrupted terms index", NULL);
+	free(offsets);
+	return NULL;
+}
+
+/*
+ * snapshot_dtmap_fixup: set the data length, re-fetch the document IDs
+ * and re-compute the counters (including the term totals).
+ */
+static int
+snapshot_dtmap_fixup(nxs_t *nxs, const idxmap_t *src, idxmap_t *idxmap,
+    size_t data_len, idxmap_t *terms, const uint32_t *offsets, size_t count)
+{
+	idxdt_hdr_t *hdr = idxmap->baseptr;
+	uint64_t token_count = 0;
+	uint32_t doc_count = 0;
+	mmrw_t mm;
+
+	mmrw_init(&mm, IDXDT_DATA_PTR(hdr, 0), data_len);
+	while (mm.remaining) {
+		const size_t offset = MMRW_GET_OFFSET(&mm);
+		uint64_t *src_doc_id_ptr, *doc_id_ptr;
+		uint32_t n, doc_total_len;
+		nxs_doc_id_t doc_id;
+
+		src_doc_id_ptr = MAP_GET_OFF(src->baseptr,
+		    sizeof(idxdt_hdr_t) + offset);
+		doc_id_ptr = (uint64_t *)(void *)mm.curptr;
+		*doc_id_ptr = atomic_load_acquire(src_doc_id_ptr);
+
+		if (mmrw_fetch64(&mm, &doc_id) == -1 ||
+		    mmrw_fetch32(&mm, &doc_total_len) == -1 ||
+		    mmrw_fetch32(&mm, &n) == -1) {
+			goto err;
+		}
+		for (unsigned i = 0; i < n; i++) {
+			nxs_term_id_t term_id;
+			uint32_t tcount;
+			uint64_t *tc;
+
+			if (mmrw_fetch32(&mm, &term_id) == -1 ||
+			    mmrw_fetch32(&mm, &tcount) == -1 ||
+			    term_id == 0 || term_id > count) {
+				goto err;
+			}
+			if (doc_id == 0) {
+				continue;
+			}
+			tc = MAP_GET_OFF(terms->baseptr, offsets[term_id - 1]);
+			*tc = htobe64(be64toh(*tc) + tcount);
+		}
+		if (doc_id && doc_total_len) {
+			token_count += doc_total_len;
+			doc_count++;
+		}
+	}
+
+	hdr->token_count = htobe64(token_count);
+	hdr->doc_count = htobe32(doc_count);
+	atomic_store_release(&hdr->data_len, htobe64(data_len));
+	return 0;
+err:
+	nxs_decl_errx(nxs, NXS_ERR_FATAL, "corrupted dtmap index", NULL);
+	return -1;
+}
+
+/*
+ * nxs_index_snapshot: create a consistent snapshot of the index without
+ * blocking the writers.
+ */
+__dso_public int
+nxs_index_snapshot(nxs_index_t *idx, const char *snapname)
+{
+	nxs_t *nxs = idx->nxs;
+	idxmap_t terms = { .fd = -1 }, dtmap = { .fd = -1 };
+	uint64_t terms_pos, dtmap_pos;
+	uint32_t *offsets = NULL;
+	char *path = NULL, *src_path = NULL;
+	size_t count;
+	int ret = -1;
+
+	nxs_clear_error(nxs);
+
+	if (str_isalnumdu(snapname) == -1) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "invalid characters in snapshot name", NULL);
+		return -1;
+	}
+	if (idx->dict->name) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID, "snapshots are not "
+		    "supported for indexes with a shared dictionary", NULL);
+		return -1;
+	}
+
+	/*
+	 * Create the snapshot directory.
+	 */
+	if (asprintf(&path, "%s/snapshots", nxs->basedir) == -1) {
+		return -1;
+	}
+	if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+		    "could not create directory at %s", path);
+		free(path);
+		return -1;
+	}
+	free(path);
+
+	if ((path = get_snapshot_path(nxs, snapname, NULL)) == NULL) {
+		return -1;
+	}
+	if (mkdir(path, 0755) == -1) {
+		if (errno == EEXIST) {
+			nxs_decl_errx(nxs, NXS_ERR_EXISTS,
+			    "snapshot `%s' already exists", snapname);
+		} else {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not create directory at %s", path);
+		}
+		free(path);
+		return -1;
+	}
+	free(path);
+	path = NULL;
+
+	/*
+	 * Copy the parameters.
+	 */
+	if (asprintf(&src_path, "%s/data/%s/params.db",
+	    nxs->basedir, idx->name) == -1 ||
+	    (path = get_snapshot_path(nxs, snapname, "params.db")) == NULL) {
+		goto out;
+	}
+	if (fs_clone_file(src_path, path) == -1) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+		    "could not copy `%s'", src_path);
+		goto out;
+	}
+
+	/*
+	 * Get the watermarks and ensure the source mappings cover them.
+	 */
+	nxs_index_repl_pos(idx, &terms_pos, &dtmap_pos);
+	if (idx_db_map(&idx->dict->terms_memmap,
+	    sizeof(idxterms_hdr_t) + terms_pos, false) == NULL ||
+	    idx_db_map(&idx->dt_memmap,
+	    sizeof(idxdt_hdr_t) + dtmap_pos, false) == NULL) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+		    "index mapping failed", NULL);
+		goto out;
+	}
+
+	/*
+	 * Copy the index files up to the watermarks.
+	 */
+	if (snapshot_copy(nxs, snapname, "nxsterms", &idx->dict->terms_memmap,
+	    sizeof(idxterms_hdr_t) + terms_pos, &terms) == -1 ||
+	    snapshot_copy(nxs, snapname, "nxsdtmap", &idx->dt_memmap,
+	    sizeof(idxdt_hdr_t) + dtmap_pos, &dtmap) == -1) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+		    "could not copy the index files", NULL);
+		goto out;
+	}
+
+	/*
+	 * Fix up the in-place updated data.
+	 */
+	offsets = snapshot_terms_fixup(nxs, &terms, terms_pos, &count);
+	if (offsets == NULL) {
+		goto out;
+	}
+	if (snapshot_dtmap_fixup(nxs, &idx->dt_memmap, &dtmap,
+	    dtmap_pos, &terms, offsets, count) == -1) {
+		goto out;
+	}
+	if (msync(terms.baseptr, terms.mapped_len, MS_SYNC) == -1 ||
+	    msync(dtmap.baseptr, dtmap.mapped_len, MS_SYNC) == -1) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM, "msync failed", NULL);
+		goto out;
+	}
+	app_dbgx("snapshot `%s': terms %"PRIu64", dtmap %"PRIu64,
+	    snapname, terms_pos, dtmap_pos);
+	ret = 0;
+out:
+	idx_db_release(&terms);
+	idx_db_release(&dtmap);
+	free(offsets);
+	free(src_path);
+	free(path);
+
+	if (ret) {
+		nxs_error_checkpoint(nxs);
+		snapshot_remove(nxs, snapname);
+	}
+	return ret;
+}
+
+/*
+ * nxs_index_clone: create a new index from the snapshot.
+ */
+__dso_public nxs_index_t *
+nxs_index_clone(nxs_t *nxs, const char *snapname, const char *name)
+{
+	nxs_index_t *idx = NULL;
+	char *path, *src, *dst;
+	unsigned i;
+
+	nxs_clear_error(nxs);
+
+	if (str_isalnumdu(snapname) == -1 || str_isalnumdu(name) == -1) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "invalid characters in the name", NULL);
+		return NULL;
+	}
+	if ((path = get_snapshot_path(nxs, snapname, NULL)) == NULL) {
+		return NULL;
+	}
+	if (!fs_is_dir(path)) {
+		nxs_decl_errx(nxs, NXS_ERR_MISSING,
+		    "snapshot `%s' does not exist", snapname);
+		free(path);
+		return NULL;
+	}
+	free(path);
+
+	if (asprintf(&path, "%s/data/%s", nxs->basedir, name) == -1) {
+		return NULL;
+	}
+	if (mkdir(path, 0755) == -1) {
+		if (errno == EEXIST) {
+			nxs_decl_errx(nxs, NXS_ERR_EXISTS,
+			    "index `%s' already exists", name);
+		} else {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not create directory at %s", path);
+		}
+		free(path);
+		return NULL;
+	}
+
+	/*
+	 * Clone the files (reflink where supported).  Note: the files
+	 * must not be hard-linked, since the index files are mutable.
+	 */
+	for (i = 0; i < __arraycount(snapshot_files); i++) {
+		const char *file = snapshot_files[i];
+		int ret;
+
+		src = get_snapshot_path(nxs, snapname, file);
+		if (asprintf(&dst, "%s/%s", path, file) == -1) {
+			dst = NULL;
+		}
+		ret = (src && dst) ? fs_clone_file(src, dst) : -1;
+		if (ret == -1) {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not clone `%s'", file);
+		}
+		free(src);
+		free(dst);
+		if (ret == -1) {
+			goto out;
+		}
+	}
+	idx = nxs_index_open(nxs, name);
+out:
+	if (!idx) {
+		nxs_error_checkpoint(nxs);
+
+		/* Remove the partially cloned index. */
+		for (i = 0; i < __arraycount(snapshot_files); i++) {
+			if (asprintf(&dst, "%s/%s",
+			    path, snapshot_files[i]) != -1) {
+				(void)unlink(dst);
+				free(dst);
+			}
+		}
+		(void)rmdir(path);
+	}
+	free(path);
+	return idx;
+}
+
+/*
+ * nxs_snapshot_destroy: remove the snapshot.
+ */
+__dso_public int
+nxs_snapshot_destroy(nxs_t *nxs, const char *snapname)
+{
+	nxs_clear_error(nxs);
+
+	if (str_isalnumdu(snapname) == -1) {
+		nxs_decl_errx(nxs, NXS_ERR_INVALID,
+		    "invalid characters in snapshot name", NULL);
+		return -1;
+	}
+	if (snapshot_remove(nxs, snapname) == -1) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+		    "could not remove snapshot `%s'", snapname);
+		return -1;
+	}
+	return 0;
+}
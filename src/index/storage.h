@@ -133,6 +133,97 @@ static_assert(sizeof(idxdt_hdr_t) % 8 == 0, "alignment guard");
 #define	IDXDT_DOC_COUNT(h)	\
     be32toh(atomic_load_relaxed(&(hdr)->doc_count))
 
+/*
+ * Replication change set.
+ *
+ *	+-------------------+
+ *	| header            |
+ *	+-------------------+
+ *	| terms data        |
+ *	+-------------------+
+ *	| dtmap data        |
+ *	+-------------------+
+ *
+ * The change set carries the raw terms and dtmap data blocks (see the
+ * above layouts) appended past the given positions, i.e. the data_len
+ * values of the follower.  The term total counts and the document
+ * deletions (which are in-place updates on the leader) are re-applied
+ * by the follower as it consumes the blocks.
+ *
+ * CAUTION: All values must be converted to big-endian for storage.
+ */
+
+#define	NXS_R_MARK	"NXS_R"
+
+typedef struct {
+	uint8_t		mark[5];	// NXS_R_MARK
+	uint8_t		ver;		// ABI version
+	uint8_t		reserved[2];
+
+	/* Terms: the starting position and the length of the data. */
+	uint32_t	terms_pos;
+	uint32_t	terms_len;
+
+	/* Document-term map: the starting position and the length. */
+	uint64_t	dtmap_pos;
+	uint64_t	dtmap_len;
+
+} __attribute__((packed)) idxrepl_hdr_t;
+
+static_assert(sizeof(idxrepl_hdr_t) == 32, "ABI guard");
+
+/*
+ * Synonym dictionary (compiled, read-only).
+ *
+ *	+-------------------+
+ *	| header            |
+ *	+-------------------+
+ *	| entries (sorted)  |
+ *	+-------------------+
+ *	| groups            |
+ *	+-------------------+
+ *	| strings           |
+ *	+-------------------+
+ *
+ * An entry maps the term to its group; the entries are sorted by the
+ * term value (byte-wise, then by length) for the binary search:
+ *
+ *	| term offset | group offset |
+ *	+-------------+--------------+
+ *	|      4      |      4       |
+ *
+ * A group lists its terms (including the term of the entry itself):
+ *
+ *	|  n  | term 0 offset |  ...  | term n offset |
+ *	+-----+---------------+-------+---------------+
+ *	|  4  |       4       |      ...              |
+ *
+ * A string is defined as | len (2) | term .. | NIL (1) | [pad] | and
+ * is 16-bit aligned.  All offsets are from the beginning of the file.
+ *
+ * CAUTION: All values must be converted to big-endian for storage.
+ */
+
+#define	NXS_S_MARK	"NXS_S"
+
+typedef struct {
+	uint8_t		mark[5];	// NXS_S_MARK
+	uint8_t		ver;		// ABI version
+	uint8_t		reserved[2];
+
+	/* Number of entries and the total length (including the header). */
+	uint32_t	entry_count;
+	uint32_t	total_len;
+
+} __attribute__((packed)) idxsyn_hdr_t;
+
+static_assert(sizeof(idxsyn_hdr_t) == 16, "ABI guard");
+
+#define	IDXSYN_ENTRY_LEN	(4UL + 4)
+#define	IDXSYN_ENTRY_OFF(i)	(sizeof(idxsyn_hdr_t) + (i) * IDXSYN_ENTRY_LEN)
+#define	IDXSYN_GROUP_LEN(n)	(4UL + (n) * 4)
+#define	IDXSYN_STR_LEN(len)	(roundup2(2UL + (len) + 1, 2))
+
 /*
  * Helpers.
  */
@@ -0,0 +1,717 @@
+/*
+ * Copyright (c) 2023 Mindaugas Rasiukevicius <rmind at noxt eu>
+ * All rights reserved.
+ *
+ * Use is subject to license terms, as specified in the LICENSE file.
+ */
+
+/*
+ * Synonym dictionary.
+ *
+ * The synonym groups are compiled from the text (one group per line,
+ * the terms separated by commas) into a read-only file which is memory
+ * mapped (see storage.h for the layout).  The terms are processed by
+ * the filter pipeline of the index when compiling, therefore they match
+ * the query tokens after the normalization, stemming, etc.
+ *
+ * At query time, each token which has a group is expanded into an OR
+ * sub-expression of the group terms (see query_tokenize()).  The unions
+ * of the document bitmaps for the groups are cached per index, in the
+ * LRU order; the entries are valid for the index generation they were
+ * computed at.  The same cache holds the bitmaps of the query filters,
+ * keyed by the canonical form of the filter expression (see query.c).
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define	__NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "rhashmap.h"
+#include "storage.h"
+#include "filters.h"
+#include "index.h"
+#include "utils.h"
+
+#define	SYN_FILE_NAME		"nxssyn"
+
+static inline uint32_t
+syn_u32(const void *base, uint32_t off)
+{
+	const uint32_t *p = MAP_GET_OFF(base, off);
+	return be32toh(*p);
+}
+
+static inline const char *
+syn_str(const void *base, uint32_t off, size_t *len)
+{
+	const uint16_t *p = MAP_GET_OFF(base, off);
+
+	*len = be16toh(*p);
+	return (const char *)(p + 1);
+}
+
+static int
+syn_strcmp(const char *s1, size_t len1, const char *s2, size_t len2)
+{
+	const int ret = memcmp(s1, s2, MIN(len1, len2));
+	return ret ? ret : (len1 > len2) - (len1 < len2);
+}
+
+static bool
+syn_verify_str(const void *base, size_t total_len, uint32_t off)
+{
+	size_t len;
+
+	if ((off & 1) != 0 || off + 2UL > total_len) {
+		return false;
+	}
+	(void)syn_str(base, off, &len);
+	return off + IDXSYN_STR_LEN(len) <= total_len;
+}
+
+/*
+ * syn_verify: verify the header and all the offsets, so the lookups
+ * do not need to perform any checks.
+ */
+static int
+syn_verify(const void *base, size_t total_len)
+{
+	const idxsyn_hdr_t *hdr = base;
+	size_t entries_end;
+	uint32_t count;
+
+	if (total_len < sizeof(idxsyn_hdr_t) ||
+	    memcmp(hdr->mark, NXS_S_MARK, sizeof(hdr->mark)) != 0 ||
+	    hdr->ver != NXS_ABI_VER || be32toh(hdr->total_len) != total_len) {
+		return -1;
+	}
+	count = be32toh(hdr->entry_count);
+	entries_end = sizeof(idxsyn_hdr_t) + count * IDXSYN_ENTRY_LEN;
+	if (entries_end > total_len) {
+		return -1;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		const uint32_t off = IDXSYN_ENTRY_OFF(i);
+		const uint32_t group = syn_u32(base, off + 4);
+		uint32_t n;
+
+		if (!syn_verify_str(base, total_len, syn_u32(base, off)) ||
+		    (group & 3) != 0 || group < entries_end ||
+		    group + 4UL > total_len) {
+			return -1;
+		}
+		n = syn_u32(base, group);
+		if (group + IDXSYN_GROUP_LEN((uint64_t)n) > total_len) {
+			return -1;
+		}
+		for (uint32_t j = 0; j < n; j++) {
+			const uint32_t toff = syn_u32(base, group + 4 + j * 4);
+
+			if (!syn_verify_str(base, total_len, toff)) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void
+syn_unmap(nxs_index_t *idx)
+{
+	if (idx->syn_baseptr) {
+		void *addr = (void *)(uintptr_t)idx->syn_baseptr;
+
+		munmap(addr, idx->syn_mapped_len);
+		idx->syn_baseptr = NULL;
+		idx->syn_mapped_len = 0;
+	}
+}
+
+static void
+syn_cache_evict(nxs_index_t *idx, idxsyn_cent_t *ent)
+{
+	rhashmap_del(idx->syn_cache_map, &ent->key, sizeof(uint64_t));
+	TAILQ_REMOVE(&idx->syn_cache_list, ent, entry);
+	idx->syn_cache_count--;
+	roaring64_bitmap_free(ent->doc_bitmap);
+	free(ent);
+}
+
+/*
+ * syn_load: map the synonym dictionary, if there is one.
+ *
+ * => The cached unions of the previous version are dropped.
+ */
+static int
+syn_load(nxs_index_t *idx, const char *path)
+{
+	idxsyn_cent_t *ent;
+	struct stat st;
+	void *addr;
+	int fd;
+
+	while ((ent = TAILQ_FIRST(&idx->syn_cache_list)) != NULL) {
+		syn_cache_evict(idx, ent);
+	}
+	syn_unmap(idx);
+	idx->syn_version++;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_FILE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		return -1;
+	}
+	if (syn_verify(addr, st.st_size) == -1) {
+		munmap(addr, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	idx->syn_baseptr = addr;
+	idx->syn_mapped_len = st.st_size;
+	return 0;
+}
+
+int
+idxsyn_open(nxs_index_t *idx, const char *name)
+{
+	char *path;
+	int ret;
+
+	TAILQ_INIT(&idx->syn_cache_list);
+	idx->syn_cache_map = rhashmap_create(0, RHM_NOCOPY | RHM_NONCRYPTO);
+	if (idx->syn_cache_map == NULL) {
+		return -1;
+	}
+	if (asprintf(&path, "%s/data/%s/%s",
+	    idx->nxs->basedir, name, SYN_FILE_NAME) == -1) {
+		return -1;
+	}
+	if ((ret = syn_load(idx, path)) == -1) {
+		nxs_decl_err(idx->nxs, NXS_ERR_FATAL,
+		    "could not load the synonym dictionary `%s'", path);
+	}
+	free(path);
+	return ret;
+}
+
+void
+idxsyn_close(nxs_index_t *idx)
+{
+	idxsyn_cent_t *ent;
+
+	if (idx->syn_cache_map) {
+		while ((ent = TAILQ_FIRST(&idx->syn_cache_list)) != NULL) {
+			syn_cache_evict(idx, ent);
+		}
+		rhashmap_destroy(idx->syn_cache_map);
+		idx->syn_cache_map = NULL;
+	}
+	syn_unmap(idx);
+}
+
+/*
+ * idxsyn_lookup: find the synonym group of the given term.
+ *
+ * => Returns the group (offset) or zero if there is none.
+ */
+uint32_t
+idxsyn_lookup(const nxs_index_t *idx, const char *value, size_t len)
+{
+	const void *base = idx->syn_baseptr;
+	const idxsyn_hdr_t *hdr = base;
+	uint32_t lo = 0, hi;
+
+	if (base == NULL) {
+		return 0;
+	}
+	hi = be32toh(hdr->entry_count);
+	while (lo < hi) {
+		const uint32_t mid = lo + (hi - lo) / 2;
+		const uint32_t off = IDXSYN_ENTRY_OFF(mid);
+		const char *term;
+		size_t term_len;
+		int cmp;
+
+		term = syn_str(base, syn_u32(base, off), &term_len);
+		if ((cmp = syn_strcmp(value, len, term, term_len)) == 0) {
+			return syn_u32(base, off + 4);
+		}
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return 0;
+}
+
+unsigned
+idxsyn_group_count(const nxs_index_t *idx, uint32_t group)
+{
+	ASSERT(idx->syn_baseptr && group);
+	return syn_u32(idx->syn_baseptr, group);
+}
+
+const char *
+idxsyn_group_term(const nxs_index_t *idx, uint32_t group, unsigned i,
+    size_t *len)
+{
+	const void *base = idx->syn_baseptr;
+
+	ASSERT(i < idxsyn_group_count(idx, group));
+	return syn_str(base, syn_u32(base, group + 4 + i * 4), len);
+}
+
+/*
+ * idxsyn_group_key: get the cache key of the group, which also
+ * distinguishes the dictionary versions.
+ */
+uint64_t
+idxsyn_group_key(const nxs_index_t *idx, uint32_t group)
+{
+	return ((uint64_t)idx->syn_version << 32) | group;
+}
+
+/*
+ * idxsyn_cache_get: get the cached union of the group documents.
+ *
+ * => The key data (if any) must match the one of the entry.
+ */
+roaring64_bitmap_t *
+idxsyn_cache_get(nxs_index_t *idx, uint64_t key, const void *data,
+    size_t len)
+{
+	idxsyn_cent_t *ent;
+
+	ent = rhashmap_get(idx->syn_cache_map, &key, sizeof(uint64_t));
+	if (ent == NULL) {
+		return NULL;
+	}
+	if (ent->data_len != len ||
+	    (len && memcmp(ent->data, data, len) != 0)) {
+		/* Hash collision: a different filter. */
+		return NULL;
+	}
+	if (ent->generation != idx_get_generation(idx)) {
+		syn_cache_evict(idx, ent);
+		return NULL;
+	}
+	TAILQ_REMOVE(&idx->syn_cache_list, ent, entry);
+	TAILQ_INSERT_TAIL(&idx->syn_cache_list, ent, entry);
+	return ent->doc_bitmap;
+}
+
+/*
+ * idxsyn_cache_put: cache the union of the group documents, with the
+ * given key data (if any).
+ *
+ * => Returns 0 if the cache took the ownership of the bitmap and -1
+ *    otherwise (e.g. the key is taken by a colliding filter).
+ * => The cache is trimmed only by idxsyn_cache_gc(), therefore the
+ *    bitmaps remain valid for the duration of the query.
+ */
+int
+idxsyn_cache_put(nxs_index_t *idx, uint64_t key, const void *data,
+    size_t len, roaring64_bitmap_t *bm)
+{
+	idxsyn_cent_t *ent;
+
+	if (rhashmap_get(idx->syn_cache_map, &key, sizeof(key)) != NULL) {
+		return -1;
+	}
+	if ((ent = malloc(offsetof(idxsyn_cent_t, data[len]))) == NULL) {
+		return -1;
+	}
+	ent->key = key;
+	ent->generation = idx_get_generation(idx);
+	ent->doc_bitmap = bm;
+	ent->data_len = len;
+	if (len) {
+		memcpy(ent->data, data, len);
+	}
+	if (rhashmap_put(idx->syn_cache_map,
+	    &ent->key, sizeof(uint64_t), ent) != ent) {
+		free(ent);
+		return -1;
+	}
+	TAILQ_INSERT_TAIL(&idx->syn_cache_list, ent, entry);
+	idx->syn_cache_count++;
+	return 0;
+}
+
+/*
+ * idxsyn_cache_gc: evict the least recently used entries over the limit.
+ *
+ * => Must be called before the query evaluation (not during it).
+ */
+void
+idxsyn_cache_gc(nxs_index_t *idx)
+{
+	while (idx->syn_cache_count > SYN_CACHE_MAX) {
+		syn_cache_evict(idx, TAILQ_FIRST(&idx->syn_cache_list));
+	}
+}
+
+/*
+ * Compilation of the synonym dictionary.
+ */
+
+typedef struct {
+	char *		value;
+	size_t		len;
+	uint32_t	group;
+	uint32_t	offset;
+} syn_term_t;
+
+typedef struct {
+	syn_term_t **	terms;
+	unsigned	count;
+	uint32_t	offset;
+} syn_group_t;
+
+typedef struct {
+	arena_t *	arena;
+	rhashmap_t *	term_map;
+	syn_term_t **	terms;
+	unsigned	term_count;
+	syn_group_t *	groups;
+	unsigned	group_count;
+	unsigned	group_size;
+} syn_compiler_t;
+
+static int
+syn_term_cmp(const void *p1, const void *p2)
+{
+	const syn_term_t *t1 = *(syn_term_t * const *)p1;
+	const syn_term_t *t2 = *(syn_term_t * const *)p2;
+
+	return syn_strcmp(t1->value, t1->len, t2->value, t2->len);
+}
+
+/*
+ * syn_add_group: parse the line and add the group of its terms.
+ *
+ * => The terms already in another group are skipped (the first group
+ *    wins); the groups with fewer than two terms are dropped.
+ */
+static int
+syn_add_group(syn_compiler_t *sc, filter_pipeline_t *fp,
+    const char *line, size_t len)
+{
+	syn_term_t **terms;
+	const char *s = line, *end = line + len;
+	unsigned count = 0, max = 1;
+
+	for (size_t i = 0; i < len; i++) {
+		max += (line[i] == ',');
+	}
+	if ((terms = arena_alloc(sc->arena, max * sizeof(*terms))) == NULL) {
+		return -1;
+	}
+	while (s < end) {
+		const char *e = memchr(s, ',', end - s);
+		const char *next = e ? e + 1 : end;
+		filter_action_t action;
+		syn_term_t *term;
+		strbuf_t buf;
+		unsigned i;
+
+		e = e ? e : end;
+		while (s < e && (*s == ' ' || *s == '\t')) {
+			s++;
+		}
+		while (e > s && (e[-1] == ' ' || e[-1] == '\t' ||
+		    e[-1] == '\r')) {
+			e--;
+		}
+		if (s == e) {
+			s = next;
+			continue;
+		}
+
+		/* Process the term with the filter pipeline. */
+		strbuf_init(&buf);
+		if (strbuf_acquire(&buf, s, e - s) == -1) {
+			return -1;
+		}
+		s = next;
+		if ((action = filter_pipeline_run(fp, &buf)) == FILT_ERROR) {
+			strbuf_release(&buf);
+			return -1;
+		}
+		if (action == FILT_DISCARD || buf.length > UINT16_MAX ||
+		    rhashmap_get(sc->term_map, buf.value, buf.length)) {
+			strbuf_release(&buf);
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			if (terms[i]->len == buf.length &&
+			    memcmp(terms[i]->value, buf.value, buf.length) == 0)
+				break;
+		}
+		if (i < count) {
+			strbuf_release(&buf);
+			continue;
+		}
+		term = arena_zalloc(sc->arena, sizeof(syn_term_t));
+		if (term == NULL || (term->value = arena_strndup(sc->arena,
+		    buf.value, buf.length)) == NULL) {
+			strbuf_release(&buf);
+			return -1;
+		}
+		term->len = buf.length;
+		terms[count++] = term;
+		strbuf_release(&buf);
+	}
+	if (count < 2) {
+		return 0;
+	}
+
+	/*
+	 * Add the group and register its terms.
+	 */
+	if (sc->group_count == sc->group_size) {
+		const unsigned n = sc->group_size ? sc->group_size * 2 : 16;
+		syn_group_t *groups;
+
+		groups = arena_alloc(sc->arena, n * sizeof(syn_group_t));
+		if (groups == NULL) {
+			return -1;
+		}
+		if (sc->group_count) {
+			memcpy(groups, sc->groups,
+			    sc->group_count * sizeof(syn_group_t));
+		}
+		sc->groups = groups;
+		sc->group_size = n;
+	}
+	for (unsigned i = 0; i < count; i++) {
+		terms[i]->group = sc->group_count;
+		rhashmap_put(sc->term_map, terms[i]->value,
+		    terms[i]->len, terms[i]);
+	}
+	sc->groups[sc->group_count].terms = terms;
+	sc->groups[sc->group_count].count = count;
+	sc->group_count++;
+	sc->term_count += count;
+	return 0;
+}
+
+/*
+ * syn_build: build the compiled dictionary (see storage.h).
+ */
+static void *
+syn_build(syn_compiler_t *sc, size_t *lenp)
+{
+	idxsyn_hdr_t *hdr;
+	size_t off, total_len;
+	unsigned n = 0;
+	void *buf;
+
+	/* Collect and sort the terms. */
+	sc->terms = arena_alloc(sc->arena,
+	    (sc->term_count + 1) * sizeof(syn_term_t *));
+	if (sc->terms == NULL) {
+		return NULL;
+	}
+	for (unsigned i = 0; i < sc->group_count; i++) {
+		const syn_group_t *grp = &sc->groups[i];
+
+		for (unsigned j = 0; j < grp->count; j++) {
+			sc->terms[n++] = grp->terms[j];
+		}
+	}
+	ASSERT(n == sc->term_count);
+	qsort(sc->terms, n, sizeof(syn_term_t *), syn_term_cmp);
+
+	/* Compute the offsets. */
+	off = sizeof(idxsyn_hdr_t) + n * IDXSYN_ENTRY_LEN;
+	for (unsigned i = 0; i < sc->group_count; i++) {
+		sc->groups[i].offset = off;
+		off += IDXSYN_GROUP_LEN(sc->groups[i].count);
+	}
+	for (unsigned i = 0; i < n; i++) {
+		sc->terms[i]->offset = off;
+		off += IDXSYN_STR_LEN(sc->terms[i]->len);
+	}
+	if ((total_len = off) > UINT32_MAX) {
+		errno = EFBIG;
+		return NULL;
+	}
+	if ((buf = calloc(1, total_len)) == NULL) {
+		return NULL;
+	}
+
+	/* Header. */
+	hdr = buf;
+	memcpy(hdr->mark, NXS_S_MARK, sizeof(hdr->mark));
+	hdr->ver = NXS_ABI_VER;
+	hdr->entry_count = htobe32(n);
+	hdr->total_len = htobe32(total_len);
+
+	/* Entries and the strings. */
+	for (unsigned i = 0; i < n; i++) {
+		const syn_term_t *term = sc->terms[i];
+		uint32_t *ent = MAP_GET_OFF(buf, IDXSYN_ENTRY_OFF(i));
+		uint16_t *str = MAP_GET_OFF(buf, term->offset);
+
+		ent[0] = htobe32(term->offset);
+		ent[1] = htobe32(sc->groups[term->group].offset);
+		str[0] = htobe16(term->len);
+		memcpy(&str[1], term->value, term->len);
+	}
+
+	/* Groups. */
+	for (unsigned i = 0; i < sc->group_count; i++) {
+		const syn_group_t *grp = &sc->groups[i];
+		uint32_t *g = MAP_GET_OFF(buf, grp->offset);
+
+		g[0] = htobe32(grp->count);
+		for (unsigned j = 0; j < grp->count; j++) {
+			g[1 + j] = htobe32(grp->terms[j]->offset);
+		}
+	}
+	*lenp = total_len;
+	return buf;
+}
+
+static int
+syn_write_file(const char *path, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		return -1;
+	}
+	while (len) {
+		const ssize_t ret = write(fd, p, len);
+
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+	if (fsync(fd) == -1) {
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+/*
+ * nxs_index_set_synonyms: compile the synonym dictionary from the text
+ * and set it for the index.
+ *
+ * => Each line defines a group of synonyms separated by commas; the
+ *    empty lines and the lines starting with '#' are ignored.
+ * => Empty text removes the dictionary.
+ * => The other handles of the index load it when re-opened.
+ */
+__dso_public int
+nxs_index_set_synonyms(nxs_index_t *idx, const char *text, size_t len)
+{
+	nxs_t *nxs = idx->nxs;
+	syn_compiler_t sc;
+	char *path = NULL, *tmp_path = NULL;
+	const char *s = text, *end = text + len;
+	void *buf = NULL;
+	size_t buf_len;
+	int ret = -1;
+
+	nxs_clear_error(nxs);
+
+	memset(&sc, 0, sizeof(syn_compiler_t));
+	if ((sc.arena = arena_create(0)) == NULL ||
+	    (sc.term_map = rhashmap_create(0, RHM_NOCOPY)) == NULL) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		goto out;
+	}
+	if (asprintf(&path, "%s/data/%s/%s",
+	    nxs->basedir, idx->name, SYN_FILE_NAME) == -1 ||
+	    asprintf(&tmp_path, "%s.tmp", path) == -1) {
+		nxs_decl_err(nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		goto out;
+	}
+
+	/*
+	 * Parse the groups.
+	 */
+	while (s < end) {
+		const char *e = memchr(s, '\n', end - s);
+		const char *next = e ? e + 1 : end;
+
+		e = e ? e : end;
+		if (e > s && *s != '#' &&
+		    syn_add_group(&sc, idx->fp, s, e - s) == -1) {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not process the synonym group", NULL);
+			goto out;
+		}
+		s = next;
+	}
+
+	/*
+	 * Write the compiled dictionary (or remove it if empty) and
+	 * atomically replace the current one.
+	 */
+	if (sc.group_count == 0) {
+		if (unlink(path) == -1 && errno != ENOENT) {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not remove `%s'", path);
+			goto out;
+		}
+	} else {
+		if ((buf = syn_build(&sc, &buf_len)) == NULL) {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not compile the synonym dictionary", NULL);
+			goto out;
+		}
+		if (syn_write_file(tmp_path, buf, buf_len) == -1 ||
+		    rename(tmp_path, path) == -1) {
+			nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+			    "could not write `%s'", path);
+			(void)unlink(tmp_path);
+			goto out;
+		}
+	}
+	if (syn_load(idx, path) == -1) {
+		nxs_decl_err(nxs, NXS_ERR_FATAL,
+		    "could not load the synonym dictionary `%s'", path);
+		goto out;
+	}
+	ret = 0;
+out:
+	if (sc.term_map) {
+		rhashmap_destroy(sc.term_map);
+	}
+	if (sc.arena) {
+		arena_destroy(sc.arena);
+	}
+	free(buf);
+	free(tmp_path);
+	free(path);
+	return ret;
+}
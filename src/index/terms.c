@@ -18,10 +18,15 @@
  * The count is a 64-bit integer updated atomically, therefore padding
  * must be added to provide the alignment where needed.
  *
+ * The terms index may be shared by a group of indexes (see the shared
+ * dictionary in idx_terms_open_shared()).  In such case, the total counts
+ * are accumulated across all indexes in the group.
+ *
  * See the storage.h header for more details on the on-disk layout.
  */
 
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/queue.h>
 #include <sys/file.h>
 
@@ -30,6 +35,7 @@
 #include <stdatomic.h>
 #include <inttypes.h>
 #include <string.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -83,64 +89,159 @@ idx_terms_verify(nxs_index_t *idx, const idxmap_t *idxmap)
 int
 idx_terms_open(nxs_index_t *idx, const char *path)
 {
+	idxdict_t *dict;
 	int fd;
 	void *baseptr;
 	bool created;
 
+	if ((dict = calloc(1, sizeof(idxdict_t))) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		return -1;
+	}
+	dict->refcnt = 1;
+	dict->terms_memmap.flags = idx->map_flags;
+
 	/*
 	 * Open the index file.
 	 *
 	 * => Returns the descriptor with the lock held.
 	 */
-	if ((fd = idx_db_open(&idx->terms_memmap, path, &created)) == -1) {
+	if ((fd = idx_db_open(&dict->terms_memmap, path, &created)) == -1) {
 		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
 		    "could not open terms index", NULL);
+		free(dict);
 		return -1;
 	}
 
 	/*
 	 * Map and, if creating, initialize the header.
 	 */
-	baseptr = idx_db_map(&idx->terms_memmap, IDX_SIZE_STEP, false);
+	baseptr = idx_db_map(&dict->terms_memmap, IDX_SIZE_STEP, false);
 	if (baseptr == NULL) {
 		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
 		    "terms mapping failed", NULL);
 		goto err;
 	}
-	if (created && idx_terms_init(&idx->terms_memmap) == -1) {
+	if (created && idx_terms_init(&dict->terms_memmap) == -1) {
 		goto err;
 	}
-	if (!created && idx_terms_verify(idx, &idx->terms_memmap) == -1) {
+	if (!created && idx_terms_verify(idx, &dict->terms_memmap) == -1) {
 		goto err;
 	}
 
 	/*
 	 * Setup the in-memory structures.
 	 */
-	if (idxterm_sysinit(idx) == -1) {
+	if (idxterm_sysinit(dict) == -1) {
 		goto err;
 	}
-	idx->terms_consumed = 0;
-	idx->terms_last_id = 0;
+	dict->terms_consumed = 0;
+	dict->terms_last_id = 0;
 	f_lock_exit(fd);
 
 	/*
 	 * Finally, load the terms.
 	 */
+	idx->dict = dict;
 	return idx_terms_sync(idx);
 err:
 	f_lock_exit(fd);
-	idx_db_release(&idx->terms_memmap);
+	idx_db_release(&dict->terms_memmap);
+	free(dict);
+	return -1;
+}
+
+/*
+ * idx_terms_open_shared: open the shared dictionary with the given name,
+ * i.e. the terms index which is shared by a group of indexes.
+ *
+ * => The dictionary is stored in the "dicts" directory under the base
+ *    directory; it is created, if it does not exist.
+ * => If already open by this instance, then just acquire a reference.
+ */
+int
+idx_terms_open_shared(nxs_index_t *idx, const char *name)
+{
+	nxs_t *nxs = idx->nxs;
+	const size_t len = strlen(name);
+	idxdict_t *dict;
+	char *path;
+	int ret;
+
+	if ((dict = rhashmap_get(nxs->dicts, name, len)) != NULL) {
+		dict->refcnt++;
+		idx->dict = dict;
+		return idx_terms_sync(idx);
+	}
+
+	/*
+	 * Create the directory (if needed) and open the terms index.
+	 */
+	if (asprintf(&path, "%s/dicts", nxs->basedir) == -1) {
+		return -1;
+	}
+	ret = mkdir(path, 0755);
+	free(path);
+	if (ret == -1 && errno != EEXIST) {
+		goto err;
+	}
+	if (asprintf(&path, "%s/dicts/%s", nxs->basedir, name) == -1) {
+		return -1;
+	}
+	ret = mkdir(path, 0755);
+	free(path);
+	if (ret == -1 && errno != EEXIST) {
+		goto err;
+	}
+	if (asprintf(&path, "%s/dicts/%s/nxsterms", nxs->basedir, name) == -1) {
+		return -1;
+	}
+	ret = idx_terms_open(idx, path);
+	free(path);
+	if (ret == -1) {
+		return -1;
+	}
+
+	/*
+	 * Register the dictionary.
+	 */
+	dict = idx->dict;
+	if ((dict->name = strdup(name)) == NULL) {
+		idx_terms_close(idx);
+		return -1;
+	}
+	rhashmap_put(nxs->dicts, dict->name, len, dict);
+	app_dbgx("opened shared dictionary `%s'", name);
+	return 0;
+err:
+	nxs_decl_err(nxs, NXS_ERR_SYSTEM,
+	    "could not create the dictionary directory", NULL);
 	return -1;
 }
 
 void
 idx_terms_close(nxs_index_t *idx)
 {
-	idxmap_t *idxmap = &idx->terms_memmap;
+	idxdict_t *dict = idx->dict;
+
+	if (dict == NULL) {
+		return;
+	}
+	idx->dict = NULL;
 
-	idxterm_sysfini(idx);
-	idx_db_release(idxmap);
+	ASSERT(dict->refcnt > 0);
+	if (--dict->refcnt > 0) {
+		return;
+	}
+	if (dict->name) {
+		nxs_t *nxs = idx->nxs;
+
+		rhashmap_del(nxs->dicts, dict->name, strlen(dict->name));
+		free(dict->name);
+	}
+	idxterm_sysfini(dict);
+	idx_db_release(&dict->terms_memmap);
+	free(dict);
 }
 
 /*
@@ -155,7 +256,8 @@ idx_terms_close(nxs_index_t *idx)
 int
 idx_terms_add(nxs_index_t *idx, tokenset_t *tokens)
 {
-	idxmap_t *idxmap = &idx->terms_memmap;
+	idxdict_t *dict = idx->dict;
+	idxmap_t *idxmap = &dict->terms_memmap;
 	size_t max_append_len, data_len, target_len, append_len = 0;
 	bool sync_ran = false;
 	idxterms_hdr_t *hdr;
@@ -182,7 +284,7 @@ again:
 	hdr = idxmap->baseptr;
 	ASSERT(idxmap->fd > 0 && hdr != NULL);
 	data_len = be32toh(atomic_load_acquire(&hdr->data_len));
-	if (idx->terms_consumed < data_len) {
+	if (dict->terms_consumed < data_len) {
 		/*
 		 * Load new terms and try to calculate again as the
 		 * file might have been re-mapped and the header pointer
@@ -228,7 +330,7 @@ again:
 			    "term too long (%zu)", len);
 			goto err;
 		}
-		if (idx->terms_last_id == MAX_TERM_ID) {
+		if (dict->terms_last_id == MAX_TERM_ID) {
 			nxs_decl_errx(idx->nxs, NXS_ERR_LIMIT,
 			    "reached the term limit (%u)", MAX_TERM_ID);
 			goto err;
@@ -239,7 +341,7 @@ again:
 		 * of the above re-sync), then just put it back to the list.
 		 */
 		if (sync_ran) {
-			term = rhashmap_get(idx->term_map, val, len);
+			term = rhashmap_get(dict->term_map, val, len);
 			if (term) {
 				tokenset_moveback(tokens, token);
 				token->idxterm = term;
@@ -272,11 +374,11 @@ again:
 			    "idxterm_create failed", NULL);
 			goto err;
 		}
-		id = ++idx->terms_last_id;
+		id = ++dict->terms_last_id;
 
 		result_term = idxterm_insert(idx, term, id);
 		if (__predict_false(result_term != term)) {
-			idxterm_destroy(idx, term);
+			idxterm_destroy(idx->dict, term);
 			if (result_term == NULL) {
 				goto err;
 			}
@@ -301,8 +403,8 @@ again:
 	ret = 0;
 err:
 	/* Publish the new data length. */
-	idx->terms_consumed = data_len + append_len;
-	atomic_store_release(&hdr->data_len, htobe32(idx->terms_consumed));
+	dict->terms_consumed = data_len + append_len;
+	atomic_store_release(&hdr->data_len, htobe32(dict->terms_consumed));
 
 	if (idxmap->sync) {
 		msync(hdr, target_len, MS_ASYNC);
@@ -320,7 +422,8 @@ err:
 int
 idx_terms_sync(nxs_index_t *idx)
 {
-	idxmap_t *idxmap = &idx->terms_memmap;
+	idxdict_t *dict = idx->dict;
+	idxmap_t *idxmap = &dict->terms_memmap;
 	size_t seen_data_len, target_len, consumed_len = 0;
 	idxterms_hdr_t *hdr;
 	void *dataptr;
@@ -335,14 +438,14 @@ idx_terms_sync(nxs_index_t *idx)
 	ASSERT(idxmap->fd > 0 && hdr != NULL);
 
 	seen_data_len = be32toh(atomic_load_acquire(&hdr->data_len));
-	if (seen_data_len == idx->terms_consumed) {
+	if (seen_data_len == dict->terms_consumed) {
 		/*
 		 * No new data: there is nothing to do.
 		 */
 		app_dbgx("nothing to consume", NULL);
 		return 0;
 	}
-	ASSERT(idx->terms_consumed < seen_data_len);
+	ASSERT(dict->terms_consumed < seen_data_len);
 
 	/*
 	 * Ensure mapping: verify that it does not exceed the mapping
@@ -356,9 +459,9 @@ idx_terms_sync(nxs_index_t *idx)
 		    "terms mapping failed", NULL);
 		return -1;
 	}
-	target_len = seen_data_len - idx->terms_consumed;
-	dataptr = IDXTERMS_DATA_PTR(hdr, idx->terms_consumed);
-	app_dbgx("current %zu, consuming %zu", idx->terms_consumed, target_len);
+	target_len = seen_data_len - dict->terms_consumed;
+	dataptr = IDXTERMS_DATA_PTR(hdr, dict->terms_consumed);
+	app_dbgx("current %zu, consuming %zu", dict->terms_consumed, target_len);
 
 	/*
 	 * Fetch the terms.
@@ -401,14 +504,101 @@ idx_terms_sync(nxs_index_t *idx)
 			    "idxterm_create failed", NULL);
 			goto err;
 		}
-		id = ++idx->terms_last_id;
+		id = ++dict->terms_last_id;
 		idxterm_insert(idx, term, id);
 		consumed_len += IDXTERMS_BLK_LEN(len);
 	}
 	ASSERT(consumed_len == target_len);
 	ret = 0;
 err:
-	idx->terms_consumed += consumed_len;
+	dict->terms_consumed += consumed_len;
 	app_dbgx("consumed %zu", consumed_len);
 	return ret;
 }
+
+/*
+ * idx_terms_apply: append the replicated terms data (the raw term blocks)
+ * at the given position.  The term total counts are reset, since they
+ * get accounted as the replicated documents are applied.
+ *
+ * => The position must match the current data length of the index.
+ */
+int
+idx_terms_apply(nxs_index_t *idx, size_t pos, const void *data, size_t len)
+{
+	idxdict_t *dict = idx->dict;
+	idxmap_t *idxmap = &dict->terms_memmap;
+	size_t data_len, target_len;
+	idxterms_hdr_t *hdr;
+	void *dataptr;
+	mmrw_t mm;
+	int ret = -1;
+
+	if (len == 0) {
+		return 0;
+	}
+	if (pos + len > UINT32_MAX) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_LIMIT,
+		    "terms data length limit reached", NULL);
+		return -1;
+	}
+
+	/*
+	 * Verify the term blocks before appending.
+	 */
+	mmrw_init(&mm, (void *)(uintptr_t)data, len);
+	while (mm.remaining) {
+		uint16_t tlen;
+
+		if (mmrw_fetch16(&mm, &tlen) == -1 || tlen == 0 ||
+		    mmrw_advance(&mm, tlen + 1 + IDXTERMS_PAD_LEN(tlen)) == -1 ||
+		    mmrw_advance(&mm, 8) == -1) {
+			nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+			    "corrupted replication terms data", NULL);
+			return -1;
+		}
+	}
+
+	if (f_lock_enter(idxmap->fd, LOCK_EX) == -1) {
+		return -1;
+	}
+	hdr = idxmap->baseptr;
+	data_len = be32toh(atomic_load_acquire(&hdr->data_len));
+	if (data_len != pos) {
+		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
+		    "terms replication position mismatch (%zu vs %zu)",
+		    pos, data_len);
+		goto out;
+	}
+
+	target_len = sizeof(idxterms_hdr_t) + data_len + len;
+	if ((hdr = idx_db_map(idxmap, target_len, true)) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
+		    "terms mapping failed", NULL);
+		goto out;
+	}
+	dataptr = IDXTERMS_DATA_PTR(hdr, data_len);
+	memcpy(dataptr, data, len);
+
+	/*
+	 * Reset the total counts.
+	 */
+	mmrw_init(&mm, dataptr, len);
+	while (mm.remaining) {
+		uint16_t tlen;
+
+		mmrw_fetch16(&mm, &tlen);
+		mmrw_advance(&mm, tlen + 1 + IDXTERMS_PAD_LEN(tlen));
+		mmrw_store64(&mm, 0);
+	}
+
+	/* Publish the new data length. */
+	atomic_store_release(&hdr->data_len, htobe32(data_len + len));
+	if (idxmap->sync) {
+		msync(hdr, target_len, MS_ASYNC);
+	}
+	ret = 0;
+out:
+	f_lock_exit(idxmap->fd);
+	return ret ? -1 : idx_terms_sync(idx);
+}
@@ -7,24 +7,31 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <string.h>
 
-#include "deque.h"
 #include "expr.h"
 #include "utils.h"
 
+/*
+ * expr_create: create an expression with the given number of elements.
+ *
+ * => The expressions are allocated from the arena and are released
+ *    together with it.
+ */
 expr_t *
-expr_create(expr_type_t type, unsigned n)
+expr_create(arena_t *arena, expr_type_t type, unsigned n)
 {
 	const size_t len = offsetof(expr_t, elements[n]);
 	expr_t *expr;
 
 	ASSERT(n || type == EXPR_VAL_TOKEN);
 
-	if ((expr = calloc(1, len)) == NULL) {
+	if ((expr = arena_zalloc(arena, len)) == NULL) {
 		return NULL;
 	}
 	expr->type = type;
+	expr->boost = 1.0f;
 	expr->nitems = n;
 	return expr;
 }
@@ -32,14 +39,14 @@ expr_create(expr_type_t type, unsigned n)
 /*
  * expr_create_token: create an expression with a given token value.
  *
- * => The given string will be consumed and released on expr_destroy().
+ * => The given string is referenced (it must be in the same arena).
  */
 expr_t *
-expr_create_token(char *value)
+expr_create_token(arena_t *arena, char *value)
 {
 	expr_t *expr;
 
-	if ((expr = expr_create(EXPR_VAL_TOKEN, 0)) == NULL) {
+	if ((expr = expr_create(arena, EXPR_VAL_TOKEN, 0)) == NULL) {
 		return NULL;
 	}
 	expr->value = value;
@@ -47,11 +54,11 @@ expr_create_token(char *value)
 }
 
 expr_t *
-expr_create_operator(expr_type_t type, expr_t *e1, expr_t *e2)
+expr_create_operator(arena_t *arena, expr_type_t type, expr_t *e1, expr_t *e2)
 {
 	expr_t *expr;
 
-	if ((expr = expr_create(type, 2)) == NULL) {
+	if ((expr = expr_create(arena, type, 2)) == NULL) {
 		return NULL;
 	}
 	ASSERT(EXPR_IS_OPERATOR(expr->type));
@@ -60,35 +67,308 @@ expr_create_operator(expr_type_t type, expr_t *e1, expr_t *e2)
 	return expr;
 }
 
-void
-expr_destroy(expr_t *expr)
+/*
+ * expr_create_filter: create the filter of the given expression, i.e.
+ * it constrains the matching documents, but its tokens are not scored.
+ */
+expr_t *
+expr_create_filter(arena_t *arena, expr_t *e)
 {
-	deque_t *gc;
+	expr_t *expr;
 
-	/*
-	 * G/C list for the expressions.  Begin with itself.
-	 */
-	gc = deque_create(0, 0);
-	deque_push(gc, expr);
+	if ((expr = expr_create(arena, EXPR_OP_FILTER, 1)) == NULL) {
+		return NULL;
+	}
+	expr->boost = 0.0f;
+	expr->elements[0] = e;
+	return expr;
+}
+
+/*
+ * Normalization of the expression tree.
+ *
+ * The grammar produces binary operators, e.g. "a OR b OR c" becomes
+ * OR(OR(a, b), c).  The normalization:
+ *
+ * - Flattens the associative operators (AND, OR) into n-ary nodes.
+ * - Removes the duplicate leaves (referencing the same token).
+ * - Lifts NOT to the top of the conjunction and merges the subtrahends:
+ *   AND(a, NOT(b, c), NOT(d, e)) becomes NOT(AND(a, b, d), c, e) and
+ *   NOT(NOT(a, b), OR(c, d)) becomes NOT(a, b, c, d).  Therefore, it
+ *   can be evaluated as a single "and not" against the union.
+ *
+ * The synonym groups (OR with the group set) are kept intact, so their
+ * cached unions can be used; so are the substrings (n-gram sequences).
+ * The filters are kept as well (their bitmaps are cached too), but the
+ * expressions within them are normalized.
+ *
+ * The boosts are not preserved: they are already applied to the tokens
+ * (see query_tokenize()).
+ *
+ * Note: NOT(a, b, ...) means "a AND NOT (b OR ...)".
+ */
+
+/* Normalization nesting limit (deeper levels are left as is). */
+#define	EXPR_NORMALIZE_RLIMIT	(100)
+
+typedef struct {
+	expr_t **	items;
+	unsigned	count;
+	unsigned	size;
+} expr_vec_t;
+
+static expr_t *	expr_normalize_r(arena_t *, expr_t *, unsigned);
+
+static bool
+expr_same_leaf(const expr_t *e1, const expr_t *e2)
+{
+	return e1->type == EXPR_VAL_TOKEN && e2->type == EXPR_VAL_TOKEN &&
+	    e1->token && e1->token == e2->token;
+}
+
+static int
+expr_vec_add(arena_t *arena, expr_vec_t *vec, expr_t *expr)
+{
+	for (unsigned i = 0; i < vec->count; i++) {
+		if (expr_same_leaf(vec->items[i], expr)) {
+			return 0;
+		}
+	}
+	if (vec->count == vec->size) {
+		const unsigned size = vec->size ? vec->size * 2 : 8;
+		const size_t len = size * sizeof(expr_t *);
+		expr_t **items;
+
+		if ((items = arena_alloc(arena, len)) == NULL) {
+			return -1;
+		}
+		if (vec->count) {
+			memcpy(items, vec->items, vec->count * sizeof(*items));
+		}
+		vec->items = items;
+		vec->size = size;
+	}
+	vec->items[vec->count++] = expr;
+	return 0;
+}
+
+static int
+expr_vec_add_elements(arena_t *arena, expr_vec_t *vec,
+    const expr_t *expr, unsigned first)
+{
+	for (unsigned i = first; i < expr->nitems; i++) {
+		if (expr_vec_add(arena, vec, expr->elements[i]) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static expr_t *
+expr_from_vec(arena_t *arena, expr_type_t type, expr_t *first,
+    const expr_vec_t *vec)
+{
+	const unsigned n = vec->count + (first != NULL);
+	unsigned i = 0;
+	expr_t *expr;
+
+	if (first == NULL && vec->count == 1) {
+		return vec->items[0];
+	}
+	if ((expr = expr_create(arena, type, n)) == NULL) {
+		return NULL;
+	}
+	if (first) {
+		expr->elements[i++] = first;
+	}
+	memcpy(&expr->elements[i], vec->items, vec->count * sizeof(expr_t *));
+	return expr;
+}
+
+#define	EXPR_IS_SPINE(e, t)	((e)->type == (t) && !(e)->group)
+
+/*
+ * expr_get_spine: get the left spine of the operators of the same type
+ * as the given expression (the grammar builds left-deep trees); returns
+ * the array of the spine nodes (top-down) and the bottom-left operand.
+ */
+static expr_t **
+expr_get_spine(arena_t *arena, expr_t *expr, unsigned *np, expr_t **leftp)
+{
+	const expr_type_t type = expr->type;
+	unsigned n = 0;
+	expr_t *node, **spine;
+
+	for (node = expr; EXPR_IS_SPINE(node, type); node = node->elements[0]) {
+		n++;
+	}
+	if ((spine = arena_alloc(arena, n * sizeof(expr_t *))) == NULL) {
+		return NULL;
+	}
+	n = 0;
+	for (node = expr; EXPR_IS_SPINE(node, type); node = node->elements[0]) {
+		spine[n++] = node;
+	}
+	*leftp = node;
+	*np = n;
+	return spine;
+}
+
+/*
+ * expr_add_operand: normalize the operand of AND/OR and add it to the
+ * list of the operands or, for AND, to the list of the subtrahends.
+ */
+static int
+expr_add_operand(arena_t *arena, expr_type_t type, expr_t *op, unsigned r,
+    expr_vec_t *ops, expr_vec_t *negs)
+{
+	if ((op = expr_normalize_r(arena, op, r)) == NULL) {
+		return -1;
+	}
+	if (op->type == type && !op->group) {
+		/* Same operator: flatten. */
+		return expr_vec_add_elements(arena, ops, op, 0);
+	}
+	if (type == EXPR_OP_AND && op->type == EXPR_OP_NOT) {
+		/* Lift the NOT: a AND (b AND NOT c) => (a AND b) AND NOT c */
+		const expr_t *pos = op->elements[0];
+
+		if (pos->type == EXPR_OP_AND) {
+			if (expr_vec_add_elements(arena, ops, pos, 0) == -1)
+				return -1;
+		} else if (expr_vec_add(arena, ops, op->elements[0]) == -1) {
+			return -1;
+		}
+		return expr_vec_add_elements(arena, negs, op, 1);
+	}
+	return expr_vec_add(arena, ops, op);
+}
+
+static expr_t *
+expr_normalize_assoc(arena_t *arena, expr_t *expr, unsigned r)
+{
+	const expr_type_t type = expr->type;
+	expr_vec_t ops = { NULL, 0, 0 }, negs = { NULL, 0, 0 };
+	expr_t **spine, *left, *result;
+	unsigned n;
+
+	if ((spine = expr_get_spine(arena, expr, &n, &left)) == NULL) {
+		return NULL;
+	}
 
 	/*
-	 * Deep-walk and G/C all expressions.
+	 * Collect the operands in order: the bottom-left operand
+	 * and then the right operands of the spine, bottom-up.
 	 */
-	while ((expr = deque_pop_back(gc)) != NULL) {
-		if (expr->type == EXPR_VAL_TOKEN) {
-			ASSERT(expr->nitems == 0);
-			free(expr->value);
-			free(expr);
-			continue;
+	if (expr_add_operand(arena, type, left, r + 1, &ops, &negs) == -1) {
+		return NULL;
+	}
+	while (n--) {
+		const expr_t *node = spine[n];
+
+		for (unsigned i = 1; i < node->nitems; i++) {
+			if (expr_add_operand(arena, type, node->elements[i],
+			    r + 1, &ops, &negs) == -1) {
+				return NULL;
+			}
+		}
+	}
+	if ((result = expr_from_vec(arena, type, NULL, &ops)) == NULL) {
+		return NULL;
+	}
+	if (negs.count) {
+		result = expr_from_vec(arena, EXPR_OP_NOT, result, &negs);
+	}
+	return result;
+}
+
+static int
+expr_add_subtrahend(arena_t *arena, expr_t *op, unsigned r, expr_vec_t *negs)
+{
+	if ((op = expr_normalize_r(arena, op, r)) == NULL) {
+		return -1;
+	}
+	if (op->type == EXPR_OP_OR && !op->group) {
+		/* a AND NOT (b OR c) => NOT(a, b, c) */
+		return expr_vec_add_elements(arena, negs, op, 0);
+	}
+	return expr_vec_add(arena, negs, op);
+}
+
+static expr_t *
+expr_normalize_not(arena_t *arena, expr_t *expr, unsigned r)
+{
+	expr_vec_t negs = { NULL, 0, 0 };
+	expr_t **spine, *pos;
+	unsigned n;
+
+	if ((spine = expr_get_spine(arena, expr, &n, &pos)) == NULL) {
+		return NULL;
+	}
+	if ((pos = expr_normalize_r(arena, pos, r + 1)) == NULL) {
+		return NULL;
+	}
+	if (pos->type == EXPR_OP_NOT) {
+		/* The minuend itself had a NOT lifted. */
+		if (expr_vec_add_elements(arena, &negs, pos, 1) == -1) {
+			return NULL;
 		}
-		for (unsigned i = 0; i < expr->nitems; i++) {
-			expr_t *subexpr = expr->elements[i];
+		pos = pos->elements[0];
+	}
+	while (n--) {
+		const expr_t *node = spine[n];
 
-			if (subexpr) {
-				deque_push(gc, subexpr);
+		for (unsigned i = 1; i < node->nitems; i++) {
+			if (expr_add_subtrahend(arena,
+			    node->elements[i], r + 1, &negs) == -1) {
+				return NULL;
 			}
 		}
-		free(expr);
 	}
-	deque_destroy(gc);
+	return expr_from_vec(arena, EXPR_OP_NOT, pos, &negs);
+}
+
+static expr_t *
+expr_normalize_filter(arena_t *arena, expr_t *expr, unsigned r)
+{
+	expr_t *e;
+
+	if ((e = expr_normalize_r(arena, expr->elements[0], r + 1)) == NULL) {
+		return NULL;
+	}
+	if (e->type == EXPR_OP_FILTER) {
+		/* Nested filter: FILTER(FILTER(a)) => FILTER(a) */
+		return e;
+	}
+	expr->elements[0] = e;
+	return expr;
+}
+
+static expr_t *
+expr_normalize_r(arena_t *arena, expr_t *expr, unsigned r)
+{
+	if (expr->type == EXPR_VAL_TOKEN || expr->type == EXPR_OP_SUBSTR ||
+	    expr->group || r > EXPR_NORMALIZE_RLIMIT) {
+		return expr;
+	}
+	if (expr->type == EXPR_OP_FILTER) {
+		return expr_normalize_filter(arena, expr, r);
+	}
+	if (expr->type == EXPR_OP_NOT) {
+		return expr_normalize_not(arena, expr, r);
+	}
+	return expr_normalize_assoc(arena, expr, r);
+}
+
+/*
+ * expr_normalize: normalize the expression tree (see above).
+ *
+ * => The new nodes are allocated from the arena; the original tree
+ *    may share the nodes with the new one.
+ * => Returns the new root or NULL on failure.
+ */
+expr_t *
+expr_normalize(arena_t *arena, expr_t *expr)
+{
+	return expr_normalize_r(arena, expr, 0);
 }
@@ -8,6 +8,10 @@
 #ifndef _EXPR_H_
 #define _EXPR_H_
 
+#include <inttypes.h>
+
+#include "arena.h"
+
 struct token;
 
 typedef enum {
@@ -17,26 +21,37 @@ typedef enum {
 	EXPR_OP_AND,
 	EXPR_OP_OR,
 	EXPR_OP_NOT,
+	EXPR_OP_SUBSTR,
+	EXPR_OP_FILTER,
 } expr_type_t;
 
 #define	EXPR_IS_OPERATOR(t)	((t) != EXPR_VAL_TOKEN)
 
+/* Maximum boost, also of the nested boosts multiplied. */
+#define	EXPR_BOOST_MAX		(1000.0f)
+
 typedef struct expr {
 	expr_type_t		type;
+	float			boost;		// scoring weight (default 1)
 
 	// EXPR_VAL_TOKEN:
 	char *			value;
 	struct token *		token;
+	unsigned		count;		// occurrences (SUBSTR element)
 
 	// EXPR_IS_OPERATOR:
+	uint64_t		group;		// cache key (synonyms, filter)
+	const void *		group_data;	// filter: canonical form
+	size_t			group_len;
 	unsigned		nitems;
 	struct expr *		elements[];
 } expr_t;
 
-expr_t *	expr_create(expr_type_t, unsigned);
-void		expr_destroy(expr_t *);
+expr_t *	expr_create(arena_t *, expr_type_t, unsigned);
+expr_t *	expr_create_token(arena_t *, char *);
+expr_t *	expr_create_operator(arena_t *, expr_type_t, expr_t *, expr_t *);
+expr_t *	expr_create_filter(arena_t *, expr_t *);
 
-expr_t *	expr_create_token(char *);
-expr_t *	expr_create_operator(expr_type_t, expr_t *, expr_t *);
+expr_t *	expr_normalize(arena_t *, expr_t *);
 
 #endif
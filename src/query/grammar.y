@@ -48,9 +48,9 @@
 
 /*
  * lexval_t has passed-by-value semantics; parser may copy it and save
- * it in its stack.  Strings are consumed and therefore must be destroyed
- * together with the expression (or in a destructor if the values gets
- * popped before it's reduced to an expr).
+ * it in its stack.  The strings and the expressions are allocated from
+ * the query arena, therefore no destructors are needed: everything is
+ * released together with the query.
  */
 %token_prefix TOKEN_
 %token_type { lexval_t }
@@ -59,20 +59,22 @@
 %type expr_list { expr_t * }
 %type value { char * }
 
-%destructor expr_list { expr_destroy($$); }
-%destructor expr { expr_destroy($$); }
-%destructor value { free($$); }
-
-// Use the precedence in logics (¬, ∧, ∨).
+// Use the precedence in logics (¬, ∧, ∨); the boost binds the tightest.
 %left OR.
 %left AND.
 %left NOT.
+%left BOOST.
 
 query ::= expr_list(E).
 {
 	q->root = E;
 }
 
+query ::= id_range expr_list(E).
+{
+	q->root = E;
+}
+
 expr_list(EL) ::= expr(E).
 {
 	EL = E;
@@ -80,22 +82,41 @@ expr_list(EL) ::= expr(E).
 
 expr_list(E) ::= expr_list(L) expr(R).
 {
-	E = expr_create_operator(EXPR_OP_OR, L, R);
+	E = expr_create_operator(q->arena, EXPR_OP_OR, L, R);
+}
+
+// The document ID range applies to the whole query, hence the top level.
+expr_list(EL) ::= expr_list(L) id_range.
+{
+	EL = L;
+}
+
+id_range ::= ID_RANGE(R).
+{
+	query_restrict_ids(q, R.id_min, R.id_max);
 }
 
 expr(E) ::= expr(L) AND expr(R).
 {
-	E = expr_create_operator(EXPR_OP_AND, L, R);
+	E = expr_create_operator(q->arena, EXPR_OP_AND, L, R);
 }
 
 expr(E) ::= expr(L) OR expr(R).
 {
-	E = expr_create_operator(EXPR_OP_OR, L, R);
+	E = expr_create_operator(q->arena, EXPR_OP_OR, L, R);
 }
 
 expr(E) ::= expr(L) AND NOT expr(R).
 {
-	E = expr_create_operator(EXPR_OP_NOT, L, R);
+	E = expr_create_operator(q->arena, EXPR_OP_NOT, L, R);
+}
+
+expr(E) ::= expr(BE) BOOST(B).
+{
+	// Nested boosts multiply, e.g. (a^2 OR b)^3 gives a^6 (capped).
+	if ((E = BE) != NULL) {
+		E->boost = MIN(E->boost * B.fpnum, EXPR_BOOST_MAX);
+	}
 }
 
 expr(E) ::= BR_OPEN expr(BE) BR_CLOSE.
@@ -103,10 +124,16 @@ expr(E) ::= BR_OPEN expr(BE) BR_CLOSE.
 	E = BE;
 }
 
+expr(E) ::= FILTER expr(FE) BR_CLOSE.
+{
+	// Matching only: the filter does not contribute to the score.
+	E = expr_create_filter(q->arena, FE);
+}
+
 expr(E) ::= value(V).
 {
-	// Note: the string value will be consumed rather than copied.
-	E = expr_create_token(V);
+	// Note: the string value is in the arena; it is not copied.
+	E = expr_create_token(q->arena, V);
 }
 
 value(V) ::= FF_STRING(T).
@@ -15,33 +15,94 @@
 #include "query.h"
 #include "utils.h"
 
+/*
+ * query_arena_get: get an arena for the query (or its scratch memory).
+ *
+ * => The index keeps a few arenas of the finished queries for reuse,
+ *    so the steady state search does not hit the system allocator.
+ * => The index may be NULL (e.g. for the parser tests).
+ */
+arena_t *
+query_arena_get(nxs_index_t *idx)
+{
+	for (unsigned i = 0; idx && i < IDX_QUERY_ARENAS; i++) {
+		arena_t *arena = idx->query_arenas[i];
+
+		if (arena) {
+			idx->query_arenas[i] = NULL;
+			return arena;
+		}
+	}
+	return arena_create(0);
+}
+
+/*
+ * query_arena_put: release all memory of the arena and keep it for
+ * reuse, if there is a free slot; otherwise, destroy the arena.
+ *
+ * => The large arenas are destroyed, so that a single broad query does
+ *    not pin its memory on the index handle.
+ */
+void
+query_arena_put(nxs_index_t *idx, arena_t *arena)
+{
+	if (arena_size(arena) > IDX_QUERY_ARENA_MAX) {
+		arena_destroy(arena);
+		return;
+	}
+	for (unsigned i = 0; idx && i < IDX_QUERY_ARENAS; i++) {
+		if (idx->query_arenas[i] == NULL) {
+			arena_reset(arena);
+			idx->query_arenas[i] = arena;
+			return;
+		}
+	}
+	arena_destroy(arena);
+}
+
+/*
+ * query_create: create a new query object.
+ *
+ * => The query and its data are allocated from the arena.
+ */
 query_t *
 query_create(nxs_index_t *idx)
 {
+	arena_t *arena;
 	query_t *q;
 
-	if ((q = calloc(1, sizeof(query_t))) == NULL) {
+	if ((arena = query_arena_get(idx)) == NULL) {
 		return NULL;
 	}
-	if ((q->tokens = tokenset_create()) == NULL) {
-		free(q);
-		return NULL;
+	if ((q = arena_zalloc(arena, sizeof(query_t))) == NULL) {
+		goto err;
 	}
 	q->idx = idx;
+	q->arena = arena;
+	q->id_max = UINT64_MAX;
+
+	if ((q->tokens = tokenset_create_arena(arena)) == NULL) {
+		goto err;
+	}
 	return q;
+err:
+	query_arena_put(idx, arena);
+	return NULL;
 }
 
 void
 query_destroy(query_t *q)
 {
-	if (q->root) {
-		expr_destroy(q->root);
-	}
+	nxs_index_t *idx = q->idx;
+	arena_t *arena = q->arena;
+
 	if (q->errmsg) {
 		free(q->errmsg);
 	}
 	tokenset_destroy(q->tokens);
-	free(q);
+
+	/* Release everything at once. */
+	query_arena_put(idx, arena);
 }
 
 void
@@ -58,6 +119,17 @@ query_set_error(query_t *q)
 	q->error = true;
 }
 
+/*
+ * query_restrict_ids: restrict the results to the given (inclusive)
+ * range of the document IDs; multiple ranges are intersected.
+ */
+void
+query_restrict_ids(query_t *q, uint64_t id_min, uint64_t id_max)
+{
+	q->id_min = MAX(q->id_min, id_min);
+	q->id_max = MIN(q->id_max, id_max);
+}
+
 const char *
 query_get_error(query_t *q)
 {
@@ -72,44 +144,381 @@ query_get_error(query_t *q)
 	return q->errmsg;
 }
 
-int
-query_prepare(query_t *q, unsigned flags)
+/*
+ * query_expand_synonyms: expand the token into an OR sub-expression of
+ * its synonym group, if it has one.
+ *
+ * => The group terms are already processed by the filter pipeline.
+ * => Returns the new expression, the same one if there is no group,
+ *    or NULL on failure.
+ */
+static expr_t *
+query_expand_synonyms(query_t *q, expr_t *expr)
 {
-	filter_pipeline_t *fp = q->idx->fp;
-	deque_t *iter;
+	const nxs_index_t *idx = q->idx;
+	const strbuf_t *str = &expr->token->buffer;
+	unsigned count, n = 1;
+	expr_t *group_expr;
+	uint32_t group;
+
+	if ((group = idxsyn_lookup(idx, str->value, str->length)) == 0) {
+		return expr;
+	}
+	count = idxsyn_group_count(idx, group);
+	if ((group_expr = expr_create(q->arena, EXPR_OP_OR, count)) == NULL) {
+		return NULL;
+	}
+	group_expr->group = idxsyn_group_key(idx, group);
+	group_expr->elements[0] = expr;
+
+	for (unsigned i = 0; i < count; i++) {
+		const char *value;
+		expr_t *syn_expr;
+		char *syn_value;
+		size_t len;
+
+		value = idxsyn_group_term(idx, group, i, &len);
+		if (len == str->length && memcmp(value, str->value, len) == 0) {
+			/* The token itself. */
+			continue;
+		}
+		syn_value = arena_strndup(q->arena, value, len);
+		if (syn_value == NULL ||
+		    (syn_expr = expr_create_token(q->arena, syn_value)) == NULL) {
+			return NULL;
+		}
+		syn_expr->token = tokenset_add_value(q->tokens, value, len);
+		if (syn_expr->token == NULL) {
+			return NULL;
+		}
+		ASSERT(n < count);
+		group_expr->elements[n++] = syn_expr;
+	}
+	ASSERT(n == count);
+	return group_expr;
+}
+
+/*
+ * N-gram mode: the value is a substring, i.e. a conjunction of its
+ * distinct n-grams with their number of occurrences (see search.c).
+ */
+
+typedef struct {
+	arena_t *	arena;
+	expr_t **	items;
+	unsigned	count;
+	unsigned	size;
+} ngram_vec_t;
+
+static int
+query_add_ngram(void *arg, token_t *token)
+{
+	ngram_vec_t *vec = arg;
+	const strbuf_t *str = &token->buffer;
 	expr_t *expr;
-	int ret = -1;
+	char *value;
+
+	for (unsigned i = 0; i < vec->count; i++) {
+		if (vec->items[i]->token == token) {
+			vec->items[i]->count++;
+			return 0;
+		}
+	}
+	value = arena_strndup(vec->arena, str->value, str->length);
+	if (value == NULL ||
+	    (expr = expr_create_token(vec->arena, value)) == NULL) {
+		return -1;
+	}
+	expr->token = token;
+	expr->count = 1;
+
+	ASSERT(vec->count < vec->size);
+	vec->items[vec->count++] = expr;
+	return 0;
+}
+
+/*
+ * query_tokenize_ngrams: replace the value with the substring expression.
+ *
+ * => Returns the new expression, the same one if the value produces
+ *    a single n-gram (or none), or NULL on failure.
+ */
+static expr_t *
+query_tokenize_ngrams(query_t *q, expr_t *expr)
+{
+	const nxs_index_t *idx = q->idx;
+	const size_t len = strlen(expr->value);
+	ngram_vec_t vec;
+	expr_t *substr;
+
+	if (len == 0) {
+		return expr;
+	}
+
+	/* There are at most as many n-grams as there are bytes. */
+	vec.arena = q->arena;
+	vec.items = arena_alloc(q->arena, len * sizeof(expr_t *));
+	vec.count = 0;
+	vec.size = len;
+	if (vec.items == NULL) {
+		return NULL;
+	}
+	if (tokenize_ngrams_value(idx->fp, q->tokens, idx->ngram,
+	    expr->value, len, query_add_ngram, &vec) == -1) {
+		return NULL;
+	}
+	if (vec.count == 0) {
+		return expr;
+	}
+	if (vec.count == 1 && vec.items[0]->count == 1) {
+		expr->token = vec.items[0]->token;
+		return expr;
+	}
+	substr = expr_create(q->arena, EXPR_OP_SUBSTR, vec.count);
+	if (substr == NULL) {
+		return NULL;
+	}
+	memcpy(substr->elements, vec.items, vec.count * sizeof(expr_t *));
+	return substr;
+}
 
-	iter = deque_create(0, 0);
-	deque_push(iter, q->root);
+/*
+ * query_set_weight: set the scoring weight of the token(s) of the value,
+ * i.e. the leaf or the elements of its expansion.
+ *
+ * => If the token is used multiple times, then the highest weight wins.
+ */
+static void
+query_set_weight(expr_t *expr, float weight)
+{
+	const unsigned n = expr->nitems ? expr->nitems : 1;
+
+	for (unsigned i = 0; i < n; i++) {
+		const expr_t *leaf = expr->nitems ? expr->elements[i] : expr;
+		token_t *token = leaf->token;
+
+		ASSERT(leaf->type == EXPR_VAL_TOKEN);
+		if (token && token->weight < weight) {
+			token->weight = weight;
+		}
+	}
+}
+
+/*
+ * query_tokenize: tokenize the values of the expressions, i.e. run
+ * the filter pipeline and build the token set; then expand the tokens
+ * which have synonyms.
+ *
+ * => In the n-gram mode, the values are split into the n-grams instead
+ *    (there are no synonyms).
+ * => The boosts are multiplied along the path to the value (capped by
+ *    EXPR_BOOST_MAX) and set as the weights of its tokens.
+ */
+static int
+query_tokenize(query_t *q)
+{
+	filter_pipeline_t *fp = q->idx->fp;
+	unsigned depth = 0;
+	expr_t ***stack;
+	float *weights;
+
+	/*
+	 * The stack for the walk (of the references to the expressions,
+	 * so they can be replaced, and their accumulated boosts): the tree
+	 * has the values as leaves and the binary operators, i.e. fewer
+	 * than 2 * nvalues nodes.
+	 */
+	stack = arena_alloc(q->arena, 2 * q->nvalues * sizeof(expr_t **));
+	weights = arena_alloc(q->arena, 2 * q->nvalues * sizeof(float));
+	if (stack == NULL || weights == NULL) {
+		return -1;
+	}
+	stack[depth] = &q->root;
+	weights[depth++] = 1.0f;
 
 	/*
 	 * Deep-walk the expressions and obtain the tokens.
 	 */
-	while ((expr = deque_pop_back(iter)) != NULL) {
+	while (depth) {
+		expr_t **exprp = stack[--depth];
+		expr_t *expr = *exprp;
+		const float weight = MIN(weights[depth] * expr->boost,
+		    EXPR_BOOST_MAX);
+
 		if (EXPR_IS_OPERATOR(expr->type)) {
 			for (unsigned i = 0; i < expr->nitems; i++) {
-				expr_t *subexpr = expr->elements[i];
-				deque_push(iter, subexpr);
+				ASSERT(depth < 2 * q->nvalues);
+				stack[depth] = &expr->elements[i];
+				weights[depth++] = weight;
 			}
 			continue;
 		}
 		ASSERT(expr->nitems == 0);
 
+		if (q->idx->ngram) {
+			if ((*exprp = query_tokenize_ngrams(q, expr)) == NULL) {
+				return -1;
+			}
+			query_set_weight(*exprp, weight);
+			continue;
+		}
+
 		/*
-		 * Tokenize the value; if there is no term in use,
+		 * Tokenize the value; if the filters discard it,
 		 * then the expr->token will remain NULL.
 		 */
 		if (tokenize_value(fp, q->tokens, expr->value,
 		    strlen(expr->value), &expr->token) == -1) {
-			goto err;
+			return -1;
 		}
+		if (expr->token &&
+		    (*exprp = query_expand_synonyms(q, expr)) == NULL) {
+			return -1;
+		}
+		query_set_weight(*exprp, weight);
 	}
+	return 0;
+}
 
-	/* Resolve tokens to terms, removing those not in use. */
-	tokenset_resolve(q->tokens, q->idx, TOKENSET_TRIM | flags);
-	ret = 0;
-err:
-	deque_destroy(iter);
-	return ret;
+/*
+ * Cache keys of the filters: the canonical form of the normalized
+ * expression within the filter, i.e. its operators and the token values
+ * serialized in the depth-first order.  The cache entry keeps the whole
+ * form and it is compared on lookup; its hash (64-bit FNV-1a) with the
+ * top bit set, to separate it from the synonym group keys, is only used
+ * to find the entry.
+ */
+
+#define	FILTER_KEY_FLAG		(UINT64_C(1) << 63)
+#define	FILTER_KEY_RLIMIT	(100)
+#define	FILTER_KEY_MAXLEN	(4096)
+
+#define	FNV64_OFFSET		UINT64_C(0xcbf29ce484222325)
+#define	FNV64_PRIME		UINT64_C(0x100000001b3)
+
+static uint64_t
+query_hash_bytes(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t h = FNV64_OFFSET;
+
+	while (len--) {
+		h ^= *p++;
+		h *= FNV64_PRIME;
+	}
+	return h;
+}
+
+static size_t
+query_put_bytes(unsigned char *buf, size_t off, const void *p, size_t len)
+{
+	if (buf) {
+		memcpy(&buf[off], p, len);
+	}
+	return off + len;
+}
+
+/*
+ * query_serialize_expr: serialize the expression into the buffer at
+ * the given offset or, if the buffer is NULL, just compute the length.
+ *
+ * => Returns the offset past the expression or zero if the expression
+ *    is too deep or too long.
+ */
+static size_t
+query_serialize_expr(const expr_t *expr, unsigned char *buf, size_t off,
+    unsigned r)
+{
+	const uint32_t hdr[] = { expr->type, expr->nitems, expr->count };
+	const token_t *token = expr->token;
+
+	if (r > FILTER_KEY_RLIMIT || off > FILTER_KEY_MAXLEN) {
+		return 0;
+	}
+	off = query_put_bytes(buf, off, hdr, sizeof(hdr));
+
+	if (expr->type == EXPR_VAL_TOKEN) {
+		const strbuf_t *str = token ? &token->buffer : NULL;
+		const uint32_t len = str ? str->length : UINT32_MAX;
+
+		off = query_put_bytes(buf, off, &len, sizeof(len));
+		if (str) {
+			off = query_put_bytes(buf, off, str->value, len);
+		}
+		return off > FILTER_KEY_MAXLEN ? 0 : off;
+	}
+	for (unsigned i = 0; i < expr->nitems; i++) {
+		off = query_serialize_expr(expr->elements[i], buf, off, r + 1);
+		if (off == 0) {
+			return 0;
+		}
+	}
+	return off;
+}
+
+/*
+ * query_set_filter_keys: set the cache keys of the filters (if the
+ * expression is too deep or too long, then the filter is not cached).
+ */
+static void
+query_set_filter_keys(query_t *q, expr_t *expr, unsigned r)
+{
+	if (!EXPR_IS_OPERATOR(expr->type) || r > FILTER_KEY_RLIMIT) {
+		return;
+	}
+	if (expr->type == EXPR_OP_FILTER) {
+		const expr_t *fexpr = expr->elements[0];
+		unsigned char *buf;
+		size_t len;
+
+		len = query_serialize_expr(fexpr, NULL, 0, r + 1);
+		if (len && (buf = arena_alloc(q->arena, len)) != NULL) {
+			(void)query_serialize_expr(fexpr, buf, 0, r + 1);
+			expr->group = query_hash_bytes(buf, len) |
+			    FILTER_KEY_FLAG;
+			expr->group_data = buf;
+			expr->group_len = len;
+		}
+	}
+	for (unsigned i = 0; i < expr->nitems; i++) {
+		query_set_filter_keys(q, expr->elements[i], r + 1);
+	}
+}
+
+/*
+ * query_resolve: (re-)resolve the tokens to terms.
+ *
+ * => The tokens which are not in use remain in the set, but without
+ *    the term (the expressions reference them).
+ */
+void
+query_resolve(query_t *q, unsigned flags)
+{
+	ASSERT((flags & (TOKENSET_STAGE | TOKENSET_TRIM)) == 0);
+
+	tokenset_unresolve(q->tokens);
+	tokenset_resolve(q->tokens, q->idx, flags);
+}
+
+/*
+ * query_prepare: tokenize the query values, normalize the expression
+ * tree, set the cache keys of the filters and resolve the tokens to terms.
+ *
+ * => The tokens are resolved last, so the normalized tree does not
+ *    depend on the index state (it is reused by the prepared queries).
+ */
+int
+query_prepare(query_t *q, unsigned flags)
+{
+	if (q->root) {
+		if (query_tokenize(q) == -1) {
+			return -1;
+		}
+		if ((q->root = expr_normalize(q->arena, q->root)) == NULL) {
+			return -1;
+		}
+		query_set_filter_keys(q, q->root, 0);
+	}
+	query_resolve(q, flags);
+	return 0;
 }
@@ -22,6 +22,10 @@ typedef union {
 		char *	str;
 		size_t	len;
 	};
+	struct {
+		uint64_t	id_min;
+		uint64_t	id_max;
+	};
 	double		fpnum;
 } lexval_t;
 
@@ -44,11 +48,22 @@ int		lex(query_t *);
 struct query {
 	nxs_index_t *	idx;
 
-	/* Lexer and the root expression. */
+	/*
+	 * Arena for the query: the lexer values, expressions and tokens
+	 * are allocated from it and released all at once.
+	 */
+	arena_t *	arena;
+
+	/* Lexer, the number of values and the root expression. */
 	lexer_t		lexer;
 	lexval_t	lval;
+	unsigned	nvalues;
 	expr_t *	root;
 
+	/* Document ID range (inclusive) to restrict the results to. */
+	uint64_t	id_min;
+	uint64_t	id_max;
+
 	/* Syntax error with the message. */
 	char *		errmsg;
 	bool		error;
@@ -59,11 +74,16 @@ struct query {
 
 #endif
 
+arena_t *	query_arena_get(nxs_index_t *);
+void		query_arena_put(nxs_index_t *, arena_t *);
+
 query_t *	query_create(nxs_index_t *);
 void		query_destroy(query_t *);
 
 int		query_parse(query_t *, const char *);
 int		query_prepare(query_t *, unsigned);
+void		query_resolve(query_t *, unsigned);
+void		query_restrict_ids(query_t *, uint64_t, uint64_t);
 
 void		query_set_error(query_t *);
 const char *	query_get_error(query_t *);
@@ -52,11 +52,27 @@
  *                 continue
  *             score = rank(term_id, doc_id)
  *             doc_scores[doc_id] += score
+ *
+ * The documents are visited in the ascending order of their IDs, so
+ * each term keeps an iterator over its bitmap which only seeks forward:
+ * the membership test is mostly a scan within the current container.
+ *
+ * The floating point addition is not associative, therefore the sum
+ * depends on the order of the terms in the query.  In the stable mode,
+ * the terms (including the fuzzy expansions) are scored in the order
+ * of their values and the sum is accumulated in double precision, so
+ * the equivalent queries produce bit-identical scores.  The results
+ * are always ordered by the score and then by the document ID.
+ *
+ * The expressions within FILTER(...) only constrain the matching
+ * documents: their tokens have zero weight, so they are not scored,
+ * and the bitmaps of the filters are cached (as the synonym groups).
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define __NXSLIB_PRIVATE
 #include "nxs_impl.h"
@@ -73,13 +89,16 @@ typedef struct {
 	uint64_t		limit;
 	ranking_algo_t		algo;
 	unsigned		tflags;
+	unsigned		timeout;
+	bool			stable;
+	nxs_doc_id_t		id_min;
+	nxs_doc_id_t		id_max;
 } search_params_t;
 
 static int
 get_search_params(nxs_index_t *idx, nxs_params_t *params, search_params_t *sp)
 {
-	const char *s;
-	bool fl;
+	const nxs_sparams_t *csp;
 
 	/*
 	 * Set some defaults.
@@ -88,89 +107,464 @@ get_search_params(nxs_index_t *idx, nxs_params_t *params, search_params_t *sp)
 	sp->limit = NXS_DEFAULT_RESULTS_LIMIT;
 	sp->tflags = TOKENSET_FUZZYMATCH;
 	sp->algo = idx->algo;
+	sp->id_max = UINT64_MAX;
+
+	/* The n-grams are matched exactly. */
+	if (idx->ngram) {
+		sp->tflags &= ~TOKENSET_FUZZYMATCH;
+	}
 
 	if (!params) {
 		return 0;
 	}
 
-	if (nxs_params_get_uint(params, "limit", &sp->limit) == 0 &&
-	    (sp->limit == 0 || sp->limit > UINT_MAX)) {
-		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
-		    "invalid limit", NULL);
+	/*
+	 * Get the compiled (validated) parameters.
+	 */
+	if ((csp = nxs_params_get_search(idx->nxs, params)) == NULL) {
 		return -1;
 	}
-	if ((s = nxs_params_get_str(params, "algo")) != NULL &&
-	    (sp->algo = get_ranking_func_id(s)) == INVALID_ALGO) {
-		nxs_decl_errx(idx->nxs, NXS_ERR_INVALID,
-		    "invalid algorithm", NULL);
-		return -1;
+	if (csp->set & NXS_SPARAM_LIMIT) {
+		sp->limit = csp->limit;
+	}
+	if (csp->set & NXS_SPARAM_ALGO) {
+		sp->algo = csp->algo;
 	}
-	if (nxs_params_get_bool(params, "fuzzymatch", &fl) == 0 && !fl) {
+	if ((csp->set & NXS_SPARAM_FUZZYMATCH) && !csp->fuzzymatch) {
 		sp->tflags &= ~TOKENSET_FUZZYMATCH;
 	}
+	if (csp->set & NXS_SPARAM_TIMEOUT) {
+		sp->timeout = csp->timeout;
+	}
+	if (csp->set & NXS_SPARAM_STABLE) {
+		sp->stable = csp->stable;
+	}
+	if (csp->set & NXS_SPARAM_IDRANGE) {
+		sp->id_min = csp->id_min;
+		sp->id_max = csp->id_max;
+	}
+	return 0;
+}
+
+/*
+ * get_deadline: get the search deadline (monotonic time in milliseconds)
+ * for the given timeout; zero means no deadline.
+ */
+static uint64_t
+get_deadline(unsigned timeout)
+{
+	struct timespec ts;
+
+	if (timeout == 0) {
+		return 0;
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000) + timeout;
+}
+
+static bool
+deadline_passed(uint64_t deadline)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000) >= deadline;
+}
+
+/*
+ * Operand of the expression evaluation: the document bitmap (NULL if
+ * empty) which is either referenced (the term bitmap) or allocated as
+ * an intermediate result.
+ */
+typedef struct {
+	const roaring64_bitmap_t *bm;
+	roaring64_bitmap_t *	tmp;
+	uint64_t		card;
+} operand_t;
+
+static void
+operand_release(operand_t *op)
+{
+	if (op->tmp) {
+		roaring64_bitmap_free(op->tmp);
+	}
+	op->bm = op->tmp = NULL;
+}
+
+static int
+operand_card_cmp(const void *p1, const void *p2)
+{
+	const operand_t *op1 = p1, *op2 = p2;
+
+	if (op1->card < op2->card)
+		return -1;
+	if (op1->card > op2->card)
+		return 1;
 	return 0;
 }
 
+static int	get_expr_bitmap(nxs_index_t *, arena_t *, expr_t *,
+		    unsigned, operand_t *);
+
+/*
+ * get_operands: evaluate the given elements of the expression.
+ *
+ * => If 'all' is false, then stop at the first empty operand (and
+ *    release the evaluated ones); returns the number of operands.
+ */
+static int
+get_operands(nxs_index_t *idx, arena_t *scratch, expr_t *expr,
+    unsigned first, unsigned r, bool all, operand_t **opsp)
+{
+	const unsigned n = expr->nitems - first;
+	operand_t *ops;
+
+	if ((ops = arena_alloc(scratch, n * sizeof(operand_t))) == NULL) {
+		return -1;
+	}
+	for (unsigned i = 0; i < n; i++) {
+		operand_t *op = &ops[i];
+
+		int ret;
+
+		ret = get_expr_bitmap(idx, scratch,
+		    expr->elements[first + i], r + 1, op);
+		if (ret == -1 || (!all && op->bm == NULL)) {
+			while (i--) {
+				operand_release(&ops[i]);
+			}
+			*opsp = NULL;
+			return ret;
+		}
+	}
+	*opsp = ops;
+	return n;
+}
+
+/*
+ * eval_union: compute the union of the operands (many-way OR).
+ *
+ * => The operands are consumed; the result may reference one of them.
+ */
+static void
+eval_union(operand_t *ops, unsigned n, operand_t *result)
+{
+	operand_t *base = NULL;
+
+	/*
+	 * Use the largest intermediate result (if any) or otherwise the
+	 * largest bitmap as the base, so the fewest containers are copied.
+	 */
+	for (unsigned i = 0; i < n; i++) {
+		operand_t *op = &ops[i];
+
+		if (op->bm == NULL) {
+			continue;
+		}
+		op->card = roaring64_bitmap_get_cardinality(op->bm);
+		if (base == NULL || (op->tmp && !base->tmp) ||
+		    (!op->tmp == !base->tmp && op->card > base->card)) {
+			base = op;
+		}
+	}
+	if (base == NULL) {
+		/* All operands are empty. */
+		return;
+	}
+	*result = *base;
+	base->bm = base->tmp = NULL;
+
+	for (unsigned i = 0; i < n; i++) {
+		operand_t *op = &ops[i];
+
+		if (op->bm == NULL) {
+			continue;
+		}
+		if (result->tmp == NULL) {
+			result->tmp = roaring64_bitmap_or(result->bm, op->bm);
+			result->bm = result->tmp;
+		} else {
+			roaring64_bitmap_or_inplace(result->tmp, op->bm);
+		}
+		operand_release(op);
+	}
+}
+
+/*
+ * eval_intersection: compute the intersection of the operands (many-way
+ * AND), starting from the smallest bitmaps.
+ *
+ * => The operands are consumed; the result may reference one of them.
+ */
+static void
+eval_intersection(operand_t *ops, unsigned n, operand_t *result)
+{
+	for (unsigned i = 0; i < n; i++) {
+		ops[i].card = roaring64_bitmap_get_cardinality(ops[i].bm);
+	}
+	qsort(ops, n, sizeof(operand_t), operand_card_cmp);
+
+	*result = ops[0];
+	for (unsigned i = 1; i < n; i++) {
+		operand_t *op = &ops[i];
+
+		if (result->bm == NULL) {
+			operand_release(op);
+			continue;
+		}
+		if (result->tmp == NULL) {
+			result->tmp = roaring64_bitmap_and(result->bm, op->bm);
+			result->bm = result->tmp;
+		} else {
+			roaring64_bitmap_and_inplace(result->tmp, op->bm);
+		}
+		operand_release(op);
+
+		/* Stop early if the intersection is empty. */
+		if (roaring64_bitmap_is_empty(result->bm)) {
+			operand_release(result);
+		}
+	}
+}
+
+/*
+ * verify_substr: verify the candidate documents of the substring, i.e.
+ * check that each n-gram occurs in the document at least as many times
+ * as in the substring.
+ *
+ * => The positions are not stored in the index, therefore the n-grams
+ *    are not checked for contiguity: there may be false positives,
+ *    e.g. "abc" (n = 2) matches the document "ab xbc".
+ */
+static int
+verify_substr(nxs_index_t *idx, const expr_t *expr, operand_t *result)
+{
+	roaring64_iterator_t *it;
+	roaring64_bitmap_t *rejected;
+	unsigned i;
+	int ret = -1;
+
+	for (i = 0; i < expr->nitems; i++) {
+		if (expr->elements[i]->count > 1)
+			break;
+	}
+	if (i == expr->nitems || result->bm == NULL) {
+		/* Nothing to verify. */
+		return 0;
+	}
+	if ((rejected = roaring64_bitmap_create()) == NULL) {
+		goto out;
+	}
+	it = roaring64_iterator_create(result->bm);
+	while (roaring64_iterator_has_value(it)) {
+		const nxs_doc_id_t doc_id = roaring64_iterator_value(it);
+		idxdoc_t *doc;
+
+		if ((doc = idxdoc_lookup(idx, doc_id)) == NULL) {
+			roaring64_iterator_free(it);
+			goto out;
+		}
+		for (i = 0; i < expr->nitems; i++) {
+			const expr_t *gram = expr->elements[i];
+			const idxterm_t *term = gram->token->idxterm;
+
+			if (gram->count > 1 && idxdoc_get_termcount(idx,
+			    doc, term->id) < (int)gram->count) {
+				roaring64_bitmap_add(rejected, doc_id);
+				break;
+			}
+		}
+		roaring64_iterator_advance(it);
+	}
+	roaring64_iterator_free(it);
+
+	if (result->tmp) {
+		roaring64_bitmap_andnot_inplace(result->tmp, rejected);
+	} else {
+		result->tmp = roaring64_bitmap_andnot(result->bm, rejected);
+		result->bm = result->tmp;
+	}
+	if (roaring64_bitmap_is_empty(result->bm)) {
+		operand_release(result);
+	}
+	ret = 0;
+out:
+	if (rejected) {
+		roaring64_bitmap_free(rejected);
+	}
+	if (ret == -1) {
+		operand_release(result);
+	}
+	return ret;
+}
+
+/*
+ * group_cacheable: the union of the synonym group may be cached only
+ * if it depends on the index state alone, i.e. there are no fuzzy
+ * expansions (which depend on the search parameters).
+ */
+static bool
+group_cacheable(const expr_t *expr)
+{
+	for (unsigned i = 0; i < expr->nitems; i++) {
+		const token_t *token = expr->elements[i]->token;
+
+		if (token && token->fuzzy) {
+			return false;
+		}
+	}
+	return true;
+}
+
 /*
- * get_expr_bitmap: recursive process AND/OR/NOT expressions and produce
- * the resulting document bitmap.
+ * filter_cacheable: the bitmap of the filter may be cached only if it
+ * depends on the index state alone, i.e. each token is either resolved
+ * to its term exactly or discarded by the filter pipeline (the fuzzy
+ * expansions depend on the search parameters).
  */
-static roaring64_bitmap_t *
-get_expr_bitmap(nxs_index_t *idx, expr_t *expr, unsigned r)
+static bool
+filter_cacheable(const expr_t *expr, unsigned r)
 {
-	roaring64_bitmap_t *result;
-	expr_t *subexpr;
+	const token_t *token = expr->token;
+
+	if (r > NXS_QUERY_RLIMIT) {
+		return false;
+	}
+	if (expr->type == EXPR_VAL_TOKEN) {
+		return !token || (token->idxterm && !token->fuzzy);
+	}
+	for (unsigned i = 0; i < expr->nitems; i++) {
+		if (!filter_cacheable(expr->elements[i], r + 1)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * get_expr_bitmap: recursively process the (normalized) AND/OR/NOT/SUBSTR
+ * and FILTER expressions and produce the resulting document bitmap.
+ */
+static int
+get_expr_bitmap(nxs_index_t *idx, arena_t *scratch, expr_t *expr,
+    unsigned r, operand_t *result)
+{
+	operand_t *ops, minuend;
+	int n;
 
 	ASSERT(expr != NULL);
+	memset(result, 0, sizeof(operand_t));
 
 	if (r > NXS_QUERY_RLIMIT) {
 		nxs_decl_errx(idx->nxs, NXS_ERR_LIMIT,
 		    "query nesting limit reached (%u levels)",
 		    NXS_QUERY_RLIMIT, NULL);
-		return NULL;
+		return -1;
 	}
 
 	if (expr->type == EXPR_VAL_TOKEN) {
 		const token_t *token = expr->token;
 
-		if (token) {
-			const idxterm_t *term = token->idxterm;
-			return roaring64_bitmap_copy(term->doc_bitmap);
+		if (token && token->fuzzy) {
+			/* Weighted disjunction: the cached union. */
+			result->bm = idxfuzzy_get_docs(idx, token->fuzzy);
+		} else if (token && token->idxterm) {
+			result->bm = idxterm_get_docs(idx, token->idxterm);
 		}
-		return roaring64_bitmap_create();
+		return 0;
 	}
 	ASSERT(expr->nitems > 0);
 
-	subexpr = expr->elements[0];
-	if ((result = get_expr_bitmap(idx, subexpr, r + 1)) == NULL) {
-		return NULL;
-	}
-
-	for (unsigned i = 1; i < expr->nitems; i++) {
-		roaring64_bitmap_t *elm;
-
-		subexpr = expr->elements[i];
-		if ((elm = get_expr_bitmap(idx, subexpr, r + 1)) == NULL) {
-			roaring64_bitmap_free(result);
-			return NULL;
+	switch (expr->type) {
+	case EXPR_OP_AND:
+		/* Any empty operand makes the result empty. */
+		n = get_operands(idx, scratch, expr, 0, r, false, &ops);
+		if (n <= 0) {
+			return n;
+		}
+		eval_intersection(ops, n, result);
+		return 0;
+	case EXPR_OP_SUBSTR:
+		/* All n-grams, with their number of occurrences. */
+		n = get_operands(idx, scratch, expr, 0, r, false, &ops);
+		if (n <= 0) {
+			return n;
 		}
+		eval_intersection(ops, n, result);
+		return verify_substr(idx, expr, result);
+	case EXPR_OP_OR:
+		if (expr->group && (result->bm = idxsyn_cache_get(idx,
+		    expr->group, NULL, 0)) != NULL) {
+			return 0;
+		}
+		n = get_operands(idx, scratch, expr, 0, r, true, &ops);
+		if (n <= 0) {
+			return n;
+		}
+		eval_union(ops, n, result);
+		if (expr->group && result->tmp && group_cacheable(expr) &&
+		    idxsyn_cache_put(idx, expr->group,
+		    NULL, 0, result->tmp) == 0) {
+			/* The cache took the ownership of the union. */
+			result->tmp = NULL;
+		}
+		return 0;
+	case EXPR_OP_NOT:
+		/*
+		 * Single "and not" against the union of the subtrahends.
+		 */
+		if (get_expr_bitmap(idx, scratch,
+		    expr->elements[0], r + 1, &minuend) == -1) {
+			return -1;
+		}
+		if (minuend.bm == NULL) {
+			return 0;
+		}
+		n = get_operands(idx, scratch, expr, 1, r, true, &ops);
+		if (n < 0) {
+			operand_release(&minuend);
+			return -1;
+		}
+		if (n > 0) {
+			operand_t subtrahend;
 
-		switch (expr->type) {
-		case EXPR_OP_AND:
-			roaring64_bitmap_and_inplace(result, elm);
-			break;
-		case EXPR_OP_OR:
-			roaring64_bitmap_or_inplace(result, elm);
-			break;
-		case EXPR_OP_NOT:
-			roaring64_bitmap_andnot_inplace(result, elm);
-			break;
-		default:
-			abort();
+			eval_union(ops, n, &subtrahend);
+			if (subtrahend.bm && minuend.tmp) {
+				roaring64_bitmap_andnot_inplace(minuend.tmp,
+				    subtrahend.bm);
+			} else if (subtrahend.bm) {
+				minuend.tmp = roaring64_bitmap_andnot(
+				    minuend.bm, subtrahend.bm);
+				minuend.bm = minuend.tmp;
+			}
+			operand_release(&subtrahend);
+		}
+		*result = minuend;
+		return 0;
+	case EXPR_OP_FILTER:
+		/*
+		 * Matching only (the tokens are not scored): the cached
+		 * bitmap of the filter expression.
+		 */
+		if (expr->group && (result->bm = idxsyn_cache_get(idx,
+		    expr->group, expr->group_data, expr->group_len)) != NULL) {
+			return 0;
 		}
-		roaring64_bitmap_free(elm);
+		if (get_expr_bitmap(idx, scratch,
+		    expr->elements[0], r + 1, result) == -1) {
+			return -1;
+		}
+		if (expr->group && result->tmp &&
+		    filter_cacheable(expr->elements[0], 0) &&
+		    idxsyn_cache_put(idx, expr->group, expr->group_data,
+		    expr->group_len, result->tmp) == 0) {
+			result->tmp = NULL;
+		}
+		return 0;
+	default:
+		abort();
 	}
-	return result;
+	return -1;
 }
 
 static query_t *
@@ -194,6 +588,7 @@ construct_query(nxs_index_t *idx, const char *query, size_t len __unused,
 		    "query failed with %s", query_get_error(q));
 		goto err;
 	}
+	query_restrict_ids(q, sp->id_min, sp->id_max);
 
 	/* Resolve the tokens to terms. */
 	if (query_prepare(q, sp->tflags) == -1) {
@@ -207,90 +602,315 @@ err:
 	return NULL;
 }
 
+/*
+ * Scoring: the weighted terms of the query (including the fuzzy
+ * expansions), each with the iterator over its document bitmap.
+ *
+ * The matching documents are scored in the ascending order, therefore
+ * the term iterators advance in lockstep with it: the membership test
+ * is a forward seek within the current container rather than a lookup
+ * from the root of the bitmap for each document and term.
+ */
+typedef struct {
+	const idxterm_t *	term;
+	float			weight;
+	roaring64_iterator_t *	it;
+} score_term_t;
+
+static int
+score_term_cmp(const void *p1, const void *p2)
+{
+	const score_term_t *st1 = p1, *st2 = p2;
+	const idxterm_t *t1 = st1->term, *t2 = st2->term;
+	int ret;
+
+	ret = memcmp(t1->value, t2->value, MIN(t1->value_len, t2->value_len));
+	if (ret) {
+		return ret;
+	}
+	if (t1->value_len != t2->value_len) {
+		return t1->value_len < t2->value_len ? -1 : 1;
+	}
+	if (st1->weight != st2->weight) {
+		return st1->weight < st2->weight ? -1 : 1;
+	}
+	return 0;
+}
+
+static void
+score_terms_release(score_term_t *terms, unsigned nterms)
+{
+	for (unsigned i = 0; i < nterms; i++) {
+		roaring64_iterator_free(terms[i].it);
+	}
+}
+
+/*
+ * get_score_terms: collect the weighted terms of the tokens, which are
+ * used in the index and scored (i.e. not only in the filters or with
+ * the zero boost), and create the iterators over their documents.
+ *
+ * => The terms are in the query order or, in the stable mode, sorted by
+ *    the term value (and the weight).  The term IDs are local to the
+ *    index, hence the values are used.
+ * => Returns the number of terms or -1 on failure.
+ */
+static int
+get_score_terms(nxs_index_t *idx, tokenset_t *tokens, bool stable,
+    arena_t *scratch, score_term_t **termsp)
+{
+	score_term_t *terms;
+	unsigned n = 0;
+	token_t *token;
+
+	TAILQ_FOREACH(token, &tokens->list, entry) {
+		n += token->fuzzy ? token->fuzzy->count : 1;
+	}
+	if ((terms = arena_alloc(scratch, n * sizeof(score_term_t))) == NULL) {
+		return -1;
+	}
+	n = 0;
+	TAILQ_FOREACH(token, &tokens->list, entry) {
+		const idxfuzzy_t *fz = token->fuzzy;
+		const unsigned count = fz ? fz->count : 1;
+
+		for (unsigned i = 0; i < count; i++) {
+			const idxterm_t *term = fz ?
+			    fz->terms[i].term : token->idxterm;
+			const float weight = fz ?
+			    fz->terms[i].weight * token->weight : token->weight;
+			const roaring64_bitmap_t *bm;
+
+			/* Note: the filter-only tokens have zero weight. */
+			if (term == NULL || weight == 0 ||
+			    (bm = idxterm_get_docs(idx, term)) == NULL) {
+				continue;
+			}
+			terms[n].it = roaring64_iterator_create(bm);
+			if (terms[n].it == NULL) {
+				score_terms_release(terms, n);
+				return -1;
+			}
+			terms[n].term = term;
+			terms[n].weight = weight;
+			n++;
+		}
+	}
+	if (stable) {
+		qsort(terms, n, sizeof(score_term_t), score_term_cmp);
+	}
+	*termsp = terms;
+	return n;
+}
+
+/*
+ * score_term_match: determine whether the term is used in the document.
+ *
+ * => The document IDs must be given in the ascending order.
+ */
+static inline bool
+score_term_match(score_term_t *st, nxs_doc_id_t doc_id)
+{
+	roaring64_iterator_t *it = st->it;
+
+	if (!roaring64_iterator_has_value(it)) {
+		return false;
+	}
+	if (roaring64_iterator_value(it) < doc_id &&
+	    !roaring64_iterator_move_equalorlarger(it, doc_id)) {
+		return false;
+	}
+	return roaring64_iterator_value(it) == doc_id;
+}
+
+/*
+ * score_doc: score the document for each term it uses.
+ *
+ * => The scores are added to the response in the term order or, in the
+ *    stable mode, summed in double precision and added once.
+ * => The document which matches only the filters has the zero score.
+ */
+static int
+score_doc(nxs_index_t *idx, const nxs_stats_t *stats, ranking_func_t rank,
+    score_term_t *terms, unsigned nterms, bool stable,
+    nxs_doc_id_t doc_id, nxs_resp_t *resp)
+{
+	idxdoc_t *doc = NULL;
+	bool scored = false;
+	double sum = 0;
+
+	for (unsigned i = 0; i < nterms; i++) {
+		const float weight = terms[i].weight;
+		float score;
+
+		if (!score_term_match(&terms[i], doc_id)) {
+			continue;
+		}
+		if (doc == NULL && (doc = idxdoc_lookup(idx, doc_id)) == NULL) {
+			return -1;
+		}
+		if ((score = rank(idx, stats, terms[i].term, doc)) < 0) {
+			/*
+			 * Negative value means no score to be given.
+			 */
+			continue;
+		}
+		if (!stable) {
+			if (nxs_resp_addresult(resp, doc,
+			    score * weight) == -1) {
+				return -1;
+			}
+			continue;
+		}
+		sum += (double)score * weight;
+		scored = true;
+	}
+	if (doc == NULL) {
+		/* No scored term: matched by the filters. */
+		if ((doc = idxdoc_lookup(idx, doc_id)) == NULL) {
+			return -1;
+		}
+		return nxs_resp_addresult(resp, doc, 0);
+	}
+	return scored ? nxs_resp_addresult(resp, doc, (float)sum) : 0;
+}
+
+/* Check the deadline every this many documents. */
+#define	NXS_DEADLINE_CHECK_MASK	(1024 - 1)
+
 static int
-run_query_logic(query_t *query, ranking_func_t rank, nxs_resp_t *resp)
+run_query_logic(query_t *query, const nxs_stats_t *stats,
+    ranking_func_t rank, uint64_t deadline, bool stable,
+    arena_t *scratch, nxs_resp_t *resp)
 {
 	nxs_index_t *idx = query->idx;
 	tokenset_t *tokens = query->tokens;
 	roaring64_iterator_t *bm_iter;
-	roaring64_bitmap_t *doc_bitmap;
-	int ret = -1;
+	score_term_t *terms;
+	operand_t doc_bitmap;
+	unsigned ndocs = 0;
+	int nterms, ret = -1;
 
 	/*
 	 * If there are no expressions or meaningful tokens (terms in use),
 	 * then then just return without an error, since such search merely
 	 * produces an empty search results.
 	 */
-	if (!query->root || tokens->count == 0) {
+	if (!query->root || tokens->count == 0 ||
+	    query->id_min > query->id_max) {
 		return 0;
 	}
 
 	/*
 	 * Process the expression logic and get the resulting bitmap.
 	 */
-	doc_bitmap = get_expr_bitmap(idx, query->root, 0);
-	if (!doc_bitmap) {
+	if (get_expr_bitmap(idx, scratch, query->root, 0, &doc_bitmap) == -1) {
+		return -1;
+	}
+	if (doc_bitmap.bm == NULL) {
+		return 0;
+	}
+	nterms = get_score_terms(idx, tokens, stable, scratch, &terms);
+	if (nterms == -1) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		operand_release(&doc_bitmap);
 		return -1;
 	}
-	bm_iter = roaring64_iterator_create(doc_bitmap);
+
+	/*
+	 * Score the documents within the ID range: seek to its start
+	 * and stop past its end, instead of intersecting the bitmap.
+	 */
+	bm_iter = roaring64_iterator_create(doc_bitmap.bm);
+	if (query->id_min) {
+		roaring64_iterator_move_equalorlarger(bm_iter, query->id_min);
+	}
 	while (roaring64_iterator_has_value(bm_iter)) {
 		const nxs_doc_id_t doc_id = roaring64_iterator_value(bm_iter);
-		token_t *token;
-
-		TAILQ_FOREACH(token, &tokens->list, entry) {
-			const idxterm_t *term = token->idxterm;
-			idxdoc_t *doc;
-			float score;
-
-			ASSERT(term != NULL);
-
-			/*
-			 * Skip if this term is not used in the document.
-			 */
-			if (!roaring64_bitmap_contains(
-			    term->doc_bitmap, doc_id)) {
-				continue;
-			}
 
-			/*
-			 * Lookup the document and compute the score.
-			 */
-			if ((doc = idxdoc_lookup(idx, doc_id)) == NULL) {
-				goto out;
-			}
-			if ((score = rank(idx, term, doc)) < 0) {
-				/*
-				 * Negative value means no score to be given.
-				 */
-				continue;
-			}
-			if (nxs_resp_addresult(resp, doc, score) == -1) {
-				goto out;
-			}
+		if (doc_id > query->id_max) {
+			break;
+		}
+		if (deadline && (++ndocs & NXS_DEADLINE_CHECK_MASK) == 0 &&
+		    deadline_passed(deadline)) {
+			nxs_decl_errx(idx->nxs, NXS_ERR_LIMIT,
+			    "search timeout reached", NULL);
+			goto out;
+		}
+		if (score_doc(idx, stats, rank, terms, nterms,
+		    stable, doc_id, resp) == -1) {
+			goto out;
 		}
 		roaring64_iterator_advance(bm_iter);
 	}
 	ret = 0;
 out:
 	roaring64_iterator_free(bm_iter);
-	roaring64_bitmap_free(doc_bitmap);
+	score_terms_release(terms, nterms);
+	operand_release(&doc_bitmap);
 	return ret;
 }
 
 /*
- * nxs_index_search: perform  a search query on the given index.
- *
- * => Returns the response object (which must be released by the caller).
+ * exec_query: create the response object and run the query logic which
+ * performs the searching and scoring of the documents.
  */
-__dso_public nxs_resp_t *
-nxs_index_search(nxs_index_t *idx, nxs_params_t *params,
-    const char *query, size_t len)
+static nxs_resp_t *
+exec_query(query_t *q, const search_params_t *sp, const nxs_stats_t *stats)
 {
-	nxs_resp_t *resp = NULL;
-	search_params_t sp;
+	nxs_index_t *idx = q->idx;
+	const idxview_t *view;
 	ranking_func_t rank;
-	query_t *q = NULL;
-	int err = -1;
+	nxs_resp_t *resp;
+	arena_t *scratch;
+
+	/* Determine the ranking algorithm. */
+	rank = get_ranking_func(sp->algo);
+	ASSERT(rank != NULL);
+
+	/*
+	 * The result entries are allocated from the scratch arena
+	 * which is released once the response is built.
+	 */
+	if ((scratch = query_arena_get(idx)) == NULL) {
+		return NULL;
+	}
+	idxsyn_cache_gc(idx);
+
+	if ((resp = nxs_resp_create(sp->limit, scratch)) == NULL) {
+		goto out;
+	}
+
+	/*
+	 * Pin the read view: the index state is synced by the caller and
+	 * the statistics are taken from the view for the whole search.
+	 */
+	view = idx_view_pin(idx);
+	nxs_resp_set_generation(resp, view->generation);
+
+	if (run_query_logic(q, stats, rank, get_deadline(sp->timeout),
+	    sp->stable, scratch, resp) == -1) {
+		nxs_resp_release(resp);
+		resp = NULL;
+		goto out;
+	}
+	if (nxs_resp_build(resp) == -1) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		nxs_resp_release(resp);
+		resp = NULL;
+	}
+out:
+	query_arena_put(idx, scratch);
+	return resp;
+}
+
+static nxs_resp_t *
+index_search(nxs_index_t *idx, nxs_params_t *params,
+    const nxs_stats_t *stats, const char *query, size_t len)
+{
+	nxs_resp_t *resp;
+	search_params_t sp;
+	query_t *q;
 
 	nxs_clear_error(idx->nxs);
 
@@ -299,15 +919,10 @@ nxs_index_search(nxs_index_t *idx, nxs_params_t *params,
 		return NULL;
 	}
 
-	/* Determine the ranking algorithm. */
-	rank = get_ranking_func(sp.algo);
-	ASSERT(rank != NULL);
-
 	/*
 	 * Sync the latest updates to the index.
 	 */
-	if (idx_terms_sync(idx) == -1 ||
-	    idx_dtmap_sync(idx, DTMAP_PARTIAL_SYNC) == -1) {
+	if (idx_sync(idx) == -1) {
 		return NULL;
 	}
 
@@ -315,28 +930,194 @@ nxs_index_search(nxs_index_t *idx, nxs_params_t *params,
 	 * Parse the query and construct the intermediate representation.
 	 */
 	if ((q = construct_query(idx, query, len, &sp)) == NULL) {
+		return NULL;
+	}
+	resp = exec_query(q, &sp, stats);
+	query_destroy(q);
+	return resp;
+}
+
+/*
+ * nxs_index_search: perform  a search query on the given index.
+ *
+ * => Returns the response object (which must be released by the caller).
+ */
+__dso_public nxs_resp_t *
+nxs_index_search(nxs_index_t *idx, nxs_params_t *params,
+    const char *query, size_t len)
+{
+	return index_search(idx, params, NULL, query, len);
+}
+
+/*
+ * nxs_index_search_global: perform a search query on the given index
+ * (shard), but score the documents using the global statistics.
+ *
+ * => The statistics are normally obtained using nxs_index_getstats()
+ *    on each shard and merged using nxs_stats_merge().
+ * => Returns the response object (which must be released by the caller).
+ */
+__dso_public nxs_resp_t *
+nxs_index_search_global(nxs_index_t *idx, nxs_params_t *params,
+    const nxs_stats_t *stats, const char *query, size_t len)
+{
+	ASSERT(stats != NULL);
+	return index_search(idx, params, stats, query, len);
+}
+
+/*
+ * nxs_index_getstats: get the index statistics for the terms used
+ * in the given query (the first phase of the distributed search).
+ *
+ * => Returns the statistics object (must be released by the caller).
+ */
+__dso_public nxs_stats_t *
+nxs_index_getstats(nxs_index_t *idx, nxs_params_t *params,
+    const char *query, size_t len)
+{
+	const idxview_t *view;
+	nxs_stats_t *stats = NULL;
+	search_params_t sp;
+	query_t *q = NULL;
+	uint64_t doc_freq;
+	token_t *token;
+
+	nxs_clear_error(idx->nxs);
+
+	if (get_search_params(idx, params, &sp) == -1) {
+		return NULL;
+	}
+	if (idx_sync(idx) == -1) {
+		return NULL;
+	}
+	if ((q = construct_query(idx, query, len, &sp)) == NULL) {
+		return NULL;
+	}
+	if ((stats = nxs_stats_create()) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
+		    "nxs_stats_create failed", NULL);
 		goto out;
 	}
+	view = idx_view_pin(idx);
+	nxs_stats_add_counts(stats, view->doc_count, view->token_count);
 
 	/*
-	 * Create the response object and run the query logic which
-	 * performs the searching and scoring of the documents.
+	 * Note: the term values are used as the keys, since the term IDs
+	 * are local to each index.  With fuzzy matching, the token expands
+	 * to the closest terms; the shards expand it independently, but
+	 * the frequency is collected for each expanded term.  The tokens
+	 * may resolve to the same term: it must be counted once per shard.
 	 */
-	if ((resp = nxs_resp_create(sp.limit)) == NULL) {
-		goto out;
-	}
-	if (run_query_logic(q, rank, resp) == -1) {
-		goto out;
+	TAILQ_FOREACH(token, &q->tokens->list, entry) {
+		const idxfuzzy_t *fz = token->fuzzy;
+		const unsigned nterms = fz ? fz->count : 1;
+
+		for (unsigned i = 0; i < nterms; i++) {
+			const idxterm_t *term = fz ?
+			    fz->terms[i].term : token->idxterm;
+
+			if (term == NULL || nxs_stats_get_doc_freq(stats,
+			    term, &doc_freq) == 0) {
+				continue;
+			}
+			if (nxs_stats_add_term(stats, term->value,
+			    term->value_len,
+			    idxterm_get_doc_freq(idx, term)) == -1) {
+				nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM,
+				    "nxs_stats_add_term failed", NULL);
+				nxs_stats_release(stats);
+				stats = NULL;
+				goto out;
+			}
+		}
 	}
-	nxs_resp_build(resp);
-	err = 0;
 out:
-	if (err && resp) {
-		nxs_resp_release(resp);
-		resp = NULL;
+	query_destroy(q);
+	return stats;
+}
+
+/*
+ * Prepared queries.
+ *
+ * The query is parsed and tokenized (including the filter pipeline)
+ * only once.  The resolution of the tokens to terms depends on the
+ * index state, therefore it is refreshed only if the index generation
+ * has changed since the last execution.
+ */
+
+struct nxs_query {
+	nxs_index_t *		idx;
+	query_t *		q;
+	search_params_t		sp;
+	uint64_t		generation;
+};
+
+/*
+ * nxs_query_prepare: parse the query and prepare it for the execution.
+ *
+ * => Returns the prepared query (must be released by the caller).
+ */
+__dso_public nxs_query_t *
+nxs_query_prepare(nxs_index_t *idx, nxs_params_t *params,
+    const char *query, size_t len)
+{
+	nxs_query_t *pq;
+
+	nxs_clear_error(idx->nxs);
+
+	if ((pq = calloc(1, sizeof(nxs_query_t))) == NULL) {
+		nxs_decl_err(idx->nxs, NXS_ERR_SYSTEM, "OOM", NULL);
+		return NULL;
 	}
-	if (q) {
-		query_destroy(q);
+	pq->idx = idx;
+
+	if (get_search_params(idx, params, &pq->sp) == -1) {
+		goto err;
 	}
-	return resp;
+	if (idx_sync(idx) == -1) {
+		goto err;
+	}
+	if ((pq->q = construct_query(idx, query, len, &pq->sp)) == NULL) {
+		goto err;
+	}
+	pq->generation = idx_get_generation(idx);
+	return pq;
+err:
+	free(pq);
+	return NULL;
+}
+
+/*
+ * nxs_query_exec: execute the prepared query.
+ *
+ * => Returns the response object (which must be released by the caller).
+ */
+__dso_public nxs_resp_t *
+nxs_query_exec(nxs_query_t *pq)
+{
+	nxs_index_t *idx = pq->idx;
+	uint64_t generation;
+
+	nxs_clear_error(idx->nxs);
+
+	if (idx_sync(idx) == -1) {
+		return NULL;
+	}
+
+	/*
+	 * Re-resolve the terms only if the index has changed.
+	 */
+	generation = idx_get_generation(idx);
+	if (pq->generation != generation) {
+		query_resolve(pq->q, pq->sp.tflags);
+		pq->generation = generation;
+	}
+	return exec_query(pq->q, &pq->sp, NULL);
+}
+
+__dso_public void
+nxs_query_release(nxs_query_t *pq)
+{
+	query_destroy(pq->q);
+	free(pq);
 }
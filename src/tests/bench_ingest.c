@@ -0,0 +1,410 @@
+/*
+ * Benchmark: ingestion scalability with the concurrent writer processes.
+ *
+ * Sweeps the number of the writer processes adding the documents to the
+ * same index (which serialize on the index file locks) and reports the
+ * throughput, the share of the time the writers waited for the locks and
+ * the growth of the index files.
+ *
+ * Usage: bench_ingest [MAX_WRITERS [DOCS_PER_WRITER]]
+ *
+ * This code is in the public domain.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <err.h>
+
+#include "nxs.h"
+#include "index.h"
+#include "helpers.h"
+#include "utils.h"
+
+#define	MAX_WRITERS_CAP		(64)
+#define	DEF_DOCS_PER_WRITER	(2000)
+
+/*
+ * Synthetic documents: the words of the vocabulary follow the Zipf
+ * distribution (as in the natural language text) and the document
+ * lengths vary.
+ */
+#define	VOCAB_SIZE		(20000)
+#define	ZIPF_EXPONENT		(1.0)
+#define	DOC_MIN_WORDS		(20)
+#define	DOC_MAX_WORDS		(300)
+#define	DOC_MAX_LEN		(DOC_MAX_WORDS * 16)
+
+static const char *syllables[] = {
+	"ka", "lo", "mi", "ren", "tas", "vo", "pel", "dri",
+	"sun", "gor", "ni", "bet", "ul", "fra", "zen", "chi",
+};
+
+static char *		vocab[VOCAB_SIZE];
+static double		vocab_cdf[VOCAB_SIZE];
+
+/* Time spent waiting for the file locks (by this process). */
+static uint64_t		lock_wait_ns;
+
+typedef struct {
+	uint64_t	docs;
+	uint64_t	elapsed_ns;
+	uint64_t	lock_wait_ns;
+} writer_stats_t;
+
+static uint64_t
+get_time_ns(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		err(EXIT_FAILURE, "clock_gettime");
+	}
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+
+/*
+ * Interpose flock(2) to measure the time waiting for the index locks:
+ * the library objects are linked into this binary.
+ */
+int
+flock(int fd, int operation)
+{
+	const bool wait = (operation & (LOCK_SH | LOCK_EX)) != 0 &&
+	    (operation & LOCK_NB) == 0;
+	const uint64_t start = wait ? get_time_ns() : 0;
+	int ret;
+
+	ret = syscall(SYS_flock, fd, operation);
+	if (wait) {
+		lock_wait_ns += get_time_ns() - start;
+	}
+	return ret;
+}
+#define	HAVE_LOCK_WAIT
+#endif
+
+static uint64_t
+rnd(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	/* xorshift64* */
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * UINT64_C(2685821657736338717);
+}
+
+static void
+vocab_init(void)
+{
+	double sum = 0;
+
+	for (unsigned i = 0; i < VOCAB_SIZE; i++) {
+		char word[64] = "";
+		unsigned v = i;
+
+		/* Base-16 digits of the word number as the syllables. */
+		do {
+			strcat(word, syllables[v % __arraycount(syllables)]);
+			v /= __arraycount(syllables);
+		} while (v || strlen(word) < 4);
+
+		if ((vocab[i] = strdup(word)) == NULL) {
+			err(EXIT_FAILURE, "strdup");
+		}
+		sum += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+		vocab_cdf[i] = sum;
+	}
+	for (unsigned i = 0; i < VOCAB_SIZE; i++) {
+		vocab_cdf[i] /= sum;
+	}
+}
+
+static const char *
+vocab_sample(uint64_t *state)
+{
+	const double u = (rnd(state) >> 11) * 0x1.0p-53;
+	unsigned lo = 0, hi = VOCAB_SIZE - 1;
+
+	while (lo < hi) {
+		const unsigned mid = (lo + hi) / 2;
+
+		if (vocab_cdf[mid] < u) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return vocab[lo];
+}
+
+static size_t
+gen_doc(uint64_t *state, char *buf)
+{
+	const unsigned nwords = DOC_MIN_WORDS +
+	    rnd(state) % (DOC_MAX_WORDS - DOC_MIN_WORDS + 1);
+	size_t len = 0;
+
+	for (unsigned i = 0; i < nwords; i++) {
+		const char *word = vocab_sample(state);
+		const size_t wlen = strlen(word);
+
+		if (len + wlen + 1 >= DOC_MAX_LEN) {
+			break;
+		}
+		memcpy(&buf[len], word, wlen);
+		len += wlen;
+		buf[len++] = ' ';
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+static void
+xwrite(int fd, const void *buf, size_t len)
+{
+	if (write(fd, buf, len) != (ssize_t)len) {
+		err(EXIT_FAILURE, "write");
+	}
+}
+
+static void
+xread(int fd, void *buf, size_t len)
+{
+	if (read(fd, buf, len) != (ssize_t)len) {
+		err(EXIT_FAILURE, "read");
+	}
+}
+
+/*
+ * run_writer: the writer process.  Opens the index, reports that it is
+ * ready, waits for the start (the parent closes the start pipe), adds
+ * the documents and reports its statistics.
+ */
+static void __attribute__((noreturn))
+run_writer(const char *basedir, const char *name, unsigned id,
+    unsigned ndocs, int start_fd, int report_fd)
+{
+	char *text = malloc(DOC_MAX_LEN);
+	uint64_t state = 0x9e3779b97f4a7c15ULL * (id + 1);
+	writer_stats_t st;
+	nxs_index_t *idx;
+	uint64_t start;
+	nxs_t *nxs;
+	char c = 0;
+
+	if (text == NULL || (nxs = nxs_open(basedir)) == NULL) {
+		errx(EXIT_FAILURE, "nxs_open failed");
+	}
+	if ((idx = nxs_index_open(nxs, name)) == NULL) {
+		errx(EXIT_FAILURE, "nxs_index_open failed");
+	}
+	xwrite(report_fd, &c, 1);
+	if (read(start_fd, &c, 1) == -1) {
+		err(EXIT_FAILURE, "read");
+	}
+
+	lock_wait_ns = 0;
+	start = get_time_ns();
+	for (unsigned i = 0; i < ndocs; i++) {
+		const nxs_doc_id_t doc_id = (uint64_t)id * ndocs + i + 1;
+		const size_t len = gen_doc(&state, text);
+
+		if (nxs_index_add(idx, NULL, doc_id, text, len) == -1) {
+			const char *errmsg;
+
+			(void)nxs_get_error(nxs, &errmsg);
+			errx(EXIT_FAILURE, "nxs_index_add: %s", errmsg);
+		}
+	}
+	st.docs = ndocs;
+	st.elapsed_ns = get_time_ns() - start;
+	st.lock_wait_ns = lock_wait_ns;
+	xwrite(report_fd, &st, sizeof(st));
+
+	nxs_index_close(idx);
+	nxs_close(nxs);
+	free(text);
+
+	/* Note: skip the atexit(3) handlers of the parent. */
+	_exit(EXIT_SUCCESS);
+}
+
+static uint64_t
+get_file_size(const char *basedir, const char *name, const char *file)
+{
+	struct stat st;
+	char *path;
+
+	if (asprintf(&path, "%s/data/%s/%s", basedir, name, file) == -1) {
+		err(EXIT_FAILURE, "asprintf");
+	}
+	if (stat(path, &st) == -1) {
+		err(EXIT_FAILURE, "stat %s", path);
+	}
+	free(path);
+	return st.st_size;
+}
+
+static void
+verify_index(nxs_t *nxs, const char *name, uint64_t expected)
+{
+	nxs_index_t *idx;
+
+	if ((idx = nxs_index_open(nxs, name)) == NULL) {
+		errx(EXIT_FAILURE, "nxs_index_open failed");
+	}
+	if (idx_get_doc_count(idx) != expected) {
+		errx(EXIT_FAILURE, "expected %"PRIu64" documents, got %u",
+		    expected, idx_get_doc_count(idx));
+	}
+	nxs_index_close(idx);
+}
+
+static void
+run_round(nxs_t *nxs, const char *basedir, unsigned nwriters,
+    unsigned ndocs, double *base_rate)
+{
+	uint64_t start, wall_ns, elapsed_ns = 0, wait_ns = 0, docs = 0;
+	uint64_t terms_len, dtmap_len;
+	int start_pipe[2], report_pipe[2];
+	double rate, wait_share;
+	nxs_index_t *idx;
+	char name[64];
+
+	snprintf(name, sizeof(name), "bench_ingest_%u", nwriters);
+	if ((idx = nxs_index_create(nxs, name, NULL)) == NULL) {
+		errx(EXIT_FAILURE, "nxs_index_create failed");
+	}
+	nxs_index_close(idx);
+
+	if (pipe(start_pipe) == -1 || pipe(report_pipe) == -1) {
+		err(EXIT_FAILURE, "pipe");
+	}
+	for (unsigned i = 0; i < nwriters; i++) {
+		switch (fork()) {
+		case -1:
+			err(EXIT_FAILURE, "fork");
+		case 0:
+			close(start_pipe[1]);
+			close(report_pipe[0]);
+			run_writer(basedir, name, i, ndocs,
+			    start_pipe[0], report_pipe[1]);
+		default:
+			break;
+		}
+	}
+	close(start_pipe[0]);
+	close(report_pipe[1]);
+
+	/*
+	 * Wait for all writers to open the index and start them.
+	 */
+	for (unsigned i = 0; i < nwriters; i++) {
+		char c;
+		xread(report_pipe[0], &c, 1);
+	}
+	start = get_time_ns();
+	close(start_pipe[1]);
+
+	for (unsigned i = 0; i < nwriters; i++) {
+		writer_stats_t st;
+
+		xread(report_pipe[0], &st, sizeof(st));
+		docs += st.docs;
+		elapsed_ns += st.elapsed_ns;
+		wait_ns += st.lock_wait_ns;
+	}
+	wall_ns = get_time_ns() - start;
+	close(report_pipe[0]);
+
+	for (unsigned i = 0; i < nwriters; i++) {
+		int status;
+
+		if (wait(&status) == -1 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != EXIT_SUCCESS) {
+			errx(EXIT_FAILURE, "writer failed");
+		}
+	}
+	verify_index(nxs, name, docs);
+
+	terms_len = get_file_size(basedir, name, "nxsterms");
+	dtmap_len = get_file_size(basedir, name, "nxsdtmap");
+	rate = docs / (wall_ns / 1e9);
+	wait_share = elapsed_ns ? (double)wait_ns / elapsed_ns : 0;
+	if (*base_rate == 0) {
+		*base_rate = rate;
+	}
+
+	printf("%7u %9"PRIu64" %9.3f %10.0f %7.2fx ", nwriters, docs,
+	    wall_ns / 1e9, rate, rate / *base_rate);
+#ifdef HAVE_LOCK_WAIT
+	printf("%8.1f%% ", wait_share * 100);
+#else
+	(void)wait_share;
+	printf("%9s ", "n/a");
+#endif
+	printf("%10"PRIu64" %10"PRIu64" %7"PRIu64"\n",
+	    terms_len / 1024, dtmap_len / 1024,
+	    (terms_len + dtmap_len) / docs);
+
+	if (nxs_index_destroy(nxs, name) == -1) {
+		errx(EXIT_FAILURE, "nxs_index_destroy failed");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned max_writers, ndocs = DEF_DOCS_PER_WRITER;
+	char *basedir = get_tmpdir();
+	double base_rate = 0;
+	nxs_t *nxs;
+
+	max_writers = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1), 16);
+	if (argc > 1) {
+		max_writers = MIN(MAX(atoi(argv[1]), 1), MAX_WRITERS_CAP);
+	}
+	if (argc > 2 && atoi(argv[2]) > 0) {
+		ndocs = atoi(argv[2]);
+	}
+	vocab_init();
+
+	if ((nxs = nxs_open(basedir)) == NULL) {
+		errx(EXIT_FAILURE, "nxs_open failed");
+	}
+	printf("%u documents per writer, %u-%u words, %u word vocabulary\n\n",
+	    ndocs, DOC_MIN_WORDS, DOC_MAX_WORDS, VOCAB_SIZE);
+	printf("%7s %9s %9s %10s %8s %9s %10s %10s %7s\n", "writers",
+	    "docs", "time (s)", "docs/s", "speedup", "lock wait",
+	    "terms (KB)", "dtmap (KB)", "B/doc");
+
+	/* Powers of two, up to the maximum (inclusive). */
+	for (unsigned n = 1; n <= max_writers; n *= 2) {
+		run_round(nxs, basedir, n, ndocs, &base_rate);
+		if (n < max_writers && n * 2 > max_writers) {
+			run_round(nxs, basedir, max_writers, ndocs, &base_rate);
+		}
+	}
+	nxs_close(nxs);
+
+	for (unsigned i = 0; i < VOCAB_SIZE; i++) {
+		free(vocab[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Benchmark: top-k selection vs the capped heap.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <err.h>
+
+#include "heap.h"
+#include "topk.h"
+#include "utils.h"
+
+#define	TOPK_LIMIT	(1000)
+#define	TOPK_RUNS	(5)
+
+typedef struct {
+	uint64_t	id;
+	float		score;
+} result_t;
+
+static int
+result_cmp(const void *p1, const void *p2)
+{
+	const result_t *r1 = p1;
+	const result_t *r2 = p2;
+
+	if (r1->score < r2->score)
+		return -1;
+	if (r1->score > r2->score)
+		return 1;
+	return 0;
+}
+
+static uint64_t
+get_time_ns(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		err(EXIT_FAILURE, "clock_gettime");
+	}
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint64_t
+run_heap(const result_t *results, size_t n, size_t k)
+{
+	const uint64_t start = get_time_ns();
+	heap_t *h;
+	size_t c;
+
+	if ((h = heap_create(k, result_cmp)) == NULL) {
+		err(EXIT_FAILURE, "heap_create");
+	}
+	for (size_t i = 0; i < n; i++) {
+		heap_add(h, __UNCONST(&results[i]));
+	}
+	(void)heap_sort(h, &c);
+	heap_destroy(h);
+	return get_time_ns() - start;
+}
+
+/*
+ * run_topk: fill the flat array and select.  The array is allocated by
+ * the caller, as the response uses the (steady state) scratch arena.
+ */
+static uint64_t
+run_topk(const result_t *results, topk_entry_t *entries, size_t n, size_t k)
+{
+	const uint64_t start = get_time_ns();
+
+	for (size_t i = 0; i < n; i++) {
+		topk_entry_set(&entries[i], results[i].id, results[i].score);
+	}
+	(void)topk_select(entries, n, k);
+	return get_time_ns() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+	const size_t max_n = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+	topk_entry_t *entries;
+	result_t *results;
+
+	results = malloc(max_n * sizeof(result_t));
+	entries = calloc(max_n, sizeof(topk_entry_t));
+	if (results == NULL || entries == NULL) {
+		err(EXIT_FAILURE, "malloc");
+	}
+	srandom(1);
+	for (size_t i = 0; i < max_n; i++) {
+		results[i].id = i + 1;
+		results[i].score = (float)random() / RAND_MAX * 20;
+	}
+
+	/*
+	 * The best of the runs for each number of the candidates.
+	 */
+	printf("%10s %6s %12s %12s\n", "candidates", "k", "heap (us)",
+	    "select (us)");
+	for (size_t n = 10000; n <= max_n; n *= 10) {
+		uint64_t heap_ns = UINT64_MAX, topk_ns = UINT64_MAX;
+
+		for (unsigned i = 0; i < TOPK_RUNS; i++) {
+			heap_ns = MIN(heap_ns,
+			    run_heap(results, n, TOPK_LIMIT));
+			topk_ns = MIN(topk_ns,
+			    run_topk(results, entries, n, TOPK_LIMIT));
+		}
+		printf("%10zu %6u %12.1f %12.1f\n", n, TOPK_LIMIT,
+		    heap_ns / 1000.0, topk_ns / 1000.0);
+	}
+	free(entries);
+	free(results);
+	return 0;
+}
@@ -284,3 +284,119 @@ test_index_search(const test_search_case_t *test_case)
 	nxs_index_close(idx);
 	nxs_close(nxs);
 }
+
+const test_doc_t test_docs[] = {
+	{ 1, "The quick brown fox jumped over the lazy dog" },
+	{ 2, "Once upon a time there were three little foxes" },
+	{ 3, "cat dog rat cow" },
+	{ 4, "cat cat dog dog" },
+	{ 5, "lorem ipsum dolor sit amet" },
+};
+const unsigned test_docs_count = __arraycount(test_docs);
+
+const char *test_queries[] = {
+	"fox", "dog", "cat OR cow", "lorem", "brown AND NOT cat", "ipsum",
+};
+const unsigned test_queries_count = __arraycount(test_queries);
+
+void
+test_add_doc(nxs_index_t *idx, nxs_doc_id_t doc_id, const char *text)
+{
+	int ret;
+
+	ret = nxs_index_add(idx, NULL, doc_id, text, strlen(text));
+	assert(ret == 0);
+}
+
+/*
+ * test_add_docs: add the documents in the [first, last) range.
+ */
+void
+test_add_docs(nxs_index_t *idx, const test_doc_t *docs,
+    unsigned first, unsigned last)
+{
+	for (unsigned i = first; i < last; i++) {
+		test_add_doc(idx, docs[i].id, docs[i].text);
+	}
+}
+
+/*
+ * test_compare_resp: the responses must be identical (as JSON).
+ */
+void
+test_compare_resp(const char *query, nxs_resp_t *expected, nxs_resp_t *resp)
+{
+	char *ejson, *json;
+
+	ejson = nxs_resp_tojson(expected, NULL);
+	assert(ejson);
+	json = nxs_resp_tojson(resp, NULL);
+	assert(json);
+
+	if (strcmp(ejson, json) != 0) {
+		errx(EXIT_FAILURE, "query [%s]: expected %s, got %s",
+		    query, ejson, json);
+	}
+	free(ejson);
+	free(json);
+}
+
+/*
+ * test_compare_search: run the test queries on both indexes; the
+ * results must be identical.
+ */
+void
+test_compare_search(nxs_index_t *expected, nxs_index_t *idx)
+{
+	for (unsigned i = 0; i < test_queries_count; i++) {
+		const char *q = test_queries[i];
+		nxs_resp_t *eresp, *resp;
+
+		eresp = nxs_index_search(expected, NULL, q, strlen(q));
+		assert(eresp);
+		resp = nxs_index_search(idx, NULL, q, strlen(q));
+		assert(resp);
+		test_compare_resp(q, eresp, resp);
+
+		nxs_resp_release(eresp);
+		nxs_resp_release(resp);
+	}
+}
+
+/*
+ * test_get_doc_mask: get the mask of the document IDs in the results
+ * and release the response.
+ */
+uint64_t
+test_get_doc_mask(nxs_resp_t *resp)
+{
+	nxs_doc_id_t doc_id;
+	uint64_t docs = 0;
+	float score;
+
+	nxs_resp_iter_reset(resp);
+	while (nxs_resp_iter_result(resp, &doc_id, &score)) {
+		assert(doc_id < 64);
+		docs |= DOC(doc_id);
+	}
+	nxs_resp_release(resp);
+	return docs;
+}
+
+/*
+ * test_check_search: search and verify the mask of the document IDs.
+ */
+void
+test_check_search(nxs_index_t *idx, const char *q, uint64_t expected)
+{
+	nxs_resp_t *resp;
+	uint64_t docs;
+
+	resp = nxs_index_search(idx, NULL, q, strlen(q));
+	assert(resp);
+
+	if ((docs = test_get_doc_mask(resp)) != expected) {
+		errx(EXIT_FAILURE, "query [%s]: expected %#"PRIx64
+		    ", got %#"PRIx64, q, expected, docs);
+	}
+}
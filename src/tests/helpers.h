@@ -26,6 +26,9 @@ typedef struct {
 #define	END_TEST_SCORE		{ 0, { 0, 0 } }
 #define	DOC_ID_ONLY(id)		{ (id), { -1, -1 } }
 
+/* Document ID (less than 64) as a bit of the results mask. */
+#define	DOC(id)			(UINT64_C(1) << (id))
+
 typedef struct {
 	const test_doc_t *docs;
 	unsigned	doc_count;
@@ -44,4 +47,21 @@ void		run_with_index(const char *, const char *, bool, test_func_t);
 
 void		test_index_search(const test_search_case_t *);
 
+/*
+ * The common document set and the queries over it, e.g. to compare the
+ * results of the index with its replica, clone, etc.
+ */
+extern const test_doc_t	test_docs[];
+extern const unsigned	test_docs_count;
+extern const char *	test_queries[];
+extern const unsigned	test_queries_count;
+
+void		test_add_doc(nxs_index_t *, nxs_doc_id_t, const char *);
+void		test_add_docs(nxs_index_t *, const test_doc_t *,
+		    unsigned, unsigned);
+void		test_compare_resp(const char *, nxs_resp_t *, nxs_resp_t *);
+void		test_compare_search(nxs_index_t *, nxs_index_t *);
+uint64_t	test_get_doc_mask(nxs_resp_t *);
+void		test_check_search(nxs_index_t *, const char *, uint64_t);
+
 #endif
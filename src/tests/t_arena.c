@@ -0,0 +1,81 @@
+/*
+ * Unit tests: arena allocator.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdalign.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "utils.h"
+
+static void
+run_tests(void)
+{
+	unsigned char *p1, *p2, *p3;
+	arena_t *arena;
+	char *s;
+
+	arena = arena_create(64);
+	assert(arena);
+
+	/*
+	 * Allocations are aligned and do not overlap.
+	 */
+	p1 = arena_zalloc(arena, 1);
+	assert(p1 && *p1 == 0);
+	p2 = arena_alloc(arena, 24);
+	assert(p2);
+	assert(((uintptr_t)p1 % alignof(max_align_t)) == 0);
+	assert(((uintptr_t)p2 % alignof(max_align_t)) == 0);
+	assert(p2 >= p1 + 1);
+	memset(p2, 0xa5, 24);
+	assert(*p1 == 0);
+
+	s = arena_strndup(arena, "hello world", 5);
+	assert(s && strcmp(s, "hello") == 0);
+
+	/*
+	 * Exceed the chunk size (including a larger than chunk object).
+	 */
+	p3 = arena_alloc(arena, 1024);
+	assert(p3);
+	memset(p3, 0x5a, 1024);
+	for (unsigned i = 0; i < 16; i++) {
+		assert(arena_alloc(arena, 48) != NULL);
+	}
+	assert(strcmp(s, "hello") == 0);
+
+	/*
+	 * Reset: the space is reused from the start.
+	 */
+	arena_reset(arena);
+	p2 = arena_alloc(arena, 1024);
+	assert(p2);
+	memset(p2, 0, 1024);
+
+	arena_reset(arena);
+	p3 = arena_alloc(arena, 1024);
+	assert(p3 == p2);
+
+	/*
+	 * The size accounts all chunks and the coalesced one.
+	 */
+	assert(arena_size(arena) >= 1024);
+	assert(arena_alloc(arena, 4096) != NULL);
+	assert(arena_size(arena) >= 1024 + 4096);
+	arena_reset(arena);
+	assert(arena_size(arena) >= 1024 + 4096);
+
+	arena_destroy(arena);
+}
+
+int
+main(void)
+{
+	run_tests();
+	puts("OK");
+	return 0;
+}
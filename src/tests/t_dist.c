@@ -0,0 +1,213 @@
+/*
+ * Unit test: distributed search (global statistics).
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <err.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+#define	SHARD_COUNT	2
+
+static const test_doc_t docs[] = {
+	{ 1, "cat cat dog dog" },
+	{ 2, "dog dog cat cat" },
+	{ 3, "cat dog rat cow" },
+	{ 4, "cat dog rat bat" },
+	{ 5, "The quick brown fox jumped over the lazy dog" },
+	{ 6, "Once upon a time there were three little foxes" },
+};
+
+static const char *queries[] = {
+	"cat", "dog", "rat OR cow", "fox dog", "cat AND NOT bat", "missing",
+	"cat cat", "fox foxes",
+};
+
+static nxs_index_t *
+create_index(nxs_t *nxs, const char *name, unsigned shard, unsigned n)
+{
+	nxs_index_t *idx;
+
+	idx = nxs_index_create(nxs, name, NULL);
+	assert(idx);
+
+	/* Distribute the documents in the round-robin fashion. */
+	for (unsigned i = 0; i < __arraycount(docs); i++) {
+		const char *text = docs[i].text;
+		int ret;
+
+		if (n && (i % n) != shard) {
+			continue;
+		}
+		ret = nxs_index_add(idx, NULL, docs[i].id, text, strlen(text));
+		assert(ret == 0);
+	}
+	return idx;
+}
+
+static float
+get_doc_score(nxs_resp_t *resp, nxs_doc_id_t target_doc_id)
+{
+	nxs_doc_id_t doc_id;
+	float score;
+
+	nxs_resp_iter_reset(resp);
+	while (nxs_resp_iter_result(resp, &doc_id, &score)) {
+		if (doc_id == target_doc_id) {
+			return score;
+		}
+	}
+	return -1;
+}
+
+static nxs_stats_t *
+get_global_stats(nxs_t *nxs, nxs_index_t *shards[], nxs_params_t *params,
+    const char *q)
+{
+	nxs_stats_t *stats, *gstats;
+	char *json;
+	size_t len;
+	int ret;
+
+	gstats = nxs_stats_create();
+	assert(gstats);
+
+	for (unsigned i = 0; i < SHARD_COUNT; i++) {
+		stats = nxs_index_getstats(shards[i], params, q, strlen(q));
+		assert(stats);
+		ret = nxs_stats_merge(gstats, stats);
+		assert(ret == 0);
+		nxs_stats_release(stats);
+	}
+
+	/*
+	 * Pass through the JSON serialization, as the coordinator would.
+	 */
+	json = nxs_stats_tojson(gstats, &len);
+	assert(json);
+	nxs_stats_release(gstats);
+
+	gstats = nxs_stats_fromjson(nxs, json, len);
+	assert(gstats);
+	free(json);
+
+	return gstats;
+}
+
+static void
+test_global_scores(nxs_t *nxs, nxs_index_t *idx, nxs_index_t *shards[],
+    const char *q)
+{
+	nxs_resp_t *resp, *shard_resp[SHARD_COUNT];
+	unsigned count = 0;
+	nxs_stats_t *stats;
+	nxs_params_t *params;
+	nxs_doc_id_t doc_id;
+	float score;
+
+	/*
+	 * Note: fuzzy matching is resolved by each shard independently,
+	 * therefore it is disabled to compare with the whole collection.
+	 */
+	params = nxs_params_create();
+	assert(params);
+	nxs_params_set_bool(params, "fuzzymatch", false);
+
+	/*
+	 * Search the whole collection.
+	 */
+	resp = nxs_index_search(idx, params, q, strlen(q));
+	assert(resp);
+
+	/*
+	 * Search each shard using the global statistics.
+	 */
+	stats = get_global_stats(nxs, shards, params, q);
+	for (unsigned i = 0; i < SHARD_COUNT; i++) {
+		shard_resp[i] = nxs_index_search_global(shards[i],
+		    params, stats, q, strlen(q));
+		assert(shard_resp[i]);
+		count += nxs_resp_resultcount(shard_resp[i]);
+	}
+	nxs_stats_release(stats);
+	nxs_params_release(params);
+
+	/*
+	 * The scores must be identical to the whole collection search.
+	 */
+	if (count != nxs_resp_resultcount(resp)) {
+		errx(EXIT_FAILURE, "query [%s]: got %u results (expected %u)",
+		    q, count, nxs_resp_resultcount(resp));
+	}
+	nxs_resp_iter_reset(resp);
+	while (nxs_resp_iter_result(resp, &doc_id, &score)) {
+		float shard_score = -1;
+
+		for (unsigned i = 0; i < SHARD_COUNT; i++) {
+			float s = get_doc_score(shard_resp[i], doc_id);
+			if (s >= 0) {
+				shard_score = s;
+			}
+		}
+		if (fabsf(score - shard_score) >= 0.0001) {
+			errx(EXIT_FAILURE, "query [%s]: doc %"PRIu64" score "
+			    "is %f (expected %f)", q, doc_id,
+			    shard_score, score);
+		}
+	}
+
+	for (unsigned i = 0; i < SHARD_COUNT; i++) {
+		nxs_resp_release(shard_resp[i]);
+	}
+	nxs_resp_release(resp);
+}
+
+static void
+test_invalid_stats(nxs_t *nxs)
+{
+	static const char *invalid[] = {
+		"", "[]", "{\"doc_count\": \"a\"}", "{\"terms\": []}",
+		"{\"terms\": {\"cat\": -1}}",
+	};
+
+	for (unsigned i = 0; i < __arraycount(invalid); i++) {
+		const char *s = invalid[i];
+		nxs_stats_t *stats = nxs_stats_fromjson(nxs, s, strlen(s));
+		assert(stats == NULL);
+	}
+}
+
+int
+main(void)
+{
+	nxs_index_t *idx, *shards[SHARD_COUNT];
+	char *basedir = get_tmpdir();
+	nxs_t *nxs;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	idx = create_index(nxs, "__test-idx-all", 0, 0);
+	shards[0] = create_index(nxs, "__test-idx-shard-1", 0, SHARD_COUNT);
+	shards[1] = create_index(nxs, "__test-idx-shard-2", 1, SHARD_COUNT);
+
+	for (unsigned i = 0; i < __arraycount(queries); i++) {
+		test_global_scores(nxs, idx, shards, queries[i]);
+	}
+	test_invalid_stats(nxs);
+
+	for (unsigned i = 0; i < SHARD_COUNT; i++) {
+		nxs_index_close(shards[i]);
+	}
+	nxs_index_close(idx);
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
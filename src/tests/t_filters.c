@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 
 #define __NXSLIB_PRIVATE
 #include "nxs_impl.h"
@@ -102,6 +103,105 @@ run_filter_action_tests(void)
 	nxs_close(nxs);
 }
 
+static unsigned		count_filter_calls;
+
+static filter_action_t
+count_filter(void *arg __unused, strbuf_t *buf)
+{
+	/*
+	 * Test filter which counts the calls: upper-cases the first
+	 * letter and discards "the".
+	 */
+	count_filter_calls++;
+	if (strcmp(buf->value, "the") == 0) {
+		return FILT_DISCARD;
+	}
+	buf->value[0] = toupper((unsigned char)buf->value[0]);
+	return FILT_MUTATION;
+}
+
+static void
+check_cached_run(filter_pipeline_t *fp, const char *token,
+    filter_action_t exp_action, const char *exp_value, unsigned calls)
+{
+	filter_action_t action;
+	strbuf_t sbuf;
+
+	strbuf_init(&sbuf);
+	strbuf_acquire(&sbuf, token, strlen(token));
+
+	count_filter_calls = 0;
+	action = filter_pipeline_run(fp, &sbuf);
+	assert(action == exp_action);
+	assert(!exp_value || strcmp(sbuf.value, exp_value) == 0);
+	assert(!exp_value || sbuf.length == strlen(exp_value));
+	assert(count_filter_calls == calls);
+
+	strbuf_release(&sbuf);
+}
+
+static void
+run_filter_cache_tests(void)
+{
+	static const char *filters[] = { "count-filter" };
+	static const filter_ops_t count_filter_ops = {
+		.filter = count_filter,
+	};
+	char long_token[STRBUF_DEF_SIZE * 2];
+	char *basedir = get_tmpdir();
+	nxs_params_t *params;
+	filter_pipeline_t *fp;
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs != NULL);
+
+	ret = nxs_filter_register(nxs, "count-filter", &count_filter_ops, NULL);
+	assert(ret == 0);
+
+	params = nxs_params_create();
+	assert(params);
+	ret = nxs_params_set_strlist(params, "filters",
+	    filters, __arraycount(filters));
+	assert(ret == 0);
+	ret = nxs_params_set_uint(params, "token_cache", 2);
+	assert(ret == 0);
+
+	fp = filter_pipeline_create(nxs, params);
+	assert(fp);
+
+	/* The repeated tokens (and the discard verdicts) are cached. */
+	check_cached_run(fp, "abc", FILT_MUTATION, "Abc", 1);
+	check_cached_run(fp, "abc", FILT_MUTATION, "Abc", 0);
+	check_cached_run(fp, "the", FILT_DISCARD, NULL, 1);
+	check_cached_run(fp, "the", FILT_DISCARD, NULL, 0);
+
+	/* Bounded: "abc" is the least recently used and evicted. */
+	check_cached_run(fp, "xyz", FILT_MUTATION, "Xyz", 1);
+	check_cached_run(fp, "the", FILT_DISCARD, NULL, 0);
+	check_cached_run(fp, "abc", FILT_MUTATION, "Abc", 1);
+
+	/* The long tokens bypass the cache. */
+	memset(long_token, 'z', sizeof(long_token) - 1);
+	long_token[sizeof(long_token) - 1] = '\0';
+	check_cached_run(fp, long_token, FILT_MUTATION, NULL, 1);
+	check_cached_run(fp, long_token, FILT_MUTATION, NULL, 1);
+	filter_pipeline_destroy(fp);
+
+	/* Disabled cache. */
+	ret = nxs_params_set_uint(params, "token_cache", 0);
+	assert(ret == 0);
+	fp = filter_pipeline_create(nxs, params);
+	assert(fp);
+	check_cached_run(fp, "abc", FILT_MUTATION, "Abc", 1);
+	check_cached_run(fp, "abc", FILT_MUTATION, "Abc", 1);
+	filter_pipeline_destroy(fp);
+
+	nxs_params_release(params);
+	nxs_close(nxs);
+}
+
 static void
 run_lua_test(const char *code)
 {
@@ -159,6 +259,7 @@ int
 main(void)
 {
 	run_filter_action_tests();
+	run_filter_cache_tests();
 	run_lua_tests();
 	puts("OK");
 	return 0;
@@ -0,0 +1,208 @@
+/*
+ * Unit test: index handle cache.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+static void
+test_refcount(nxs_t *nxs)
+{
+	nxs_index_t *idx, *idx2;
+	const char *text = "cat dog";
+	unsigned count;
+	int ret;
+
+	idx = nxs_index_acquire(nxs, "__test-idx-1");
+	assert(idx);
+
+	/* The same handle is returned while open. */
+	idx2 = nxs_index_acquire(nxs, "__test-idx-1");
+	assert(idx2 == idx);
+	nxs_index_release(idx2);
+
+	ret = nxs_index_add(idx, NULL, 1, text, strlen(text));
+	assert(ret == 0);
+
+	/* The index in use must not be evicted. */
+	nxs_index_cache_config(nxs, 1, 0);
+	count = nxs_index_cache_gc(nxs);
+	assert(count == 0);
+
+	/* The last release evicts the handle (over the budget). */
+	nxs_index_release(idx);
+	count = nxs_index_cache_gc(nxs);
+	assert(count == 0);
+	nxs_index_cache_config(nxs, 0, 0);
+
+	/* Re-open: the data must be there. */
+	idx = nxs_index_acquire(nxs, "__test-idx-1");
+	assert(idx);
+	ret = nxs_index_add(idx, NULL, 1, text, strlen(text));
+	assert(ret == -1 && nxs_get_error(nxs, NULL) == NXS_ERR_EXISTS);
+	nxs_index_release(idx);
+}
+
+static void
+test_idle(nxs_t *nxs)
+{
+	nxs_index_t *idx, *idx2;
+	unsigned count;
+	int ret;
+
+	/* Released handles stay open without the limits. */
+	idx = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx);
+	nxs_index_release(idx);
+	count = nxs_index_cache_gc(nxs);
+	assert(count == 0);
+
+	/* Cheap re-acquire of the idle handle. */
+	idx2 = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx2 == idx);
+	nxs_index_release(idx2);
+
+	/* Idle handles are evicted in the LRU order. */
+	idx = nxs_index_acquire(nxs, "__test-idx-1");
+	assert(idx);
+	nxs_index_release(idx);
+	nxs_index_cache_config(nxs, 1, 0);
+	count = nxs_index_cache_gc(nxs);
+	assert(count == 0); /* already evicted by the config call */
+
+	/* The idle handle is closed on destroy. */
+	nxs_index_cache_config(nxs, 0, 0);
+	idx = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx);
+	nxs_index_release(idx);
+	ret = nxs_index_destroy(nxs, "__test-idx-2");
+	assert(ret == 0);
+	idx = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx == NULL);
+
+	/* The handle was evicted: the index can be created again. */
+	idx = nxs_index_create(nxs, "__test-idx-2", NULL);
+	assert(idx);
+	nxs_index_release(idx);
+}
+
+static void
+test_destroy_in_use(nxs_t *nxs)
+{
+	nxs_index_t *idx, *idx2;
+	const char *text = "cat dog";
+	int ret;
+
+	idx = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx);
+
+	/* Closing a shared handle only drops the reference. */
+	idx2 = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx2 == idx);
+	nxs_index_close(idx2);
+	assert(nxs_index_acquire(nxs, "__test-idx-2") == idx);
+	nxs_index_release(idx);
+
+	/* The handle in use is detached from the cache. */
+	ret = nxs_index_destroy(nxs, "__test-idx-2");
+	assert(ret == 0);
+	idx2 = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx2 == NULL);
+
+	/* The new index gets a new handle. */
+	idx2 = nxs_index_create(nxs, "__test-idx-2", NULL);
+	assert(idx2 && idx2 != idx);
+	ret = nxs_index_add(idx2, NULL, 1, text, strlen(text));
+	assert(ret == 0);
+	nxs_index_release(idx2);
+
+	/* The last release closes the doomed handle. */
+	nxs_index_release(idx);
+	idx = nxs_index_acquire(nxs, "__test-idx-2");
+	assert(idx == idx2);
+	nxs_index_release(idx);
+}
+
+static void
+test_sync(nxs_t *nxs, const char *basedir)
+{
+	const char *text = "sync test";
+	nxs_index_t *idx, *idx2;
+	nxs_resp_t *resp;
+	nxs_t *nxs2;
+	int ret;
+
+	idx = nxs_index_acquire(nxs, "__test-idx-1");
+	assert(idx);
+	nxs_index_release(idx);
+
+	/* Nothing to sync. */
+	ret = nxs_index_sync(idx);
+	assert(ret == 0);
+	assert(nxs_index_cache_sync(nxs) == 0);
+
+	/*
+	 * Another instance (e.g. process) updates the index: the idle
+	 * handle is synced once.
+	 */
+	nxs2 = nxs_open(basedir);
+	assert(nxs2);
+	idx2 = nxs_index_open(nxs2, "__test-idx-1");
+	assert(idx2);
+	ret = nxs_index_add(idx2, NULL, 2, text, strlen(text));
+	assert(ret == 0);
+
+	assert(nxs_index_cache_sync(nxs) == 1);
+	assert(nxs_index_cache_sync(nxs) == 0);
+
+	/* The searches find the handle up to date. */
+	idx = nxs_index_acquire(nxs, "__test-idx-1");
+	assert(idx);
+	resp = nxs_index_search(idx, NULL, "sync", 4);
+	assert(resp && nxs_resp_resultcount(resp) == 1);
+	nxs_resp_release(resp);
+
+	ret = nxs_index_remove(idx2, 2);
+	assert(ret == 0);
+	ret = nxs_index_sync(idx);
+	assert(ret == 1);
+	nxs_index_release(idx);
+
+	nxs_index_close(idx2);
+	nxs_close(nxs2);
+}
+
+int
+main(void)
+{
+	char *basedir = get_tmpdir();
+	nxs_index_t *idx;
+	nxs_t *nxs;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	idx = nxs_index_create(nxs, "__test-idx-1", NULL);
+	assert(idx);
+	nxs_index_close(idx);
+
+	idx = nxs_index_create(nxs, "__test-idx-2", NULL);
+	assert(idx);
+	nxs_index_release(idx);
+
+	test_refcount(nxs);
+	test_sync(nxs, basedir);
+	test_idle(nxs);
+	test_destroy_in_use(nxs);
+
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
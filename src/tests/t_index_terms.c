@@ -76,7 +76,7 @@ run_idxterm_test(void)
 	term = idxterm_lookup(&idx, tval, sizeof(tval) - 1);
 	assert(term == tp && term->offset == 1001);
 
-	idxterm_destroy(&idx, term);
+	idxterm_destroy(idx.dict, term);
 
 	idx_terms_close(&idx);
 }
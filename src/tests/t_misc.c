@@ -91,6 +91,74 @@ run_params_tests(void)
 	nxs_params_release(params);
 }
 
+static void
+run_search_params_tests(void)
+{
+	const nxs_sparams_t *sp;
+	nxs_params_t *params;
+	char *json;
+	int ret;
+
+	params = nxs_params_create();
+	assert(params);
+
+	/*
+	 * Compiled from the key-value pairs.
+	 */
+	ret = nxs_params_set_uint(params, "limit", 10);
+	assert(ret == 0);
+	ret = nxs_params_set_bool(params, "fuzzymatch", false);
+	assert(ret == 0);
+	ret = nxs_params_set_uint(params, "id_min", 7);
+	assert(ret == 0);
+
+	sp = nxs_params_get_search(NULL, params);
+	assert(sp && sp->limit == 10 && !sp->fuzzymatch);
+	assert((sp->set & (NXS_SPARAM_ALGO | NXS_SPARAM_TIMEOUT)) == 0);
+	assert((sp->set & NXS_SPARAM_IDRANGE) != 0);
+	assert(sp->id_min == 7 && sp->id_max == UINT64_MAX);
+
+	/*
+	 * The typed values take precedence.
+	 */
+	nxs_params_set_limit(params, 5);
+	nxs_params_set_algo(params, "tf-idf");
+	nxs_params_set_timeout(params, 100);
+	nxs_params_set_stable(params, true);
+	nxs_params_set_id_range(params, 10, 20);
+
+	sp = nxs_params_get_search(NULL, params);
+	assert(sp && sp->limit == 5 && sp->algo == TF_IDF);
+	assert(sp->timeout == 100 && !sp->fuzzymatch && sp->stable);
+	assert(sp->id_min == 10 && sp->id_max == 20);
+
+	/* The interchange form includes the typed values. */
+	json = nxs_params_tojson(params, NULL);
+	assert(json && strstr(json, "\"TF-IDF\"") && strstr(json, "100"));
+	assert(strstr(json, "\"stable\":true"));
+	assert(strstr(json, "\"id_max\":20"));
+	free(json);
+
+	/*
+	 * Invalid values.
+	 */
+	nxs_params_set_limit(params, 0);
+	sp = nxs_params_get_search(NULL, params);
+	assert(sp == NULL);
+
+	nxs_params_set_limit(params, 1);
+	nxs_params_set_algo(params, "no-such-algo");
+	sp = nxs_params_get_search(NULL, params);
+	assert(sp == NULL);
+
+	nxs_params_set_algo(params, "bm25");
+	nxs_params_set_id_range(params, 20, 10);
+	sp = nxs_params_get_search(NULL, params);
+	assert(sp == NULL);
+
+	nxs_params_release(params);
+}
+
 static void
 run_resp_tests(void)
 {
@@ -98,23 +166,29 @@ run_resp_tests(void)
 	char *s;
 	int ret;
 
-	resp = nxs_resp_create(1000);
+	resp = nxs_resp_create(1000, NULL);
 	assert(resp);
 
+	/* Equal scores are ordered by the document ID. */
+	ret = nxs_resp_addresult(resp, &(const idxdoc_t){ .id = 3 }, 1.5);
+	assert(ret == 0);
+
 	ret = nxs_resp_addresult(resp, &(const idxdoc_t){ .id = 1 }, 1.5);
 	assert(ret == 0);
 
 	ret = nxs_resp_addresult(resp, &(const idxdoc_t){ .id = 2 }, 3);
 	assert(ret == 0);
 
-	nxs_resp_build(resp);
+	ret = nxs_resp_build(resp);
+	assert(ret == 0);
 
 	s = nxs_resp_tojson(resp, NULL);
 	nxs_resp_release(resp);
 
 	assert(strcmp(s,
 	    "{\"results\":[{\"doc_id\":2,\"score\":3.0},"
-	    "{\"doc_id\":1,\"score\":1.5}],\"count\":2}") == 0);
+	    "{\"doc_id\":1,\"score\":1.5},"
+	    "{\"doc_id\":3,\"score\":1.5}],\"count\":3}") == 0);
 	free(s);
 }
 
@@ -143,6 +217,7 @@ int
 main(void)
 {
 	run_params_tests();
+	run_search_params_tests();
 	run_resp_tests();
 	run_loglevel_tests();
 	puts("OK");
@@ -0,0 +1,113 @@
+/*
+ * Unit test: character n-gram index and the substring search.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+static nxs_index_t *
+create_index(nxs_t *nxs, const char *name, unsigned n)
+{
+	nxs_params_t *params;
+	nxs_index_t *idx;
+
+	params = nxs_params_create();
+	assert(params);
+	nxs_params_set_uint(params, "ngram", n);
+
+	idx = nxs_index_create(nxs, name, params);
+	nxs_params_release(params);
+	return idx;
+}
+
+static void
+run_substr_tests(nxs_t *nxs)
+{
+	nxs_index_t *idx;
+
+	idx = create_index(nxs, "__test-idx-1", 3);
+	assert(idx);
+
+	test_add_doc(idx, 1, "SKU-AB12345 widget");
+	test_add_doc(idx, 2, "SKU-XY99887 gadget");
+	test_add_doc(idx, 3, "aaaa");
+	test_add_doc(idx, 4, "aa");
+
+	/* Substrings of the identifiers (and the normalization). */
+	test_check_search(idx, "AB123", DOC(1));
+	test_check_search(idx, "99887", DOC(2));
+	test_check_search(idx, "sku", DOC(1) | DOC(2));
+	test_check_search(idx, "ab99", 0);
+	test_check_search(idx, "idge", DOC(1));
+
+	/* Operators. */
+	test_check_search(idx, "idget OR adget", DOC(1) | DOC(2));
+	test_check_search(idx, "sku AND NOT gadget", DOC(1));
+
+	/* Repeated n-grams: the number of occurrences is verified. */
+	test_check_search(idx, "aaaa", DOC(3));
+	test_check_search(idx, "aaaaa", 0);
+
+	/* Shorter than n: only the whole word. */
+	test_check_search(idx, "aa", DOC(4));
+
+	/* New documents. */
+	test_add_doc(idx, 5, "ab1234");
+	test_check_search(idx, "AB123", DOC(1) | DOC(5));
+
+	nxs_index_close(idx);
+}
+
+static void
+run_cjk_tests(nxs_t *nxs)
+{
+	nxs_index_t *idx;
+
+	idx = create_index(nxs, "__test-idx-2", 2);
+	assert(idx);
+
+	test_add_doc(idx, 1, "東京都庁");
+	test_add_doc(idx, 2, "京都大学");
+
+	test_check_search(idx, "京都", DOC(1) | DOC(2));
+	test_check_search(idx, "東京", DOC(1));
+	test_check_search(idx, "京都大", DOC(2));
+	test_check_search(idx, "大阪", 0);
+
+	nxs_index_close(idx);
+}
+
+static void
+run_param_tests(nxs_t *nxs)
+{
+	nxs_index_t *idx;
+
+	/* Invalid n-gram size. */
+	idx = create_index(nxs, "__test-idx-3", 7);
+	assert(idx == NULL);
+}
+
+int
+main(void)
+{
+	char *basedir = get_tmpdir();
+	nxs_t *nxs;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	run_substr_tests(nxs);
+	run_cjk_tests(nxs);
+	run_param_tests(nxs);
+
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
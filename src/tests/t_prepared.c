@@ -0,0 +1,112 @@
+/*
+ * Unit test: prepared queries.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+static uint64_t
+compare_search(nxs_index_t *idx, nxs_query_t **pq)
+{
+	uint64_t generation = 0;
+
+	for (unsigned i = 0; i < test_queries_count; i++) {
+		const char *q = test_queries[i];
+		nxs_resp_t *resp, *presp;
+
+		resp = nxs_index_search(idx, NULL, q, strlen(q));
+		assert(resp);
+		presp = nxs_query_exec(pq[i]);
+		assert(presp);
+		test_compare_resp(q, resp, presp);
+
+		/* Both at the same read view. */
+		generation = nxs_resp_generation(resp);
+		assert(generation > 0);
+		assert(generation == nxs_resp_generation(presp));
+
+		nxs_resp_release(resp);
+		nxs_resp_release(presp);
+	}
+	return generation;
+}
+
+static void
+test_invalid(nxs_index_t *idx)
+{
+	nxs_query_t *pq;
+
+	pq = nxs_query_prepare(idx, NULL, "(", 1);
+	assert(pq == NULL);
+}
+
+int
+main(void)
+{
+	nxs_query_t **pq;
+	char *basedir = get_tmpdir();
+	uint64_t generation, prev;
+	nxs_index_t *idx;
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+	idx = nxs_index_create(nxs, "__test-idx-prepared", NULL);
+	assert(idx);
+	test_add_docs(idx, test_docs, 0, 1);
+
+	pq = calloc(test_queries_count, sizeof(nxs_query_t *));
+	assert(pq);
+
+	/*
+	 * Prepare the queries while most of the terms are unknown.
+	 */
+	for (unsigned i = 0; i < test_queries_count; i++) {
+		const char *q = test_queries[i];
+
+		pq[i] = nxs_query_prepare(idx, NULL, q, strlen(q));
+		assert(pq[i]);
+	}
+	prev = compare_search(idx, pq);
+
+	/*
+	 * Add the documents: the new terms must be resolved.
+	 * Each change advances the generation.
+	 */
+	for (unsigned i = 1; i < test_docs_count; i++) {
+		test_add_docs(idx, test_docs, i, i + 1);
+		generation = compare_search(idx, pq);
+		assert(generation > prev);
+		prev = generation;
+	}
+
+	/*
+	 * Remove a document.
+	 */
+	ret = nxs_index_remove(idx, 3);
+	assert(ret == 0);
+	generation = compare_search(idx, pq);
+	assert(generation > prev);
+
+	/* Repeated execution without changes. */
+	assert(compare_search(idx, pq) == generation);
+
+	test_invalid(idx);
+
+	for (unsigned i = 0; i < test_queries_count; i++) {
+		nxs_query_release(pq[i]);
+	}
+	free(pq);
+	nxs_index_close(idx);
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
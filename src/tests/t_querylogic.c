@@ -51,16 +51,198 @@ static const test_search_case_t test_case_3 = {
 	}
 };
 
+static const test_search_case_t test_case_4 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "java OR shell OR windows OR java",  // flattened OR
+	.scores = {
+		DOC_ID_ONLY(2),
+		DOC_ID_ONLY(4),
+		DOC_ID_ONLY(5),
+		DOC_ID_ONLY(6),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_5 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "linux AND (linux AND textbook) AND linux",
+	.scores = {
+		DOC_ID_ONLY(1),
+		DOC_ID_ONLY(4),
+		DOC_ID_ONLY(5),
+		DOC_ID_ONLY(6),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_6 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "textbook AND NOT windows AND NOT java",
+	.scores = {
+		DOC_ID_ONLY(1),
+		DOC_ID_ONLY(2),
+		DOC_ID_ONLY(6),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_7 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "(textbook AND NOT java) AND linux AND "
+	         "NOT (windows OR shell)",  // nested NOT lifted
+	.scores = {
+		DOC_ID_ONLY(1),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_8 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "erlang AND non-existant-term AND python",
+	.scores = { END_TEST_SCORE }
+};
+
+static const test_search_case_t test_case_9 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "unux",  // fuzzy expansion: "unix" and "linux"
+	.scores = {
+		DOC_ID_ONLY(1),
+		DOC_ID_ONLY(2),
+		DOC_ID_ONLY(4),
+		DOC_ID_ONLY(5),
+		DOC_ID_ONLY(6),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_10 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "textbook id:[2..5]",  // document ID range
+	.scores = {
+		DOC_ID_ONLY(2),
+		DOC_ID_ONLY(4),
+		DOC_ID_ONLY(5),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_11 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "id:[..0x3] erlang OR shell id:[2..]",
+	.scores = {
+		DOC_ID_ONLY(2),
+		DOC_ID_ONLY(3),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_12 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "textbook AND FILTER(linux OR unix)",
+	.scores = {
+		DOC_ID_ONLY(1),
+		DOC_ID_ONLY(2),
+		DOC_ID_ONLY(4),
+		DOC_ID_ONLY(5),
+		DOC_ID_ONLY(6),
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_13 = {
+	.docs = docs, .doc_count = __arraycount(docs),
+	.query = "FILTER(erlang) AND NOT FILTER(linux)",
+	.scores = {
+		DOC_ID_ONLY(3),
+		END_TEST_SCORE
+	}
+};
+
 static const test_search_case_t *test_cases[] = {
-	&test_case_1, &test_case_2, &test_case_3
+	&test_case_1, &test_case_2, &test_case_3, &test_case_4,
+	&test_case_5, &test_case_6, &test_case_7, &test_case_8,
+	&test_case_9, &test_case_10, &test_case_11, &test_case_12,
+	&test_case_13,
 };
 
+static unsigned
+search_count(nxs_index_t *idx, const char *q)
+{
+	nxs_resp_t *resp;
+	unsigned count;
+
+	resp = nxs_index_search(idx, NULL, q, strlen(q));
+	assert(resp);
+	count = nxs_resp_resultcount(resp);
+	nxs_resp_release(resp);
+	return count;
+}
+
+static void
+run_filter_cache_test(void)
+{
+	const char *q = "textbook AND FILTER(linux OR unix)";
+	char *basedir = get_tmpdir();
+	roaring64_bitmap_t *bm;
+	idxsyn_cent_t *ent;
+	nxs_index_t *idx;
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+	idx = nxs_index_create(nxs, "__test-idx-2", NULL);
+	assert(idx);
+
+	for (unsigned i = 0; i < __arraycount(docs); i++) {
+		const char *text = docs[i].text;
+
+		ret = nxs_index_add(idx, NULL, docs[i].id, text, strlen(text));
+		assert(ret == 0);
+	}
+
+	/* The union of the filter is cached and then reused. */
+	assert(search_count(idx, q) == 5);
+	assert(idx->syn_cache_count == 1);
+	assert(search_count(idx, q) == 5);
+	assert(idx->syn_cache_count == 1);
+
+	/*
+	 * A different filter with the same hash (collision) must not get
+	 * the cached bitmap nor replace it.
+	 */
+	ent = TAILQ_FIRST(&idx->syn_cache_list);
+	assert(ent && ent->data_len > 0);
+	bm = idxsyn_cache_get(idx, ent->key, "other", 5);
+	assert(bm == NULL);
+	bm = roaring64_bitmap_create();
+	assert(bm);
+	ret = idxsyn_cache_put(idx, ent->key, "other", 5, bm);
+	assert(ret == -1);
+	roaring64_bitmap_free(bm);
+	bm = idxsyn_cache_get(idx, ent->key, ent->data, ent->data_len);
+	assert(bm == ent->doc_bitmap);
+
+	/* The cached bitmap is not used by the newer generation. */
+	ret = nxs_index_add(idx, NULL, 7, "Unix textbook", 13);
+	assert(ret == 0);
+	assert(search_count(idx, q) == 6);
+
+	/* Not cached if it depends on the fuzzy matching. */
+	assert(search_count(idx, "textbook AND FILTER(unux OR java)") == 6);
+	assert(idx->syn_cache_count == 1);
+
+	nxs_index_close(idx);
+	nxs_close(nxs);
+}
+
 int
 main(void)
 {
 	for (unsigned i = 0; i < __arraycount(test_cases); i++) {
 		test_index_search(test_cases[i]);
 	}
+	run_filter_cache_test();
 	puts("OK");
 	return 0;
 }
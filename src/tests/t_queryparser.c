@@ -114,10 +114,94 @@ static const test_case_t test_case_10 = {
 	.tokens = { TOKEN_FF_STRING, TOKEN_AND, TOKEN_FF_STRING, 0, },
 };
 
+static const test_case_t test_case_11 = {
+	.query = "A^3 OR (B AND C^0.5)^2",
+	.repr = "(OR `A`^3 (AND `B` `C`^0.5)^2)",
+	.tokens = {
+		TOKEN_FF_STRING, TOKEN_BOOST, TOKEN_OR, TOKEN_BR_OPEN,
+		TOKEN_FF_STRING, TOKEN_AND, TOKEN_FF_STRING, TOKEN_BOOST,
+		TOKEN_BR_CLOSE, TOKEN_BOOST, 0,
+	},
+};
+
+static const test_case_t test_case_12 = {
+	.query = "^2 OR A",
+	.repr = NULL,  // syntax error
+	.tokens = { TOKEN_BOOST, TOKEN_OR, TOKEN_FF_STRING, 0 },
+};
+
+static const test_case_t test_case_13 = {
+	.query = "id:[..0x10] A OR B id:[5..] C",
+	.repr = "(OR (OR `A` `B`) `C`)",
+	.tokens = {
+		TOKEN_ID_RANGE, TOKEN_FF_STRING, TOKEN_OR, TOKEN_FF_STRING,
+		TOKEN_ID_RANGE, TOKEN_FF_STRING, 0,
+	},
+};
+
+static const test_case_t test_case_14 = {
+	.query = "(A id:[1..2])",
+	.repr = NULL,  // syntax error: the range is only at the top level
+	.tokens = {
+		TOKEN_BR_OPEN, TOKEN_FF_STRING, TOKEN_ID_RANGE,
+		TOKEN_BR_CLOSE, 0,
+	},
+};
+
+static const test_case_t test_case_15 = {
+	.query = "A id:[2..1]",
+	.repr = NULL,  // syntax error: inverted range
+	.tokens = { TOKEN_FF_STRING, 0 },
+};
+
+static const test_case_t test_case_16 = {
+	.query = "A AND filter(B OR C)",
+	.repr = "(AND `A` (FILTER (OR `B` `C`)))",
+	.tokens = {
+		TOKEN_FF_STRING, TOKEN_AND, TOKEN_FILTER, TOKEN_FF_STRING,
+		TOKEN_OR, TOKEN_FF_STRING, TOKEN_BR_CLOSE, 0,
+	},
+};
+
+static const test_case_t test_case_17 = {
+	.query = "filter (A)",  // not a filter: the bracket is separate
+	.repr = "(OR `filter` `A`)",
+	.tokens = {
+		TOKEN_FF_STRING, TOKEN_BR_OPEN, TOKEN_FF_STRING,
+		TOKEN_BR_CLOSE, 0,
+	},
+};
+
+static const test_case_t test_case_18 = {
+	.query = "c^ OR x^y a^2x",  // the caret not followed by a digit
+	.repr = "(OR (OR (OR `c^` `x^y`) `a`^2) `x`)",
+	.tokens = {
+		TOKEN_FF_STRING, TOKEN_OR, TOKEN_FF_STRING, TOKEN_FF_STRING,
+		TOKEN_BOOST, TOKEN_FF_STRING, 0,
+	},
+};
+
+static const test_case_t test_case_19 = {
+	.query = "a^1000000000000000000000000000000000000000",
+	.repr = NULL,  // syntax error: the boost is too large
+	.tokens = { TOKEN_FF_STRING, 0 },
+};
+
+static const test_case_t test_case_20 = {
+	.query = "((a^1000)^1000)^2",
+	.repr = "`a`^1000",  // the nested boosts are capped
+	.tokens = {
+		TOKEN_BR_OPEN, TOKEN_BR_OPEN, TOKEN_FF_STRING, TOKEN_BOOST,
+		TOKEN_BR_CLOSE, TOKEN_BOOST, TOKEN_BR_CLOSE, TOKEN_BOOST, 0,
+	},
+};
+
 static const test_case_t *test_cases[] = {
 	&test_case_1, &test_case_2, &test_case_3, &test_case_4, &test_case_5,
 	/*&test_case_6,*/ &test_case_7, &test_case_8, &test_case_9,
-	&test_case_10,
+	&test_case_10, &test_case_11, &test_case_12, &test_case_13,
+	&test_case_14, &test_case_15, &test_case_16, &test_case_17,
+	&test_case_18, &test_case_19, &test_case_20,
 };
 
 static void
@@ -142,8 +226,8 @@ test_query_lexer(const test_case_t *t)
 		switch (token) {
 		case TOKEN_QUOTED_STRING:
 		case TOKEN_FF_STRING:
+			/* The string is allocated from the query arena. */
 			ASSERT(lval->len);
-			free(lval->str);
 			break;
 		}
 
@@ -160,11 +244,18 @@ expr_string_dump(const expr_t *expr)
 		[EXPR_OP_OR] = "OR",
 		[EXPR_OP_NOT] = "NOT",
 	};
-	char *buf = NULL;
+	char *buf = NULL, *s;
 
 	if (expr->type == EXPR_VAL_TOKEN) {
 		// Use the backtick for strings
 		asprintf(&buf, "`%s`", expr->value);
+	} else if (expr->type == EXPR_OP_FILTER) {
+		char *e = expr_string_dump(expr->elements[0]);
+
+		// Note: the filter has the zero boost (not shown)
+		asprintf(&buf, "(FILTER %s)", e);
+		free(e);
+		return buf;
 	} else {
 		char *e1 = expr_string_dump(expr->elements[0]);
 		char *e2 = expr_string_dump(expr->elements[1]);
@@ -173,6 +264,11 @@ expr_string_dump(const expr_t *expr)
 		free(e1);
 		free(e2);
 	}
+	if (expr->boost != 1.0f) {
+		asprintf(&s, "%s^%g", buf, expr->boost);
+		free(buf);
+		buf = s;
+	}
 	return buf;
 }
 
@@ -210,6 +306,27 @@ test_query_parser(const test_case_t *t)
 	query_destroy(q);
 }
 
+static void
+test_query_id_range(void)
+{
+	query_t *q;
+	int ret;
+
+	/* The ranges are intersected. */
+	q = query_create(NULL);
+	ret = query_parse(q, "id:[..0x10] A id:[5..] B id:[0..100]");
+	assert(ret == 0 && !q->error);
+	assert(q->id_min == 5 && q->id_max == 16);
+	query_destroy(q);
+
+	/* Unbounded by default. */
+	q = query_create(NULL);
+	ret = query_parse(q, "A");
+	assert(ret == 0 && !q->error);
+	assert(q->id_min == 0 && q->id_max == UINT64_MAX);
+	query_destroy(q);
+}
+
 int
 main(void)
 {
@@ -219,6 +336,7 @@ main(void)
 	for (unsigned i = 0; i < __arraycount(test_cases); i++) {
 		test_query_parser(test_cases[i]);
 	}
+	test_query_id_range();
 	puts("OK");
 	return 0;
 }
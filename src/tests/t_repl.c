@@ -0,0 +1,121 @@
+/*
+ * Unit test: index replication.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+static unsigned
+replicate(nxs_index_t *leader, nxs_index_t *follower, size_t maxlen)
+{
+	uint64_t terms_pos, dtmap_pos, lt_pos, ld_pos;
+	unsigned rounds = 0;
+
+	for (;;) {
+		size_t len;
+		void *buf;
+		int ret;
+
+		nxs_index_repl_pos(follower, &terms_pos, &dtmap_pos);
+		nxs_index_repl_pos(leader, &lt_pos, &ld_pos);
+		if (terms_pos == lt_pos && dtmap_pos == ld_pos) {
+			break;
+		}
+		buf = nxs_index_repl_export(leader,
+		    terms_pos, dtmap_pos, maxlen, &len);
+		assert(buf);
+
+		ret = nxs_index_repl_apply(follower, buf, len);
+		assert(ret == 0);
+		free(buf);
+		rounds++;
+	}
+	return rounds;
+}
+
+static void
+test_invalid(nxs_index_t *leader, nxs_index_t *follower)
+{
+	size_t len;
+	void *buf;
+	int ret;
+
+	/* Position past the index data. */
+	buf = nxs_index_repl_export(leader, UINT32_MAX, 0, 0, &len);
+	assert(buf == NULL);
+
+	/* Garbage and truncated change sets. */
+	ret = nxs_index_repl_apply(follower, "garbage", 7);
+	assert(ret == -1);
+
+	buf = nxs_index_repl_export(leader, 0, 0, 0, &len);
+	assert(buf);
+	ret = nxs_index_repl_apply(follower, buf, len - 1);
+	assert(ret == -1);
+
+	/* Stale positions (already applied). */
+	ret = nxs_index_repl_apply(follower, buf, len);
+	assert(ret == -1);
+	free(buf);
+}
+
+int
+main(void)
+{
+	nxs_index_t *leader, *follower;
+	char *basedir = get_tmpdir();
+	unsigned rounds;
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	leader = nxs_index_create(nxs, "__test-idx-leader", NULL);
+	assert(leader);
+	follower = nxs_index_create(nxs, "__test-idx-follower", NULL);
+	assert(follower);
+
+	/*
+	 * Initial replication.
+	 */
+	test_add_docs(leader, test_docs, 0, 3);
+	rounds = replicate(leader, follower, 0);
+	assert(rounds == 1);
+	test_compare_search(leader, follower);
+
+	/*
+	 * Incremental replication with the removal of a replicated
+	 * document and the document length limit (one block per round).
+	 */
+	test_add_docs(leader, test_docs, 3, test_docs_count);
+	ret = nxs_index_remove(leader, 3);
+	assert(ret == 0);
+
+	rounds = replicate(leader, follower, 1);
+	assert(rounds == 3);
+	test_compare_search(leader, follower);
+
+	/*
+	 * Re-open the follower: the removed document must not be loaded.
+	 */
+	nxs_index_close(follower);
+	follower = nxs_index_open(nxs, "__test-idx-follower");
+	assert(follower);
+	test_compare_search(leader, follower);
+
+	test_invalid(leader, follower);
+
+	nxs_index_close(follower);
+	nxs_index_close(leader);
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
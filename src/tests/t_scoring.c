@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <err.h>
 
 #include "nxs.h"
 #include "index.h"
@@ -157,17 +158,167 @@ static const test_search_case_t test_case_7 = {
 	}
 };
 
+static const test_search_case_t test_case_8 = {
+	/*
+	 * Boost: the term score is multiplied.
+	 */
+	.docs = docs_1, .doc_count = __arraycount(docs_1),
+	.query = "fox^2 dog", .scores = {
+		{ 1,
+			{
+				DOG_TFIDF_SCORE + 2 * FOX_TFIDF_SCORE,
+				DOG_BM25_SCORE + 2 * FOX_BM25_SCORE,
+			}
+		},
+		{ 2, { 2 * FOX_TFIDF_SCORE, 2 * FOX_BM25_SCORE } },
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_9 = {
+	/*
+	 * Boost of the sub-expression; the highest weight of
+	 * the term wins if it is used multiple times.
+	 */
+	.docs = docs_1, .doc_count = __arraycount(docs_1),
+	.query = "(fox OR dog)^0.5 dog", .scores = {
+		{ 1,
+			{
+				DOG_TFIDF_SCORE + 0.5 * FOX_TFIDF_SCORE,
+				DOG_BM25_SCORE + 0.5 * FOX_BM25_SCORE,
+			}
+		},
+		{ 2, { 0.5 * FOX_TFIDF_SCORE, 0.5 * FOX_BM25_SCORE } },
+		END_TEST_SCORE
+	}
+};
+
+static const test_doc_t docs_6[] = {
+	{ 70000, "The quick brown fox jumped over the lazy dog" },
+	{
+		UINT64_C(0x200000001),
+		"Once upon a time there were three little foxes"
+	},
+};
+
+static const test_search_case_t test_case_10 = {
+	/*
+	 * Sparse document IDs (different bitmap containers): the term
+	 * iterators seek forward across them.
+	 */
+	.docs = docs_6, .doc_count = __arraycount(docs_6),
+	.query = "fox^2 dog", .scores = {
+		{ 70000,
+			{
+				DOG_TFIDF_SCORE + 2 * FOX_TFIDF_SCORE,
+				DOG_BM25_SCORE + 2 * FOX_BM25_SCORE,
+			}
+		},
+		{ UINT64_C(0x200000001),
+			{ 2 * FOX_TFIDF_SCORE, 2 * FOX_BM25_SCORE }
+		},
+		END_TEST_SCORE
+	}
+};
+
+static const test_search_case_t test_case_11 = {
+	/*
+	 * Filter: the documents are matched, but not scored by it.
+	 */
+	.docs = docs_1, .doc_count = __arraycount(docs_1),
+	.query = "dog OR FILTER(fox)", .scores = {
+		{ 1, { DOG_TFIDF_SCORE, DOG_BM25_SCORE } },
+		{ 2, { 0, 0 } },
+		END_TEST_SCORE
+	}
+};
+
 static const test_search_case_t *test_cases[] = {
 	&test_case_1, &test_case_2, &test_case_3, &test_case_4,
-	&test_case_5, &test_case_6, &test_case_7
+	&test_case_5, &test_case_6, &test_case_7, &test_case_8,
+	&test_case_9, &test_case_10, &test_case_11,
 };
 
+static char *
+search_stable(nxs_index_t *idx, const char *algo, const char *q)
+{
+	nxs_params_t *params;
+	nxs_resp_t *resp;
+	char *s;
+
+	params = nxs_params_create();
+	assert(params);
+	nxs_params_set_algo(params, algo);
+	nxs_params_set_stable(params, true);
+
+	resp = nxs_index_search(idx, params, q, strlen(q));
+	nxs_params_release(params);
+	assert(resp);
+
+	s = nxs_resp_tojson(resp, NULL);
+	nxs_resp_release(resp);
+	assert(s);
+	return s;
+}
+
+static void
+run_stable_tests(void)
+{
+	static const char *queries[] = {
+		"cat dog rat^0.3 cow^0.7 bat^0.1",
+		"bat^0.1 cow^0.7 rat^0.3 dog cat",
+		"rat^0.3 bat^0.1 cat cow^0.7 dog",
+	};
+	char *basedir = get_tmpdir();
+	nxs_index_t *idx;
+	nxs_t *nxs;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	idx = nxs_index_create(nxs, "__test-idx-1", NULL);
+	assert(idx);
+
+	for (unsigned i = 0; i < __arraycount(docs_3); i++) {
+		const char *text = docs_3[i].text;
+		int ret;
+
+		ret = nxs_index_add(idx, NULL, docs_3[i].id,
+		    text, strlen(text));
+		assert(ret == 0);
+	}
+
+	/*
+	 * Stable mode: the order of the terms in the query does not
+	 * affect the scores (the responses must be identical).
+	 */
+	for (unsigned a = 0; a < 2; a++) {
+		const char *algo = a ? "BM25" : "TF-IDF";
+		char *expected = search_stable(idx, algo, queries[0]);
+
+		for (unsigned i = 1; i < __arraycount(queries); i++) {
+			char *s = search_stable(idx, algo, queries[i]);
+
+			if (strcmp(s, expected) != 0) {
+				errx(EXIT_FAILURE, "query [%s]: expected %s, "
+				    "got %s", queries[i], expected, s);
+			}
+			free(s);
+		}
+		free(expected);
+	}
+
+	nxs_index_close(idx);
+	nxs_close(nxs);
+}
+
 int
 main(void)
 {
 	for (unsigned i = 0; i < __arraycount(test_cases); i++) {
 		test_index_search(test_cases[i]);
 	}
+	run_stable_tests();
 	puts("OK");
 	return 0;
 }
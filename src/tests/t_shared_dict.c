@@ -0,0 +1,104 @@
+/*
+ * Unit test: indexes sharing the term dictionary.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#define __NXSLIB_PRIVATE
+#include "nxs_impl.h"
+#include "helpers.h"
+#include "utils.h"
+
+static nxs_index_t *
+create_index(nxs_t *nxs, const char *name)
+{
+	nxs_params_t *params;
+	nxs_index_t *idx;
+	int ret;
+
+	params = nxs_params_create();
+	assert(params);
+	ret = nxs_params_set_str(params, "dictionary", "tenants");
+	assert(ret == 0);
+
+	idx = nxs_index_create(nxs, name, params);
+	assert(idx);
+	nxs_params_release(params);
+	return idx;
+}
+
+int
+main(void)
+{
+	char *basedir = get_tmpdir();
+	nxs_index_t *idx1, *idx2;
+	uint64_t terms_pos, dtmap_pos;
+	char *path;
+	size_t len;
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	idx1 = create_index(nxs, "__test-idx-1");
+	idx2 = create_index(nxs, "__test-idx-2");
+
+	/* The dictionary is shared; there is no own terms index. */
+	assert(idx1->dict == idx2->dict);
+	asprintf(&path, "%s/data/__test-idx-1/nxsterms", basedir);
+	assert(access(path, F_OK) == -1);
+	free(path);
+
+	/*
+	 * The postings are per index.
+	 */
+	test_add_doc(idx1, 1, "cat dog");
+	test_add_doc(idx2, 2, "dog cow");
+	test_add_doc(idx2, 3, "cat cat");
+	assert(idx1->dict->term_count == 3);
+
+	test_check_search(idx1, "dog", DOC(1));
+	test_check_search(idx1, "cow", 0);
+	test_check_search(idx2, "dog", DOC(2));
+	test_check_search(idx2, "cat", DOC(3));
+
+	/* Fuzzy match must not pick the term not occurring in the index. */
+	test_check_search(idx1, "cowx", 0);
+	test_check_search(idx2, "cowx", DOC(2));
+
+	/*
+	 * Close one index and re-open it: the other is not affected.
+	 */
+	nxs_index_close(idx1);
+	test_check_search(idx2, "cow", DOC(2));
+
+	idx1 = nxs_index_open(nxs, "__test-idx-1");
+	assert(idx1 && idx1->dict == idx2->dict);
+	test_check_search(idx1, "dog", DOC(1));
+
+	/* Re-open both: load the dictionary from the disk. */
+	nxs_index_close(idx1);
+	nxs_index_close(idx2);
+	idx1 = nxs_index_open(nxs, "__test-idx-1");
+	assert(idx1 && idx1->dict->term_count == 3);
+	test_check_search(idx1, "cat", DOC(1));
+
+	/* Replication is not supported. */
+	nxs_index_repl_pos(idx1, &terms_pos, &dtmap_pos);
+	assert(nxs_index_repl_export(idx1, 0, 0, 0, &len) == NULL);
+	assert(nxs_get_error(nxs, NULL) == NXS_ERR_INVALID);
+	nxs_index_close(idx1);
+
+	ret = nxs_index_destroy(nxs, "__test-idx-1");
+	assert(ret == 0);
+
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Unit tests: slab allocator.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "slab.h"
+#include "utils.h"
+
+#define	NOBJS		(4096)
+
+static void
+run_basic_tests(void)
+{
+	slab_stats_t st0, st;
+	unsigned char *p, *q;
+
+	slab_get_stats(&st0);
+
+	/*
+	 * Aligned and usable objects of the different sizes.
+	 */
+	p = slab_alloc(1);
+	assert(p && ((uintptr_t)p % 16) == 0);
+	*p = 0xa5;
+
+	q = slab_calloc(100, 3);
+	assert(q && ((uintptr_t)q % 16) == 0);
+	for (unsigned i = 0; i < 300; i++) {
+		assert(q[i] == 0);
+	}
+	memset(q, 0x5a, 300);
+	assert(*p == 0xa5);
+
+	slab_get_stats(&st);
+	assert(st.used == st0.used + 301);
+	slab_free(q);
+
+	/*
+	 * Aligned allocation (e.g. the bitmap container).
+	 */
+	q = slab_aligned_alloc(64, 8192);
+	assert(q && ((uintptr_t)q % 64) == 0);
+	memset(q, 0xff, 8192);
+	slab_free(q);
+
+	/*
+	 * Realloc: in place within the size class, then moves.
+	 */
+	q = slab_realloc(NULL, 20);
+	assert(q);
+	memcpy(q, "0123456789", 10);
+	p = slab_realloc(q, 24);
+	assert(p == q);
+	p = slab_realloc(p, 5000);
+	assert(p && memcmp(p, "0123456789", 10) == 0);
+
+	/* Large object. */
+	q = slab_alloc(256 * 1024);
+	assert(q);
+	memset(q, 0, 256 * 1024);
+	slab_get_stats(&st);
+	assert(st.large >= 256 * 1024);
+	slab_free(q);
+	slab_free(p);
+	slab_free(NULL);
+
+	slab_get_stats(&st);
+	assert(st.used == st0.used + 1);
+	slab_free(slab_realloc(NULL, 0));
+}
+
+static void
+run_churn_tests(void)
+{
+	void **objs = malloc(NOBJS * sizeof(void *));
+	slab_stats_t st0, st;
+
+	assert(objs);
+	slab_get_stats(&st0);
+
+	/*
+	 * Fill many slabs, then free every other object: the slabs are
+	 * fragmented, but the freed objects are reused by the same class.
+	 */
+	for (unsigned i = 0; i < NOBJS; i++) {
+		objs[i] = slab_alloc(100);
+		assert(objs[i]);
+	}
+	for (unsigned i = 0; i < NOBJS; i += 2) {
+		slab_free(objs[i]);
+	}
+	slab_get_stats(&st);
+	assert(st.free >= (NOBJS / 2) * 100);
+	for (unsigned i = 0; i < NOBJS; i += 2) {
+		objs[i] = slab_alloc(100);
+		assert(objs[i]);
+	}
+	slab_get_stats(&st);
+	assert(st.used == st0.used + NOBJS * 100);
+
+	/*
+	 * Free all: the empty slabs are released (except the spare).
+	 */
+	for (unsigned i = 0; i < NOBJS; i++) {
+		slab_free(objs[i]);
+	}
+	slab_get_stats(&st);
+	assert(st.used == st0.used);
+	assert(st.slabs <= st0.slabs + 1);
+	free(objs);
+}
+
+int
+main(void)
+{
+	run_basic_tests();
+	run_churn_tests();
+	puts("OK");
+	return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Unit test: index snapshots and cloning.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+int
+main(void)
+{
+	nxs_index_t *idx, *ref, *clone;
+	char *basedir = get_tmpdir();
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	idx = nxs_index_create(nxs, "__test-idx", NULL);
+	assert(idx);
+	ref = nxs_index_create(nxs, "__test-idx-ref", NULL);
+	assert(ref);
+
+	/*
+	 * Snapshot with a removed document; modify the index afterwards.
+	 */
+	test_add_docs(idx, test_docs, 0, 3);
+	test_add_docs(ref, test_docs, 0, 2);
+	ret = nxs_index_remove(idx, 3);
+	assert(ret == 0);
+
+	ret = nxs_index_snapshot(idx, "snap1");
+	assert(ret == 0);
+
+	test_add_docs(idx, test_docs, 3, test_docs_count);
+	ret = nxs_index_remove(idx, 1);
+	assert(ret == 0);
+
+	/* Duplicate and invalid snapshot names. */
+	ret = nxs_index_snapshot(idx, "snap1");
+	assert(ret == -1 && nxs_get_error(nxs, NULL) == NXS_ERR_EXISTS);
+	ret = nxs_index_snapshot(idx, "../snap");
+	assert(ret == -1);
+
+	/*
+	 * Clone the snapshot: it must not observe the later changes.
+	 */
+	clone = nxs_index_clone(nxs, "snap1", "__test-idx-clone");
+	assert(clone);
+	test_compare_search(ref, clone);
+
+	/* The clone is independent and writable. */
+	test_add_docs(clone, test_docs, 3, test_docs_count);
+	test_add_docs(ref, test_docs, 3, test_docs_count);
+	test_compare_search(ref, clone);
+
+	/* Re-open the clone. */
+	nxs_index_close(clone);
+	clone = nxs_index_open(nxs, "__test-idx-clone");
+	assert(clone);
+	test_compare_search(ref, clone);
+	nxs_index_close(clone);
+
+	/* Existing index name and missing snapshot. */
+	clone = nxs_index_clone(nxs, "snap1", "__test-idx");
+	assert(clone == NULL);
+	clone = nxs_index_clone(nxs, "snap2", "__test-idx-other");
+	assert(clone == NULL);
+
+	ret = nxs_snapshot_destroy(nxs, "snap1");
+	assert(ret == 0);
+	clone = nxs_index_clone(nxs, "snap1", "__test-idx-other");
+	assert(clone == NULL);
+
+	nxs_index_close(ref);
+	nxs_index_close(idx);
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Unit test: synonym dictionary.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "nxs.h"
+#include "helpers.h"
+#include "utils.h"
+
+static const char synonyms[] =
+    "# vehicles\n"
+    "car, Automobile,auto , car\n"
+    "\n"
+    "bike, bicycle\n"
+    "lonely\n";
+
+int
+main(void)
+{
+	const char *q = "vehicle AND car";
+	char *basedir = get_tmpdir();
+	nxs_index_t *idx;
+	nxs_query_t *pq;
+	nxs_t *nxs;
+	int ret;
+
+	nxs = nxs_open(basedir);
+	assert(nxs);
+
+	idx = nxs_index_create(nxs, "__test-idx-1", NULL);
+	assert(idx);
+
+	test_add_doc(idx, 1, "car repair");
+	test_add_doc(idx, 2, "automobile dealer");
+	test_add_doc(idx, 3, "vehicle auto parts");
+	test_add_doc(idx, 4, "bicycle shop");
+
+	/* No dictionary. */
+	test_check_search(idx, "car", DOC(1));
+
+	ret = nxs_index_set_synonyms(idx, synonyms, strlen(synonyms));
+	assert(ret == 0);
+
+	/* Expansion (twice, the second time from the cache). */
+	test_check_search(idx, "car", DOC(1) | DOC(2) | DOC(3));
+	test_check_search(idx, "auto", DOC(1) | DOC(2) | DOC(3));
+	test_check_search(idx, "bike", DOC(4));
+	test_check_search(idx, "lonely", 0);
+
+	/* Filter pipeline (normalization, stemming) and the operators. */
+	test_check_search(idx, "CARS", DOC(1) | DOC(2) | DOC(3));
+	test_check_search(idx, "automobile AND repair", DOC(1));
+	test_check_search(idx, "shop OR auto",
+	    DOC(1) | DOC(2) | DOC(3) | DOC(4));
+	test_check_search(idx, "vehicle AND NOT car", 0);
+	test_check_search(idx, "parts AND NOT bike", DOC(3));
+
+	/* The cached union must reflect the index changes. */
+	pq = nxs_query_prepare(idx, NULL, q, strlen(q));
+	assert(pq);
+	assert(test_get_doc_mask(nxs_query_exec(pq)) == DOC(3));
+
+	test_add_doc(idx, 5, "auto vehicle insurance");
+	test_check_search(idx, "car", DOC(1) | DOC(2) | DOC(3) | DOC(5));
+	assert(test_get_doc_mask(nxs_query_exec(pq)) == (DOC(3) | DOC(5)));
+	nxs_query_release(pq);
+
+	/* Re-open: the dictionary is loaded from the disk. */
+	nxs_index_close(idx);
+	idx = nxs_index_open(nxs, "__test-idx-1");
+	assert(idx);
+	test_check_search(idx, "bicycle", DOC(4));
+
+	/* Remove the dictionary. */
+	ret = nxs_index_set_synonyms(idx, "", 0);
+	assert(ret == 0);
+	test_check_search(idx, "car", DOC(1));
+
+	nxs_index_close(idx);
+	nxs_close(nxs);
+	puts("OK");
+	return 0;
+}
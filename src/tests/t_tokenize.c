@@ -165,7 +165,7 @@ run_tokenizer_tests(void)
 		tokenset_t *tokens;
 		unsigned i;
 
-		tokens = tokenize(fp, params, text, strlen(text));
+		tokens = tokenize(fp, NULL, text, strlen(text));
 		assert(tokens != NULL);
 
 		i = 0;
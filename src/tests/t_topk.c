@@ -0,0 +1,130 @@
+/*
+ * Unit test: top-k selection.
+ * This code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <assert.h>
+
+#include "topk.h"
+#include "utils.h"
+
+typedef enum {
+	ORDER_RANDOM,
+	ORDER_ASCENDING,
+	ORDER_DESCENDING,
+	ORDER_EQUAL,
+} order_t;
+
+static int
+cmp_entry(const void *p1, const void *p2)
+{
+	const topk_entry_t *e1 = p1;
+	const topk_entry_t *e2 = p2;
+
+	if (e1->score > e2->score)
+		return -1;
+	if (e1->score < e2->score)
+		return 1;
+	if (e1->id < e2->id)
+		return -1;
+	if (e1->id > e2->id)
+		return 1;
+	return 0;
+}
+
+static void
+fill_entries(topk_entry_t *a, size_t n, order_t order)
+{
+	for (size_t i = 0; i < n; i++) {
+		float score;
+
+		switch (order) {
+		case ORDER_RANDOM:
+			/* Few distinct values: many ties. */
+			score = (float)(random() % 50) / 4 - 2;
+			break;
+		case ORDER_ASCENDING:
+			score = (float)i;
+			break;
+		case ORDER_DESCENDING:
+			score = (float)(n - i);
+			break;
+		case ORDER_EQUAL:
+		default:
+			score = 1.5;
+			break;
+		}
+		/* Unique IDs, in a shuffled order. */
+		topk_entry_set(&a[i], (i * 7919) % n + 1, score);
+	}
+}
+
+static void
+run_select_test(size_t n, size_t k, order_t order)
+{
+	topk_entry_t *a, *ref;
+	size_t c;
+
+	a = calloc(n + 1, sizeof(topk_entry_t));
+	ref = calloc(n + 1, sizeof(topk_entry_t));
+	assert(a && ref);
+
+	fill_entries(a, n, order);
+	memcpy(ref, a, n * sizeof(topk_entry_t));
+	qsort(ref, n, sizeof(topk_entry_t), cmp_entry);
+
+	c = topk_select(a, n, k);
+	assert(c == MIN(n, k));
+	for (size_t i = 0; i < c; i++) {
+		assert(a[i].id == ref[i].id);
+		assert(a[i].score == ref[i].score);
+	}
+	free(a);
+	free(ref);
+}
+
+static void
+run_key_tests(void)
+{
+	const float scores[] = { -1e30f, -2.5f, -0.0f, 0.0f, 1e-30f, 2.5f };
+	topk_entry_t a, b;
+
+	/* The key has the same order as the score. */
+	for (unsigned i = 0; i < __arraycount(scores) - 1; i++) {
+		topk_entry_set(&a, 1, scores[i]);
+		topk_entry_set(&b, 1, scores[i + 1]);
+		assert(a.key < b.key || (a.key == b.key && a.score == b.score));
+	}
+}
+
+static void
+run_tests(void)
+{
+	static const size_t sizes[] = {
+	    0, 1, 2, 15, 16, 17, 100, 1000, 5003, 20011
+	};
+	static const size_t ks[] = { 0, 1, 10, 16, 17, 100, 1000, 10000 };
+
+	srandom(1);
+
+	for (unsigned i = 0; i < __arraycount(sizes); i++) {
+		for (unsigned j = 0; j < __arraycount(ks); j++) {
+			for (order_t o = ORDER_RANDOM; o <= ORDER_EQUAL; o++) {
+				run_select_test(sizes[i], ks[j], o);
+			}
+		}
+	}
+}
+
+int
+main(void)
+{
+	run_key_tests();
+	run_tests();
+	puts("OK");
+	return 0;
+}
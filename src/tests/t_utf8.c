@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <err.h>
@@ -125,6 +126,12 @@ run_diacritic_test(void)
 		{ "ĄŽUOLĖLIS", "AZUOLELIS" },
 		{ "Fuglafjørður", "Fuglafjordur" },
 		{ "Árbæ", "Arbae" },
+		{ "Ελληνικά", "Ελληνικα" },
+		{ "йогурт", "иогурт" },
+		{ "Æsir", "AEsir" },
+		{ "ÆSIR", "AESIR" },
+		{ "cafe\xcc\x81", "cafe" },  // combining acute accent
+		{ "東京", "東京" },
 	};
 	utf8_ctx_t *ctx;
 	strbuf_t buf;
@@ -147,6 +154,114 @@ run_diacritic_test(void)
 	utf8_ctx_destroy(ctx);
 }
 
+/*
+ * encode_cp: encode the code point in UTF-8 into the buffer.
+ */
+static size_t
+encode_cp(uint32_t c, char *buf)
+{
+	if (c < 0x80) {
+		buf[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		buf[0] = 0xc0 | (c >> 6);
+		buf[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+	buf[0] = 0xe0 | (c >> 12);
+	buf[1] = 0x80 | ((c >> 6) & 0x3f);
+	buf[2] = 0x80 | (c & 0x3f);
+	return 3;
+}
+
+static bool
+check_fold(utf8_ctx_t *ctx, const char *input)
+{
+	strbuf_t buf, ref;
+	ssize_t ret;
+	bool folded;
+
+	strbuf_init(&buf);
+	strbuf_init(&ref);
+
+	ret = strbuf_acquire(&ref, input, strlen(input));
+	assert(ret > 0);
+	ret = utf8_translit(ctx, &ref);
+	assert(ret >= 0);
+
+	/* Folding table (if covered). */
+	ret = strbuf_acquire(&buf, input, strlen(input));
+	assert(ret > 0);
+	folded = utf8_fold_ascii(&buf) != -1;
+	if (folded && strcmp(buf.value, ref.value) != 0) {
+		errx(EXIT_FAILURE, "fold [%s]: expected [%s], got [%s]",
+		    input, ref.value, buf.value);
+	}
+	strbuf_release(&buf);
+
+	/* Folding table with the fallback. */
+	ret = strbuf_acquire(&buf, input, strlen(input));
+	assert(ret > 0);
+	ret = utf8_subs_diacritics(ctx, &buf);
+	assert(ret >= 0 && (size_t)ret == buf.length);
+	if (strcmp(buf.value, ref.value) != 0) {
+		errx(EXIT_FAILURE, "subs [%s]: expected [%s], got [%s]",
+		    input, ref.value, buf.value);
+	}
+	strbuf_release(&buf);
+	strbuf_release(&ref);
+	return folded;
+}
+
+/*
+ * run_fold_diff_test: compare the folding table against the ICU
+ * transliteration over the full BMP: each code point on its own, with
+ * the neighbours and followed by the next code point.
+ */
+static void
+run_fold_diff_test(void)
+{
+	static const char *ctxs[][2] = {
+		{ "", "" }, { "a", "b" }, { "A", "B" }, { "x", "Y" },
+	};
+	static const char *common[] = { "é", "ø", "ά", "й", "ß", "Ł" };
+	unsigned nfolded = 0;
+	utf8_ctx_t *ctx;
+	char input[32];
+
+	ctx = utf8_ctx_create(NULL);
+	assert(ctx);
+
+	for (uint32_t c = 1; c < 0x10000; c++) {
+		size_t n;
+
+		if (c >= 0xd800 && c <= 0xdfff) {
+			continue;  // surrogates
+		}
+		for (unsigned i = 0; i < __arraycount(ctxs); i++) {
+			n = strlen(ctxs[i][0]);
+			memcpy(input, ctxs[i][0], n);
+			n += encode_cp(c, &input[n]);
+			strcpy(&input[n], ctxs[i][1]);
+			nfolded += check_fold(ctx, input);
+		}
+		if (c + 1 < 0xd800 || (c + 1 > 0xdfff && c + 1 < 0x10000)) {
+			n = encode_cp(c, input);
+			n += encode_cp(c + 1, &input[n]);
+			input[n] = '\0';
+			nfolded += check_fold(ctx, input);
+		}
+	}
+
+	/* The common characters must be in the table. */
+	for (unsigned i = 0; i < __arraycount(common); i++) {
+		assert(check_fold(ctx, common[i]));
+	}
+	assert(nfolded > 0);
+	utf8_ctx_destroy(ctx);
+}
+
 int
 main(void)
 {
@@ -154,6 +269,7 @@ main(void)
 	run_case_test();
 	run_norm_test();
 	run_diacritic_test();
+	run_fold_diff_test();
 	puts("OK");
 	return 0;
 }
@@ -5,12 +5,14 @@
  * Use is subject to license terms, as specified in the LICENSE file.
  */
 
+#include <sys/resource.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
 #include <getopt.h>
 #include <time.h>
+#include <errno.h>
 #include <err.h>
 
 #include "nxs.h"
@@ -18,22 +20,85 @@
 
 #define	APP_NAME	"nxsearch_test"
 
+#define	MAX_INDEX_OPTS	(8)
+
 static struct timespec	ts;
+static unsigned long	alloc_count;
+
+/*
+ * Count the memory allocations (glibc only; not with the sanitizers
+ * which interpose the allocator themselves).
+ */
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define	BENCH_ASAN
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define	BENCH_ASAN
+#endif
+
+#if defined(__GLIBC__) && !defined(BENCH_ASAN)
+#define	COUNT_ALLOCS
+
+void *	__libc_malloc(size_t);
+void *	__libc_calloc(size_t, size_t);
+void *	__libc_realloc(void *, size_t);
+void *	__libc_memalign(size_t, size_t);
+
+void *
+malloc(size_t len)
+{
+	alloc_count++;
+	return __libc_malloc(len);
+}
+
+void *
+calloc(size_t n, size_t len)
+{
+	alloc_count++;
+	return __libc_calloc(n, len);
+}
+
+void *
+realloc(void *ptr, size_t len)
+{
+	alloc_count++;
+	return __libc_realloc(ptr, len);
+}
+
+int
+posix_memalign(void **ptr, size_t align, size_t len)
+{
+	alloc_count++;
+	if ((*ptr = __libc_memalign(align, len)) == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+#endif
 
 static void
 usage(void)
 {
 	fprintf(stderr,
-	    "Usage:\t" APP_NAME " -i INDEX [ -a | -r ]\n"
+	    "Usage:\t" APP_NAME " -i INDEX [ -a [ -g N ] [ -o OPTION ] | -r ]\n"
 	    "      \t" APP_NAME " -i INDEX -d ID -p FILE_PATH\n"
 	    "      \t" APP_NAME " -i INDEX -p DIRECTORY_PATH\n"
-	    "      \t" APP_NAME " -i INDEX -s QUERY\n"
+	    "      \t" APP_NAME " -i INDEX -s QUERY [ -n COUNT ]\n"
 	    "\n"
 	    "Options:\n"
 	    "  -a, --add              Add the specified index\n"
 	    "  -d, --doc-id           Specify the document ID\n"
+	    "  -g, --ngram N          Add an index of character N-grams\n"
 	    "  -p, --path PATH        Index the given file or directory\n"
 	    "  -i, --index INDEX      Specify the index\n"
+	    "  -n, --repeat COUNT     Repeat the search (reports allocations\n"
+	    "                         and the latency percentiles)\n"
+	    "  -o, --option OPTION    Enable the boolean index option, e.g.\n"
+	    "                         mmap_hugepages, mmap_populate,\n"
+	    "                         mmap_lock or mmap_prefetch\n"
+	    "                         (may be repeated)\n"
 	    "  -r, --remove           Drop the specified index\n"
 	    "  -s, --search QUERY     Search\n"
 	    "\n"
@@ -69,6 +134,58 @@ benchmark_end(const char *operation)
 	printf("%s: %"PRIi64" ms\n", operation, elapsed);
 }
 
+static uint64_t
+get_time_ns(void)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+		err(EXIT_FAILURE, "clock_gettime");
+	}
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int
+latency_cmp(const void *p1, const void *p2)
+{
+	const uint64_t t1 = *(const uint64_t *)p1, t2 = *(const uint64_t *)p2;
+	return (t1 > t2) - (t1 < t2);
+}
+
+/*
+ * report_latency: print the mean and the percentiles of the latencies,
+ * e.g. to compare the memory mapping options of the index.
+ */
+static void
+report_latency(uint64_t *times, unsigned n)
+{
+	uint64_t total = 0;
+
+	for (unsigned i = 0; i < n; i++) {
+		total += times[i];
+	}
+	qsort(times, n, sizeof(uint64_t), latency_cmp);
+	printf("search latency: mean %.1f us, p50 %.1f us, "
+	    "p99 %.1f us, max %.1f us\n", (double)total / n / 1000,
+	    times[n / 2] / 1000.0, times[(n * 99) / 100] / 1000.0,
+	    times[n - 1] / 1000.0);
+}
+
+/*
+ * report_memory: print the peak resident memory of the process, e.g. to
+ * compare the word and the n-gram indexes of the same documents.
+ */
+static void
+report_memory(const char *operation)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1) {
+		err(EXIT_FAILURE, "getrusage");
+	}
+	printf("%s: max RSS %ld KB\n", operation, ru.ru_maxrss);
+}
+
 static void
 index_file(nxs_t *nxs, nxs_index_t *idx, nxs_doc_id_t doc_id, const char *path)
 {
@@ -111,12 +228,15 @@ index_dir(nxs_t *nxs, nxs_index_t *idx, const char *path)
 int
 main(int argc, char **argv)
 {
-	static const char *opts_s = "ad:i:p:rs:h?";
+	static const char *opts_s = "ad:g:i:n:o:p:rs:h?";
 	static struct option opts_l[] = {
 		{ "add",	no_argument,		0,	'a'	},
 		{ "doc-id",	required_argument,	0,	'd'	},
+		{ "ngram",	required_argument,	0,	'g'	},
 		{ "path",	required_argument,	0,	'p'	},
 		{ "index",	required_argument,	0,	'i'	},
+		{ "repeat",	required_argument,	0,	'n'	},
+		{ "option",	required_argument,	0,	'o'	},
 		{ "search",	required_argument,	0,	's'	},
 		{ "remove",	no_argument,		0,	'r'	},
 		{ "help",	no_argument,		0,	'h'	},
@@ -127,6 +247,8 @@ main(int argc, char **argv)
 	const char *index = NULL, *query = NULL, *path = NULL, *e = NULL;
 	bool add = false, drop = false;
 	nxs_doc_id_t doc_id = 0;
+	const char *index_opts[MAX_INDEX_OPTS];
+	unsigned repeat = 0, ngram = 0, nopts = 0;
 	int ch;
 
 	while ((ch = getopt_long(argc, argv, opts_s, opts_l, NULL)) != -1) {
@@ -137,12 +259,24 @@ main(int argc, char **argv)
 		case 'd':
 			doc_id = atol(optarg);
 			break;
+		case 'g':
+			ngram = atoi(optarg);
+			break;
 		case 'p':
 			path = optarg;
 			break;
 		case 'i':
 			index = optarg;
 			break;
+		case 'n':
+			repeat = atoi(optarg);
+			break;
+		case 'o':
+			if (nopts == MAX_INDEX_OPTS) {
+				usage();
+			}
+			index_opts[nopts++] = optarg;
+			break;
 		case 'r':
 			drop = true;
 			break;
@@ -166,8 +300,27 @@ main(int argc, char **argv)
 	}
 
 	if (add) {
+		nxs_params_t *params = NULL;
+
+		if ((ngram || nopts) &&
+		    (params = nxs_params_create()) == NULL) {
+			err(EXIT_FAILURE, "nxs_params_create");
+		}
+		if (ngram &&
+		    nxs_params_set_uint(params, "ngram", ngram) == -1) {
+			err(EXIT_FAILURE, "nxs_params_set_uint");
+		}
+		for (unsigned i = 0; i < nopts; i++) {
+			if (nxs_params_set_bool(params,
+			    index_opts[i], true) == -1) {
+				err(EXIT_FAILURE, "nxs_params_set_bool");
+			}
+		}
 		benchmark_start();
-		idx = nxs_index_create(nxs, index, NULL);
+		idx = nxs_index_create(nxs, index, params);
+		if (params) {
+			nxs_params_release(params);
+		}
 		if (idx == NULL) {
 			nxs_get_error(nxs, &e);
 			errx(EXIT_FAILURE, "could not create the index: %s", e);
@@ -194,6 +347,7 @@ main(int argc, char **argv)
 			index_dir(nxs, idx, path);
 		}
 		benchmark_end("indexing");
+		report_memory("indexing");
 	}
 
 	if (query) {
@@ -214,6 +368,45 @@ main(int argc, char **argv)
 		free(json);
 	}
 
+	if (query && repeat) {
+		uint64_t *times;
+		unsigned long allocs;
+
+		if ((times = calloc(repeat, sizeof(uint64_t))) == NULL) {
+			err(EXIT_FAILURE, "calloc");
+		}
+
+		/*
+		 * Steady state: the first search above was the warm-up.
+		 */
+		allocs = alloc_count;
+		benchmark_start();
+		for (unsigned i = 0; i < repeat; i++) {
+			const uint64_t start = get_time_ns();
+			nxs_resp_t *resp;
+
+			resp = nxs_index_search(idx, NULL,
+			    query, strlen(query));
+			if (resp == NULL) {
+				nxs_get_error(nxs, &e);
+				errx(EXIT_FAILURE, "search error: %s", e);
+			}
+			nxs_resp_release(resp);
+			times[i] = get_time_ns() - start;
+		}
+		benchmark_end("repeated search");
+		report_latency(times, repeat);
+		free(times);
+		report_memory("repeated search");
+		allocs = alloc_count - allocs;
+#ifdef COUNT_ALLOCS
+		printf("allocations per query: %.1f\n",
+		    (double)allocs / repeat);
+#else
+		(void)allocs;
+#endif
+	}
+
 	if (drop) {
 		errx(EXIT_FAILURE, "not yet implemented yet");
 	}
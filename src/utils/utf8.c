@@ -13,8 +13,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <unicode/utypes.h>
+#include <unicode/utf8.h>
+#include <unicode/utf16.h>
+#include <unicode/ustring.h>
 #include <unicode/ucasemap.h>
 #include <unicode/unorm2.h>
 #include <unicode/utrans.h>
@@ -32,6 +36,44 @@ static const char NFKD_RULE[] =
 
 #define	NORM_BUF_MULTI		3	// XXX: 3x is an arbitrary choice
 
+/*
+ * ASCII folding table: the transliteration of the Latin, Greek and
+ * Cyrillic blocks, precomputed once using the above rule.  It allows the
+ * common tokens to be transliterated in a single pass over the UTF-8
+ * string, without the conversions to UTF-16 and the ICU transforms.
+ *
+ * - The code point is in the table only if its transliteration does
+ * not depend on the context, i.e. the neighbouring characters (e.g.
+ * the combining marks, the case-dependent ligature rules or the
+ * composition).  Otherwise, the entry is FOLD_NONE.
+ *
+ * - If a string has a code point outside the table (or an entry which
+ * is FOLD_NONE), then the whole string falls back to the transliterator.
+ */
+#define	FOLD_MAXLEN		7
+#define	FOLD_NONE		UINT8_MAX
+#define	FOLD_BUF_SIZE		256
+
+typedef struct {
+	uint8_t		len;
+	char		str[FOLD_MAXLEN];
+} fold_entry_t;
+
+static const struct {
+	UChar32		start;
+	UChar32		end;
+} fold_ranges[] = {
+	{ 0x0080, 0x0250 },	// Latin-1 Supplement, Latin Extended-A/B
+	{ 0x0370, 0x0530 },	// Greek and Coptic, Cyrillic (+ Supplement)
+	{ 0x1e00, 0x2000 },	// Latin Extended Additional, Greek Extended
+};
+
+#define	FOLD_TABLE_SIZE	\
+    ((0x0250 - 0x0080) + (0x0530 - 0x0370) + (0x2000 - 0x1e00))
+
+static fold_entry_t		fold_table[FOLD_TABLE_SIZE];
+static pthread_once_t		fold_once = PTHREAD_ONCE_INIT;
+
 struct utf8_ctx {
 	char *			locale;
 	UCaseMap *		csm;
@@ -209,13 +251,230 @@ utf8_toupper(utf8_ctx_t *ctx, const char *s, char *buf, size_t buflen)
 
 
 /*
- * utf8_subs_diacritics: uses standard ICU transformation to remove the
+ * fold_translit: transliterate a single code point (or the code point
+ * with the given context) using the transliterator.
+ *
+ * => Returns the result length in units or -1 on failure.
+ */
+static int32_t
+fold_translit(UTransliterator *tr, const UChar *pre, UChar32 c,
+    const UChar *post, UChar *ubuf, int32_t ulen)
+{
+	UErrorCode ec = U_ZERO_ERROR;
+	int32_t len = 0, limit;
+
+	while (*pre) {
+		ubuf[len++] = *pre++;
+	}
+	U16_APPEND_UNSAFE(ubuf, len, c);
+	while (*post) {
+		ubuf[len++] = *post++;
+	}
+	ubuf[len] = 0;
+	limit = len;
+
+	utrans_transUChars(tr, ubuf, &len, ulen, 0, &limit, &ec);
+	return U_FAILURE(ec) || len >= ulen ? -1 : len;
+}
+
+/*
+ * fold_context_free: check that the transliteration of the code point
+ * is the same regardless of its neighbours.
+ */
+static bool
+fold_context_free(UTransliterator *tr, const UNormalizer2 *nfkc,
+    UChar32 c, const UChar *out, int32_t outlen)
+{
+	static const UChar probes[][2] = {
+		{ 'a', 0 }, { 'A', 0 }, { '0', 0 }, { '-', 0 },
+	};
+	const UNormalizer2 *nfkd;
+	UErrorCode ec = U_ZERO_ERROR;
+	UChar32 first;
+	UChar ubuf[32];
+	int32_t i;
+
+	/*
+	 * Must not interact with the preceding characters in the
+	 * normalization steps: the decomposition on the input and the
+	 * composition on the output.  Note: the following character
+	 * either has a boundary before it too or it is not in the table.
+	 */
+	nfkd = unorm2_getNFKDInstance(&ec);
+	if (U_FAILURE(ec) || !unorm2_hasBoundaryBefore(nfkd, c)) {
+		return false;
+	}
+	if (outlen) {
+		i = 0;
+		U16_NEXT_UNSAFE(out, i, first);
+		if (!unorm2_hasBoundaryBefore(nfkc, first)) {
+			return false;
+		}
+	}
+
+	/*
+	 * The context rules (e.g. the ligatures followed by lowercase).
+	 */
+	for (i = 0; i < (int32_t)__arraycount(probes); i++) {
+		const UChar *p = probes[i];
+
+		if (fold_translit(tr, p, c, u"", ubuf, 32) != outlen + 1 ||
+		    ubuf[0] != p[0] || u_memcmp(&ubuf[1], out, outlen)) {
+			return false;
+		}
+		if (fold_translit(tr, u"", c, p, ubuf, 32) != outlen + 1 ||
+		    u_memcmp(ubuf, out, outlen) || ubuf[outlen] != p[0]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void
+fold_sysinit(void)
+{
+	const UNormalizer2 *nfkc;
+	UErrorCode ec = U_ZERO_ERROR;
+	UTransliterator *tr;
+	UChar rule[sizeof(NFKD_RULE)];
+	unsigned n = 0;
+
+	for (unsigned i = 0; i < FOLD_TABLE_SIZE; i++) {
+		fold_table[i].len = FOLD_NONE;
+	}
+
+	u_strFromUTF8(rule, sizeof(NFKD_RULE), NULL, NFKD_RULE, -1, &ec);
+	if (U_FAILURE(ec)) {
+		return;
+	}
+	tr = utrans_openU(rule, -1, UTRANS_FORWARD, NULL, 0, NULL, &ec);
+	if (U_FAILURE(ec)) {
+		return;
+	}
+	nfkc = unorm2_getNFKCInstance(&ec);
+	if (U_FAILURE(ec)) {
+		goto out;
+	}
+
+	for (unsigned r = 0; r < __arraycount(fold_ranges); r++) {
+		for (UChar32 c = fold_ranges[r].start;
+		    c < fold_ranges[r].end; c++, n++) {
+			fold_entry_t *fe = &fold_table[n];
+			UChar ubuf[32];
+			int32_t len, nbytes = 0;
+
+			if ((len = fold_translit(tr, u"", c, u"",
+			    ubuf, 32)) == -1) {
+				continue;
+			}
+			if (!fold_context_free(tr, nfkc, c, ubuf, len)) {
+				continue;
+			}
+			ec = U_ZERO_ERROR;
+			u_strToUTF8(fe->str, FOLD_MAXLEN, &nbytes,
+			    ubuf, len, &ec);
+			if (U_FAILURE(ec) || nbytes > FOLD_MAXLEN) {
+				continue;
+			}
+			fe->len = nbytes;
+		}
+	}
+	ASSERT(n == FOLD_TABLE_SIZE);
+out:
+	utrans_close(tr);
+}
+
+static inline const fold_entry_t *
+fold_lookup(UChar32 c)
+{
+	unsigned base = 0;
+
+	for (unsigned r = 0; r < __arraycount(fold_ranges); r++) {
+		const UChar32 start = fold_ranges[r].start;
+		const UChar32 end = fold_ranges[r].end;
+
+		if (c < start) {
+			break;
+		}
+		if (c < end) {
+			const fold_entry_t *fe = &fold_table[base + c - start];
+			return fe->len != FOLD_NONE ? fe : NULL;
+		}
+		base += end - start;
+	}
+	return NULL;
+}
+
+/*
+ * utf8_fold_ascii: transliterate the string using the folding table,
+ * with the same result as utf8_translit().
+ *
+ * => Returns the result length in bytes or -1 if the string has a code
+ *    point outside the table (then it must be transliterated by ICU).
+ * => The string is not modified if it is ASCII.
+ */
+ssize_t
+utf8_fold_ascii(strbuf_t *buf)
+{
+	const uint8_t *s = (const uint8_t *)buf->value;
+	const int32_t len = buf->length;
+	char fbuf[FOLD_BUF_SIZE];
+	int32_t i = 0, n;
+
+	/* Fast path: ASCII is transliterated to itself. */
+	while (i < len && s[i] < 0x80) {
+		i++;
+	}
+	if (i == len) {
+		return len;
+	}
+	pthread_once(&fold_once, fold_sysinit);
+
+	if (i >= FOLD_BUF_SIZE) {
+		return -1;
+	}
+	memcpy(fbuf, s, i);
+	n = i;
+
+	while (i < len) {
+		const fold_entry_t *fe;
+		UChar32 c;
+
+		if (s[i] < 0x80) {
+			if (n == FOLD_BUF_SIZE) {
+				return -1;
+			}
+			fbuf[n++] = s[i++];
+			continue;
+		}
+		U8_NEXT(s, i, len, c);
+		if (c < 0 || (fe = fold_lookup(c)) == NULL) {
+			return -1;
+		}
+		if (n + fe->len > FOLD_BUF_SIZE) {
+			return -1;
+		}
+		memcpy(&fbuf[n], fe->str, fe->len);
+		n += fe->len;
+	}
+
+	if (strbuf_prealloc(buf, n + 1) == -1) {
+		return -1;
+	}
+	memcpy(buf->value, fbuf, n);
+	buf->value[n] = '\0';
+	buf->length = n;
+	return n;
+}
+
+/*
+ * utf8_translit: uses standard ICU transformation to remove the
  * diacritic characters.
  *
  * See more: https://unicode-org.github.io/icu/userguide/transforms/general/
  */
 ssize_t
-utf8_subs_diacritics(utf8_ctx_t *ctx, strbuf_t *buf)
+utf8_translit(utf8_ctx_t *ctx, strbuf_t *buf)
 {
 	UErrorCode ec = U_ZERO_ERROR;
 	uint16_t *ubuf = NULL;
@@ -259,6 +518,22 @@ out:
 	return len;
 }
 
+/*
+ * utf8_subs_diacritics: remove the diacritic characters (and otherwise
+ * transliterate to ASCII, where possible) using the folding table or,
+ * for the code points outside it, the ICU transformation.
+ */
+ssize_t
+utf8_subs_diacritics(utf8_ctx_t *ctx, strbuf_t *buf)
+{
+	ssize_t len;
+
+	if ((len = utf8_fold_ascii(buf)) != -1) {
+		return len;
+	}
+	return utf8_translit(ctx, buf);
+}
+
 /*
  * utf8_normalize: lowercase the UTF-8 string and normalize using
  * Normalization Form KC (NFKC).
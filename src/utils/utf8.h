@@ -20,6 +20,8 @@ ssize_t		utf8_from_utf16_new(utf8_ctx_t *, const uint16_t *,
 
 ssize_t		utf8_tolower(utf8_ctx_t *, const char *, char *, size_t);
 ssize_t		utf8_toupper(utf8_ctx_t *, const char *, char *, size_t);
+ssize_t		utf8_fold_ascii(strbuf_t *);
+ssize_t		utf8_translit(utf8_ctx_t *, strbuf_t *);
 ssize_t		utf8_subs_diacritics(utf8_ctx_t *, strbuf_t *);
 ssize_t		utf8_normalize(utf8_ctx_t *, strbuf_t *);
 
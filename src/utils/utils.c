@@ -8,6 +8,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include <stdlib.h>
 #include <unistd.h>
@@ -88,6 +92,95 @@ out:
 	return text;
 }
 
+/*
+ * fs_copy_range: copy the given length of data from the beginning of the
+ * source file to the destination file.
+ *
+ * => On Linux, copy_file_range(2) is used which shares the data blocks
+ *    (reflink) on the file systems supporting it.
+ */
+int
+fs_copy_range(int dfd, int sfd, size_t len)
+{
+	unsigned char buf[64 * 1024];
+	off_t off = 0;
+
+#ifdef __linux__
+	while ((size_t)off < len) {
+		loff_t soff = off, doff = off;
+		ssize_t ret;
+
+		ret = copy_file_range(sfd, &soff, dfd, &doff, len - off, 0);
+		if (ret == -1 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			/* Not supported: fallback to read/write. */
+			break;
+		}
+		off += ret;
+	}
+#endif
+	while ((size_t)off < len) {
+		const size_t chunk = MIN(sizeof(buf), len - off);
+		ssize_t ret;
+
+		if ((ret = pread(sfd, buf, chunk, off)) <= 0) {
+			if (ret == -1 && errno == EINTR) {
+				continue;
+			}
+			if (ret == 0) {
+				errno = EIO;
+			}
+			return -1;
+		}
+		if (pwrite(dfd, buf, ret, off) != ret) {
+			return -1;
+		}
+		off += ret;
+	}
+	return 0;
+}
+
+/*
+ * fs_clone_file: create a copy of the file at the destination path.
+ *
+ * => Uses reflink (FICLONE) where supported, otherwise copies the data.
+ */
+int
+fs_clone_file(const char *src, const char *dst)
+{
+	int sfd, dfd = -1, ret = -1;
+	struct stat st;
+
+	if ((sfd = open(src, O_RDONLY | O_CLOEXEC)) == -1) {
+		return -1;
+	}
+	if (fstat(sfd, &st) == -1) {
+		goto out;
+	}
+	dfd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (dfd == -1) {
+		goto out;
+	}
+#ifdef FICLONE
+	if (ioctl(dfd, FICLONE, sfd) == 0) {
+		ret = 0;
+		goto out;
+	}
+#endif
+	if (fs_copy_range(dfd, sfd, st.st_size) == -1) {
+		goto out;
+	}
+	ret = 0;
+out:
+	if (dfd != -1) {
+		close(dfd);
+	}
+	close(sfd);
+	return ret;
+}
+
 bool
 fs_is_dir(const char *path)
 {
@@ -178,6 +178,8 @@ void	_app_log(int, const char *, int, const char *, const char *, ...);
 int	str_isalnumdu(const char *);
 ssize_t	fs_read(int, void *, size_t);
 void *	fs_read_file(const char *, size_t *);
+int	fs_copy_range(int, int, size_t);
+int	fs_clone_file(const char *, const char *);
 bool	fs_is_dir(const char *);
 
 int	f_lock_enter(int, int);
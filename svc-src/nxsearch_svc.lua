@@ -8,19 +8,36 @@
 local nxs = require "nxsearch"
 local nxs_fs = require "nxsearch_storage"
 local routes = require "resty.route".new()
-local lrucache = require "resty.lrucache"
 local cjson = require "cjson"
 
 local NXS_BASEDIR = os.getenv("NXS_BASEDIR")
 local NXS_ENABLE_LUA_POST = os.getenv("NXS_ENABLE_LUA_POST")
+local NXS_SHARDS = os.getenv("NXS_SHARDS")
+local NXS_REPL_LEADER = os.getenv("NXS_REPL_LEADER")
+local NXS_REPL_INDEXES = os.getenv("NXS_REPL_INDEXES")
+local NXS_REPL_INTERVAL = tonumber(os.getenv("NXS_REPL_INTERVAL") or 1)
 
-local nxs_index_ttl = 86400
-local nxs_index_map = lrucache.new(32)
+-- Index handle cache: memory budget (bytes) and idle timeout (seconds).
+local NXS_CACHE_MEMORY = tonumber(os.getenv("NXS_CACHE_MEMORY") or
+                                  256 * 1024 * 1024)
+local NXS_CACHE_IDLE = tonumber(os.getenv("NXS_CACHE_IDLE") or 86400)
+local NXS_CACHE_GC_INTERVAL = 60
 
-local PARAMS_NUMFIELDS = {"limit"}
+-- Background sync of the index handles (seconds; zero to disable),
+-- so the catch-up after the updates does not land on the searches.
+local NXS_SYNC_INTERVAL = tonumber(os.getenv("NXS_SYNC_INTERVAL") or 1)
+
+local SHARD_DEFAULT_TIMEOUT = 5000 -- msec
+local SHARD_DEFAULT_LIMIT = 1000
+
+local REPL_MAX_CHUNK = 8 * 1024 * 1024
+local REPL_MAX_ROUNDS = 64
+local REPL_TIMEOUT = 30000 -- msec
 
 -------------------------------------------------------------------------
 
+local repl_timer -- forward declaration
+
 local function nxs_svc_init()
   local filters = nxs_fs.get_filters()
   local i
@@ -31,6 +48,32 @@ local function nxs_svc_init()
     local ok, err = nxs.load_lua(name, content)
     if not ok then error(err) end
   end
+
+  -- The index handles are cached by the library; the idle ones
+  -- are periodically evicted.
+  nxs.cache_config(NXS_CACHE_MEMORY, NXS_CACHE_IDLE)
+  local ok, err = ngx.timer.every(NXS_CACHE_GC_INTERVAL, function(premature)
+    if not premature then
+      collectgarbage() -- release the unreferenced handles
+      nxs.cache_gc()
+    end
+  end)
+  if not ok then error(err) end
+
+  if NXS_SYNC_INTERVAL > 0 then
+    local ok, err = ngx.timer.every(NXS_SYNC_INTERVAL, function(premature)
+      if not premature then
+        nxs.cache_sync()
+      end
+    end)
+    if not ok then error(err) end
+  end
+
+  -- Periodic replication pull (a single worker is sufficient).
+  if NXS_REPL_LEADER and NXS_REPL_INDEXES and ngx.worker.id() == 0 then
+    local ok, err = ngx.timer.every(NXS_REPL_INTERVAL, repl_timer)
+    if not ok then error(err) end
+  end
 end
 
 -------------------------------------------------------------------------
@@ -69,38 +112,45 @@ local function set_http_sys_error(msg)
 end
 
 local function get_nxs_index(name)
-  local index = nxs_index_map:get(name)
-  local err
-
+  -- Note: returns the cached handle, if the index is already open.
+  local index, err = nxs.open(name)
   if not index then
-    index, err = nxs.open(name)
-    if not index then
-      return set_http_error(err)
-    end
-    nxs_index_map:set(name, index, nxs_index_ttl)
+    return set_http_error(err)
   end
   return index
 end
 
 local function query_string_to_params(args)
-  local i
+  local params = nil
 
-  -- If empty table, then return nil.
-  if next(args) == nil then
-    return nil
+  -- Use the typed setters (no JSON round-trip) for the known fields.
+  local function get_params()
+    params = params or nxs.newparams()
+    return params
   end
 
-  -- Adjust the type of the numeric fields.
-  for i = 1, #PARAMS_NUMFIELDS do
-    local field = PARAMS_NUMFIELDS[i]
-    local value = args[field]
-    if value ~= nil then
-      args[field] = tonumber(value)
-    end
+  if args["limit"] ~= nil then
+    get_params():set_limit(tonumber(args["limit"]) or 0)
   end
-
-  local qstr_json = cjson.encode(args)
-  return nxs.newparams():fromjson(qstr_json)
+  if args["algo"] ~= nil then
+    get_params():set_algo(tostring(args["algo"]))
+  end
+  if args["fuzzymatch"] ~= nil then
+    local value = tostring(args["fuzzymatch"])
+    get_params():set_fuzzymatch(value ~= "false" and value ~= "0")
+  end
+  if args["timeout"] ~= nil then
+    get_params():set_timeout(math.max(tonumber(args["timeout"]) or 0, 0))
+  end
+  if args["stable"] ~= nil then
+    local value = tostring(args["stable"])
+    get_params():set_stable(value ~= "false" and value ~= "0")
+  end
+  if args["id_min"] ~= nil or args["id_max"] ~= nil then
+    get_params():set_id_range(tonumber(args["id_min"]),
+      tonumber(args["id_max"]))
+  end
+  return params
 end
 
 local function fetch_resp_to_json(index_name, repr)
@@ -111,10 +161,22 @@ local function fetch_resp_to_json(index_name, repr)
     table.insert(results, {
       ["doc_id"] = doc_id,
       ["score"] = score,
-      ["content"] = nxs_fs.fetch_file(index_name, doc_id),
     })
   end
 
+  -- The representation is a hash: keep the order of the search results,
+  -- i.e. by the score (descending) and then by the document ID.
+  table.sort(results, function(a, b)
+    if a.score ~= b.score then
+      return a.score > b.score
+    end
+    return a.doc_id < b.doc_id
+  end)
+
+  for _, result in ipairs(results) do
+    result["content"] = nxs_fs.fetch_file(index_name, result.doc_id)
+  end
+
   return cjson.encode({
     ["results"] = results,
     ["count"] = #results
@@ -145,6 +207,12 @@ end
       items:
         type: string
       default: ["normalizer", "stopwords", "stemmer"]
+    "dictionary":
+      description: >
+        Name of the shared term dictionary.  The indexes with the same
+        dictionary share the terms; they must use the same language and
+        filters.  Not supported with the replication and snapshots.
+      type: string
 --]]
 
 --[[
@@ -295,7 +363,6 @@ routes:post("@/:string", function(self, name)
   if not index then
     return set_http_error(err)
   end
-  nxs_index_map:set(name, index, nxs_index_ttl)
 
   return ngx.exit(ngx.HTTP_CREATED)
 end)
@@ -321,9 +388,7 @@ routes:delete("@/:string", function(self, name)
             $ref: "#/components/schemas/error_response"
   --]]
 
-  -- Destroy the reference first.
-  nxs_index_map:delete(name)
-  collectgarbage() -- ensure index gets closed
+  collectgarbage() -- ensure the index handle gets released
   nxs_fs.destroy_index(name)
 
   local ok, err = nxs.destroy(name)
@@ -454,6 +519,28 @@ routes:post("@/:string/search", function(self, name)
       schema:
         type: boolean
       default: true
+    - name: "timeout"
+      description: "Search timeout in milliseconds (0 for no timeout)"
+      in: query
+      schema:
+        type: integer
+      default: 0
+    - name: "stable"
+      description: "Score the terms in a fixed (canonical) order"
+      in: query
+      schema:
+        type: boolean
+      default: false
+    - name: "id_min"
+      description: "Minimum document ID (inclusive)"
+      in: query
+      schema:
+        type: integer
+    - name: "id_max"
+      description: "Maximum document ID (inclusive)"
+      in: query
+      schema:
+        type: integer
   responses:
     200:
       content:
@@ -476,6 +563,9 @@ routes:post("@/:string/search", function(self, name)
     return set_http_error(err)
   end
 
+  -- The index generation the results were produced at (for caching).
+  ngx.header["X-Index-Generation"] = tostring(resp:generation())
+
   if query_string["fetch"] then
     ngx.say(fetch_resp_to_json(name, resp:repr()))
   else
@@ -487,6 +577,674 @@ end)
 
 -------------------------------------------------------------------------
 
+--
+-- Distributed search (scatter-gather).
+--
+-- The coordinator fans out the query to the shards listed in NXS_SHARDS
+-- (a comma-separated list of the service base URLs) in two phases:
+--
+-- 1) Obtain the statistics of the query terms from each shard and sum
+-- them, so that the ranking uses the collection-wide counters.
+--
+-- 2) Run the search on each shard using the global statistics and merge
+-- the results by the score (and then by the document ID).
+--
+
+local function get_shard_list()
+  local shards = {}
+  local url
+
+  for url in string.gmatch(NXS_SHARDS or "", "[^,%s]+") do
+    table.insert(shards, (string.gsub(url, "/+$", "")))
+  end
+  return shards
+end
+
+local function shard_request(url, body, timeout)
+  local http = require "resty.http"
+  local httpc = http.new()
+
+  httpc:set_timeout(timeout)
+  local res, err = httpc:request_uri(url, {
+    method = "POST",
+    body = body,
+  })
+  if not res then
+    return nil, err
+  end
+  if res.status ~= ngx.HTTP_OK then
+    local ok, data = pcall(cjson.decode, res.body)
+    if ok and type(data) == "table" and data.error then
+      return nil, data.error.msg
+    end
+    return nil, string.format("HTTP %u", res.status)
+  end
+
+  local ok, data = pcall(cjson.decode, res.body)
+  if not ok then
+    return nil, "invalid response"
+  end
+  return data
+end
+
+--
+-- shards_scatter: run the request on all (remaining) shards concurrently.
+-- The failed shards are recorded and excluded from the subsequent phases.
+--
+local function shards_scatter(shards, failed, path, body, timeout)
+  local threads = {}
+  local results = {}
+  local i
+
+  for i = 1, #shards do
+    local url = shards[i] .. path
+    threads[i] = ngx.thread.spawn(shard_request, url, body, timeout)
+  end
+  for i = 1, #shards do
+    local ok, data, err = ngx.thread.wait(threads[i])
+    if not ok then
+      err = data
+      data = nil
+    end
+    if data then
+      results[shards[i]] = data
+    else
+      table.insert(failed, {["url"] = shards[i], ["error"] = err})
+    end
+  end
+
+  -- Keep only the shards which succeeded.
+  local remaining = {}
+  for i = 1, #shards do
+    if results[shards[i]] then
+      table.insert(remaining, shards[i])
+    end
+  end
+  return remaining, results
+end
+
+local function merge_shard_stats(shards, results)
+  local stats = {["doc_count"] = 0, ["token_count"] = 0, ["terms"] = {}}
+  local i
+
+  for i = 1, #shards do
+    local shard_stats = results[shards[i]]
+    local term, doc_freq
+
+    stats.doc_count = stats.doc_count + (shard_stats.doc_count or 0)
+    stats.token_count = stats.token_count + (shard_stats.token_count or 0)
+    for term, doc_freq in pairs(shard_stats.terms or {}) do
+      stats.terms[term] = (stats.terms[term] or 0) + doc_freq
+    end
+  end
+  return stats
+end
+
+local function merge_shard_results(shards, results, limit)
+  local merged = {}
+  local i, j
+
+  for i = 1, #shards do
+    local shard_results = results[shards[i]].results or {}
+    for j = 1, #shard_results do
+      table.insert(merged, shard_results[j])
+    end
+  end
+
+  -- Deterministic ordering: score (descending), then document ID.
+  table.sort(merged, function(a, b)
+    if a.score ~= b.score then
+      return a.score > b.score
+    end
+    return a.doc_id < b.doc_id
+  end)
+  for i = #merged, limit + 1, -1 do
+    merged[i] = nil
+  end
+  return merged
+end
+
+routes:post("@/:string/shard/stats", function(self, name)
+  --[[
+  @api [post] /{index}/shard/stats
+  tags:
+    - distributed
+  description: |
+    Get the index statistics for the query terms (the first phase
+    of the distributed search).
+  parameters:
+    - name: "index"
+      description: "Index name"
+      in: "path"
+      type: "string"
+  requestBody:
+    required: true
+    content:
+      text/plain:
+        schema:
+          type: string
+  responses:
+    200:
+      content:
+        application/json:
+          schema:
+            type: object
+            properties:
+              doc_count:
+                type: integer
+              token_count:
+                type: integer
+              terms:
+                type: object
+                additionalProperties:
+                  type: integer
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local index = get_nxs_index(name)
+  local query_string = ngx.req.get_uri_args()
+  local params = query_string_to_params(query_string)
+
+  local stats, err = index:stats(get_http_body(true), params)
+  if not stats then
+    return set_http_error(err)
+  end
+  ngx.say(stats)
+  return ngx.exit(ngx.HTTP_OK)
+end)
+
+routes:post("@/:string/shard/search", function(self, name)
+  --[[
+  @api [post] /{index}/shard/search
+  tags:
+    - distributed
+  description: |
+    Search the index using the given global statistics (the second
+    phase of the distributed search).  Accepts the same query string
+    parameters as the regular search.
+  parameters:
+    - name: "index"
+      description: "Index name"
+      in: "path"
+      type: "string"
+  requestBody:
+    required: true
+    content:
+      application/json:
+        schema:
+          type: object
+          properties:
+            query:
+              type: string
+            stats:
+              type: object
+  responses:
+    200:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/search_response"
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local index = get_nxs_index(name)
+  local query_string = ngx.req.get_uri_args()
+  local params = query_string_to_params(query_string)
+
+  local ok, req = pcall(cjson.decode, get_http_body(true))
+  if not ok or type(req) ~= "table" or type(req.query) ~= "string" or
+     type(req.stats) ~= "table" then
+    return set_http_error({["code"] = nxs.ERR_INVALID,
+      ["msg"] = "invalid shard search request"})
+  end
+
+  local resp, err = index:search(req.query, params, cjson.encode(req.stats))
+  if not resp then
+    return set_http_error(err)
+  end
+  ngx.say(resp:tojson())
+  return ngx.exit(ngx.HTTP_OK)
+end)
+
+routes:post("@/:string/dsearch", function(self, name)
+  --[[
+  @api [post] /{index}/dsearch
+  tags:
+    - distributed
+  description: |
+    Search the index distributed across the shards listed in the
+    `NXS_SHARDS` environment variable (comma-separated base URLs).
+    The scores are computed using the global statistics, therefore
+    they are comparable across the shards.
+  parameters:
+    - name: "index"
+      description: "Index name"
+      in: "path"
+      type: "string"
+    - name: "algo"
+      description: "Override the ranking algorithm (see index creation)"
+      in: query
+      schema:
+        type: string
+    - name: "limit"
+      description: "The cap for the results"
+      in: query
+      schema:
+        type: integer
+      default: 1000
+    - name: "fuzzymatch"
+      description: "Fuzzy-match the terms"
+      in: query
+      schema:
+        type: boolean
+      default: true
+    - name: "timeout"
+      description: "Search timeout in milliseconds (0 for no timeout)"
+      in: query
+      schema:
+        type: integer
+      default: 0
+    - name: "stable"
+      description: "Score the terms in a fixed (canonical) order"
+      in: query
+      schema:
+        type: boolean
+      default: false
+    - name: "id_min"
+      description: "Minimum document ID (inclusive)"
+      in: query
+      schema:
+        type: integer
+    - name: "id_max"
+      description: "Maximum document ID (inclusive)"
+      in: query
+      schema:
+        type: integer
+    - name: "shard_timeout"
+      description: "Per-shard HTTP timeout (in milliseconds)"
+      in: query
+      schema:
+        type: integer
+      default: 5000
+    - name: "partial"
+      description: "Return the partial results if some shards failed"
+      in: query
+      schema:
+        type: boolean
+      default: true
+  responses:
+    200:
+      content:
+        application/json:
+          schema:
+            type: object
+            properties:
+              count:
+                type: integer
+              results:
+                type: array
+                items:
+                  type: object
+              shards:
+                type: object
+                properties:
+                  total:
+                    type: integer
+                  successful:
+                    type: integer
+                  failed:
+                    type: array
+                    items:
+                      type: object
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local all_shards = get_shard_list()
+  if #all_shards == 0 then
+    return set_http_sys_error("no shards configured (NXS_SHARDS)")
+  end
+
+  local query = get_http_body(true)
+  local query_string = ngx.req.get_uri_args()
+  local timeout = tonumber(query_string["shard_timeout"]) or
+                  SHARD_DEFAULT_TIMEOUT
+  local limit = tonumber(query_string["limit"]) or SHARD_DEFAULT_LIMIT
+  local partial = query_string["partial"] ~= "false" and
+                  query_string["partial"] ~= "0"
+  local failed = {}
+
+  -- Pass through the search parameters (including the search timeout)
+  -- to the shards.
+  query_string["shard_timeout"] = nil
+  query_string["partial"] = nil
+  local args = ngx.encode_args(query_string)
+  if args ~= "" then
+    args = "?" .. args
+  end
+
+  -- Phase 1: gather and merge the statistics.
+  local shards, results = shards_scatter(all_shards, failed,
+    "/" .. name .. "/shard/stats" .. args, query, timeout)
+  local stats = merge_shard_stats(shards, results)
+
+  -- Phase 2: search with the global statistics and merge the results.
+  local body = cjson.encode({["query"] = query, ["stats"] = stats})
+  shards, results = shards_scatter(shards, failed,
+    "/" .. name .. "/shard/search" .. args, body, timeout)
+
+  if #failed > 0 and (not partial or #shards == 0) then
+    return set_http_sys_error(string.format(
+      "%u of %u shards failed: %s", #failed, #all_shards,
+      tostring(failed[1].error)))
+  end
+
+  local merged = merge_shard_results(shards, results, limit)
+  ngx.say(cjson.encode({
+    ["results"] = merged,
+    ["count"] = #merged,
+    ["shards"] = {
+      ["total"] = #all_shards,
+      ["successful"] = #shards,
+      ["failed"] = setmetatable(failed, cjson.array_mt),
+    },
+  }))
+  return ngx.exit(ngx.HTTP_OK)
+end)
+
+-------------------------------------------------------------------------
+
+--
+-- Replication.
+--
+-- The follower pulls the index changes past its positions (the data
+-- lengths of its terms and dtmap files) from the leader and applies
+-- them.  The pull may be triggered using the /{index}/repl/pull API or
+-- periodically, if NXS_REPL_LEADER (the leader base URL) and
+-- NXS_REPL_INDEXES (a comma-separated list of index names) are set.
+--
+-- Note: the follower index must be created with the same parameters
+-- and it must not be modified other than by the replication.
+--
+
+local function repl_pull(index, name, leader)
+  local http = require "resty.http"
+  local httpc = http.new()
+  local total = 0
+  local round
+
+  httpc:set_timeout(REPL_TIMEOUT)
+  for round = 1, REPL_MAX_ROUNDS do
+    local terms_pos, dtmap_pos = index:repl_pos()
+    local url = string.format("%s/%s/repl?%s", leader, name,
+      ngx.encode_args({
+        ["terms_pos"] = terms_pos,
+        ["dtmap_pos"] = dtmap_pos,
+        ["maxlen"] = REPL_MAX_CHUNK,
+      }))
+
+    local res, err = httpc:request_uri(url, {method = "GET"})
+    if not res then
+      return nil, err
+    end
+    if res.status ~= ngx.HTTP_OK then
+      return nil, string.format("leader responded with HTTP %u", res.status)
+    end
+
+    local ok, err = index:repl_apply(res.body)
+    if not ok then
+      return nil, err.msg
+    end
+
+    -- Stop if the positions did not advance (no more changes).
+    local new_terms_pos, new_dtmap_pos = index:repl_pos()
+    if new_terms_pos == terms_pos and new_dtmap_pos == dtmap_pos then
+      break
+    end
+    total = total + (new_terms_pos - terms_pos) + (new_dtmap_pos - dtmap_pos)
+  end
+  return total
+end
+
+repl_timer = function(premature)
+  local name
+
+  if premature then
+    return
+  end
+  for name in string.gmatch(NXS_REPL_INDEXES, "[^,%s]+") do
+    local index, err = nxs.open(name)
+    local ok
+
+    if index then
+      ok, err = repl_pull(index, name, NXS_REPL_LEADER)
+    end
+    if not ok then
+      ngx.log(ngx.ERR, string.format(
+        "replication of index `%s' failed: %s", name, tostring(err)))
+    end
+  end
+end
+
+routes:get("@/:string/repl", function(self, name)
+  --[[
+  @api [get] /{index}/repl
+  tags:
+    - replication
+  description: |
+    Get the index changes past the given positions (the leader side
+    of the replication).  The positions are obtained by the follower
+    from its own index.
+  parameters:
+    - name: "index"
+      description: "Index name"
+      in: "path"
+      type: "string"
+    - name: "terms_pos"
+      description: "Position in the terms index"
+      in: query
+      schema:
+        type: integer
+      default: 0
+    - name: "dtmap_pos"
+      description: "Position in the document-term index"
+      in: query
+      schema:
+        type: integer
+      default: 0
+    - name: "maxlen"
+      description: "The cap for the document data length (0 for no limit)"
+      in: query
+      schema:
+        type: integer
+      default: 0
+  responses:
+    200:
+      content:
+        application/octet-stream:
+          schema:
+            type: string
+            format: binary
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local index = get_nxs_index(name)
+  local query_string = ngx.req.get_uri_args()
+  local terms_pos = tonumber(query_string["terms_pos"]) or 0
+  local dtmap_pos = tonumber(query_string["dtmap_pos"]) or 0
+  local maxlen = tonumber(query_string["maxlen"]) or 0
+
+  local data, err = index:repl_export(terms_pos, dtmap_pos, maxlen)
+  if not data then
+    return set_http_error(err)
+  end
+  ngx.header["Content-Type"] = "application/octet-stream"
+  ngx.print(data)
+  return ngx.exit(ngx.HTTP_OK)
+end)
+
+routes:post("@/:string/repl/pull", function(self, name)
+  --[[
+  @api [post] /{index}/repl/pull
+  tags:
+    - replication
+  description: |
+    Pull the changes from the leader and apply them to the index
+    (the follower side of the replication).  Only the configured leader
+    (`NXS_REPL_LEADER`) is pulled from.
+  parameters:
+    - name: "index"
+      description: "Index name"
+      in: "path"
+      type: "string"
+  responses:
+    200:
+      content:
+        application/json:
+          schema:
+            type: object
+            properties:
+              bytes:
+                description: "The number of bytes applied"
+                type: integer
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local index = get_nxs_index(name)
+
+  if not NXS_REPL_LEADER then
+    return set_http_sys_error("no leader configured")
+  end
+
+  local bytes, err = repl_pull(index, name,
+    (string.gsub(NXS_REPL_LEADER, "/+$", "")))
+  if not bytes then
+    return set_http_sys_error(err)
+  end
+  ngx.say(cjson.encode({["bytes"] = bytes}))
+  return ngx.exit(ngx.HTTP_OK)
+end)
+
+-------------------------------------------------------------------------
+--
+-- Snapshots: a consistent copy of the index taken without blocking the
+-- writers.  A new index can be created (cloned) from the snapshot.
+--
+
+routes:post("@/:string/snapshot/:string", function(self, name, snapname)
+  --[[
+  @api [post] /{index}/snapshot/{snapshot}
+  tags:
+    - snapshot
+  description: "Create a snapshot of the index."
+  parameters:
+    - name: "index"
+      description: "Index name"
+      in: "path"
+      type: "string"
+    - name: "snapshot"
+      description: "Snapshot name (must be alphanumeric)"
+      in: "path"
+      type: "string"
+  responses:
+    201:
+      description: "Created"
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local index = get_nxs_index(name)
+  local ok, err = index:snapshot(snapname)
+  if not ok then
+    return set_http_error(err)
+  end
+  return ngx.exit(ngx.HTTP_CREATED)
+end)
+
+routes:delete("@/snapshots/:string", function(self, snapname)
+  --[[
+  @api [delete] /snapshots/{snapshot}
+  tags:
+    - snapshot
+  description: "Delete a snapshot."
+  parameters:
+    - name: "snapshot"
+      description: "Snapshot name"
+      in: "path"
+      type: "string"
+  responses:
+    200:
+      description: "OK"
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local ok, err = nxs.destroy_snapshot(snapname)
+  if not ok then
+    return set_http_error(err)
+  end
+  return ngx.exit(ngx.HTTP_OK)
+end)
+
+routes:post("@/:string/clone/:string", function(self, name, snapname)
+  --[[
+  @api [post] /{index}/clone/{snapshot}
+  tags:
+    - snapshot
+  description: "Create a new index from the snapshot."
+  parameters:
+    - name: "index"
+      description: "New index name (must be alphanumeric)"
+      in: "path"
+      type: "string"
+    - name: "snapshot"
+      description: "Snapshot name"
+      in: "path"
+      type: "string"
+  responses:
+    201:
+      description: "Created"
+    400:
+      content:
+        application/json:
+          schema:
+            $ref: "#/components/schemas/error_response"
+  --]]
+
+  local index, err = nxs.clone(snapname, name)
+  if not index then
+    return set_http_error(err)
+  end
+  return ngx.exit(ngx.HTTP_CREATED)
+end)
+
+-------------------------------------------------------------------------
+
 nxs_svc_init() -- initialize nxsearch service
 
 return routes
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Distributed search test: expects the coordinator on port 8000 and
+# two shards on ports 8001 and 8002 (see docker-compose.yaml).
+#
+
+set -eu
+
+index="__test-index-dist-1"
+coordinator="http://127.0.0.1:8000"
+shard1="http://127.0.0.1:8001"
+shard2="http://127.0.0.1:8002"
+
+curl -s -XPOST $shard1/$index
+curl -s -XPOST $shard2/$index
+
+curl -s -d "cat dog cow" $shard1/$index/add/1
+curl -s -d "dog cow" $shard2/$index/add/2
+curl -s -d "cat cat cat" $shard2/$index/add/3
+
+results="$(curl -s -d "cat" $coordinator/$index/dsearch)"
+doc_ids="$(echo "$results" | jq '.results[].doc_id' | xargs)"
+successful="$(echo "$results" | jq '.shards.successful')"
+
+curl -s -XDELETE $shard1/$index
+curl -s -XDELETE $shard2/$index
+
+expected="3 1"
+if [ "$doc_ids" != "$expected" ] || [ "$successful" != "2" ]; then
+	echo "ERROR: expected document IDs [ $expected ] but got:" >&2
+	echo "$results" | jq >&2
+	exit 1
+fi
+
+echo "OK"